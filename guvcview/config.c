@@ -65,10 +65,21 @@ static config_t my_config =
 	.fps_num = 1,
 	.fps_denom = 25,
 	.audio_device = -1,/*guvcview will use API default in this case*/
+	.audio_drift = 1, /*drift correction on*/
 	.video_fx = 0, /*no video fx*/
 	.audio_fx = 0, /*no audio fx*/
 	.osd_mask = 0, /*REND_OSD_NONE*/
 	.crosshair_color=0x0000FF00, /*osd crosshair rgb color (0x00RRGGBB)*/
+	.video_segment_time = 0, /*no segmented recording*/
+	.video_segment_size = 0,
+	.video_segment_retention = 0,
+	.video_preroll = 0, /*no pre-roll*/
+	.video_preroll_mem = 64,
+	.motion_record = 0, /*no motion triggered recording*/
+	.motion_record_interval = 5,
+	.motion_record_hold = 10,
+	.mkv_checkpoint = 0, /*no checkpoints*/
+	.video_threads = 0, /*codec default*/
 };
 
 /*
@@ -153,6 +164,8 @@ int config_save(const char *filename)
 	fprintf(fp, "fps_denom=%i\n", my_config.fps_denom);
 	fprintf(fp, "#audio device index (-1 - api default)\n");
 	fprintf(fp, "audio_device=%i\n", my_config.audio_device);
+	fprintf(fp, "#audio clock drift correction - resample to the video clock (1 - on, 0 - off)\n");
+	fprintf(fp, "audio_drift=%i\n", my_config.audio_drift);
 	fprintf(fp, "#video fx mask \n");
 	fprintf(fp, "video_fx=0x%x\n", my_config.video_fx);
 	fprintf(fp, "#audio fx mask \n");
@@ -160,6 +173,26 @@ int config_save(const char *filename)
 	fprintf(fp, "#OSD mask \n");
 	fprintf(fp, "osd_mask=0x%x\n", my_config.osd_mask);
 	fprintf(fp, "crosshair_color=0x%x\n", my_config.crosshair_color);
+	fprintf(fp, "#video segment duration in minutes (0 - disabled)\n");
+	fprintf(fp, "video_segment_time=%i\n", my_config.video_segment_time);
+	fprintf(fp, "#video segment size in MB (0 - disabled)\n");
+	fprintf(fp, "video_segment_size=%i\n", my_config.video_segment_size);
+	fprintf(fp, "#delete oldest video segments when disk space is low (0 - disabled)\n");
+	fprintf(fp, "video_segment_retention=%i\n", my_config.video_segment_retention);
+	fprintf(fp, "#video pre-roll time in seconds - direct input only (0 - disabled)\n");
+	fprintf(fp, "video_preroll=%i\n", my_config.video_preroll);
+	fprintf(fp, "#video pre-roll memory in MB\n");
+	fprintf(fp, "video_preroll_mem=%i\n", my_config.video_preroll_mem);
+	fprintf(fp, "#motion triggered recording sensitivity 1-100 (0 - disabled)\n");
+	fprintf(fp, "motion_record=%i\n", my_config.motion_record);
+	fprintf(fp, "#motion detection interval in frames\n");
+	fprintf(fp, "motion_record_interval=%i\n", my_config.motion_record_interval);
+	fprintf(fp, "#motion recording hold time in seconds after the last motion\n");
+	fprintf(fp, "motion_record_hold=%i\n", my_config.motion_record_hold);
+	fprintf(fp, "#matroska index checkpoint interval in seconds - crash safe files (0 - disabled)\n");
+	fprintf(fp, "mkv_checkpoint=%i\n", my_config.mkv_checkpoint);
+	fprintf(fp, "#video encoder threads (0 - codec default, -1 - auto)\n");
+	fprintf(fp, "video_threads=%i\n", my_config.video_threads);
 
 	/* return to system locale */
     setlocale(LC_NUMERIC, "");
@@ -317,12 +350,34 @@ int config_load(const char *filename)
 			my_config.photo_sufix = (int) strtoul(value, NULL, 10);
 			set_photo_sufix_flag(my_config.photo_sufix);
 		}
+		else if(strcmp(token, "video_segment_time") == 0)
+			my_config.video_segment_time = (int) strtoul(value, NULL, 10);
+		else if(strcmp(token, "video_segment_size") == 0)
+			my_config.video_segment_size = (int) strtoul(value, NULL, 10);
+		else if(strcmp(token, "video_segment_retention") == 0)
+			my_config.video_segment_retention = (int) strtoul(value, NULL, 10);
+		else if(strcmp(token, "video_preroll") == 0)
+			my_config.video_preroll = (int) strtoul(value, NULL, 10);
+		else if(strcmp(token, "video_preroll_mem") == 0)
+			my_config.video_preroll_mem = (int) strtoul(value, NULL, 10);
+		else if(strcmp(token, "motion_record") == 0)
+			my_config.motion_record = (int) strtoul(value, NULL, 10);
+		else if(strcmp(token, "motion_record_interval") == 0)
+			my_config.motion_record_interval = (int) strtoul(value, NULL, 10);
+		else if(strcmp(token, "motion_record_hold") == 0)
+			my_config.motion_record_hold = (int) strtoul(value, NULL, 10);
+		else if(strcmp(token, "mkv_checkpoint") == 0)
+			my_config.mkv_checkpoint = (int) strtoul(value, NULL, 10);
+		else if(strcmp(token, "video_threads") == 0)
+			my_config.video_threads = (int) strtol(value, NULL, 10);
 		else if(strcmp(token, "fps_num") == 0)
 			my_config.fps_num = (int) strtoul(value, NULL, 10);
 		else if(strcmp(token, "fps_denom") == 0)
 			my_config.fps_denom = (int) strtoul(value, NULL, 10);
 		else if(strcmp(token, "audio_device") == 0)
 			my_config.audio_device = (int) strtoul(value, NULL, 10);
+		else if(strcmp(token, "audio_drift") == 0)
+			my_config.audio_drift = (int) strtoul(value, NULL, 10);
 		else if(strcmp(token, "video_fx") == 0)
 			my_config.video_fx = (uint32_t) strtoul(value, NULL, 16);
 		else if(strcmp(token, "audio_fx") == 0)
@@ -395,6 +450,10 @@ void config_update(options_t *my_options)
 	if(my_options->audio_device >= 0)
 		my_config.audio_device = my_options->audio_device;
 
+	/*audio clock drift correction*/
+	if(my_options->audio_drift >= 0)
+		my_config.audio_drift = my_options->audio_drift;
+
 	/*input format*/
 	if(strlen(my_options->format) > 2)
 	{
@@ -438,6 +497,30 @@ void config_update(options_t *my_options)
 		my_config.video_path = strdup(my_options->video_path);
 	}
 
+	/*segmented recording*/
+	if(my_options->video_segment_time >= 0)
+		my_config.video_segment_time = my_options->video_segment_time;
+	if(my_options->video_segment_size >= 0)
+		my_config.video_segment_size = my_options->video_segment_size;
+	if(my_options->video_segment_retention > 0)
+		my_config.video_segment_retention = my_options->video_segment_retention;
+
+	/*pre-roll*/
+	if(my_options->video_preroll >= 0)
+		my_config.video_preroll = my_options->video_preroll;
+
+	/*motion triggered recording*/
+	if(my_options->motion_record >= 0)
+		my_config.motion_record = my_options->motion_record;
+
+	/*matroska checkpoints*/
+	if(my_options->mkv_checkpoint >= 0)
+		my_config.mkv_checkpoint = my_options->mkv_checkpoint;
+
+	/*video encoder threads*/
+	if(my_options->video_threads >= -1)
+		my_config.video_threads = my_options->video_threads;
+
 	/*photo*/
 	if(my_options->photo_name)
 	{
@@ -46,10 +46,21 @@ typedef struct _config_t
 	int fps_num;
 	int fps_denom;
 	int audio_device;/*audio device index*/
+	int audio_drift; /*flag: audio clock drift correction (resampling)*/
 	uint32_t video_fx;
 	uint32_t audio_fx;
 	uint32_t osd_mask; /*OSD bit mask*/
 	uint32_t crosshair_color; /*osd crosshair rgb color (0x00RRGGBB)*/
+	int video_segment_time; /*segmented recording: segment duration in minutes (0 - disabled)*/
+	int video_segment_size; /*segmented recording: segment size in MB (0 - disabled)*/
+	int video_segment_retention; /*flag: delete oldest segments when disk space is low*/
+	int video_preroll; /*pre-roll time in seconds (0 - disabled)*/
+	int video_preroll_mem; /*pre-roll memory budget in MB*/
+	int motion_record; /*motion triggered recording sensitivity 1-100 (0 - disabled)*/
+	int motion_record_interval; /*motion detection runs every N frames*/
+	int motion_record_hold; /*recording continues N seconds after the last motion*/
+	int mkv_checkpoint; /*matroska index checkpoint interval in seconds (0 - disabled)*/
+	int video_threads; /*libav video encoder threads (0 - codec default, -1 - auto)*/
 } config_t;
 
 /*
@@ -543,7 +543,7 @@ int get_video_muxer()
 /*
  * sets video muxer
  * args:
- *   muxer - video muxer (ENCODER_MUX_[MKV|WEBM|AVI])
+ *   muxer - video muxer (ENCODER_MUX_[MKV|WEBM|AVI|MP4])
  *
  * asserts:
  *   none
@@ -608,6 +608,9 @@ void set_video_name(const char *name)
 			case ENCODER_MUX_WEBM:
 				video_name = set_file_extension(name, "webm");
 				break;
+			case ENCODER_MUX_MP4:
+				video_name = set_file_extension(name, "mp4");
+				break;
 			default:
 				video_name = set_file_extension(name, "avi");
 				break;
@@ -623,6 +626,8 @@ void set_video_name(const char *name)
 	}
 	else if ( strcasecmp(ext, "avi") == 0 )
 		set_video_muxer(ENCODER_MUX_AVI);
+	else if ( strcasecmp(ext, "mp4") == 0 )
+		set_video_muxer(ENCODER_MUX_MP4);
 
 	if(ext)
 		free(ext);
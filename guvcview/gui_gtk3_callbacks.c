@@ -480,6 +480,11 @@ static void video_update_extension (GtkComboBox *chooser, GtkWidget *file_dialog
 				set_file_extension(basename, "avi"));
 			gtk_file_filter_add_pattern(filter, "*.avi");
 			break;
+		case ENCODER_MUX_MP4:
+			gtk_file_chooser_set_current_name (GTK_FILE_CHOOSER (file_dialog),
+				set_file_extension(basename, "mp4"));
+			gtk_file_filter_add_pattern(filter, "*.mp4");
+			break;
 		default:
 		case ENCODER_MUX_MKV:
 			gtk_file_chooser_set_current_name (GTK_FILE_CHOOSER (file_dialog),
@@ -641,6 +646,7 @@ void video_file_clicked (GtkWidget *item, void *data)
 	gtk_combo_box_text_append_text(GTK_COMBO_BOX_TEXT(VideoFormat),_("Matroska  (*.mkv)"));
 	gtk_combo_box_text_append_text(GTK_COMBO_BOX_TEXT(VideoFormat),_("WebM (*.webm)"));
 	gtk_combo_box_text_append_text(GTK_COMBO_BOX_TEXT(VideoFormat),_("Avi  (*.avi)"));
+	gtk_combo_box_text_append_text(GTK_COMBO_BOX_TEXT(VideoFormat),_("MP4  (*.mp4)"));
 
 	gtk_combo_box_set_active(GTK_COMBO_BOX(VideoFormat), get_video_muxer());
 	gtk_box_pack_start(GTK_BOX(FBox), VideoFormat, FALSE, FALSE, 2);
@@ -655,6 +661,9 @@ void video_file_clicked (GtkWidget *item, void *data)
 		case ENCODER_MUX_AVI:
 			gtk_file_filter_add_pattern(filter, "*.avi");
 			break;
+		case ENCODER_MUX_MP4:
+			gtk_file_filter_add_pattern(filter, "*.mp4");
+			break;
 		default:
 		case ENCODER_MUX_MKV:
 			gtk_file_filter_add_pattern(filter, "*.mkv");
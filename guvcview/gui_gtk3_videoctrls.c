@@ -561,6 +561,45 @@ int gui_attach_gtk3_videoctrls(GtkWidget *parent)
 	g_signal_connect (GTK_CHECK_BUTTON(OsdCrosshairEnable), "toggled",
 		G_CALLBACK (render_osd_changed), NULL);
 
+	/* Histogram OSD */
+	GtkWidget *OsdHistogramEnable = gtk_check_button_new_with_label (_(" Histogram"));
+	g_object_set_data (G_OBJECT (OsdHistogramEnable), "osd_info", GINT_TO_POINTER(REND_OSD_HISTOGRAM));
+	gtk_widget_set_halign (OsdHistogramEnable, GTK_ALIGN_FILL);
+	gtk_widget_set_hexpand (OsdHistogramEnable, TRUE);
+	gtk_grid_attach(GTK_GRID(table_osd), OsdHistogramEnable, 1, 0, 1, 1);
+
+	gtk_toggle_button_set_active(GTK_TOGGLE_BUTTON(OsdHistogramEnable),
+		(render_get_osd_mask() & REND_OSD_HISTOGRAM) > 0);
+	gtk_widget_show (OsdHistogramEnable);
+	g_signal_connect (GTK_CHECK_BUTTON(OsdHistogramEnable), "toggled",
+		G_CALLBACK (render_osd_changed), NULL);
+
+	/* Waveform OSD */
+	GtkWidget *OsdWaveformEnable = gtk_check_button_new_with_label (_(" Waveform"));
+	g_object_set_data (G_OBJECT (OsdWaveformEnable), "osd_info", GINT_TO_POINTER(REND_OSD_WAVEFORM));
+	gtk_widget_set_halign (OsdWaveformEnable, GTK_ALIGN_FILL);
+	gtk_widget_set_hexpand (OsdWaveformEnable, TRUE);
+	gtk_grid_attach(GTK_GRID(table_osd), OsdWaveformEnable, 2, 0, 1, 1);
+
+	gtk_toggle_button_set_active(GTK_TOGGLE_BUTTON(OsdWaveformEnable),
+		(render_get_osd_mask() & REND_OSD_WAVEFORM) > 0);
+	gtk_widget_show (OsdWaveformEnable);
+	g_signal_connect (GTK_CHECK_BUTTON(OsdWaveformEnable), "toggled",
+		G_CALLBACK (render_osd_changed), NULL);
+
+	/* Focus peaking OSD */
+	GtkWidget *OsdFocusPeakEnable = gtk_check_button_new_with_label (_(" Focus peaking"));
+	g_object_set_data (G_OBJECT (OsdFocusPeakEnable), "osd_info", GINT_TO_POINTER(REND_OSD_FOCUS_PEAK));
+	gtk_widget_set_halign (OsdFocusPeakEnable, GTK_ALIGN_FILL);
+	gtk_widget_set_hexpand (OsdFocusPeakEnable, TRUE);
+	gtk_grid_attach(GTK_GRID(table_osd), OsdFocusPeakEnable, 3, 0, 1, 1);
+
+	gtk_toggle_button_set_active(GTK_TOGGLE_BUTTON(OsdFocusPeakEnable),
+		(render_get_osd_mask() & REND_OSD_FOCUS_PEAK) > 0);
+	gtk_widget_show (OsdFocusPeakEnable);
+	g_signal_connect (GTK_CHECK_BUTTON(OsdFocusPeakEnable), "toggled",
+		G_CALLBACK (render_osd_changed), NULL);
+
 	/*add control grid to parent container*/
 	gtk_container_add(GTK_CONTAINER(parent), video_controls_grid);
 
@@ -402,7 +402,8 @@ void MainWindow::video_file_clicked ()
 	QString filter_mkv = _("Matroska  (*.mkv)");
 	QString filter_webm = _("WebM (*.webm)");
 	QString filter_avi = _("Avi  (*.avi)");
-	QString filter_all = _("Videos  (*.mkv *.webm *.avi)");
+	QString filter_mp4 = _("MP4  (*.mp4)");
+	QString filter_all = _("Videos  (*.mkv *.webm *.avi *.mp4)");
 	
 	QString filter;
 	filter.append(filter_mkv);
@@ -411,6 +412,8 @@ void MainWindow::video_file_clicked ()
 	filter.append(";;");
 	filter.append(filter_avi);
 	filter.append(";;");
+	filter.append(filter_mp4);
+	filter.append(";;");
 	filter.append(filter_all);
 	
 	QString video_name = get_video_path();
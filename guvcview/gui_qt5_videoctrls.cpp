@@ -420,6 +420,36 @@ int MainWindow::gui_attach_qt5_videoctrls(QWidget *parent)
 	/*connect signal*/
 	connect(OsdCrosshairEnable, SIGNAL(stateChanged(int)), this, SLOT(render_osd_changed(int)));
 
+	/* Histogram OSD */
+	QCheckBox *OsdHistogramEnable = new QCheckBox(_(" Histogram"), table_osd);
+	OsdHistogramEnable->setProperty("osd_info", REND_OSD_HISTOGRAM);
+	OsdHistogramEnable->show();
+
+	osd_layout->addWidget(OsdHistogramEnable, 0, 1);
+	OsdHistogramEnable->setChecked((render_get_osd_mask() & REND_OSD_HISTOGRAM) > 0);
+	/*connect signal*/
+	connect(OsdHistogramEnable, SIGNAL(stateChanged(int)), this, SLOT(render_osd_changed(int)));
+
+	/* Waveform OSD */
+	QCheckBox *OsdWaveformEnable = new QCheckBox(_(" Waveform"), table_osd);
+	OsdWaveformEnable->setProperty("osd_info", REND_OSD_WAVEFORM);
+	OsdWaveformEnable->show();
+
+	osd_layout->addWidget(OsdWaveformEnable, 0, 2);
+	OsdWaveformEnable->setChecked((render_get_osd_mask() & REND_OSD_WAVEFORM) > 0);
+	/*connect signal*/
+	connect(OsdWaveformEnable, SIGNAL(stateChanged(int)), this, SLOT(render_osd_changed(int)));
+
+	/* Focus peaking OSD */
+	QCheckBox *OsdFocusPeakEnable = new QCheckBox(_(" Focus peaking"), table_osd);
+	OsdFocusPeakEnable->setProperty("osd_info", REND_OSD_FOCUS_PEAK);
+	OsdFocusPeakEnable->show();
+
+	osd_layout->addWidget(OsdFocusPeakEnable, 0, 3);
+	OsdFocusPeakEnable->setChecked((render_get_osd_mask() & REND_OSD_FOCUS_PEAK) > 0);
+	/*connect signal*/
+	connect(OsdFocusPeakEnable, SIGNAL(stateChanged(int)), this, SLOT(render_osd_changed(int)));
+
 
 	line++;
 	QSpacerItem *spacer = new QSpacerItem(40, 20, QSizePolicy::Minimum, QSizePolicy::Expanding);
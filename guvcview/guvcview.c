@@ -119,6 +119,26 @@ int main(int argc, char *argv[])
 	/*get command line options*/
 	options_t *my_options = options_get();
 
+	/*recover mode: rebuild the matroska index and exit*/
+	if(my_options->mkv_recover)
+	{
+		encoder_set_verbosity(my_options->verbosity);
+		int ret = encoder_mkv_recover(my_options->mkv_recover);
+		options_clean();
+		return ret;
+	}
+
+	/*benchmark mode: encode synthetic frames with every video codec and exit*/
+	if(my_options->encoder_benchmark)
+	{
+		encoder_set_verbosity(my_options->verbosity);
+		int width = (my_options->width > 0) ? my_options->width : 1280;
+		int height = (my_options->height > 0) ? my_options->height : 720;
+		int ret = encoder_video_benchmark(width, height, 100, 0);
+		options_clean();
+		return ret;
+	}
+
 	char *config_path = smart_cat(getenv("HOME"), '/', ".config/guvcview2");
 	mkdir(config_path, 0777);
 
@@ -149,6 +169,10 @@ int main(int argc, char *argv[])
 
 	if(strcasecmp(my_config->render, "none") == 0)
 		render = RENDER_NONE;
+	else if(strcasecmp(my_config->render, "null") == 0)
+		render = RENDER_NULL;
+	else if(strcasecmp(my_config->render, "shm") == 0)
+		render = RENDER_SHM;
 	else if(strcasecmp(my_config->render, "sdl") == 0)
 	{
 #if ENABLE_SDL2
@@ -351,6 +375,14 @@ int main(int argc, char *argv[])
 		fprintf(stderr, "GUVCVIEW: couldn't get a valid audio context for the selected api - disabling audio\n");
 	
 	encoder_set_verbosity(debug_level);
+	encoder_set_file_io_flags(my_options->video_io);
+	encoder_set_mkv_checkpoint(my_config->mkv_checkpoint);
+	encoder_set_video_threads(my_config->video_threads);
+	encoder_set_video_crop(my_options->video_crop_x, my_options->video_crop_y,
+		my_options->video_crop_width, my_options->video_crop_height);
+	encoder_set_video_scale(my_options->video_scale_width, my_options->video_scale_height);
+	encoder_set_video_pix_fmt(my_options->video_pix_fmt);
+	encoder_set_video_motion(my_options->video_motion);
 
 	/*start capture thread if not in control_panel mode*/
 	if(!my_options->control_panel)
@@ -26,6 +26,7 @@
 #include <getopt.h>
 
 #include "gviewv4l2core.h"
+#include "gviewencoder.h"
 #include "gview.h"
 #include "core_io.h"
 #include "gui.h"
@@ -117,7 +118,7 @@ static opt_values_t opt_values[] =
 		.opt_long = "render",
 		.req_arg = 1,
 		.opt_help_arg = N_("RENDER_API"),
-		.opt_help = N_("Select render API (e.g none; sdl; sfml)")
+		.opt_help = N_("Select render API (e.g none; sdl; sfml; null; shm)")
 	},
 	{
 		.opt_short = 'm',
@@ -126,6 +127,13 @@ static opt_values_t opt_values[] =
 		.opt_help_arg = N_("RENDER_WINDOW_FLAGS"),
 		.opt_help = N_("Set render window flags (e.g none; full; max; WIDTHxHEIGHT)")
 	},
+	{
+		.opt_short = 'R',
+		.opt_long = "render_fps",
+		.req_arg = 1,
+		.opt_help_arg = N_("FPS"),
+		.opt_help = N_("Set max render (preview) frame rate (0 - capture frame rate)")
+	},
 	{
 		.opt_short = 'a',
 		.opt_long = "audio",
@@ -140,6 +148,13 @@ static opt_values_t opt_values[] =
 		.opt_help_arg = N_("AUDIO_DEVICE"),
 		.opt_help = N_("Select audio device index for selected api (0..N)")
 	},
+	{
+		.opt_short = 'D',
+		.opt_long = "audio_drift",
+		.req_arg = 1,
+		.opt_help_arg = N_("STATE"),
+		.opt_help = N_("lock the audio clock to the video clock by resampling (1 - on, 0 - off)")
+	},
 	{
 		.opt_short = 'g',
 		.opt_long = "gui",
@@ -198,6 +213,118 @@ static opt_values_t opt_values[] =
 		.opt_help_arg = N_("TIME_IN_SEC"),
 		.opt_help = N_("time (double) in sec. for video capture)")
 	},
+	{
+		.opt_short = 'W',
+		.opt_long = "video_io",
+		.req_arg = 1,
+		.opt_help_arg = N_("FLAGS"),
+		.opt_help = N_("video file writes (comma separated: prealloc, direct, dontneed)")
+	},
+	{
+		.opt_short = 'T',
+		.opt_long = "segment_time",
+		.req_arg = 1,
+		.opt_help_arg = N_("MINUTES"),
+		.opt_help = N_("split video capture in segments of MINUTES (0 - disabled)")
+	},
+	{
+		.opt_short = 'Z',
+		.opt_long = "segment_size",
+		.req_arg = 1,
+		.opt_help_arg = N_("MB"),
+		.opt_help = N_("split video capture in segments of MB (0 - disabled)")
+	},
+	{
+		.opt_short = 'K',
+		.opt_long = "segment_retention",
+		.req_arg = 0,
+		.opt_help_arg = "",
+		.opt_help = N_("delete oldest video segments when disk space is low")
+	},
+	{
+		.opt_short = 'P',
+		.opt_long = "preroll",
+		.req_arg = 1,
+		.opt_help_arg = N_("TIME_IN_SEC"),
+		.opt_help = N_("keep the last TIME_IN_SEC of video before recording starts (direct input only)")
+	},
+	{
+		.opt_short = 'C',
+		.opt_long = "mkv_checkpoint",
+		.req_arg = 1,
+		.opt_help_arg = N_("TIME_IN_SEC"),
+		.opt_help = N_("write the matroska index every TIME_IN_SEC (crash safe files, 0 - disabled)")
+	},
+	{
+		.opt_short = 'X',
+		.opt_long = "mkv_recover",
+		.req_arg = 1,
+		.opt_help_arg = N_("FILENAME"),
+		.opt_help = N_("rebuild the index of an unfinished matroska file and exit")
+	},
+	{
+		.opt_short = 'N',
+		.opt_long = "video_threads",
+		.req_arg = 1,
+		.opt_help_arg = N_("THREADS"),
+		.opt_help = N_("video encoder threads: auto or number (0 - codec default)")
+	},
+	{
+		.opt_short = 'B',
+		.opt_long = "encoder_benchmark",
+		.req_arg = 0,
+		.opt_help_arg = "",
+		.opt_help = N_("benchmark the video encoders at 1 to N threads (uses --resolution) and exit")
+	},
+	{
+		.opt_short = 'S',
+		.opt_long = "video_scale",
+		.req_arg = 1,
+		.opt_help_arg = N_("WIDTHxHEIGHT"),
+		.opt_help = N_("scale the video to this size before encoding (0 keeps the aspect ratio)")
+	},
+	{
+		.opt_short = 'O',
+		.opt_long = "video_crop",
+		.req_arg = 1,
+		.opt_help_arg = N_("WIDTHxHEIGHT+X+Y"),
+		.opt_help = N_("crop the video to this rectangle before encoding")
+	},
+	{
+		.opt_short = 'Y',
+		.opt_long = "video_pix_fmt",
+		.req_arg = 1,
+		.opt_help_arg = N_("FORMAT"),
+		.opt_help = N_("video encoder pixel format, e.g. yuv422p or nv12 (default: codec format)")
+	},
+	{
+		.opt_short = 'M',
+		.opt_long = "video_motion",
+		.req_arg = 1,
+		.opt_help_arg = N_("FLAGS"),
+		.opt_help = N_("motion aware encoding (comma separated: roi, skip)")
+	},
+	{
+		.opt_short = 'A',
+		.opt_long = "motion_record",
+		.req_arg = 1,
+		.opt_help_arg = N_("SENSITIVITY"),
+		.opt_help = N_("record video only while motion is detected (with at least 2 sec of pre-roll), sensitivity 1 to 100 (0 - disabled)")
+	},
+	{
+		.opt_short = 'L',
+		.opt_long = "timelapse",
+		.req_arg = 1,
+		.opt_help_arg = N_("TIME_IN_SEC"),
+		.opt_help = N_("time-lapse video: record one frame every TIME_IN_SEC (double)")
+	},
+	{
+		.opt_short = 'J',
+		.opt_long = "timelapse_fps",
+		.req_arg = 1,
+		.opt_help_arg = N_("FPS"),
+		.opt_help = N_("time-lapse video playback frame rate (default 25)")
+	},
 	{
 		.opt_short = 't',
 		.opt_long = "photo_timer",
@@ -248,6 +375,7 @@ static options_t my_options =
 	.gui = "",
 	.audio = "",
 	.audio_device = -1, /*use default*/
+	.audio_drift = -1, /*not set*/
 	.capture = "",
 	.video_codec = "",
 	.audio_codec = "",
@@ -264,7 +392,28 @@ static options_t my_options =
 	.exit_on_term = 0,
 	.render_flag = "none",
 	.render_width = 0,
-	.render_height = 0
+	.render_height = 0,
+	.render_fps = 0,
+	.video_io = 0,
+	.video_segment_time = -1,
+	.video_segment_size = -1,
+	.video_segment_retention = 0,
+	.video_preroll = -1,
+	.mkv_checkpoint = -1,
+	.mkv_recover = NULL,
+	.video_threads = -2,
+	.encoder_benchmark = 0,
+	.video_scale_width = 0,
+	.video_scale_height = 0,
+	.video_crop_width = 0,
+	.video_crop_height = 0,
+	.video_crop_x = 0,
+	.video_crop_y = 0,
+	.video_pix_fmt = NULL,
+	.video_motion = 0,
+	.motion_record = -1,
+	.timelapse = 0,
+	.timelapse_fps = 25
 };
 
 /*
@@ -406,6 +555,48 @@ void opt_print_version()
 	printf("Guvcview version %s\n", VERSION);
 }
 
+/*
+ * parses a comma separated list of flag names
+ * args:
+ *   str - comma separated list (e.g. "prealloc,dontneed")
+ *   names - flag names (NULL terminated)
+ *   flags - flag values (one per name)
+ *   value - pointer to the resulting flags bitmask
+ *
+ * asserts:
+ *   none
+ *
+ * returns: 0 on success, -1 if str has an unknown flag name
+ */
+static int opt_parse_flags(const char *str, const char *names[], const int flags[], int *value)
+{
+	int ret = 0;
+	*value = 0;
+
+	char *list = strdup(str);
+	if(list == NULL)
+		return -1;
+
+	char *saveptr = NULL;
+	char *token = strtok_r(list, ",", &saveptr);
+	while(token != NULL)
+	{
+		int i = 0;
+		while(names[i] != NULL && strcmp(token, names[i]) != 0)
+			i++;
+
+		if(names[i] != NULL)
+			*value |= flags[i];
+		else
+			ret = -1;
+
+		token = strtok_r(NULL, ",", &saveptr);
+	}
+
+	free(list);
+	return ret;
+}
+
 /*
  * parses the command line options
  * args:
@@ -569,6 +760,120 @@ int options_parse(int argc, char *argv[])
 
 				break;
 			}
+			case 'R':
+				my_options.render_fps = atoi(optarg);
+				if(my_options.render_fps < 0)
+					my_options.render_fps = 0;
+				break;
+			case 'W':
+			{
+				const char *io_names[] = {"prealloc", "direct", "dontneed", NULL};
+				const int io_flags[] = {ENCODER_IO_PREALLOC, ENCODER_IO_DIRECT, ENCODER_IO_DONTNEED};
+				if(opt_parse_flags(optarg, io_names, io_flags, &my_options.video_io) < 0)
+					fprintf(stderr, "V4L2_CORE: (options) Error in video io usage: -W[--video_io] prealloc,direct,dontneed \n");
+				break;
+			}
+			case 'T':
+				my_options.video_segment_time = atoi(optarg);
+				if(my_options.video_segment_time < 0)
+					my_options.video_segment_time = 0;
+				break;
+			case 'Z':
+				my_options.video_segment_size = atoi(optarg);
+				if(my_options.video_segment_size < 0)
+					my_options.video_segment_size = 0;
+				break;
+			case 'K':
+				my_options.video_segment_retention = 1;
+				break;
+			case 'P':
+				my_options.video_preroll = atoi(optarg);
+				if(my_options.video_preroll < 0)
+					my_options.video_preroll = 0;
+				break;
+			case 'C':
+				my_options.mkv_checkpoint = atoi(optarg);
+				if(my_options.mkv_checkpoint < 0)
+					my_options.mkv_checkpoint = 0;
+				break;
+			case 'X':
+				if(my_options.mkv_recover != NULL)
+					free(my_options.mkv_recover);
+				my_options.mkv_recover = strdup(optarg);
+				break;
+			case 'N':
+				if(strcasecmp(optarg, "auto") == 0)
+					my_options.video_threads = ENCODER_THREADS_AUTO;
+				else
+					my_options.video_threads = atoi(optarg);
+				if(my_options.video_threads < ENCODER_THREADS_AUTO)
+					my_options.video_threads = ENCODER_THREADS_DEFAULT;
+				break;
+			case 'B':
+				my_options.encoder_benchmark = 1;
+				break;
+			case 'S':
+				my_options.video_scale_width = (int) strtol(optarg, &stopstring, 10);
+				my_options.video_scale_height = 0;
+				if( *stopstring != 'x')
+					fprintf(stderr, "V4L2_CORE: (options) Error in video scale usage: -S[--video_scale] WIDTHxHEIGHT \n");
+				else
+					my_options.video_scale_height = (int) strtol(stopstring + 1, &stopstring, 10);
+				if(my_options.video_scale_width < 0)
+					my_options.video_scale_width = 0;
+				if(my_options.video_scale_height < 0)
+					my_options.video_scale_height = 0;
+				break;
+			case 'O':
+				my_options.video_crop_x = 0;
+				my_options.video_crop_y = 0;
+				my_options.video_crop_width = (int) strtol(optarg, &stopstring, 10);
+				my_options.video_crop_height = 0;
+				if( *stopstring == 'x')
+					my_options.video_crop_height = (int) strtol(stopstring + 1, &stopstring, 10);
+				if( *stopstring == '+')
+					my_options.video_crop_x = (int) strtol(stopstring + 1, &stopstring, 10);
+				if( *stopstring == '+')
+					my_options.video_crop_y = (int) strtol(stopstring + 1, &stopstring, 10);
+				if(my_options.video_crop_width <= 0 || my_options.video_crop_height <= 0 ||
+					my_options.video_crop_x < 0 || my_options.video_crop_y < 0)
+				{
+					fprintf(stderr, "V4L2_CORE: (options) Error in video crop usage: -O[--video_crop] WIDTHxHEIGHT+X+Y \n");
+					my_options.video_crop_width = 0;
+					my_options.video_crop_height = 0;
+				}
+				break;
+			case 'Y':
+				if(my_options.video_pix_fmt != NULL)
+					free(my_options.video_pix_fmt);
+				my_options.video_pix_fmt = strdup(optarg);
+				break;
+			case 'M':
+			{
+				const char *motion_names[] = {"roi", "skip", NULL};
+				const int motion_flags[] = {ENCODER_MOTION_ROI, ENCODER_MOTION_SKIP};
+				if(opt_parse_flags(optarg, motion_names, motion_flags, &my_options.video_motion) < 0)
+					fprintf(stderr, "V4L2_CORE: (options) Error in video motion usage: -M[--video_motion] roi,skip \n");
+				break;
+			}
+			case 'A':
+				my_options.motion_record = atoi(optarg);
+				if(my_options.motion_record < 0)
+					my_options.motion_record = 0;
+				if(my_options.motion_record > 100)
+					my_options.motion_record = 100;
+				break;
+			case 'L':
+				my_options.timelapse = strtod(optarg, (char **)NULL);
+				break;
+			case 'J':
+				my_options.timelapse_fps = atoi(optarg);
+				if(my_options.timelapse_fps <= 0)
+				{
+					fprintf(stderr, "V4L2_CORE: (options) Error in time-lapse fps usage: -J[--timelapse_fps] FPS \n");
+					my_options.timelapse_fps = 25;
+				}
+				break;
 			case 'g':
 			{
 				int str_size = strlen(optarg);
@@ -585,6 +890,9 @@ int options_parse(int argc, char *argv[])
 			case 'k':
 				my_options.audio_device = atoi(optarg);
 				break;
+			case 'D':
+				my_options.audio_drift = (atoi(optarg) > 0) ? 1 : 0;
+				break;
 			case 'o':
 			{
 				int str_size = strlen(optarg);
@@ -734,4 +1042,12 @@ void options_clean()
 	if(my_options.photo_path != NULL)
 		free(my_options.photo_path);
 	my_options.photo_path = NULL;
+
+	if(my_options.mkv_recover != NULL)
+		free(my_options.mkv_recover);
+	my_options.mkv_recover = NULL;
+
+	if(my_options.video_pix_fmt != NULL)
+		free(my_options.video_pix_fmt);
+	my_options.video_pix_fmt = NULL;
 }
@@ -37,6 +37,7 @@ typedef struct _options_t
 	char gui[5];     /*gui api*/
 	char audio[6];   /*audio api - none; port; pulse*/
 	int audio_device; /*audio device index 0..N (-1 = default)*/
+	int audio_drift; /*audio clock drift correction (-1 - not set, 0 - off, 1 - on)*/
 	char capture[5]; /*capture method: read or mmap*/
 	char audio_codec[5]; /*audio codec*/
 	char video_codec[5]; /*video codec*/
@@ -54,6 +55,27 @@ typedef struct _options_t
 	char render_flag[5]; /*render window flag => default (none) | FULLSCREEN (full) | MAXIMIZED (max)*/
 	int render_width; //render window width (default 0), if set, render window flag is none
 	int render_height; //render window height (default 0), if set, render window flag is none
+	int render_fps; //max preview frame rate (default 0 - render every frame)
+	int video_io; //video file write flags (ENCODER_IO_XXX)
+	int video_segment_time; //video segment duration in minutes (-1 - not set, 0 - disabled)
+	int video_segment_size; //video segment size in MB (-1 - not set, 0 - disabled)
+	int video_segment_retention; //flag: delete oldest segments when disk space is low
+	int video_preroll; //video pre-roll time in seconds (-1 - not set, 0 - disabled)
+	int mkv_checkpoint; //matroska index checkpoint interval in seconds (-1 - not set, 0 - disabled)
+	char *mkv_recover; //matroska file to recover (rebuild the index and exit)
+	int video_threads; //video encoder threads (-2 - not set, -1 - auto, 0 - codec default)
+	int encoder_benchmark; //flag: run the video encoder benchmark and exit
+	int video_scale_width; //encoded video width (0 - capture/crop width)
+	int video_scale_height; //encoded video height (0 - capture/crop height)
+	int video_crop_width; //video crop rectangle (0 - no crop)
+	int video_crop_height;
+	int video_crop_x;
+	int video_crop_y;
+	char *video_pix_fmt; //encoder pixel format name (NULL - codec default)
+	int video_motion; //motion aware encoding flags (ENCODER_MOTION_XXX)
+	int motion_record; //motion triggered recording sensitivity (-1 - not set, 0 - disabled)
+	double timelapse; //time-lapse video: record one frame every N seconds (0 - disabled)
+	int timelapse_fps; //time-lapse video playback frame rate
 } options_t;
 
 /*
@@ -46,6 +46,9 @@
 #include "gui.h"
 #include "../config.h"
 
+/*motion triggered recording: minimum pre-roll (sec) that keeps the event start*/
+#define MOTION_RECORD_PREROLL (2)
+
 /*flags*/
 extern int debug_level;
 
@@ -64,6 +67,14 @@ static uint64_t my_video_begin_time = 0; /*first video frame ts*/
 
 static int restart = 0; /*restart flag*/
 
+static int motion_recording = 0; /*recording started by the motion trigger*/
+
+static uint64_t my_timelapse_interval = 0; /*time-lapse frame interval (0 - disabled)*/
+static int my_timelapse_fps = 25; /*time-lapse playback frame rate*/
+static uint64_t my_timelapse_last = 0; /*last kept frame ts*/
+static int64_t my_timelapse_start = 0; /*first kept frame ts*/
+static int64_t my_timelapse_frames = 0; /*kept frames*/
+
 static char render_caption[30]; /*render window caption*/
 
 static uint32_t my_render_mask = REND_FX_YUV_NOFILT; /*render fx filter mask*/
@@ -85,8 +96,21 @@ static __THREAD_TYPE encoder_thread;
 
 static int my_encoder_status = 0;
 
+/*pre-roll standby (software codecs): an encoder thread encodes to the pre-roll buffer*/
+static __MUTEX_TYPE preroll_mutex = __STATIC_MUTEX_INIT;
+static __THREAD_TYPE preroll_thread;
+static int preroll_standby = 0; /*cleared to start recording or stop the standby*/
+static int preroll_encoding = 0; /*the standby encoder takes frames*/
+static int preroll_codec_ind = 0; /*standby encoder codec*/
+
 static char status_message[80];
 
+/*segmented recording*/
+static char *segment_current = NULL; /*current segment filename*/
+static char *segment_next = NULL; /*next (prepared) segment filename*/
+static char **segment_list = NULL; /*completed segments (oldest first)*/
+static int segment_list_size = 0;
+
 /*
  * set render flag
  * args:
@@ -246,6 +270,29 @@ int get_encoder_status()
 	return my_encoder_status;
 }
 
+/*
+ * checks if time-lapse video is on
+ *   h264 direct input is never decimated (frames depend on each other)
+ * args:
+ *    none
+ *
+ * asserts:
+ *    none
+ *
+ * returns: 1 if on; 0 if off
+ */
+static int check_timelapse()
+{
+	if(my_timelapse_interval == 0)
+		return 0;
+
+	if(get_video_codec_ind() == 0 &&
+		v4l2core_get_requested_frame_format(my_vd) == V4L2_PIX_FMT_H264)
+		return 0;
+
+	return 1;
+}
+
 /*
  * stops the photo timed capture
  * args:
@@ -704,6 +751,9 @@ static void *audio_processing_loop(void *data)
 
 	audio_set_cap_buffer_size(audio_ctx,
 		frame_size * audio_get_channels(audio_ctx));
+	/*drift correction must be set before audio_start*/
+	config_t *my_config = config_get();
+	audio_set_drift_correction(audio_ctx, my_config->audio_drift);
 	audio_start(audio_ctx);
 	/*
 	 * alloc the buffer after audio_start
@@ -735,16 +785,15 @@ static void *audio_processing_loop(void *data)
 		{
 			/*
 			 * no buffers to process
-			 * sleep a couple of milisec
+			 * wait for the capture callback (with a timeout
+			 * so that the save video flag is checked)
 			 */
-			 struct timespec req = {
-				.tv_sec = 0,
-				.tv_nsec = 1000000};/*nanosec*/
-			 nanosleep(&req, NULL);
+			audio_wait_buffer(audio_ctx, 50);
 		}
 		else if(ret == 0)
 		{
-			encoder_ctx->enc_audio_ctx->pts = audio_buff->timestamp;
+			/*audio starts after the pre-roll video*/
+			encoder_ctx->enc_audio_ctx->pts = audio_buff->timestamp + encoder_ctx->preroll_time;
 
 			/*OSD vu meter level*/
 			render_set_vu_level(audio_buff->level_meter);
@@ -768,12 +817,166 @@ static void *audio_processing_loop(void *data)
 
 	render_set_osd_mask(osd_mask);
 
+	if(debug_level > 0 && my_config->audio_drift)
+	{
+		audio_drift_stats_t drift_stats;
+		audio_get_drift_stats(audio_ctx, &drift_stats);
+		printf("GUVCVIEW: audio drift %" PRId64 " ns (error %" PRId64 " ns; correction %.1f ppm)\n",
+			drift_stats.drift, drift_stats.error, drift_stats.correction_ppm);
+	}
+
 	audio_stop(audio_ctx);
 	audio_delete_buffer(audio_buff);
 
 	return ((void *) 0);
 }
 
+/*
+ * join a path and a file name
+ * args:
+ *    path - file path (dir)
+ *    name - file name
+ *
+ * asserts:
+ *    none
+ *
+ * returns: newly allocated string with the full filename (must free)
+ */
+static char *video_join_path(const char *path, const char *name)
+{
+	int pathsize = strlen(path);
+	if(path[pathsize - 1] != '/')
+		return smart_cat(path, '/', name);
+
+	return smart_cat(path, 0, name);
+}
+
+/*
+ * segmented recording: prepare the next segment file ahead of the
+ *   segment limit and request the switch (on a keyframe) when reached
+ * args:
+ *    encoder_ctx - pointer to encoder context
+ *    path - video file path
+ *    name - video file base name (segments get a number suffix)
+ *    max_time - segment duration limit in ns (0 - no limit)
+ *    max_size - segment size limit in bytes (0 - no limit)
+ *
+ * asserts:
+ *    none
+ *
+ * returns: none
+ */
+static void video_segment_supervisor(encoder_context_t *encoder_ctx,
+	const char *path, const char *name, int64_t max_time, int64_t max_size)
+{
+	int status = encoder_muxer_get_segment_status();
+
+	if(segment_next && status == ENCODER_SEGMENT_NONE)
+	{
+		/*the muxer switched files: current segment is complete*/
+		segment_list = realloc(segment_list, (segment_list_size + 1) * sizeof(char *));
+		if(segment_list == NULL)
+		{
+			fprintf(stderr,"GUVCVIEW: FATAL memory allocation failure (video_segment_supervisor): %s\n", strerror(errno));
+			exit(-1);
+		}
+		segment_list[segment_list_size] = segment_current;
+		segment_list_size++;
+
+		segment_current = segment_next;
+		segment_next = NULL;
+
+		snprintf(status_message, 79, _("saving video to %s"), segment_current);
+		gui_status_message(status_message);
+		return;
+	}
+
+	/*segment progress (percentage of the limit)*/
+	int64_t progress = 0;
+	if(max_time > 0)
+		progress = encoder_muxer_get_segment_duration(encoder_ctx) * 100 / max_time;
+	if(max_size > 0)
+		progress = MAX(progress, encoder_muxer_get_segment_size() * 100 / max_size);
+
+	if(status == ENCODER_SEGMENT_NONE && progress >= 90)
+	{
+		/*open the next file ahead of time (no capture gap on switch)*/
+		char *next_name = add_file_suffix(path, name);
+		char *filename = video_join_path(path, next_name);
+		free(next_name);
+
+		if(encoder_muxer_prepare_next(encoder_ctx, filename) == 0)
+			segment_next = filename;
+		else
+			free(filename);
+	}
+	else if(status == ENCODER_SEGMENT_READY && progress >= 100)
+	{
+		if(debug_level > 0)
+			printf("GUVCVIEW: segment limit reached - switching on next keyframe\n");
+
+		encoder_muxer_split(encoder_ctx);
+
+		/*raw h264: request a IDR (key) frame from the device*/
+		if(encoder_ctx->video_codec_ind == 0 &&
+			v4l2core_get_requested_frame_format(my_vd) == V4L2_PIX_FMT_H264)
+			v4l2core_h264_request_idr(my_vd);
+	}
+}
+
+/*
+ * segmented recording: delete the oldest completed segment
+ * args:
+ *    none
+ *
+ * asserts:
+ *    none
+ *
+ * returns: 1 if a segment was deleted, 0 otherwise
+ */
+static int video_segment_drop_oldest()
+{
+	if(segment_list_size <= 0)
+		return 0;
+
+	if(unlink(segment_list[0]) != 0)
+		fprintf(stderr, "GUVCVIEW: couldn't delete video segment %s: %s\n",
+			segment_list[0], strerror(errno));
+	else if(debug_level > 0)
+		printf("GUVCVIEW: low disk space - deleted video segment %s\n", segment_list[0]);
+
+	free(segment_list[0]);
+	segment_list_size--;
+	memmove(segment_list, segment_list + 1, segment_list_size * sizeof(char *));
+
+	return 1;
+}
+
+/*
+ * segmented recording: clean the segment lists
+ * args:
+ *    none
+ *
+ * asserts:
+ *    none
+ *
+ * returns: none
+ */
+static void video_segment_clean()
+{
+	int i = 0;
+	for(i = 0; i < segment_list_size; i++)
+		free(segment_list[i]);
+	free(segment_list);
+	segment_list = NULL;
+	segment_list_size = 0;
+
+	free(segment_current);
+	segment_current = NULL;
+	free(segment_next);
+	segment_next = NULL;
+}
+
 /*
  * encoder loop (should run in a separate thread)
  * args:
@@ -786,7 +989,10 @@ static void *audio_processing_loop(void *data)
  */
 static void *encoder_loop(void *data)
 {
-	my_encoder_status = 1;
+	/*pre-roll standby: not recording until start_encoder_thread*/
+	int standby = preroll_standby;
+	if(!standby)
+		my_encoder_status = 1;
 
 	if(debug_level > 1)
 		printf("GUVCVIEW: encoder thread (tid: %u)\n",
@@ -800,7 +1006,20 @@ static void *encoder_loop(void *data)
 	int channels = 0;
 	int samprate = 0;
 
-	if(audio_ctx)
+	int fps_num = v4l2core_get_fps_num(my_vd);
+	int fps_denom = v4l2core_get_fps_denom(my_vd);
+
+	/*time-lapse video: no audio, kept frames are played at the time-lapse fps*/
+	int timelapse = check_timelapse();
+	if(timelapse)
+	{
+		fps_num = 1;
+		fps_denom = my_timelapse_fps;
+	}
+	/*time-lapse frames arrive slowly, never drop them*/
+	encoder_set_video_governor(!timelapse);
+
+	if(audio_ctx && !timelapse)
 	{
 		channels = audio_get_channels(audio_ctx);
 		samprate = audio_get_samprate(audio_ctx);
@@ -818,8 +1037,8 @@ static void *encoder_loop(void *data)
 		get_video_muxer(),
 		v4l2core_get_frame_width(my_vd),
 		v4l2core_get_frame_height(my_vd),
-		v4l2core_get_fps_num(my_vd),
-		v4l2core_get_fps_denom(my_vd),
+		fps_num,
+		fps_denom,
 		channels,
 		samprate);
 
@@ -864,6 +1083,40 @@ static void *encoder_loop(void *data)
 		current_framerate = v4l2core_get_h264_frame_rate_config(my_vd);
 	}
 
+	/*pre-roll standby: keep the encoded packets until recording starts*/
+	if(standby)
+	{
+		encoder_ctx->preroll_encode = 1;
+		preroll_encoding = 1;
+
+		while(preroll_standby)
+		{
+			if(encoder_process_next_video_buffer(encoder_ctx) > 0)
+			{
+				struct timespec req = {
+					.tv_sec = 0,
+					.tv_nsec = 1000000};/*nanosec*/
+				nanosleep(&req, NULL);
+			}
+		}
+
+		/*standby stopped without recording*/
+		if(!video_capture_get_save_video())
+		{
+			preroll_encoding = 0;
+			encoder_close(encoder_ctx);
+			encoder_preroll_reset();
+			return ((void *) 0);
+		}
+
+		/*frames keep going to the ring buffer (save video flag is set)*/
+		preroll_encoding = 0;
+		my_encoder_status = 1;
+
+		/*the container may have changed meanwhile*/
+		encoder_ctx->muxer_id = get_video_muxer();
+	}
+
 	char *video_filename = NULL;
 	/*get_video_[name|path] always return a non NULL value*/
 	char *name = strdup(get_video_name());
@@ -875,21 +1128,29 @@ static void *encoder_loop(void *data)
 		free(name); /*free old name*/
 		name = new_name; /*replace with suffixed name*/
 	}
-	int pathsize = strlen(path);
-	if(path[pathsize - 1] != '/')
-		video_filename = smart_cat(path, '/', name);
-	else
-		video_filename = smart_cat(path, 0, name);
+	video_filename = video_join_path(path, name);
+
+	/*segmented recording*/
+	config_t *my_config = config_get();
+	int64_t segment_time = (int64_t) my_config->video_segment_time * 60 * NSEC_PER_SEC;
+	int64_t segment_size = (int64_t) my_config->video_segment_size * 1024 * 1024;
+	/*segment files always get a number suffix*/
+	char *segment_name = strdup(get_video_name());
+	segment_current = strdup(video_filename);
 
 	snprintf(status_message, 79, _("saving video to %s"), video_filename);
 	gui_status_message(status_message);
 
+	/*
+	 * start video capture
+	 * (before the muxer flushes the pre-roll frames, so that
+	 *  new frames go to the encoder ring buffer)
+	 */
+	video_capture_save_video(1);
+
 	/*muxer initialization*/
 	encoder_muxer_init(encoder_ctx, video_filename);
 
-	/*start video capture*/
-	video_capture_save_video(1);
-
 	int treshold = 102400; /*100 Mbytes*/
 	int64_t last_check_pts = 0; /*last pts when disk supervisor called*/
 
@@ -924,6 +1185,11 @@ static void *encoder_loop(void *data)
 
 		}
 
+		/*segmented recording*/
+		if(segment_time > 0 || segment_size > 0)
+			video_segment_supervisor(encoder_ctx, path, segment_name,
+				segment_time, segment_size);
+
 		/*disk supervisor*/
 		if(encoder_ctx->enc_video_ctx->pts - last_check_pts > 2 * NSEC_PER_SEC)
 		{
@@ -931,8 +1197,13 @@ static void *encoder_loop(void *data)
 
 			if(!encoder_disk_supervisor(treshold, path))
 			{
-				/*stop capture*/
-				gui_set_video_capture_button_status(0);
+				/*retention policy: free space by deleting the oldest segment*/
+				if(!my_config->video_segment_retention ||
+					!video_segment_drop_oldest())
+				{
+					/*stop capture*/
+					gui_set_video_capture_button_status(0);
+				}
 			}
 		}
 	}
@@ -968,12 +1239,102 @@ static void *encoder_loop(void *data)
 	free(video_filename);
 	free(path);
 	free(name);
+	free(segment_name);
+	video_segment_clean();
 
 	my_encoder_status = 0;
 
 	return ((void *) 0);
 }
 
+/*
+ * get the direct input (raw compressed) frame data
+ * args:
+ *    frame - pointer to frame buffer
+ *    size - pointer to store the frame size
+ *
+ * asserts:
+ *    none
+ *
+ * returns: pointer to the frame data
+ */
+static uint8_t *get_direct_input_frame(v4l2_frame_buff_t *frame, int *size)
+{
+	switch(v4l2core_get_requested_frame_format(my_vd))
+	{
+		case  V4L2_PIX_FMT_H264:
+			*size = (int) frame->h264_frame_size;
+			return frame->h264_frame;
+
+		default:
+			*size = (int) frame->raw_frame_size;
+			return frame->raw_frame;
+	}
+}
+
+/*
+ * stop the pre-roll standby encoder thread (if not recording)
+ *   only called from the capture loop
+ * args:
+ *    none
+ *
+ * asserts:
+ *    none
+ *
+ * returns: none
+ */
+static void preroll_standby_stop()
+{
+	__LOCK_MUTEX(&preroll_mutex);
+	int standby = preroll_standby;
+	preroll_standby = 0;
+	__UNLOCK_MUTEX(&preroll_mutex);
+
+	if(standby)
+		__THREAD_JOIN(preroll_thread);
+}
+
+/*
+ * keep an encoder thread in pre-roll standby while not recording
+ *   (software codecs only, direct input frames are kept by the
+ *   capture loop), only called from the capture loop
+ * args:
+ *    none
+ *
+ * asserts:
+ *    none
+ *
+ * returns: none
+ */
+static void preroll_standby_update()
+{
+	int codec_ind = get_video_codec_ind();
+
+	/*codec changed: restart the standby encoder*/
+	if(preroll_standby && preroll_codec_ind != codec_ind)
+		preroll_standby_stop();
+
+	if(codec_ind == 0 || check_timelapse())
+		return;
+
+	__LOCK_MUTEX(&preroll_mutex);
+
+	if(!preroll_standby && !get_encoder_status() && !video_capture_get_save_video())
+	{
+		preroll_standby = 1;
+		preroll_codec_ind = codec_ind;
+
+		int ret = __THREAD_CREATE(&preroll_thread, encoder_loop, NULL);
+		if(ret)
+		{
+			fprintf(stderr, "GUVCVIEW: pre-roll encoder thread creation failed (%i)\n", ret);
+			preroll_standby = 0;
+		}
+	}
+
+	__UNLOCK_MUTEX(&preroll_mutex);
+}
+
 /*
  * capture loop (should run in a separate thread)
  * args:
@@ -1014,6 +1375,18 @@ void *capture_loop(void *data)
 
 	render_set_crosshair_color(my_config->crosshair_color);
 
+	render_set_preview_fps(my_options->render_fps);
+
+	if(render == RENDER_SHM)
+	{
+		/*one shm object per device: /guvcview-<device basename>*/
+		char *device_name = get_file_basename(my_options->device);
+		char shm_name[64];
+		snprintf(shm_name, 63, "/guvcview-%s", device_name);
+		free(device_name);
+		render_set_shm_name(shm_name);
+	}
+
 	if(render_init(
 		render,
 		v4l2core_get_frame_width(my_vd),
@@ -1033,6 +1406,27 @@ void *capture_loop(void *data)
 		render_set_event_callback(EV_KEY_RIGHT, &key_RIGHT_callback, NULL);
 	}
 
+	/*
+	 * keep the last video frames before recording
+	 * (direct input frames or the packets of a standby encoder),
+	 * motion recording always keeps the frames before the trigger
+	 */
+	int preroll_sec = my_config->video_preroll;
+	if(my_config->motion_record > 0 && preroll_sec < MOTION_RECORD_PREROLL)
+		preroll_sec = MOTION_RECORD_PREROLL;
+
+	if(preroll_sec > 0)
+	{
+		encoder_preroll_init(preroll_sec, my_config->video_preroll_mem);
+		preroll_standby_update();
+	}
+
+	/*start and stop recording on motion (event start is kept by the pre-roll)*/
+	motion_recording = 0;
+	if(my_config->motion_record > 0)
+		encoder_motion_trigger_init(my_config->motion_record,
+			my_config->motion_record_interval, my_config->motion_record_hold);
+
 	/*add a video capture timer*/
 	if(my_options->video_timer > 0)
 	{
@@ -1053,6 +1447,16 @@ void *capture_loop(void *data)
 	if(my_options->photo_npics > 0)
 		my_photo_npics = my_options->photo_npics;
 
+	/*time-lapse video*/
+	my_timelapse_interval = 0;
+	if(my_options->timelapse > 0)
+	{
+		my_timelapse_interval = (uint64_t) (NSEC_PER_SEC * my_options->timelapse);
+		my_timelapse_fps = my_options->timelapse_fps;
+		if(check_timelapse() == 0)
+			fprintf(stderr, "GUVCVIEW: time-lapse is not supported for h264 direct input\n");
+	}
+
 	v4l2core_start_stream(my_vd);
 
 	v4l2_frame_buff_t *frame = NULL; //pointer to frame buffer
@@ -1068,6 +1472,10 @@ void *capture_loop(void *data)
 			int current_height = v4l2core_get_frame_height(my_vd);
 
 			restart = 0; /*reset*/
+
+			/*the standby encoder uses the frame size (restarted with the new one)*/
+			preroll_standby_stop();
+
 			v4l2core_stop_stream(my_vd);
 
 			v4l2core_clean_buffers(my_vd);
@@ -1135,13 +1543,59 @@ void *capture_loop(void *data)
 		}
 
 		/*get the frame from v4l2 core*/
-		frame = v4l2core_get_decoded_frame(my_vd);
+		frame = v4l2core_get_frame(my_vd);
 		if( frame != NULL)
 		{
+			/*
+			 * time-lapse video: frames that are not kept
+			 * are released before decoding
+			 */
+			if(video_capture_get_save_video() && check_timelapse())
+			{
+				if(my_timelapse_last > 0 &&
+					frame->timestamp - my_timelapse_last < my_timelapse_interval)
+				{
+					v4l2core_release_frame(my_vd, frame);
+					continue;
+				}
+				my_timelapse_last = frame->timestamp;
+			}
+			else
+			{
+				my_timelapse_last = 0;
+				my_timelapse_frames = 0;
+			}
+
+			v4l2core_decode_frame(my_vd, frame);
+
 			/*run software autofocus (must be called after frame was grabbed and decoded)*/
 			if(do_soft_autofocus || do_soft_focus)
 				do_soft_focus = v4l2core_soft_autofocus_run(my_vd, frame);
 
+			/*pre-roll standby encoder (restarted after each recording)*/
+			if(preroll_sec > 0)
+				preroll_standby_update();
+
+			/*motion triggered recording (before any fx is applied)*/
+			if(my_config->motion_record > 0)
+			{
+				int motion = encoder_motion_trigger_frame(frame->yuv_frame,
+					frame->width, frame->height, frame->timestamp);
+
+				if(motion && !motion_recording && !get_encoder_status())
+				{
+					motion_recording = 1;
+					gui_click_video_capture_button();
+				}
+				else if(!motion && motion_recording)
+				{
+					motion_recording = 0;
+					/*the recording may have been stopped meanwhile*/
+					if(get_encoder_status())
+						gui_click_video_capture_button();
+				}
+			}
+
 			/* apply fx effects to the frame
 			 * do it before saving the frame
 			 * (we want to store the effects)
@@ -1217,8 +1671,8 @@ void *capture_loop(void *data)
 				save_image = 0; /*reset*/
 			}
 
-			/*save the frame (video)*/
-			if(video_capture_get_save_video())
+			/*save the frame (video or pre-roll standby encoder)*/
+			if(video_capture_get_save_video() || preroll_encoding)
 			{
 				int size = (frame->width * frame->height * 3) / 2;
 
@@ -1228,49 +1682,39 @@ void *capture_loop(void *data)
 				 * (we may want to store a compressed format
 				 */
 				if(get_video_codec_ind() == 0) //raw frame
-				{
-					switch(v4l2core_get_requested_frame_format(my_vd))
-					{
-						case  V4L2_PIX_FMT_H264:
-							input_frame = frame->h264_frame;
-							size = (int) frame->h264_frame_size;
-							break;
-						default:
-							input_frame = frame->raw_frame;
-							size = (int) frame->raw_frame_size;
-							break;
-					}
+					input_frame = get_direct_input_frame(frame, &size);
 
+				/*time-lapse video: kept frames are played at the time-lapse fps*/
+				int64_t timestamp = frame->timestamp;
+				if(check_timelapse())
+				{
+					if(my_timelapse_frames == 0)
+						my_timelapse_start = frame->timestamp;
+					timestamp = my_timelapse_start +
+						(my_timelapse_frames * NSEC_PER_SEC) / my_timelapse_fps;
+					my_timelapse_frames++;
 				}
-				/*add the frame to the encoder buffer*/
-				encoder_add_video_frame(input_frame, size, frame->timestamp, frame->isKeyframe);
 
+				/*add the frame to the encoder buffer*/
 				/*
-				 * exponencial scheduler
-				 *  with 50% threshold (milisec)
-				 *  and max value of 250 ms (4 fps)
+				 * capture is never throttled: if the encoder
+				 * falls behind, its load governor drops frames
 				 */
-				double time_sched = encoder_buff_scheduler(ENCODER_SCHED_LIN, 0.5, 250);
-				if(time_sched > 0)
-				{
-					switch(v4l2core_get_requested_frame_format(my_vd))
-					{
-						case  V4L2_PIX_FMT_H264:
-						{
-							uint32_t framerate = lround(time_sched * 1E6); /*nanosec*/
-							v4l2core_set_h264_frame_rate_config(my_vd, framerate);
-							break;
-						}
-						default:
-						{
-							struct timespec req = {
-								.tv_sec = 0,
-								.tv_nsec = (uint32_t) time_sched * 1E6};/*nanosec*/
-							nanosleep(&req, NULL);
-							break;
-						}
-					}
-				}
+				encoder_add_video_frame(input_frame, size, timestamp, frame->isKeyframe);
+			}
+
+			else if(preroll_sec > 0 && get_video_codec_ind() == 0)
+			{
+				/*pre-roll: keep the last direct input frames*/
+				int size = 0;
+				uint8_t *input_frame = get_direct_input_frame(frame, &size);
+
+				/*only h264 has inter frames*/
+				int keyframe = frame->isKeyframe;
+				if(v4l2core_get_requested_frame_format(my_vd) != V4L2_PIX_FMT_H264)
+					keyframe = 1;
+
+				encoder_preroll_add_frame(input_frame, size, frame->timestamp, keyframe);
 			}
 
 			/* render the osd
@@ -1295,6 +1739,10 @@ void *capture_loop(void *data)
 	/*if we are still saving video then stop it*/
 	if(video_capture_get_save_video())
 		stop_encoder_thread();
+	preroll_standby_stop();
+
+	encoder_preroll_close();
+	encoder_motion_trigger_close();
 
 	render_close();
 
@@ -1313,6 +1761,18 @@ void *capture_loop(void *data)
  */
 int start_encoder_thread(void *data)
 {
+	/*the pre-roll standby encoder starts recording*/
+	__LOCK_MUTEX(&preroll_mutex);
+	if(preroll_standby)
+	{
+		encoder_thread = preroll_thread;
+		video_capture_save_video(1);
+		preroll_standby = 0;
+		__UNLOCK_MUTEX(&preroll_mutex);
+		return 0;
+	}
+	__UNLOCK_MUTEX(&preroll_mutex);
+
 	int ret = __THREAD_CREATE(&encoder_thread, encoder_loop, data);
 
 	if(ret)
@@ -38,6 +38,10 @@
 #include <math.h>
 #include <errno.h>
 #include <assert.h>
+#include <time.h>
+#include <limits.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
 /* support for internationalization - i18n */
 #include <locale.h>
 #include <libintl.h>
@@ -51,11 +55,36 @@
   #include "audio_pulseaudio.h"
 #endif
 
-#define AUDBUFF_NUM     80    /*number of audio buffers*/
+#define AUDBUFF_NUM     80    /*min number of audio buffers in the ring*/
 #define AUDBUFF_FRAMES  1152  /*number of audio frames per buffer*/
-static audio_buff_t *audio_buffers = NULL; /*pointer to buffers list*/
-static int buffer_read_index = 0; /*current read index of buffer list*/
-static int buffer_write_index = 0;/*current write index of buffer list*/
+#define AUDRING_SECONDS 2     /*min ring capacity in seconds of audio*/
+
+/*
+ * single producer (capture callback) / single consumer ring
+ * sized in samples, the producer never blocks or takes a lock:
+ * positions are free running sample counters, the capacity is a multiple
+ * of capture_buff_size so a buffer is always contiguous in the ring
+ */
+typedef struct _audio_ring_meta_t
+{
+	int64_t timestamp;     /*buffer begin time*/
+	int64_t drift;         /*generated - real buffer end time*/
+} audio_ring_meta_t;
+
+static sample_t *ring_data = NULL;          /*ring samples*/
+static audio_ring_meta_t *ring_meta = NULL; /*per buffer info*/
+static uint64_t ring_capacity = 0;   /*ring size in samples*/
+static uint64_t ring_write_pos = 0;  /*samples written (producer)*/
+static uint64_t ring_read_pos = 0;   /*samples read (consumer)*/
+static uint64_t ring_overflow_samples = 0; /*samples dropped (ring full)*/
+static uint32_t ring_overflow_events = 0;  /*number of dropped buffers*/
+/*consumer wakeup (futex word): buffer publish counter and waiting flag*/
+static uint32_t ring_futex_seq = 0;
+static uint32_t ring_waiting = 0;
+
+/*drift correction (consumer side)*/
+static sample_t *resample_buff = NULL;  /*resampled buffer (interleaved float)*/
+static int64_t resample_first_ts = -1;  /*timestamp of the first captured buffer*/
 
 int verbosity = 0;
 
@@ -116,26 +145,33 @@ void audio_unlock_mutex(audio_context_t *audio_ctx)
  */
 static void audio_free_buffers()
 {
-	buffer_read_index = 0;
-	buffer_write_index = 0;
-
 	/*return if no buffers set*/
-	if(!audio_buffers)
+	if(!ring_data)
 	{
 		if(verbosity > 0)
-			fprintf(stderr,"AUDIO: can't free audio buffers (audio_free_buffers): audio_buffers is null\n");
+			fprintf(stderr,"AUDIO: can't free audio buffers (audio_free_buffers): ring is null\n");
 		return;
 	}
 
-	int i = 0;
+	if(ring_overflow_events > 0)
+		fprintf(stderr, "AUDIO: ring overflow - dropped %" PRIu64 " samples (%u buffers)\n",
+			ring_overflow_samples, ring_overflow_events);
+
+	free(ring_data);
+	ring_data = NULL;
+	free(ring_meta);
+	ring_meta = NULL;
 
-	for(i = 0; i < AUDBUFF_NUM; ++i)
+	if(resample_buff)
 	{
-		free(audio_buffers[i].data);
+		audio_resample_close();
+		free(resample_buff);
+		resample_buff = NULL;
 	}
 
-	free(audio_buffers);
-	audio_buffers = NULL;
+	ring_capacity = 0;
+	ring_write_pos = 0;
+	ring_read_pos = 0;
 }
 
 /*
@@ -214,12 +250,7 @@ static int audio_init_buffers(audio_context_t *audio_ctx)
 
 	/*don't allocate if no audio*/
 	if(audio_ctx->api == AUDIO_NONE)
-	{
-		audio_buffers = NULL;
 		return 0;
-	}
-	
-	int i = 0;
 
 	/*set the buffers size*/
 	if(!audio_ctx->capture_buff_size)
@@ -236,28 +267,49 @@ static int audio_init_buffers(audio_context_t *audio_ctx)
 		exit(-1);
 	}
 	
-	/*free audio_buffers (if any)*/
-	audio_free_buffers();
+	/*free the ring (if any)*/
+	if(ring_data)
+		audio_free_buffers();
+
+	/*ring capacity: a multiple of the buffer size*/
+	uint64_t buffers = (AUDRING_SECONDS * audio_ctx->samprate * audio_ctx->channels) /
+		audio_ctx->capture_buff_size + 1;
+	if(buffers < AUDBUFF_NUM)
+		buffers = AUDBUFF_NUM;
+
+	ring_capacity = buffers * audio_ctx->capture_buff_size;
 
-	audio_buffers = calloc(AUDBUFF_NUM, sizeof(audio_buff_t));
-	if(audio_buffers == NULL)
+	ring_data = calloc(ring_capacity, sizeof(sample_t));
+	ring_meta = calloc(buffers, sizeof(audio_ring_meta_t));
+	if(ring_data == NULL || ring_meta == NULL)
 	{
 		fprintf(stderr,"AUDIO: FATAL memory allocation failure (audio_init_buffers): %s\n", strerror(errno));
 		exit(-1);
 	}
 
-	for(i = 0; i < AUDBUFF_NUM; ++i)
+	ring_write_pos = 0;
+	ring_read_pos = 0;
+	ring_overflow_samples = 0;
+	ring_overflow_events = 0;
+
+	/*drift correction resampler*/
+	if(audio_ctx->drift_correction &&
+		audio_resample_init(audio_ctx->channels, audio_ctx->samprate,
+			audio_ctx->capture_buff_size / audio_ctx->channels) == 0)
 	{
-		audio_buffers[i].data = calloc(
-			audio_ctx->capture_buff_size, sizeof(sample_t));
-		if(audio_buffers[i].data == NULL)
+		resample_buff = calloc(audio_ctx->capture_buff_size, sizeof(sample_t));
+		if(resample_buff == NULL)
 		{
 			fprintf(stderr,"AUDIO: FATAL memory allocation failure (audio_init_buffers): %s\n", strerror(errno));
 			exit(-1);
 		}
-		audio_buffers[i].flag = AUDIO_BUFF_FREE;
+		resample_first_ts = -1;
 	}
 
+	if(verbosity > 1)
+		printf("AUDIO: ring with %" PRIu64 " samples (%" PRIu64 " buffers)\n",
+			ring_capacity, buffers);
+
 	return 0;
 }
 
@@ -287,45 +339,110 @@ void audio_fill_buffer(audio_context_t *audio_ctx, int64_t ts)
 
 	audio_ctx->ts_drift = audio_ctx->current_ts - ts;
 
-	/*get the current write indexed buffer flag*/
-	audio_lock_mutex(audio_ctx);
-	int flag = audio_buffers[buffer_write_index].flag;
-	audio_unlock_mutex(audio_ctx);
+	/*
+	 * wait free publish: only the producer writes ring_write_pos
+	 * and the consumer only moves ring_read_pos forward
+	 */
+	uint64_t write_pos = ring_write_pos;
+	uint64_t read_pos = __atomic_load_n(&ring_read_pos, __ATOMIC_ACQUIRE);
 
-	if(flag == AUDIO_BUFF_USED)
+	if(ring_capacity - (write_pos - read_pos) < (uint64_t) audio_ctx->capture_buff_size)
 	{
-		fprintf(stderr, "AUDIO: write buffer(%i) is still in use - dropping data\n", buffer_write_index);
+		/*ring is full: drop the data (reported in audio_stop)*/
+		__atomic_add_fetch(&ring_overflow_samples, audio_ctx->capture_buff_size, __ATOMIC_RELAXED);
+		__atomic_add_fetch(&ring_overflow_events, 1, __ATOMIC_RELAXED);
 		return;
 	}
 
+	uint64_t index = write_pos % ring_capacity;
+	audio_ring_meta_t *meta = &ring_meta[index / audio_ctx->capture_buff_size];
+
 	/*write max_frames and fill a buffer*/
-	memcpy(audio_buffers[buffer_write_index].data,
+	memcpy(ring_data + index,
 		audio_ctx->capture_buff,
 		audio_ctx->capture_buff_size * sizeof(sample_t));
 	/*buffer begin time*/
-	audio_buffers[buffer_write_index].timestamp = audio_ctx->current_ts - buffer_length;
-	if(audio_buffers[buffer_write_index].timestamp < 0)
-		fprintf(stderr, "AUDIO: write buffer(%i) - invalid timestamp (< 0): cur_ts:%" PRId64 " buf_length:%" PRId64 "\n", 
-			buffer_write_index, audio_ctx->current_ts, buffer_length);
+	meta->timestamp = audio_ctx->current_ts - buffer_length;
+	meta->drift = audio_ctx->ts_drift;
+	if(meta->timestamp < 0)
+		fprintf(stderr, "AUDIO: write buffer - invalid timestamp (< 0): cur_ts:%" PRId64 " buf_length:%" PRId64 "\n",
+			audio_ctx->current_ts, buffer_length);
+
+	__atomic_store_n(&ring_write_pos, write_pos + audio_ctx->capture_buff_size, __ATOMIC_RELEASE);
+
+	/*wake the consumer (only a syscall if it is actually waiting)*/
+	__atomic_add_fetch(&ring_futex_seq, 1, __ATOMIC_SEQ_CST);
+	if(__atomic_load_n(&ring_waiting, __ATOMIC_SEQ_CST))
+		syscall(SYS_futex, &ring_futex_seq, FUTEX_WAKE_PRIVATE, 1, NULL, NULL, 0);
+}
+
+/*
+ * wait for a captured buffer to be available in the ring
+ * args:
+ *   audio_ctx - pointer to audio context
+ *   timeout_ms - max wait time in ms
+ *
+ * asserts:
+ *   audio_ctx is not null
+ *
+ * returns: 0 if a buffer is available, 1 on timeout
+ */
+int audio_wait_buffer(audio_context_t *audio_ctx, int timeout_ms)
+{
+	/*assertions*/
+	assert(audio_ctx != NULL);
+
+	if(!ring_data)
+	{
+		/*no audio: just honour the timeout*/
+		struct timespec req = {
+			.tv_sec = timeout_ms / 1000,
+			.tv_nsec = (timeout_ms % 1000) * 1000000};
+		nanosleep(&req, NULL);
+		return 1;
+	}
+
+	struct timespec timeout = {
+		.tv_sec = timeout_ms / 1000,
+		.tv_nsec = (timeout_ms % 1000) * 1000000};
+
+	__atomic_store_n(&ring_waiting, 1, __ATOMIC_SEQ_CST);
+	uint32_t seq = __atomic_load_n(&ring_futex_seq, __ATOMIC_SEQ_CST);
+
+	int ret = 0;
+	/*check after announcing the wait so a publish can't be missed*/
+	if(__atomic_load_n(&ring_write_pos, __ATOMIC_ACQUIRE) -
+		ring_read_pos < (uint64_t) audio_ctx->capture_buff_size)
+	{
+		/*sleeps only if no buffer was published since seq was read*/
+		syscall(SYS_futex, &ring_futex_seq, FUTEX_WAIT_PRIVATE, seq, &timeout, NULL, 0);
 
-	audio_buffers[buffer_write_index].level_meter[0] = audio_ctx->capture_buff_level[0];
-	audio_buffers[buffer_write_index].level_meter[1] = audio_ctx->capture_buff_level[1];
+		if(__atomic_load_n(&ring_write_pos, __ATOMIC_ACQUIRE) -
+			ring_read_pos < (uint64_t) audio_ctx->capture_buff_size)
+			ret = 1;
+	}
 
-	audio_lock_mutex(audio_ctx);
-	audio_buffers[buffer_write_index].flag = AUDIO_BUFF_USED;
-	NEXT_IND(buffer_write_index, AUDBUFF_NUM);
-	audio_unlock_mutex(audio_ctx);
+	__atomic_store_n(&ring_waiting, 0, __ATOMIC_SEQ_CST);
 
+	return ret;
 }
 
-/* saturate float samples to int16 limits*/
-static int16_t clip_int16 (float in)
+/*
+ * get the ring overflow count
+ * args:
+ *   audio_ctx - pointer to audio context
+ *
+ * asserts:
+ *   audio_ctx is not null
+ *
+ * returns: number of samples dropped since audio_start (ring full)
+ */
+uint64_t audio_get_overflow_samples(audio_context_t *audio_ctx)
 {
-	//int16_t out = (int16_t) (in < -32768) ? -32768 : (in > 32767) ? 32767 : in;
+	/*assertions*/
+	assert(audio_ctx != NULL);
 
-	long lout =  lroundf(in);
-	int16_t out = (lout < INT16_MIN) ? INT16_MIN : (lout > INT16_MAX) ? INT16_MAX: (int16_t) lout;
-	return (out);
+	return __atomic_load_n(&ring_overflow_samples, __ATOMIC_RELAXED);
 }
 
 /*
@@ -343,88 +460,110 @@ static int16_t clip_int16 (float in)
  */
 int audio_get_next_buffer(audio_context_t *audio_ctx, audio_buff_t *buff, int type, uint32_t mask)
 {
-	audio_lock_mutex(audio_ctx);
-	int flag = audio_buffers[buffer_read_index].flag;
-	audio_unlock_mutex(audio_ctx);
+	if(!ring_data)
+		return 1; /*no audio*/
 
-	if(flag == AUDIO_BUFF_FREE)
-		return 1; /*all done*/
+	int frames = audio_ctx->capture_buff_size / audio_ctx->channels;
 
-	/*aplly fx*/
-	audio_fx_apply(audio_ctx, (sample_t *) audio_buffers[buffer_read_index].data, mask);
-
-	/*copy data into requested format type*/
-	int i = 0;
-	switch(type)
+	/*
+	 * with drift correction the ring buffers go through the resampler
+	 * until it has a full buffer of corrected frames
+	 */
+	while(!resample_buff || audio_resample_pull(resample_buff, frames) != 0)
 	{
-		case GV_SAMPLE_TYPE_FLOAT:
-		{
-			sample_t *my_data = (sample_t *) buff->data;
-			memcpy( my_data, audio_buffers[buffer_read_index].data,
-				audio_ctx->capture_buff_size * sizeof(sample_t));
-			break;
-		}
-		case GV_SAMPLE_TYPE_INT16:
-		{
-			int16_t *my_data = (int16_t *) buff->data;
-			sample_t *buff_p = (sample_t *) audio_buffers[buffer_read_index].data;
-			for(i = 0; i < audio_ctx->capture_buff_size; ++i)
-			{
-				my_data[i] = clip_int16( (buff_p[i]) * INT16_MAX);
-			}
-			break;
-		}
-		case GV_SAMPLE_TYPE_FLOATP:
-		{
-			int j=0;
+		uint64_t read_pos = ring_read_pos;
+		if(__atomic_load_n(&ring_write_pos, __ATOMIC_ACQUIRE) - read_pos <
+			(uint64_t) audio_ctx->capture_buff_size)
+			return 1; /*all done*/
 
-			float *my_data[audio_ctx->channels];
-			sample_t *buff_p = (sample_t *) audio_buffers[buffer_read_index].data;
+		uint64_t index = read_pos % ring_capacity;
+		sample_t *ring_buff = ring_data + index;
+		audio_ring_meta_t *meta = &ring_meta[index / audio_ctx->capture_buff_size];
 
-			for(j = 0; j < audio_ctx->channels; ++j)
-				my_data[j] = (float *) (((float *) buff->data) +
-					(j * audio_ctx->capture_buff_size/audio_ctx->channels));
+		/*aplly fx*/
+		audio_fx_apply(audio_ctx, ring_buff, mask);
 
-			for(i = 0; i < audio_ctx->capture_buff_size/audio_ctx->channels; ++i)
-				for(j = 0; j < audio_ctx->channels; ++j)
-				{
-					my_data[j][i] = *buff_p++;
-				}
-			break;
-		}
-		case GV_SAMPLE_TYPE_INT16P:
+		if(!resample_buff)
 		{
-			int j=0;
+			/*copy data into requested format type and get the channels level*/
+			audio_convert_samples(ring_buff, buff->data, frames,
+				audio_ctx->channels, type, buff->level_meter);
 
-			int16_t *my_data[audio_ctx->channels];
-			sample_t *buff_p = (sample_t *) audio_buffers[buffer_read_index].data;
+			buff->timestamp = meta->timestamp;
 
-			for(j = 0; j < audio_ctx->channels; ++j)
-				my_data[j] = (int16_t *) (((int16_t *) buff->data) +
-					(j * audio_ctx->capture_buff_size/audio_ctx->channels));
+			/*release the buffer to the producer*/
+			__atomic_store_n(&ring_read_pos, read_pos + audio_ctx->capture_buff_size, __ATOMIC_RELEASE);
 
-			for(i = 0; i < audio_ctx->capture_buff_size/audio_ctx->channels; ++i)
-				for(j = 0; j < audio_ctx->channels; ++j)
-				{
-					my_data[j][i] = clip_int16((*buff_p++) * INT16_MAX);
-				}
-			break;
+			return 0;
 		}
-	}
 
-	buff->timestamp = audio_buffers[buffer_read_index].timestamp;
+		if(resample_first_ts < 0)
+			resample_first_ts = meta->timestamp;
 
-	buff->level_meter[0] = audio_buffers[buffer_read_index].level_meter[0];
-	buff->level_meter[1] = audio_buffers[buffer_read_index].level_meter[1];
+		audio_resample_push(ring_buff, frames, meta->drift);
 
-	audio_lock_mutex(audio_ctx);
-	audio_buffers[buffer_read_index].flag = AUDIO_BUFF_FREE;
-	NEXT_IND(buffer_read_index, AUDBUFF_NUM);
-	audio_unlock_mutex(audio_ctx);
+		/*release the buffer to the producer*/
+		__atomic_store_n(&ring_read_pos, read_pos + audio_ctx->capture_buff_size, __ATOMIC_RELEASE);
+	}
+
+	/*copy data into requested format type and get the channels level*/
+	audio_convert_samples(resample_buff, buff->data, frames,
+		audio_ctx->channels, type, buff->level_meter);
+
+	/*corrected frames are locked to the monotonic clock*/
+	audio_drift_stats_t stats;
+	audio_resample_get_stats(&stats);
+	buff->timestamp = resample_first_ts +
+		(int64_t) (((stats.frames_out - frames) * NSEC_PER_SEC) / audio_ctx->samprate);
 
 	return 0;
 }
 
+/*
+ * enable/disable the audio clock drift correction
+ *   (resamples the audio by a few ppm to lock it to the monotonic clock
+ *    used for the video timestamps) - must be set before audio_start
+ * args:
+ *   audio_ctx - pointer to audio context
+ *   enable - 1 enable (default); 0 disable
+ *
+ * asserts:
+ *   audio_ctx is not null
+ *
+ * returns: none
+ */
+void audio_set_drift_correction(audio_context_t *audio_ctx, int enable)
+{
+	/*assertions*/
+	assert(audio_ctx != NULL);
+
+	audio_ctx->drift_correction = enable ? 1 : 0;
+}
+
+/*
+ * get the audio clock drift correction stats
+ * args:
+ *   audio_ctx - pointer to audio context
+ *   stats - pointer to audio_drift_stats_t to fill
+ *
+ * asserts:
+ *   audio_ctx is not null
+ *   stats is not null
+ *
+ * returns: none
+ */
+void audio_get_drift_stats(audio_context_t *audio_ctx, audio_drift_stats_t *stats)
+{
+	/*assertions*/
+	assert(audio_ctx != NULL);
+	assert(stats != NULL);
+
+	if(resample_buff)
+		audio_resample_get_stats(stats);
+	else
+		memset(stats, 0, sizeof(audio_drift_stats_t));
+}
+
 /*
  * audio initialization
  * args:
@@ -449,6 +588,9 @@ audio_context_t *audio_init(int api, int device)
 
 	/*initialize the mutex*/
 	__INIT_MUTEX(&(audio_ctx->mutex));
+
+	/*lock the audio to the video (monotonic) clock*/
+	audio_ctx->drift_correction = 1;
 	
 	int ret = 0;
 
@@ -751,6 +893,10 @@ int audio_start(audio_context_t *audio_ctx)
 
 	/*alloc the ring buffer*/
 	audio_init_buffers(audio_ctx);
+
+	/*preallocate the fx chain (fx can be toggled while capturing)*/
+	if(audio_ctx->api != AUDIO_NONE)
+		audio_fx_init(audio_ctx);
 	
 	/*reset timestamp values*/
 	audio_ctx->current_ts = 0;
@@ -813,7 +959,8 @@ int audio_stop(audio_context_t *audio_ctx)
 	}
 
 	/*free the ring buffer (if any)*/
-	audio_free_buffers();
+	if(ring_data != NULL)
+		audio_free_buffers();
 		
 	return err;
 }
@@ -858,6 +1005,6 @@ void audio_close(audio_context_t *audio_ctx)
 			break;
 	}
 
-	if(audio_buffers != NULL)
+	if(ring_data != NULL)
 		audio_free_buffers();
 }
@@ -49,11 +49,12 @@ struct _audio_context_t
 
 	sample_t *capture_buff;       /*pointer to capture data*/
 	int capture_buff_size;        /*capture buffer size (bytes)*/
-	float capture_buff_level[2];  /*capture buffer channels level*/
 
 	void *stream;                 /*pointer to audio stream (portaudio)*/
 
 	int stream_flag;              /*stream flag*/
+
+	int drift_correction;         /*resample to the monotonic clock (1 - on; 0 - off)*/
 	
 	pthread_mutex_t mutex;       /*audio mutex*/
 
@@ -72,4 +73,101 @@ struct _audio_context_t
  */
 void audio_fill_buffer(audio_context_t *audio_ctx, int64_t ts);
 
+/*
+ * convert interleaved float samples and compute the channels peak level
+ * args:
+ *   in - interleaved float samples
+ *   out - output samples buffer (big enough for frames * channels samples)
+ *   frames - number of frames (samples per channel)
+ *   channels - number of channels
+ *   type - output sample type (GV_SAMPLE_TYPE_[INT16|FLOAT|INT16P|FLOATP])
+ *   level - pointer to store the channels peak level (absolute value)
+ *
+ * asserts:
+ *   in is not null
+ *   out is not null
+ *
+ * returns: none
+ */
+void audio_convert_samples(const sample_t *in, void *out, int frames,
+	int channels, int type, float level[2]);
+
+/*
+ * allocate the audio fx data for the current audio configuration
+ *   (called from audio_start, so that audio_fx_apply never allocates)
+ * args:
+ *   audio_ctx - pointer to audio context
+ *
+ * asserts:
+ *   audio_ctx is not null
+ *
+ * returns: error code (0 ok)
+ */
+int audio_fx_init(audio_context_t *audio_ctx);
+
+/*
+ * init the drift correction resampler
+ * args:
+ *   channels - audio channels
+ *   samprate - sample rate
+ *   frames - frames per buffer
+ *
+ * asserts:
+ *   none
+ *
+ * returns: error code (0 ok)
+ */
+int audio_resample_init(int channels, int samprate, int frames);
+
+/*
+ * close the drift correction resampler
+ * args:
+ *   none
+ *
+ * asserts:
+ *   none
+ *
+ * returns: none
+ */
+void audio_resample_close();
+
+/*
+ * push captured frames into the resampler and update the drift estimation
+ * args:
+ *   in - interleaved float samples
+ *   frames - number of frames
+ *   drift - generated (sample clock) - real (monotonic) buffer end time in ns
+ *
+ * asserts:
+ *   in is not null
+ *
+ * returns: error code (0 ok)
+ */
+int audio_resample_push(const sample_t *in, int frames, int64_t drift);
+
+/*
+ * get resampled frames
+ * args:
+ *   out - interleaved float output buffer
+ *   frames - number of frames to get
+ *
+ * asserts:
+ *   out is not null
+ *
+ * returns: 0 if the frames were written, 1 if more input is needed
+ */
+int audio_resample_pull(sample_t *out, int frames);
+
+/*
+ * get the drift correction stats
+ * args:
+ *   stats - pointer to audio_drift_stats_t to fill
+ *
+ * asserts:
+ *   stats is not null
+ *
+ * returns: none
+ */
+void audio_resample_get_stats(audio_drift_stats_t *stats);
+
 #endif
@@ -0,0 +1,492 @@
+/*******************************************************************************#
+#           guvcview              http://guvcview.sourceforge.net               #
+#                                                                               #
+#           Paulo Assis <pj.assis@gmail.com>                                    #
+#                                                                               #
+# This program is free software; you can redistribute it and/or modify          #
+# it under the terms of the GNU General Public License as published by          #
+# the Free Software Foundation; either version 2 of the License, or             #
+# (at your option) any later version.                                           #
+#                                                                               #
+# This program is distributed in the hope that it will be useful,               #
+# but WITHOUT ANY WARRANTY; without even the implied warranty of                #
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the                 #
+# GNU General Public License for more details.                                  #
+#                                                                               #
+# You should have received a copy of the GNU General Public License             #
+# along with this program; if not, write to the Free Software                   #
+# Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA     #
+#                                                                               #
+********************************************************************************/
+
+/*******************************************************************************#
+#                                                                               #
+#  Audio library - sample format conversion                                     #
+#                                                                               #
+#  float to int16 / planar conversion with the channels peak level computed    #
+#  in the same pass, SIMD kernels are selected at runtime                       #
+#                                                                               #
+********************************************************************************/
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <assert.h>
+
+#include "gviewaudio.h"
+#include "audio.h"
+#include "gview.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+	#include <emmintrin.h>
+	#define HAS_SSE2_KERNELS (1)
+	#define TARGET_SSE2 __attribute__((target("sse2")))
+#endif
+
+extern int verbosity;
+
+typedef void (*convert_func_t)(const sample_t *in, void *out, int frames,
+	int channels, float level[2]);
+
+/*
+ * update the channels peak level with a sample
+ * args:
+ *   level - channels peak level
+ *   chan - sample channel
+ *   sample - sample value
+ *
+ * asserts:
+ *   none
+ *
+ * returns: none
+ */
+static inline void peak_update(float level[2], int chan, float sample)
+{
+	float abs_sample = fabsf(sample);
+	if(chan < 2 && level[chan] < abs_sample)
+		level[chan] = abs_sample;
+}
+
+/*
+ * update the channels peak level with the first two channels of
+ * interleaved samples (strided pass, used by the vector kernels when
+ * the channels don't map to fixed vector lanes)
+ * args:
+ *   in - interleaved float samples
+ *   frames - number of frames (samples per channel)
+ *   channels - number of channels
+ *   level - channels peak level
+ *
+ * asserts:
+ *   none
+ *
+ * returns: none
+ */
+static void peak_scan(const sample_t *in, int frames, int channels, float level[2])
+{
+	int i = 0;
+
+	for(i = 0; i < frames; i++, in += channels)
+	{
+		peak_update(level, 0, in[0]);
+		if(channels > 1)
+			peak_update(level, 1, in[1]);
+	}
+}
+
+/* saturate float samples to int16 limits (round to nearest)*/
+static inline int16_t clip_int16(float in)
+{
+	float out = in * INT16_MAX;
+
+	if(out >= INT16_MAX)
+		return INT16_MAX;
+	if(out <= INT16_MIN)
+		return INT16_MIN;
+
+	return (int16_t) (out < 0 ? out - 0.5f : out + 0.5f);
+}
+
+/*
+ * scalar conversion kernels (any number of channels)
+ * args:
+ *   in - interleaved float samples
+ *   out - output samples (planar data is stored with a frames stride)
+ *   frames - number of frames (samples per channel)
+ *   channels - number of channels
+ *   level - channels peak level (updated)
+ *
+ * asserts:
+ *   none
+ *
+ * returns: none
+ */
+static void convert_float_c(const sample_t *in, void *out, int frames,
+	int channels, float level[2])
+{
+	int i = 0;
+	int samples = frames * channels;
+
+	memcpy(out, in, samples * sizeof(sample_t));
+
+	for(i = 0; i < samples; i++)
+		peak_update(level, i % channels, in[i]);
+}
+
+static void convert_int16_c(const sample_t *in, void *out, int frames,
+	int channels, float level[2])
+{
+	int16_t *out_p = (int16_t *) out;
+	int i = 0;
+	int samples = frames * channels;
+
+	for(i = 0; i < samples; i++)
+	{
+		peak_update(level, i % channels, in[i]);
+		out_p[i] = clip_int16(in[i]);
+	}
+}
+
+static void convert_floatp_c(const sample_t *in, void *out, int frames,
+	int channels, float level[2])
+{
+	int i = 0;
+	int j = 0;
+
+	for(i = 0; i < frames; i++)
+		for(j = 0; j < channels; j++)
+		{
+			peak_update(level, j, *in);
+			((float *) out)[j * frames + i] = *in++;
+		}
+}
+
+static void convert_int16p_c(const sample_t *in, void *out, int frames,
+	int channels, float level[2])
+{
+	int i = 0;
+	int j = 0;
+
+	for(i = 0; i < frames; i++)
+		for(j = 0; j < channels; j++)
+		{
+			peak_update(level, j, *in);
+			((int16_t *) out)[j * frames + i] = clip_int16(*in++);
+		}
+}
+
+#ifdef HAS_SSE2_KERNELS
+
+/*
+ * SSE2 kernels: for mono and stereo each channel peak is kept in its own
+ * vector lanes (interleaved stereo - even lanes left, odd lanes right),
+ * other layouts get the peak level from a strided scalar pass (peak_scan)
+ */
+
+/*store the peak vector lanes into the channels level*/
+TARGET_SSE2 static void peak_store_sse2(__m128 peak, int channels, float level[2])
+{
+	float lanes[4];
+	_mm_storeu_ps(lanes, peak);
+
+	if(channels == 1)
+	{
+		float max = MAX(MAX(lanes[0], lanes[1]), MAX(lanes[2], lanes[3]));
+		if(level[0] < max)
+			level[0] = max;
+	}
+	else
+	{
+		if(level[0] < MAX(lanes[0], lanes[2]))
+			level[0] = MAX(lanes[0], lanes[2]);
+		if(level[1] < MAX(lanes[1], lanes[3]))
+			level[1] = MAX(lanes[1], lanes[3]);
+	}
+}
+
+/*convert 8 float samples into 8 saturated int16*/
+TARGET_SSE2 static __m128i float_to_int16_sse2(__m128 a, __m128 b)
+{
+	const __m128 scale = _mm_set1_ps(INT16_MAX);
+	const __m128 max = _mm_set1_ps(INT16_MAX);
+	const __m128 min = _mm_set1_ps(INT16_MIN);
+
+	/*clamp first: out of range values would convert to INT32_MIN*/
+	a = _mm_max_ps(_mm_min_ps(_mm_mul_ps(a, scale), max), min);
+	b = _mm_max_ps(_mm_min_ps(_mm_mul_ps(b, scale), max), min);
+
+	return _mm_packs_epi32(_mm_cvtps_epi32(a), _mm_cvtps_epi32(b));
+}
+
+TARGET_SSE2 static void convert_float_sse2(const sample_t *in, void *out, int frames,
+	int channels, float level[2])
+{
+	if(channels > 2)
+	{
+		memcpy(out, in, frames * channels * sizeof(sample_t));
+		peak_scan(in, frames, channels, level);
+		return;
+	}
+
+	const __m128 abs_mask = _mm_castsi128_ps(_mm_set1_epi32(0x7FFFFFFF));
+	__m128 peak = _mm_setzero_ps();
+	float *out_p = (float *) out;
+	int samples = frames * channels;
+	int i = 0;
+
+	for(; i + 4 <= samples; i += 4)
+	{
+		__m128 a = _mm_loadu_ps(in + i);
+		peak = _mm_max_ps(peak, _mm_and_ps(a, abs_mask));
+		_mm_storeu_ps(out_p + i, a);
+	}
+
+	peak_store_sse2(peak, channels, level);
+
+	/*4 is a multiple of channels so i % channels is the channel*/
+	for(; i < samples; i++)
+	{
+		peak_update(level, i % channels, in[i]);
+		out_p[i] = in[i];
+	}
+}
+
+TARGET_SSE2 static void convert_int16_sse2(const sample_t *in, void *out, int frames,
+	int channels, float level[2])
+{
+	/*lanes only map to channels for mono and stereo*/
+	int lane_peak = (channels <= 2);
+
+	const __m128 abs_mask = _mm_castsi128_ps(_mm_set1_epi32(0x7FFFFFFF));
+	__m128 peak = _mm_setzero_ps();
+	int16_t *out_p = (int16_t *) out;
+	int samples = frames * channels;
+	int i = 0;
+
+	for(; i + 8 <= samples; i += 8)
+	{
+		__m128 a = _mm_loadu_ps(in + i);
+		__m128 b = _mm_loadu_ps(in + i + 4);
+		peak = _mm_max_ps(peak, _mm_max_ps(_mm_and_ps(a, abs_mask), _mm_and_ps(b, abs_mask)));
+		_mm_storeu_si128((__m128i *) (out_p + i), float_to_int16_sse2(a, b));
+	}
+
+	if(lane_peak)
+		peak_store_sse2(peak, channels, level);
+	else
+		peak_scan(in, frames, channels, level);
+
+	for(; i < samples; i++)
+	{
+		if(lane_peak)
+			peak_update(level, i % channels, in[i]);
+		out_p[i] = clip_int16(in[i]);
+	}
+}
+
+TARGET_SSE2 static void convert_floatp_sse2(const sample_t *in, void *out, int frames,
+	int channels, float level[2])
+{
+	if(channels != 2)
+	{
+		/*mono planar is the same as interleaved*/
+		if(channels == 1)
+			convert_float_sse2(in, out, frames, channels, level);
+		else
+		{
+			/*plain copy (no saturation): only the peak pass changes*/
+			int i = 0;
+			int j = 0;
+			for(j = 0; j < channels; j++)
+				for(i = 0; i < frames; i++)
+					((float *) out)[j * frames + i] = in[i * channels + j];
+			peak_scan(in, frames, channels, level);
+		}
+		return;
+	}
+
+	const __m128 abs_mask = _mm_castsi128_ps(_mm_set1_epi32(0x7FFFFFFF));
+	__m128 peak_l = _mm_setzero_ps();
+	__m128 peak_r = _mm_setzero_ps();
+	float *left = (float *) out;
+	float *right = left + frames;
+	int i = 0;
+
+	for(; i + 4 <= frames; i += 4)
+	{
+		__m128 a = _mm_loadu_ps(in + 2 * i);     /*l0 r0 l1 r1*/
+		__m128 b = _mm_loadu_ps(in + 2 * i + 4); /*l2 r2 l3 r3*/
+		__m128 l = _mm_shuffle_ps(a, b, _MM_SHUFFLE(2, 0, 2, 0));
+		__m128 r = _mm_shuffle_ps(a, b, _MM_SHUFFLE(3, 1, 3, 1));
+
+		peak_l = _mm_max_ps(peak_l, _mm_and_ps(l, abs_mask));
+		peak_r = _mm_max_ps(peak_r, _mm_and_ps(r, abs_mask));
+
+		_mm_storeu_ps(left + i, l);
+		_mm_storeu_ps(right + i, r);
+	}
+
+	/*l l l l r r r r -> l r l r lanes*/
+	peak_store_sse2(_mm_max_ps(_mm_unpacklo_ps(peak_l, peak_r), _mm_unpackhi_ps(peak_l, peak_r)),
+		2, level);
+
+	for(; i < frames; i++)
+	{
+		peak_update(level, 0, in[2 * i]);
+		peak_update(level, 1, in[2 * i + 1]);
+		left[i] = in[2 * i];
+		right[i] = in[2 * i + 1];
+	}
+}
+
+/*int16 planar for any number of channels: strided loads, vector saturation*/
+TARGET_SSE2 static void convert_int16p_strided_sse2(const sample_t *in, void *out, int frames,
+	int channels, float level[2])
+{
+	int j = 0;
+
+	for(j = 0; j < channels; j++)
+	{
+		const sample_t *src = in + j;
+		int16_t *dst = (int16_t *) out + j * frames;
+		int i = 0;
+
+		for(; i + 8 <= frames; i += 8, src += 8 * channels)
+		{
+			__m128 a = _mm_set_ps(src[3 * channels], src[2 * channels], src[channels], src[0]);
+			__m128 b = _mm_set_ps(src[7 * channels], src[6 * channels], src[5 * channels], src[4 * channels]);
+			_mm_storeu_si128((__m128i *) (dst + i), float_to_int16_sse2(a, b));
+		}
+
+		for(; i < frames; i++, src += channels)
+			dst[i] = clip_int16(*src);
+	}
+
+	peak_scan(in, frames, channels, level);
+}
+
+TARGET_SSE2 static void convert_int16p_sse2(const sample_t *in, void *out, int frames,
+	int channels, float level[2])
+{
+	if(channels != 2)
+	{
+		if(channels == 1)
+			convert_int16_sse2(in, out, frames, channels, level);
+		else
+			convert_int16p_strided_sse2(in, out, frames, channels, level);
+		return;
+	}
+
+	const __m128 abs_mask = _mm_castsi128_ps(_mm_set1_epi32(0x7FFFFFFF));
+	__m128 peak_l = _mm_setzero_ps();
+	__m128 peak_r = _mm_setzero_ps();
+	int16_t *left = (int16_t *) out;
+	int16_t *right = left + frames;
+	int i = 0;
+
+	for(; i + 8 <= frames; i += 8)
+	{
+		__m128 a = _mm_loadu_ps(in + 2 * i);
+		__m128 b = _mm_loadu_ps(in + 2 * i + 4);
+		__m128 c = _mm_loadu_ps(in + 2 * i + 8);
+		__m128 d = _mm_loadu_ps(in + 2 * i + 12);
+		__m128 l0 = _mm_shuffle_ps(a, b, _MM_SHUFFLE(2, 0, 2, 0));
+		__m128 r0 = _mm_shuffle_ps(a, b, _MM_SHUFFLE(3, 1, 3, 1));
+		__m128 l1 = _mm_shuffle_ps(c, d, _MM_SHUFFLE(2, 0, 2, 0));
+		__m128 r1 = _mm_shuffle_ps(c, d, _MM_SHUFFLE(3, 1, 3, 1));
+
+		peak_l = _mm_max_ps(peak_l, _mm_max_ps(_mm_and_ps(l0, abs_mask), _mm_and_ps(l1, abs_mask)));
+		peak_r = _mm_max_ps(peak_r, _mm_max_ps(_mm_and_ps(r0, abs_mask), _mm_and_ps(r1, abs_mask)));
+
+		_mm_storeu_si128((__m128i *) (left + i), float_to_int16_sse2(l0, l1));
+		_mm_storeu_si128((__m128i *) (right + i), float_to_int16_sse2(r0, r1));
+	}
+
+	peak_store_sse2(_mm_max_ps(_mm_unpacklo_ps(peak_l, peak_r), _mm_unpackhi_ps(peak_l, peak_r)),
+		2, level);
+
+	for(; i < frames; i++)
+	{
+		peak_update(level, 0, in[2 * i]);
+		peak_update(level, 1, in[2 * i + 1]);
+		left[i] = clip_int16(in[2 * i]);
+		right[i] = clip_int16(in[2 * i + 1]);
+	}
+}
+
+#endif /*HAS_SSE2_KERNELS*/
+
+/*conversion kernels indexed by GV_SAMPLE_TYPE_*/
+static convert_func_t convert_funcs[4] = {NULL, NULL, NULL, NULL};
+
+/*
+ * select the conversion kernels for the running cpu
+ * args:
+ *   none
+ *
+ * asserts:
+ *   none
+ *
+ * returns: none
+ */
+static void audio_convert_init()
+{
+	convert_funcs[GV_SAMPLE_TYPE_INT16] = convert_int16_c;
+	convert_funcs[GV_SAMPLE_TYPE_FLOAT] = convert_float_c;
+	convert_funcs[GV_SAMPLE_TYPE_INT16P] = convert_int16p_c;
+	convert_funcs[GV_SAMPLE_TYPE_FLOATP] = convert_floatp_c;
+
+#ifdef HAS_SSE2_KERNELS
+	__builtin_cpu_init();
+	if(__builtin_cpu_supports("sse2"))
+	{
+		convert_funcs[GV_SAMPLE_TYPE_INT16] = convert_int16_sse2;
+		convert_funcs[GV_SAMPLE_TYPE_FLOAT] = convert_float_sse2;
+		convert_funcs[GV_SAMPLE_TYPE_INT16P] = convert_int16p_sse2;
+		convert_funcs[GV_SAMPLE_TYPE_FLOATP] = convert_floatp_sse2;
+
+		if(verbosity > 1)
+			printf("AUDIO: using SSE2 sample conversion\n");
+	}
+#endif
+}
+
+/*
+ * convert interleaved float samples and compute the channels peak level
+ * args:
+ *   in - interleaved float samples
+ *   out - output samples buffer (big enough for frames * channels samples)
+ *   frames - number of frames (samples per channel)
+ *   channels - number of channels
+ *   type - output sample type (GV_SAMPLE_TYPE_[INT16|FLOAT|INT16P|FLOATP])
+ *   level - pointer to store the channels peak level (absolute value)
+ *
+ * asserts:
+ *   in is not null
+ *   out is not null
+ *
+ * returns: none
+ */
+void audio_convert_samples(const sample_t *in, void *out, int frames,
+	int channels, int type, float level[2])
+{
+	/*asserts*/
+	assert(in != NULL);
+	assert(out != NULL);
+
+	/*the audio thread is the only caller, no race on init*/
+	if(convert_funcs[0] == NULL)
+		audio_convert_init();
+
+	level[0] = 0;
+	level[1] = 0;
+
+	if(type < 0 || type > 3)
+	{
+		fprintf(stderr, "AUDIO: (audio_convert_samples) invalid sample type %i\n", type);
+		return;
+	}
+
+	convert_funcs[type](in, out, frames, channels, level);
+}
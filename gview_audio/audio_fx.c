@@ -32,6 +32,10 @@
 #include <locale.h>
 #include <libintl.h>
 
+#ifdef __SSE2__
+	#include <emmintrin.h>
+#endif
+
 #include "../config.h"
 #include "gviewaudio.h"
 #include "audio.h"
@@ -43,15 +47,35 @@
 
 extern int verbosity;
 
+/*
+ * all fx state is allocated by audio_fx_init (at audio_start)
+ * so that toggling fx while capturing never allocates on the audio thread;
+ * the buffer is processed in blocks of FX_BLOCK_FRAMES through all the
+ * enabled fx (the block stays in cache between fx)
+ */
+#define FX_BLOCK_FRAMES (256)
+
+/*fx parameters*/
+#define FX_ECHO_DELAY_MS    (300)
+#define FX_ECHO_DECAY       (0.5f)
+#define FX_REVERB_DELAY_MS  (50)
+#define FX_FUZZ_HPF_FREQ    (1000)
+#define FX_FILT_RES         (0.9f)
+#define FX_PITCH_RATE       (2)
+#define FX_PITCH_WINDOW_MS  (20)
+
 /*----------- structs for audio effects ------------*/
 
-/*data for Butterworth filter (LP or HP)*/
+/*
+ * Butterworth filter (LP or HP) - one lane per channel (max 4)
+ * out(n) = a1 * in + a2 * in(n-1) + a3 * in(n-2) - b1*out(n-1) - b2*out(n-2)
+ */
 typedef struct _fx_filt_data_t
 {
-	sample_t buff_in1[2];
-	sample_t buff_in2[2];
-	sample_t buff_out1[2];
-	sample_t buff_out2[2];
+	float in1[4];  /*in(n-1)*/
+	float in2[4];  /*in(n-2)*/
+	float out1[4]; /*out(n-1)*/
+	float out2[4]; /*out(n-2)*/
 	float c;
 	float a1;
 	float a2;
@@ -60,36 +84,16 @@ typedef struct _fx_filt_data_t
 	float b2;
 } fx_filt_data_t;
 
-/*data for Comb4 filter*/
-typedef struct _fx_comb4_data_t
-{
-	int buff_size1;
-	int buff_size2;
-	int buff_size3;
-	int buff_size4;
-
-	sample_t *CombBuff10; // four parallel  comb filters - first channel
-	sample_t *CombBuff11; // four parallel comb filters - second channel
-	sample_t *CombBuff20; // four parallel  comb filters - first channel
-	sample_t *CombBuff21; // four parallel comb filters - second channel
-	sample_t *CombBuff30; // four parallel  comb filters - first channel
-	sample_t *CombBuff31; // four parallel comb filters - second channel
-	sample_t *CombBuff40; // four parallel  comb filters - first channel
-	sample_t *CombBuff41; // four parallel comb filters - second channel
-
-	int CombIndex1; //comb filter 1 index
-	int CombIndex2; //comb filter 2 index
-	int CombIndex3; //comb filter 3 index
-	int CombIndex4; //comb filter 4 index
-} fx_comb4_data_t;
-
-/* data for delay*/
+/*
+ * delay line (echo, comb and all pass filters)
+ * samples are interleaved like the audio buffer
+ */
 typedef struct _fx_delay_data_t
 {
-	int buff_size;
-	sample_t *delayBuff1; // delay buffer 1 - first channel
-	sample_t *delayBuff2; // delay buffer 2 - second channel (stereo)
-	int delayIndex; // delay buffer index
+	int buff_size;     /*delay size in samples (frames * channels)*/
+	sample_t *buff;    /*delay buffer*/
+	int index;         /*delay buffer index*/
+	float gain;        /*feedback gain*/
 } fx_delay_data_t;
 
 /* data for WahWah effect*/
@@ -122,50 +126,108 @@ typedef struct _fx_rate_data_t
 
 typedef struct _audio_fx_t
 {
-	fx_delay_data_t *ECHO;
-	fx_delay_data_t *AP1;
-	fx_comb4_data_t *COMB4;
-	fx_filt_data_t  *HPF;
-	fx_filt_data_t  *LPF1;
-	fx_rate_data_t  *RT1;
-	fx_wah_data_t   *wahData;
+	/*configuration the fx data was allocated for*/
+	int channels;
+	int samprate;
+	int buff_size;
+
+	uint32_t mask;           /*last applied fx mask*/
+
+	fx_delay_data_t ECHO;
+	fx_delay_data_t COMB4[4]; /*four parallel comb filters*/
+	float comb_in_gain;
+	fx_delay_data_t AP1;
+	fx_filt_data_t  HPF;
+	fx_filt_data_t  LPF1;
+	fx_rate_data_t  RT1;
+	fx_wah_data_t   wahData;
+
+	sample_t *block_acc;     /*comb filters accumulator (one block)*/
 } audio_fx_t;
 
 /*audio fx data*/
 static audio_fx_t *aud_fx = NULL;
 
 /*
- * initialize audio fx data
+ * allocate a zeroed sample buffer
  * args:
- *    none
+ *   size - number of samples
  *
  * asserts:
- *    none
+ *   none
  *
- * returns: none
+ * returns: pointer to buffer
  */
-static void audio_fx_init ()
+static sample_t *fx_alloc_samples(int size)
 {
-	aud_fx = calloc(1, sizeof(audio_fx_t));
-	if(aud_fx == NULL)
+	sample_t *buff = calloc(size > 0 ? size : 1, sizeof(sample_t));
+	if(buff == NULL)
 	{
 		fprintf(stderr,"AUDIO: FATAL memory allocation failure (audio_fx_init): %s\n", strerror(errno));
 		exit(-1);
 	}
-	/*Echo effect data */
-	aud_fx->ECHO = NULL;
-	/* 4 parallel comb filters data*/
-	aud_fx->COMB4 = NULL;
-	/*all pass 1 filter data*/
-	aud_fx->AP1 = NULL;
-	/*WahWah effect data*/
-	aud_fx->wahData = NULL;
-	/*high pass filter data*/
-	aud_fx->HPF = NULL;
-	/*rate transposer*/
-	aud_fx->RT1 = NULL;
-	/*low pass filter*/
-	aud_fx->LPF1 = NULL;
+	return buff;
+}
+
+/*
+ * init a delay line
+ * args:
+ *   DELAY - pointer to fx_delay_data_t
+ *   delay_ms - delay in ms
+ *   gain - feedback gain
+ *   samprate - sample rate
+ *   channels - audio channels
+ *
+ * asserts:
+ *   none
+ *
+ * returns: none
+ */
+static void init_DELAY(fx_delay_data_t *DELAY, int delay_ms, float gain,
+	int samprate, int channels)
+{
+	int frames = (int) delay_ms * (samprate * 0.001);
+	if(frames < 1)
+		frames = 1;
+
+	DELAY->buff_size = frames * channels;
+	DELAY->buff = fx_alloc_samples(DELAY->buff_size);
+	DELAY->index = 0;
+	DELAY->gain = gain;
+}
+
+/*
+ * reset a delay line (silence)
+ * args:
+ *   DELAY - pointer to fx_delay_data_t
+ *
+ * asserts:
+ *   none
+ *
+ * returns: none
+ */
+static void reset_DELAY(fx_delay_data_t *DELAY)
+{
+	memset(DELAY->buff, 0, DELAY->buff_size * sizeof(sample_t));
+	DELAY->index = 0;
+}
+
+/*
+ * reset a filter state
+ * args:
+ *   FILT - pointer to fx_filt_data_t
+ *
+ * asserts:
+ *   none
+ *
+ * returns: none
+ */
+static void reset_FILT(fx_filt_data_t *FILT)
+{
+	memset(FILT->in1, 0, sizeof(FILT->in1));
+	memset(FILT->in2, 0, sizeof(FILT->in2));
+	memset(FILT->out1, 0, sizeof(FILT->out1));
+	memset(FILT->out2, 0, sizeof(FILT->out2));
 }
 
 /*
@@ -185,14 +247,29 @@ static float clip_float (float in)
 	return in;
 }
 
+#ifdef __SSE2__
+/* clip 4 float samples [-1.0 ; 1.0]*/
+static inline __m128 clip_float_sse2(__m128 in)
+{
+	return _mm_max_ps(_mm_min_ps(in, _mm_set1_ps(1.0f)), _mm_set1_ps(-1.0f));
+}
+#endif
+
 /*
  * Butterworth Filter for HP or LP
  * out(n) = a1 * in + a2 * in(n-1) + a3 * in(n-2) - b1*out(n-1) - b2*out(n-2)
+ *   the channels are processed in parallel (one SIMD lane each),
+ *   only the first 4 channels are filtered (filter state has 4 lanes)
  * args:
  *   FILT - pointer to fx_filt_data_t
  *   Buff - sampe buffer
  *   NumSamples - samples in buffer
  *   channels - number of audio channels
+ *
+ * asserts:
+ *   none
+ *
+ * returns: none
  */
 static void Butt(fx_filt_data_t *FILT,
 	sample_t *Buff,
@@ -201,35 +278,76 @@ static void Butt(fx_filt_data_t *FILT,
 {
 	int index = 0;
 
-	for (index = 0; index < NumSamples; index = index + channels)
+	/*filtered channels (the frame stride is always channels)*/
+	int lanes = MIN(channels, 4);
+
+#ifdef __SSE2__
+	if(lanes != 3)
 	{
-		sample_t out = FILT->a1 * Buff[index] + FILT->a2 * FILT->buff_in1[0] +
-			FILT->a3 * FILT->buff_in1[1] - FILT->b1 * FILT->buff_out1[0] -
-			FILT->b2 * FILT->buff_out1[1];
-		FILT->buff_in1[1] = FILT->buff_in1[0]; //in(n-2) = in(n-1)
-		FILT->buff_in1[0] = Buff[index]; // in(n-1) = in
-		FILT->buff_out1[1] = FILT->buff_out1[0]; //out(n-2) = out(n-1)
-		FILT->buff_out1[0] = out; //out(n-1) = out
-
-		Buff[index] = clip_float(out);
-		/*process second channel*/
-		if(channels > 1)
+		__m128 a1 = _mm_set1_ps(FILT->a1);
+		__m128 a2 = _mm_set1_ps(FILT->a2);
+		__m128 a3 = _mm_set1_ps(FILT->a3);
+		__m128 b1 = _mm_set1_ps(FILT->b1);
+		__m128 b2 = _mm_set1_ps(FILT->b2);
+
+		__m128 in1 = _mm_loadu_ps(FILT->in1);
+		__m128 in2 = _mm_loadu_ps(FILT->in2);
+		__m128 out1 = _mm_loadu_ps(FILT->out1);
+		__m128 out2 = _mm_loadu_ps(FILT->out2);
+
+		for (index = 0; index + channels <= NumSamples; index += channels)
+		{
+			__m128 in = (lanes == 4) ? _mm_loadu_ps(Buff + index) :
+				(lanes == 2) ? _mm_castpd_ps(_mm_load_sd((const double *) (Buff + index))) :
+				_mm_load_ss(Buff + index);
+
+			__m128 out = _mm_sub_ps(
+				_mm_add_ps(_mm_add_ps(_mm_mul_ps(a1, in), _mm_mul_ps(a2, in1)), _mm_mul_ps(a3, in2)),
+				_mm_add_ps(_mm_mul_ps(b1, out1), _mm_mul_ps(b2, out2)));
+
+			in2 = in1;
+			in1 = in;
+			out2 = out1;
+			out1 = out;
+
+			out = clip_float_sse2(out);
+			if(lanes == 4)
+				_mm_storeu_ps(Buff + index, out);
+			else if(lanes == 2)
+				_mm_store_sd((double *) (Buff + index), _mm_castps_pd(out));
+			else
+				_mm_store_ss(Buff + index, out);
+		}
+
+		_mm_storeu_ps(FILT->in1, in1);
+		_mm_storeu_ps(FILT->in2, in2);
+		_mm_storeu_ps(FILT->out1, out1);
+		_mm_storeu_ps(FILT->out2, out2);
+		return;
+	}
+#endif
+
+	for (index = 0; index + channels <= NumSamples; index += channels)
+	{
+		int ch = 0;
+		for(ch = 0; ch < lanes; ch++)
 		{
-			out = FILT->a1 * Buff[index+1] + FILT->a2 * FILT->buff_in2[0] +
-				FILT->a3 * FILT->buff_in2[1] - FILT->b1 * FILT->buff_out2[0] -
-				FILT->b2 * FILT->buff_out2[1];
-			FILT->buff_in2[1] = FILT->buff_in2[0]; //in(n-2) = in(n-1)
-			FILT->buff_in2[0] = Buff[index+1]; // in(n-1) = in
-			FILT->buff_out2[1] = FILT->buff_out2[0]; //out(n-2) = out(n-1)
-			FILT->buff_out2[0] = out; //out(n-1) = out
-
-			Buff[index+1] = clip_float(out);
+			sample_t in = Buff[index + ch];
+			sample_t out = FILT->a1 * in + FILT->a2 * FILT->in1[ch] +
+				FILT->a3 * FILT->in2[ch] - FILT->b1 * FILT->out1[ch] -
+				FILT->b2 * FILT->out2[ch];
+			FILT->in2[ch] = FILT->in1[ch]; //in(n-2) = in(n-1)
+			FILT->in1[ch] = in; // in(n-1) = in
+			FILT->out2[ch] = FILT->out1[ch]; //out(n-2) = out(n-1)
+			FILT->out1[ch] = out; //out(n-1) = out
+
+			Buff[index + ch] = clip_float(out);
 		}
 	}
 }
 
 /*
- * HP Filter: out(n) = a1 * in + a2 * in(n-1) + a3 * in(n-2) - b1*out(n-1) - b2*out(n-2)
+ * HP Filter coeficients: out(n) = a1 * in + a2 * in(n-1) + a3 * in(n-2) - b1*out(n-1) - b2*out(n-2)
  * f - cuttof freq., from ~0 Hz to SampleRate/2 - though many synths seem to filter only  up to SampleRate/4
  * r  = rez amount, from sqrt(2) to ~ 0.1
  *
@@ -240,8 +358,8 @@ static void Butt(fx_filt_data_t *FILT,
  *  b1 = 2.0 * ( c*c - 1.0) * a1;
  *  b2 = ( 1.0 - r * c + c * c) * a1;
  * args:
- *   audio_ctx - pointer to audio context
- *   data -pointer to audio buffer to be processed
+ *   FILT - pointer to fx_filt_data_t
+ *   samprate - sample rate
  *   cutoff_freq - filter cut off frequency
  *   res - rez amount
  *
@@ -250,33 +368,24 @@ static void Butt(fx_filt_data_t *FILT,
  *
  * returns: none
  */
-static void HPF(audio_context_t *audio_ctx,
-	sample_t *data,
+static void init_HPF(fx_filt_data_t *FILT,
+	int samprate,
 	int cutoff_freq,
 	float res)
 {
-	if(aud_fx->HPF == NULL)
-	{
-		float inv_samprate = 1.0 / audio_ctx->samprate;
-		aud_fx->HPF = calloc(1, sizeof(fx_filt_data_t));
-		if(aud_fx->HPF == NULL)
-		{
-			fprintf(stderr,"AUDIO: FATAL memory allocation failure (HPF): %s\n", strerror(errno));
-			exit(-1);
-		}
-		aud_fx->HPF->c = tan(M_PI * cutoff_freq * inv_samprate);
-		aud_fx->HPF->a1 = 1.0 / (1.0 + (res * aud_fx->HPF->c) + (aud_fx->HPF->c * aud_fx->HPF->c));
-		aud_fx->HPF->a2 = -2.0 * aud_fx->HPF->a1;
-		aud_fx->HPF->a3 = aud_fx->HPF->a1;
-		aud_fx->HPF->b1 = 2.0 * ((aud_fx->HPF->c * aud_fx->HPF->c) - 1.0) * aud_fx->HPF->a1;
-		aud_fx->HPF->b2 = (1.0 - (res * aud_fx->HPF->c) + (aud_fx->HPF->c * aud_fx->HPF->c)) * aud_fx->HPF->a1;
-	}
-
-	Butt(aud_fx->HPF, data, audio_ctx->capture_buff_size, audio_ctx->channels);
+	float inv_samprate = 1.0 / samprate;
+
+	reset_FILT(FILT);
+	FILT->c = tan(M_PI * cutoff_freq * inv_samprate);
+	FILT->a1 = 1.0 / (1.0 + (res * FILT->c) + (FILT->c * FILT->c));
+	FILT->a2 = -2.0 * FILT->a1;
+	FILT->a3 = FILT->a1;
+	FILT->b1 = 2.0 * ((FILT->c * FILT->c) - 1.0) * FILT->a1;
+	FILT->b2 = (1.0 - (res * FILT->c) + (FILT->c * FILT->c)) * FILT->a1;
 }
 
 /*
- * LP Filter: out(n) = a1 * in + a2 * in(n-1) + a3 * in(n-2) - b1*out(n-1) - b2*out(n-2)
+ * LP Filter coeficients: out(n) = a1 * in + a2 * in(n-1) + a3 * in(n-2) - b1*out(n-1) - b2*out(n-2)
  * f - cuttof freq., from ~0 Hz to SampleRate/2 -
  *     though many synths seem to filter only  up to SampleRate/4
  * r  = rez amount, from sqrt(2) to ~ 0.1
@@ -289,8 +398,8 @@ static void HPF(audio_context_t *audio_ctx,
  * b2 = ( 1.0 - r * c + c * c) * a1;
  *
  * args:
- *   audio_ctx - pointer to audio context
- *   data -pointer to audio buffer to be processed
+ *   FILT - pointer to fx_filt_data_t
+ *   samprate - sample rate
  *   cutoff_freq - filter cut off frequency
  *   res - rez amount
  *
@@ -299,304 +408,271 @@ static void HPF(audio_context_t *audio_ctx,
  *
  * returns: none
  */
-static void LPF(audio_context_t *audio_ctx,
-	sample_t *data,
+static void init_LPF(fx_filt_data_t *FILT,
+	int samprate,
 	float cutoff_freq,
 	float res)
 {
-	if(aud_fx->LPF1 == NULL)
+	reset_FILT(FILT);
+	FILT->c = 1.0 / tan(M_PI * cutoff_freq / samprate);
+	FILT->a1 = 1.0 / (1.0 + (res * FILT->c) + (FILT->c * FILT->c));
+	FILT->a2 = 2.0 * FILT->a1;
+	FILT->a3 = FILT->a1;
+	FILT->b1 = 2.0 * (1.0 - (FILT->c * FILT->c)) * FILT->a1;
+	FILT->b2 = (1.0 - (res * FILT->c) + (FILT->c * FILT->c)) * FILT->a1;
+}
+
+/*
+ * Non-linear amplifier with soft distortion curve (4 times)
+ *   in < 0:  out = (in + 1)^3 - 1
+ *   in >= 0: out = (in - 1)^3 + 1
+ * args:
+ *   data - sample buffer
+ *   NumSamples - samples in buffer
+ *
+ * asserts:
+ *   none
+ *
+ * returns: none
+ */
+static void fuzz_amplifier(sample_t *data, int NumSamples)
+{
+	int samp = 0;
+
+#ifdef __SSE2__
+	const __m128 one = _mm_set1_ps(1.0f);
+	const __m128 sign_bit = _mm_set1_ps(-0.0f);
+	for(; samp + 4 <= NumSamples; samp += 4)
 	{
-		aud_fx->LPF1 = calloc(1, sizeof(fx_filt_data_t));
-		if(aud_fx->LPF1 == NULL)
+		__m128 x = _mm_loadu_ps(data + samp);
+		int n = 0;
+		for(n = 0; n < 4; n++)
 		{
-			fprintf(stderr,"AUDIO: FATAL memory allocation failure (LPF): %s\n", strerror(errno));
-			exit(-1);
+			/*s = in < 0 ? -1 : 1 ; out = (in - s)^3 + s*/
+			__m128 neg = _mm_cmplt_ps(x, _mm_setzero_ps());
+			__m128 s = _mm_or_ps(one, _mm_and_ps(neg, sign_bit));
+			__m128 t = _mm_sub_ps(x, s);
+			x = clip_float_sse2(_mm_add_ps(_mm_mul_ps(_mm_mul_ps(t, t), t), s));
 		}
-		aud_fx->LPF1->c = 1.0 / tan(M_PI * cutoff_freq / audio_ctx->samprate);
-		aud_fx->LPF1->a1 = 1.0 / (1.0 + (res * aud_fx->LPF1->c) + (aud_fx->LPF1->c * aud_fx->LPF1->c));
-		aud_fx->LPF1->a2 = 2.0 * aud_fx->LPF1->a1;
-		aud_fx->LPF1->a3 = aud_fx->LPF1->a1;
-		aud_fx->LPF1->b1 = 2.0 * (1.0 - (aud_fx->LPF1->c * aud_fx->LPF1->c)) * aud_fx->LPF1->a1;
-		aud_fx->LPF1->b2 = (1.0 - (res * aud_fx->LPF1->c) + (aud_fx->LPF1->c * aud_fx->LPF1->c)) * aud_fx->LPF1->a1;
+		_mm_storeu_ps(data + samp, x);
 	}
+#endif
 
-	Butt(aud_fx->LPF1, data, audio_ctx->capture_buff_size, audio_ctx->channels);
+	for(; samp < NumSamples; samp++)
+	{
+		sample_t x = data[samp];
+		int n = 0;
+		for(n = 0; n < 4; n++)
+		{
+			float temp = (x < 0) ? x + 1.0f : x - 1.0f;
+			x = clip_float((x < 0) ? (temp * temp * temp) - 1.0f : (temp * temp * temp) + 1.0f);
+		}
+		data[samp] = x;
+	}
 }
 
-/* Non-linear amplifier with soft distortion curve.
+/*
+ * get the length of the next contiguous run in a delay line
+ *   each delay sample is used only once in a run (run <= buff_size)
+ *   so all samples in a run are independent and can be vectorized
  * args:
- *   input - sample input
+ *   DELAY - pointer to fx_delay_data_t
+ *   remaining - remaining samples to process
  *
  * asserts:
  *   none
  *
- * returns: processed sample
+ * returns: run length in samples
  */
-static sample_t CubicAmplifier( sample_t input )
+static inline int delay_run(fx_delay_data_t *DELAY, int remaining)
 {
-	sample_t out;
-	float temp;
-	if( input < 0 ) /*silence*/
-	{
+	int run = DELAY->buff_size - DELAY->index;
+	return (run < remaining) ? run : remaining;
+}
 
-		temp = input + 1.0f;
-		out = (temp * temp * temp) - 1.0f;
-	}
-	else
-	{
-		temp = input - 1.0f;
-		out = (temp * temp * temp) + 1.0f;
-	}
-	return clip_float(out);
+/*
+ * advance a delay line index
+ * args:
+ *   DELAY - pointer to fx_delay_data_t
+ *   run - number of processed samples
+ *
+ * asserts:
+ *   none
+ *
+ * returns: none
+ */
+static inline void delay_advance(fx_delay_data_t *DELAY, int run)
+{
+	DELAY->index += run;
+	if(DELAY->index >= DELAY->buff_size)
+		DELAY->index = 0;
 }
 
 /*
- * four paralell Comb filters for reverb
+ * Echo effect
+ *   out = 0.7 * in + 0.3 * delay ; delay = in + delay * decay
  * args:
- *   audio_ctx - audio context
+ *   ECHO - pointer to echo delay line
  *   data - audio buffer to be processed
- *   delay1_ms - delay for filter 1
- *   delay2_ms - delay for filter 2
- *   delay3_ms - delay for filter 3
- *   delay4_ms - delay for filter 4
- *   gain1 - feed gain for filter 1
- *   gain2 - feed gain for filter 2
- *   gain3 - feed gain for filter 3
- *   gain4 - feed gain for filter 4
- *   in_gain - input line gain
+ *   NumSamples - samples in buffer
  *
  * asserts:
  *   none
  *
  * returns: none
  */
-static void CombFilter4 (audio_context_t *audio_ctx,
+static void audio_fx_echo(fx_delay_data_t *ECHO,
 	sample_t *data,
-	int delay1_ms,
-	int delay2_ms,
-	int delay3_ms,
-	int delay4_ms,
-	float gain1,
-	float gain2,
-	float gain3,
-	float gain4,
-	float in_gain)
+	int NumSamples)
 {
-	int samp=0;
-	/*buff_size in samples*/
-
-	if (aud_fx->COMB4 == NULL)
+	int done = 0;
+	while(done < NumSamples)
 	{
-		aud_fx->COMB4 = calloc(1, sizeof(fx_comb4_data_t));
-		if(aud_fx->COMB4 == NULL)
-		{
-			fprintf(stderr,"AUDIO: FATAL memory allocation failure (CombFilter4): %s\n", strerror(errno));
-			exit(-1);
-		}
-		/*buff_size in samples*/
-		aud_fx->COMB4->buff_size1 = (int) delay1_ms * (audio_ctx->samprate * 0.001);
-		aud_fx->COMB4->buff_size2 = (int) delay2_ms * (audio_ctx->samprate * 0.001);
-		aud_fx->COMB4->buff_size3 = (int) delay3_ms * (audio_ctx->samprate * 0.001);
-		aud_fx->COMB4->buff_size4 = (int) delay4_ms * (audio_ctx->samprate * 0.001);
-
-		aud_fx->COMB4->CombBuff10 = calloc(aud_fx->COMB4->buff_size1, sizeof(sample_t));
-		if(aud_fx->COMB4->CombBuff10 == NULL)
-		{
-			fprintf(stderr,"AUDIO: FATAL memory allocation failure (CombFilter4): %s\n", strerror(errno));
-			exit(-1);
-		}
-		aud_fx->COMB4->CombBuff20 = calloc(aud_fx->COMB4->buff_size2, sizeof(sample_t));
-		if(aud_fx->COMB4->CombBuff20 == NULL)
-		{
-			fprintf(stderr,"AUDIO: FATAL memory allocation failure (CombFilter4): %s\n", strerror(errno));
-			exit(-1);
-		}
-		aud_fx->COMB4->CombBuff30 = calloc(aud_fx->COMB4->buff_size3, sizeof(sample_t));
-		if(aud_fx->COMB4->CombBuff30 == NULL)
-		{
-			fprintf(stderr,"AUDIO: FATAL memory allocation failure (CombFilter4): %s\n", strerror(errno));
-			exit(-1);
-		}
-		aud_fx->COMB4->CombBuff40 = calloc(aud_fx->COMB4->buff_size4, sizeof(sample_t));
-		if(aud_fx->COMB4->CombBuff40 == NULL)
-		{
-			fprintf(stderr,"AUDIO: FATAL memory allocation failure (CombFilter4): %s\n", strerror(errno));
-			exit(-1);
-		}
-		aud_fx->COMB4->CombBuff11 = NULL;
-		aud_fx->COMB4->CombBuff21 = NULL;
-		aud_fx->COMB4->CombBuff31 = NULL;
-		aud_fx->COMB4->CombBuff41 = NULL;
-		if(audio_ctx->channels > 1)
+		int run = delay_run(ECHO, NumSamples - done);
+		sample_t *x = data + done;
+		sample_t *d = ECHO->buff + ECHO->index;
+		int i = 0;
+
+#ifdef __SSE2__
+		const __m128 g_in = _mm_set1_ps(0.7f);
+		const __m128 g_delay = _mm_set1_ps(0.3f);
+		const __m128 decay = _mm_set1_ps(ECHO->gain);
+		for(; i + 4 <= run; i += 4)
 		{
-			aud_fx->COMB4->CombBuff11 = calloc(aud_fx->COMB4->buff_size1, sizeof(sample_t));
-			if(aud_fx->COMB4->CombBuff11 == NULL)
-			{
-				fprintf(stderr,"AUDIO: FATAL memory allocation failure (CombFilter4): %s\n", strerror(errno));
-				exit(-1);
-			}
-			aud_fx->COMB4->CombBuff21 = calloc(aud_fx->COMB4->buff_size2, sizeof(sample_t));
-			if(aud_fx->COMB4->CombBuff21 == NULL)
-			{
-				fprintf(stderr,"AUDIO: FATAL memory allocation failure (CombFilter4): %s\n", strerror(errno));
-				exit(-1);
-			}
-			aud_fx->COMB4->CombBuff31 = calloc(aud_fx->COMB4->buff_size3, sizeof(sample_t));
-			if(aud_fx->COMB4->CombBuff31 == NULL)
-			{
-				fprintf(stderr,"AUDIO: FATAL memory allocation failure (CombFilter4): %s\n", strerror(errno));
-				exit(-1);
-			}
-			aud_fx->COMB4->CombBuff41 = calloc(aud_fx->COMB4->buff_size4, sizeof(sample_t));
-			if(aud_fx->COMB4->CombBuff41 == NULL)
-			{
-				fprintf(stderr,"AUDIO: FATAL memory allocation failure (CombFilter4): %s\n", strerror(errno));
-				exit(-1);
-			}
+			__m128 in = _mm_loadu_ps(x + i);
+			__m128 del = _mm_loadu_ps(d + i);
+			__m128 out = _mm_add_ps(_mm_mul_ps(g_in, in), _mm_mul_ps(g_delay, del));
+			_mm_storeu_ps(d + i, _mm_add_ps(in, _mm_mul_ps(del, decay)));
+			_mm_storeu_ps(x + i, clip_float_sse2(out));
 		}
-	}
-
-	for(samp = 0; samp < audio_ctx->capture_buff_size; samp = samp + audio_ctx->channels)
-	{
-		sample_t out1 = in_gain * data[samp] +
-			gain1 * aud_fx->COMB4->CombBuff10[aud_fx->COMB4->CombIndex1];
-		sample_t out2 = in_gain * data[samp] +
-			gain2 * aud_fx->COMB4->CombBuff20[aud_fx->COMB4->CombIndex2];
-		sample_t out3 = in_gain * data[samp] +
-			gain3 * aud_fx->COMB4->CombBuff30[aud_fx->COMB4->CombIndex3];
-		sample_t out4 = in_gain * data[samp] +
-			gain4 * aud_fx->COMB4->CombBuff40[aud_fx->COMB4->CombIndex4];
-
-		aud_fx->COMB4->CombBuff10[aud_fx->COMB4->CombIndex1] = data[samp] +
-			gain1 * aud_fx->COMB4->CombBuff10[aud_fx->COMB4->CombIndex1];
-		aud_fx->COMB4->CombBuff20[aud_fx->COMB4->CombIndex2] = data[samp] +
-			gain2 * aud_fx->COMB4->CombBuff20[aud_fx->COMB4->CombIndex2];
-		aud_fx->COMB4->CombBuff30[aud_fx->COMB4->CombIndex3] = data[samp] +
-			gain3 * aud_fx->COMB4->CombBuff30[aud_fx->COMB4->CombIndex3];
-		aud_fx->COMB4->CombBuff40[aud_fx->COMB4->CombIndex4] = data[samp] +
-			gain4 * aud_fx->COMB4->CombBuff40[aud_fx->COMB4->CombIndex4];
-
-		data[samp] = clip_float(out1 + out2 + out3 + out4);
-
-		/*if stereo process second channel */
-		if(audio_ctx->channels > 1)
+#endif
+		for(; i < run; i++)
 		{
-			out1 = in_gain * data[samp+1] +
-				gain1 * aud_fx->COMB4->CombBuff11[aud_fx->COMB4->CombIndex1];
-			out2 = in_gain * data[samp+1] +
-				gain2 * aud_fx->COMB4->CombBuff21[aud_fx->COMB4->CombIndex2];
-			out3 = in_gain * data[samp+1] +
-				gain3 * aud_fx->COMB4->CombBuff31[aud_fx->COMB4->CombIndex3];
-			out4 = in_gain * data[samp+1] +
-				gain4 * aud_fx->COMB4->CombBuff41[aud_fx->COMB4->CombIndex4];
-
-			aud_fx->COMB4->CombBuff11[aud_fx->COMB4->CombIndex1] = data[samp+1] +
-				gain1 * aud_fx->COMB4->CombBuff11[aud_fx->COMB4->CombIndex1];
-			aud_fx->COMB4->CombBuff21[aud_fx->COMB4->CombIndex2] = data[samp+1] +
-				gain2 * aud_fx->COMB4->CombBuff21[aud_fx->COMB4->CombIndex2];
-			aud_fx->COMB4->CombBuff31[aud_fx->COMB4->CombIndex3] = data[samp+1] +
-				gain3 * aud_fx->COMB4->CombBuff31[aud_fx->COMB4->CombIndex3];
-			aud_fx->COMB4->CombBuff41[aud_fx->COMB4->CombIndex4] = data[samp+1] +
-				gain4 * aud_fx->COMB4->CombBuff41[aud_fx->COMB4->CombIndex4];
-
-			data[samp+1] = clip_float(out1 + out2 + out3 + out4);
+			sample_t out = (0.7f * x[i]) + (0.3f * d[i]);
+			d[i] = x[i] + (d[i] * ECHO->gain);
+			x[i] = clip_float(out);
 		}
 
-		if(++(aud_fx->COMB4->CombIndex1) >= aud_fx->COMB4->buff_size1) aud_fx->COMB4->CombIndex1=0;
-		if(++(aud_fx->COMB4->CombIndex2) >= aud_fx->COMB4->buff_size2) aud_fx->COMB4->CombIndex2=0;
-		if(++(aud_fx->COMB4->CombIndex3) >= aud_fx->COMB4->buff_size3) aud_fx->COMB4->CombIndex3=0;
-		if(++(aud_fx->COMB4->CombIndex4) >= aud_fx->COMB4->buff_size4) aud_fx->COMB4->CombIndex4=0;
+		delay_advance(ECHO, run);
+		done += run;
 	}
 }
 
 /*
- * All pass filter
+ * four paralell Comb filters for reverb
+ *   out = sum(in_gain * in + gain[n] * delay[n]) ; delay[n] = in + gain[n] * delay[n]
  * args:
- *   AP - pointer to fx_delay_data_t
- *   Buff -pointer to sample buffer
- *   NumSamples - number of samples in buffer
- *   channels -number of audio channels
- *   gain- filter gain
+ *   data - audio buffer to be processed
+ *   NumSamples - samples in buffer (max FX_BLOCK_FRAMES * channels)
  *
  * asserts:
  *   none
  *
  * returns: none
  */
-static void all_pass (fx_delay_data_t *AP,
-	sample_t *Buff,
-	int NumSamples,
-	int channels,
-	float gain)
+static void CombFilter4 (sample_t *data, int NumSamples)
 {
-	int samp = 0;
-	float inv_gain = 1.0 / gain;
+	sample_t *acc = aud_fx->block_acc;
+	float in_gain = aud_fx->comb_in_gain;
+	int i = 0;
+
+	for(i = 0; i < NumSamples; i++)
+		acc[i] = 0;
 
-	for(samp = 0; samp < NumSamples; samp += channels)
+	int n = 0;
+	for(n = 0; n < 4; n++)
 	{
-		AP->delayBuff1[AP->delayIndex] = Buff[samp] +
-			(gain * AP->delayBuff1[AP->delayIndex]);
-		Buff[samp] = ((AP->delayBuff1[AP->delayIndex] * (1 - gain*gain)) -
-			Buff[samp]) * inv_gain;
-		if(channels > 1)
+		fx_delay_data_t *COMB = &aud_fx->COMB4[n];
+		int done = 0;
+		while(done < NumSamples)
 		{
-			AP->delayBuff2[AP->delayIndex] = Buff[samp+1] +
-				(gain * AP->delayBuff2[AP->delayIndex]);
-			Buff[samp+1] = ((AP->delayBuff2[AP->delayIndex] * (1 - gain*gain)) -
-				Buff[samp+1]) * inv_gain;
-		}
+			int run = delay_run(COMB, NumSamples - done);
+			sample_t *x = data + done;
+			sample_t *a = acc + done;
+			sample_t *d = COMB->buff + COMB->index;
+			i = 0;
+#ifdef __SSE2__
+			const __m128 g = _mm_set1_ps(COMB->gain);
+			const __m128 g_in = _mm_set1_ps(in_gain);
+			for(; i + 4 <= run; i += 4)
+			{
+				__m128 in = _mm_loadu_ps(x + i);
+				__m128 gd = _mm_mul_ps(g, _mm_loadu_ps(d + i));
+				_mm_storeu_ps(a + i, _mm_add_ps(_mm_loadu_ps(a + i),
+					_mm_add_ps(_mm_mul_ps(g_in, in), gd)));
+				_mm_storeu_ps(d + i, _mm_add_ps(in, gd));
+			}
+#endif
+			for(; i < run; i++)
+			{
+				sample_t gd = COMB->gain * d[i];
+				a[i] += in_gain * x[i] + gd;
+				d[i] = x[i] + gd;
+			}
 
-		if(++(AP->delayIndex) >= AP->buff_size) AP->delayIndex=0;
+			delay_advance(COMB, run);
+			done += run;
+		}
 	}
+
+	i = 0;
+#ifdef __SSE2__
+	for(; i + 4 <= NumSamples; i += 4)
+		_mm_storeu_ps(data + i, clip_float_sse2(_mm_loadu_ps(acc + i)));
+#endif
+	for(; i < NumSamples; i++)
+		data[i] = clip_float(acc[i]);
 }
 
 /*
- * All pass for reverb
+ * All pass filter
+ *   delay = in + gain * delay ; out = (delay * (1 - gain^2) - in) / gain
  * args:
- * 	 audio_ctx - audio context
- *   data - audio buffer to be processed
- *   delay_ms - delay in ms
- *   gain - filter gain
+ *   AP - pointer to fx_delay_data_t
+ *   Buff -pointer to sample buffer
+ *   NumSamples - number of samples in buffer
  *
  * asserts:
  *   none
  *
  * returns: none
  */
-static void all_pass1 (audio_context_t *audio_ctx,
-	sample_t *data,
-	int delay_ms,
-	float gain)
+static void all_pass (fx_delay_data_t *AP,
+	sample_t *Buff,
+	int NumSamples)
 {
-	if(aud_fx->AP1 == NULL)
+	float gain = AP->gain;
+	float inv_gain = 1.0 / gain;
+	float gain2 = 1 - gain*gain;
+
+	int done = 0;
+	while(done < NumSamples)
 	{
-		aud_fx->AP1 = calloc(1, sizeof(fx_delay_data_t));
-		if(aud_fx->AP1 == NULL)
-		{
-			fprintf(stderr,"AUDIO: FATAL memory allocation failure (all_pass1): %s\n", strerror(errno));
-			exit(-1);
-		}
-		aud_fx->AP1->buff_size = (int) delay_ms  * (audio_ctx->samprate * 0.001);
-		aud_fx->AP1->delayBuff1 = calloc(aud_fx->AP1->buff_size, sizeof(sample_t));
-		if(aud_fx->AP1->delayBuff1 == NULL)
+		int run = delay_run(AP, NumSamples - done);
+		sample_t *x = Buff + done;
+		sample_t *d = AP->buff + AP->index;
+		int i = 0;
+#ifdef __SSE2__
+		const __m128 g = _mm_set1_ps(gain);
+		const __m128 g2 = _mm_set1_ps(gain2);
+		const __m128 ig = _mm_set1_ps(inv_gain);
+		for(; i + 4 <= run; i += 4)
 		{
-			fprintf(stderr,"AUDIO: FATAL memory allocation failure (all_pass1): %s\n", strerror(errno));
-			exit(-1);
+			__m128 in = _mm_loadu_ps(x + i);
+			__m128 del = _mm_add_ps(in, _mm_mul_ps(g, _mm_loadu_ps(d + i)));
+			_mm_storeu_ps(d + i, del);
+			_mm_storeu_ps(x + i, _mm_mul_ps(_mm_sub_ps(_mm_mul_ps(del, g2), in), ig));
 		}
-		aud_fx->AP1->delayBuff2 = NULL;
-		if(audio_ctx->channels > 1)
+#endif
+		for(; i < run; i++)
 		{
-			aud_fx->AP1->delayBuff2 = calloc(aud_fx->AP1->buff_size, sizeof(sample_t));
-			if(aud_fx->AP1->delayBuff2 == NULL)
-			{
-				fprintf(stderr,"AUDIO: FATAL memory allocation failure (all_pass1): %s\n", strerror(errno));
-				exit(-1);
-			}
+			d[i] = x[i] + (gain * d[i]);
+			x[i] = ((d[i] * gain2) - x[i]) * inv_gain;
 		}
-	}
 
-	all_pass (aud_fx->AP1, data,
-		audio_ctx->capture_buff_size, audio_ctx->channels, gain);
+		delay_advance(AP, run);
+		done += run;
+	}
 }
 
 /*
@@ -642,63 +718,43 @@ static void change_rate_less(fx_rate_data_t *RT,
  * increase audio tempo by adding audio windows of wtime_ms in given rate
  *   rate: 2 -> [w1..w2][w1..w2][w2..w3][w2..w3]  3-> [w1..w2][w1..w2][w1..w2][w2..w3][w2..w3][w2..w3]
  * args:
- *   audio_ctx - audio context
+ *   RT - pointer to fx_rate_data_t
  *   data - audio buffer to be processed
  *   rate -rate of added windows
- *   wtime_ms - window time in ms
+ *   channels - audio channels
  *
  * asserts:
  *   none
  *
  * returns: none
  */
-static void change_tempo_more(audio_context_t *audio_ctx,
+static void change_tempo_more(fx_rate_data_t *RT,
 	sample_t *data,
 	int rate,
-	int	wtime_ms)
+	int channels)
 {
 	int samp = 0;
 	int i = 0;
 	int r = 0;
 	int index = 0;
 
-	if(aud_fx->RT1->wBuff1 == NULL)
-	{
-		aud_fx->RT1->wSize  = wtime_ms * audio_ctx->samprate * 0.001;
-		aud_fx->RT1->wBuff1 = calloc(aud_fx->RT1->wSize, sizeof(sample_t));
-		if(aud_fx->RT1->wBuff1 == NULL)
-		{
-			fprintf(stderr,"AUDIO: FATAL memory allocation failure (change_tempo_more): %s\n", strerror(errno));
-			exit(-1);
-		}
-		if (audio_ctx->channels >1)
-		{
-			aud_fx->RT1->wBuff2 = calloc(aud_fx->RT1->wSize, sizeof(sample_t));
-			if(aud_fx->RT1->wBuff2 == NULL)
-			{
-				fprintf(stderr,"AUDIO: FATAL memory allocation failure (change_tempo_more): %s\n", strerror(errno));
-				exit(-1);
-			}
-		}
-	}
-
-	//printf("samples  = %i\n", data->RT1->numsamples);
-	for(samp = 0; samp < aud_fx->RT1->numsamples; samp++)
+	for(samp = 0; samp < RT->numsamples; samp++)
 	{
-		aud_fx->RT1->wBuff1[i] = aud_fx->RT1->rBuff1[samp];
-		if(audio_ctx->channels > 1)
-			aud_fx->RT1->wBuff2[i] = aud_fx->RT1->rBuff2[samp];
+		/*window buffers hold wSize + 1 samples*/
+		RT->wBuff1[i] = RT->rBuff1[samp];
+		if(channels > 1)
+			RT->wBuff2[i] = RT->rBuff2[samp];
 
-		if((++i) > aud_fx->RT1->wSize)
+		if((++i) > RT->wSize)
 		{
 			for (r = 0; r < rate; r++)
 			{
-				for(i = 0; i < aud_fx->RT1->wSize; i++)
+				for(i = 0; i < RT->wSize; i++)
 				{
-					data[index] = aud_fx->RT1->wBuff1[i];
-					if (audio_ctx->channels > 1)
-						data[index +1] = aud_fx->RT1->wBuff2[i];
-					index += audio_ctx->channels;
+					data[index] = RT->wBuff1[i];
+					if (channels > 1)
+						data[index +1] = RT->wBuff2[i];
+					index += channels;
 				}
 			}
 			i = 0;
@@ -706,127 +762,42 @@ static void change_tempo_more(audio_context_t *audio_ctx,
 	}
 }
 
-#define FUZZ(x) CubicAmplifier(CubicAmplifier(CubicAmplifier(CubicAmplifier(x))))
-
 /*
- * Fuzz distortion
- * args:
- *   audio_ctx - audio context
- *   data - audio buffer to be processed
- *
- * asserts:
- *    audio_ctx is not null
- *
- * returns: none
- */
-static void audio_fx_fuzz (audio_context_t *audio_ctx, sample_t *data)
-{
-	/*assertions*/
-	assert(audio_ctx != NULL);
-
-	int samp=0;
-	for(samp = 0; samp < audio_ctx->capture_buff_size; samp++)
-		data[samp] = FUZZ(data[samp]);
-	HPF(audio_ctx, data, 1000, 0.9);
-}
-
-/*
- * Echo effect
+ * Reverb effect
  * args:
- *   audio_ctx - audio context
  *   data - audio buffer to be processed
- *   delay_ms - echo delay in ms (e.g: 300)
- *   decay - feedback gain (<1)  (e.g: 0.5)
+ *   NumSamples - samples in buffer (max FX_BLOCK_FRAMES * channels)
  *
  * asserts:
- *   audio_ctx is not null
+ *   none
  *
  * returns: none
  */
-static void audio_fx_echo(audio_context_t *audio_ctx,
-	sample_t *data,
-	int delay_ms,
-	float decay)
+static void audio_fx_reverb (sample_t *data, int NumSamples)
 {
-	/*assertions*/
-	assert(audio_ctx != NULL);
-
-	int samp = 0;
-
-	if(aud_fx->ECHO == NULL)
-	{
-		aud_fx->ECHO = calloc(1, sizeof(fx_delay_data_t));
-		if(aud_fx->ECHO == NULL)
-		{
-			fprintf(stderr,"AUDIO: FATAL memory allocation failure (audio_fx_echo): %s\n", strerror(errno));
-			exit(-1);
-		}
-		aud_fx->ECHO->buff_size = (int) delay_ms * audio_ctx->samprate * 0.001;
-		aud_fx->ECHO->delayBuff1 = calloc(aud_fx->ECHO->buff_size, sizeof(sample_t));
-		if(aud_fx->ECHO->delayBuff1 == NULL)
-		{
-			fprintf(stderr,"AUDIO: FATAL memory allocation failure (audio_fx_echo): %s\n", strerror(errno));
-			exit(-1);
-		}
-		aud_fx->ECHO->delayBuff2 = NULL;
-		if(audio_ctx->channels > 1)
-		{
-			aud_fx->ECHO->delayBuff2 = calloc(aud_fx->ECHO->buff_size, sizeof(sample_t));
-			if(aud_fx->ECHO->delayBuff2 == NULL)
-			{
-				fprintf(stderr,"AUDIO: FATAL memory allocation failure (audio_fx_echo): %s\n", strerror(errno));
-				exit(-1);
-			}
-		}
-	}
-
-	for(samp = 0; samp < audio_ctx->capture_buff_size; samp = samp + audio_ctx->channels)
-	{
-		sample_t out = (0.7 * data[samp]) +
-			(0.3 * aud_fx->ECHO->delayBuff1[aud_fx->ECHO->delayIndex]);
-		aud_fx->ECHO->delayBuff1[aud_fx->ECHO->delayIndex] = data[samp] +
-			(aud_fx->ECHO->delayBuff1[aud_fx->ECHO->delayIndex] * decay);
-		data[samp] = clip_float(out);
-		/*if stereo process second channel in separate*/
-		if (audio_ctx->channels > 1)
-		{
-			out = (0.7 * data[samp+1]) +
-				(0.3 * aud_fx->ECHO->delayBuff2[aud_fx->ECHO->delayIndex]);
-			aud_fx->ECHO->delayBuff2[aud_fx->ECHO->delayIndex] = data[samp] +
-				(aud_fx->ECHO->delayBuff2[aud_fx->ECHO->delayIndex] * decay);
-			data[samp+1] = clip_float(out);
-		}
+	/*4 parallel comb filters*/
+	CombFilter4 (data, NumSamples);
 
-		if(++(aud_fx->ECHO->delayIndex) >= aud_fx->ECHO->buff_size) aud_fx->ECHO->delayIndex=0;
-	}
+	/*all pass*/
+	all_pass (&aud_fx->AP1, data, NumSamples);
 }
 
 /*
- * Reverb effect
+ * Fuzz distortion
  * args:
- *   audio_ctx - audio context
  *   data - audio buffer to be processed
- *   delay_ms - reverb delay in ms
+ *   NumSamples - samples in buffer
+ *   channels - audio channels
  *
  * asserts:
- *   audio_ctx is not null
+ *    none
  *
  * returns: none
  */
-static void audio_fx_reverb (audio_context_t *audio_ctx,
-	sample_t *data,
-	int delay_ms)
+static void audio_fx_fuzz (sample_t *data, int NumSamples, int channels)
 {
-	/*assertions*/
-	assert(audio_ctx != NULL);
-
-	/*4 parallel comb filters*/
-	CombFilter4 (audio_ctx, data,
-		delay_ms, delay_ms - 5, delay_ms -10, delay_ms -15,
-		0.55, 0.6, 0.5, 0.45, 0.7);
-	
-	/*all pass*/
-	all_pass1 (audio_ctx, data, delay_ms, 0.75);
+	fuzz_amplifier(data, NumSamples);
+	Butt(&aud_fx->HPF, data, NumSamples, channels);
 }
 
 #define lfoskipsamples 30
@@ -837,80 +808,83 @@ static void audio_fx_reverb (audio_context_t *audio_ctx,
  * 	  depth and freqofs should be from 0(min) to 1(max) !
  * 	  res should be greater than 0 !
  * args:
- *   audio_ctx - audio context
+ *   wah - pointer to wah data (lfoskip and phase set at init)
  *   data - audio buffer to be processed
- *   freq - LFO frequency (1.5)
- *   startphase - LFO startphase in RADIANS - usefull for stereo WahWah (0)
+ *   NumSamples - samples in buffer
  *   depth - Wah depth (0.7)
  *   freqofs - Wah frequency offset (0.3)
  *   res - Resonance (2.5)
  *
  * asserts:
- *   audio_ctx is not null
+ *   none
  *
  * returns: none
  */
-static void audio_fx_wahwah (audio_context_t *audio_ctx,
+static void audio_fx_wahwah (fx_wah_data_t *wah,
 	sample_t *data,
-	float freq,
-	float startphase,
+	int NumSamples,
 	float depth,
 	float freqofs,
 	float res)
 {
-	/*assertions*/
-	assert(audio_ctx != NULL);
-
 	float frequency, omega, sn, cs, alpha;
 
-	if(aud_fx->wahData == NULL)
-	{
-		aud_fx->wahData = calloc(1, sizeof(fx_wah_data_t));
-		if(aud_fx->wahData == NULL)
-		{
-			fprintf(stderr,"AUDIO: FATAL memory allocation failure (audio_fx_wahwah): %s\n", strerror(errno));
-			exit(-1);
-		}
-		aud_fx->wahData->lfoskip = freq * 2 * M_PI / audio_ctx->samprate;
-		aud_fx->wahData->phase = startphase;
-		/*if right channel set: phase += (float)M_PI;*/
-	}
-
 	int samp = 0;
-	for(samp = 0; samp < audio_ctx->capture_buff_size; samp++)
+	for(samp = 0; samp < NumSamples; samp++)
 	{
 		float in = data[samp];
 
-		if ((aud_fx->wahData->skipcount++) % lfoskipsamples == 0)
+		if ((wah->skipcount++) % lfoskipsamples == 0)
 		{
-			frequency = (1 + cos(aud_fx->wahData->skipcount * aud_fx->wahData->lfoskip + aud_fx->wahData->phase)) * 0.5;
+			frequency = (1 + cos(wah->skipcount * wah->lfoskip + wah->phase)) * 0.5;
 			frequency = frequency * depth * (1 - freqofs) + freqofs;
 			frequency = exp((frequency - 1) * 6);
 			omega = M_PI * frequency;
 			sn = sin(omega);
 			cs = cos(omega);
 			alpha = sn / (2 * res);
-			aud_fx->wahData->b0 = (1 - cs) * 0.5;
-			aud_fx->wahData->b1 = 1 - cs;
-			aud_fx->wahData->b2 = (1 - cs) * 0.5;
-			aud_fx->wahData->a0 = 1 + alpha;
-			aud_fx->wahData->a1 = -2 * cs;
-			aud_fx->wahData->a2 = 1 - alpha;
+			wah->b0 = (1 - cs) * 0.5;
+			wah->b1 = 1 - cs;
+			wah->b2 = (1 - cs) * 0.5;
+			wah->a0 = 1 + alpha;
+			wah->a1 = -2 * cs;
+			wah->a2 = 1 - alpha;
 		}
-		float out = (aud_fx->wahData->b0 * in + aud_fx->wahData->b1 * aud_fx->wahData->xn1 +
-			aud_fx->wahData->b2 * aud_fx->wahData->xn2 - aud_fx->wahData->a1 * aud_fx->wahData->yn1 -
-			aud_fx->wahData->a2 * aud_fx->wahData->yn2) / aud_fx->wahData->a0;
-		aud_fx->wahData->xn2 = aud_fx->wahData->xn1;
-		aud_fx->wahData->xn1 = in;
-		aud_fx->wahData->yn2 = aud_fx->wahData->yn1;
-		aud_fx->wahData->yn1 = out;
+		float out = (wah->b0 * in + wah->b1 * wah->xn1 +
+			wah->b2 * wah->xn2 - wah->a1 * wah->yn1 -
+			wah->a2 * wah->yn2) / wah->a0;
+		wah->xn2 = wah->xn1;
+		wah->xn1 = in;
+		wah->yn2 = wah->yn1;
+		wah->yn1 = out;
 
 		data[samp] = clip_float(out);
 	}
 }
 
 /*
- * change pitch effect
+ * reset the WahWah state
+ * args:
+ *   wah - pointer to wah data
+ *   samprate - sample rate
+ *   freq - LFO frequency (1.5)
+ *   startphase - LFO startphase in RADIANS - usefull for stereo WahWah (0)
+ *
+ * asserts:
+ *   none
+ *
+ * returns: none
+ */
+static void reset_WAHWAH(fx_wah_data_t *wah, int samprate, float freq, float startphase)
+{
+	memset(wah, 0, sizeof(fx_wah_data_t));
+	wah->lfoskip = freq * 2 * M_PI / samprate;
+	wah->phase = startphase;
+	/*if right channel set: phase += (float)M_PI;*/
+}
+
+/*
+ * change pitch effect (processes the full buffer)
  * args:
  *   audio_ctx - audio context
  *   data - audio buffer to be processed
@@ -925,192 +899,159 @@ static void audio_fx_change_pitch (audio_context_t *audio_ctx,
 	sample_t *data,
 	int rate)
 {
-	if(aud_fx->RT1 == NULL)
-	{
-		aud_fx->RT1 = calloc(1, sizeof(fx_rate_data_t));
-		if(aud_fx->RT1 == NULL)
-		{
-			fprintf(stderr,"AUDIO: FATAL memory allocation failure (audio_fx_change_pitch): %s\n", strerror(errno));
-			exit(-1);
-		}
-		aud_fx->RT1->wBuff1 = NULL;
-		aud_fx->RT1->wBuff2 = NULL;
-		aud_fx->RT1->rBuff1 = calloc(audio_ctx->capture_buff_size/audio_ctx->channels, sizeof(sample_t));
-		if(aud_fx->RT1->rBuff1 == NULL)
-		{
-			fprintf(stderr,"AUDIO: FATAL memory allocation failure (audio_fx_change_pitch): %s\n", strerror(errno));
-			exit(-1);
-		}
-		aud_fx->RT1->rBuff2 = NULL;
-		if(audio_ctx->channels > 1)
-		{
-			aud_fx->RT1->rBuff2 = calloc(audio_ctx->capture_buff_size/audio_ctx->channels, sizeof(sample_t));
-			if(aud_fx->RT1->rBuff2 == NULL)
-			{
-				fprintf(stderr,"AUDIO: FATAL memory allocation failure (audio_fx_change_pitch): %s\n", strerror(errno));
-				exit(-1);
-			}
-		}
-	}
-
-	change_rate_less(aud_fx->RT1, data, rate, audio_ctx->capture_buff_size, audio_ctx->channels);
-	change_tempo_more(audio_ctx, data, rate, 20);
-	LPF(audio_ctx, data, audio_ctx->samprate * 0.25, 0.9);
+	change_rate_less(&aud_fx->RT1, data, rate, audio_ctx->capture_buff_size, audio_ctx->channels);
+	change_tempo_more(&aud_fx->RT1, data, rate, audio_ctx->channels);
+	Butt(&aud_fx->LPF1, data, audio_ctx->capture_buff_size, audio_ctx->channels);
 }
 
 /*
- * clean fx_delay_data_t
+ * reset the state of newly enabled fx (so they start from silence)
  * args:
- *   DELAY - pointer to fx_delay_data_t
+ *   mask - or'ed fx combination to reset
  *
  * asserts:
  *   none
  *
  * returns: none
  */
-static void close_DELAY(fx_delay_data_t *DELAY)
+static void audio_fx_reset(uint32_t mask)
 {
-	if(DELAY != NULL)
+	int n = 0;
+
+	if(mask & AUDIO_FX_ECHO)
+		reset_DELAY(&aud_fx->ECHO);
+
+	if(mask & AUDIO_FX_REVERB)
 	{
-		free(DELAY->delayBuff1);
-		free(DELAY->delayBuff2);
-		free(DELAY);
+		for(n = 0; n < 4; n++)
+			reset_DELAY(&aud_fx->COMB4[n]);
+		reset_DELAY(&aud_fx->AP1);
 	}
+
+	if(mask & AUDIO_FX_FUZZ)
+		reset_FILT(&aud_fx->HPF);
+
+	if(mask & AUDIO_FX_WAHWAH)
+		reset_WAHWAH(&aud_fx->wahData, aud_fx->samprate, 1.5, 0);
+
+	if(mask & AUDIO_FX_DUCKY)
+		reset_FILT(&aud_fx->LPF1);
 }
 
 /*
- * clean fx_comb4_data_t
+ * clean audio fx data
  * args:
- *   COMB4 - pointer to fx_comb4_data_t
+ *   none
  *
  * asserts:
  *   none
  *
  * returns: none
  */
-static void close_COMB4(fx_comb4_data_t *COMB4)
+void audio_fx_close()
 {
-	if(COMB4 != NULL)
-	{
-		free(COMB4->CombBuff10);
-		free(COMB4->CombBuff20);
-		free(COMB4->CombBuff30);
-		free(COMB4->CombBuff40);
+	if(aud_fx == NULL)
+		return;
 
-		free(COMB4->CombBuff11);
-		free(COMB4->CombBuff21);
-		free(COMB4->CombBuff31);
-		free(COMB4->CombBuff41);
+	int n = 0;
 
-		free(COMB4);
-	}
+	free(aud_fx->ECHO.buff);
+	for(n = 0; n < 4; n++)
+		free(aud_fx->COMB4[n].buff);
+	free(aud_fx->AP1.buff);
+
+	free(aud_fx->RT1.rBuff1);
+	free(aud_fx->RT1.rBuff2);
+	free(aud_fx->RT1.wBuff1);
+	free(aud_fx->RT1.wBuff2);
+
+	free(aud_fx->block_acc);
+
+	free(aud_fx);
+	aud_fx = NULL;
 }
 
 /*
- * clean fx_filt_data_t
+ * allocate the audio fx data for the current audio configuration
+ *   (called from audio_start, so that audio_fx_apply never allocates)
  * args:
- *   FILT - pointer to fx_filt_data_t
+ *   audio_ctx - pointer to audio context
  *
  * asserts:
- *   none
+ *   audio_ctx is not null
  *
- * returns: none
+ * returns: error code (0 ok)
  */
-static void close_FILT(fx_filt_data_t *FILT)
+int audio_fx_init(audio_context_t *audio_ctx)
 {
-	if(FILT != NULL)
+	/*assertions*/
+	assert(audio_ctx != NULL);
+
+	if(audio_ctx->channels <= 0 || audio_ctx->samprate <= 0 ||
+		audio_ctx->capture_buff_size <= 0)
 	{
-		free(FILT);
+		fprintf(stderr, "AUDIO: (audio_fx_init) invalid audio configuration\n");
+		return -1;
 	}
-}
 
-/*
- * clean fx_wah_data_t
- * args:
- *   WAH - pointer to fx_wah_data_t
- *
- * asserts:
- *   none
- *
- * returns: none
- */
-static void close_WAHWAH(fx_wah_data_t *WAH)
-{
-	if(WAH != NULL)
+	/*already allocated for this configuration*/
+	if(aud_fx != NULL &&
+		aud_fx->channels == audio_ctx->channels &&
+		aud_fx->samprate == audio_ctx->samprate &&
+		aud_fx->buff_size == audio_ctx->capture_buff_size)
 	{
-		free(WAH);
+		audio_fx_reset(~0);
+		aud_fx->mask = AUDIO_FX_NONE;
+		return 0;
 	}
-}
 
-/*
- * clean reverb data
- * args:
- *   none
- *
- * asserts:
- *   none
- *
- * returns: none
- */
-static void close_reverb()
-{
-	close_DELAY(aud_fx->AP1);
-	aud_fx->AP1 = NULL;
-	close_COMB4(aud_fx->COMB4);
-	aud_fx->COMB4 = NULL;
-}
+	audio_fx_close();
 
-/*
- * clean pitch data
- * args:
- *   none
- *
- * asserts:
- *   none
- *
- * returns: none
- */
-static void close_pitch ()
-{
-	if(aud_fx->RT1 != NULL)
+	aud_fx = calloc(1, sizeof(audio_fx_t));
+	if(aud_fx == NULL)
 	{
-		free(aud_fx->RT1->rBuff1);
-		free(aud_fx->RT1->rBuff2);
-		free(aud_fx->RT1->wBuff1);
-		free(aud_fx->RT1->wBuff2);
-		free(aud_fx->RT1);
-		aud_fx->RT1 = NULL;
-		close_FILT(aud_fx->LPF1);
-		aud_fx->LPF1 = NULL;
+		fprintf(stderr,"AUDIO: FATAL memory allocation failure (audio_fx_init): %s\n", strerror(errno));
+		exit(-1);
 	}
-}
 
-/*
- * clean audio fx data
- * args:
- *   none
- *
- * asserts:
- *   none
- *
- * returns: none
- */
-void audio_fx_close()
-{
-	if(aud_fx == NULL)
-		return;
+	int channels = audio_ctx->channels;
+	int samprate = audio_ctx->samprate;
 
-	close_DELAY(aud_fx->ECHO);
-	aud_fx->ECHO = NULL;
-	close_reverb();
-	close_WAHWAH(aud_fx->wahData);
-	aud_fx->wahData = NULL;
-	close_FILT(aud_fx->HPF);
-	aud_fx->HPF = NULL;
-	close_pitch();
+	aud_fx->channels = channels;
+	aud_fx->samprate = samprate;
+	aud_fx->buff_size = audio_ctx->capture_buff_size;
+	aud_fx->mask = AUDIO_FX_NONE;
 
-	free(aud_fx);
-	aud_fx = NULL;
+	/*Echo effect data */
+	init_DELAY(&aud_fx->ECHO, FX_ECHO_DELAY_MS, FX_ECHO_DECAY, samprate, channels);
+
+	/* 4 parallel comb filters data*/
+	init_DELAY(&aud_fx->COMB4[0], FX_REVERB_DELAY_MS, 0.55, samprate, channels);
+	init_DELAY(&aud_fx->COMB4[1], FX_REVERB_DELAY_MS - 5, 0.6, samprate, channels);
+	init_DELAY(&aud_fx->COMB4[2], FX_REVERB_DELAY_MS - 10, 0.5, samprate, channels);
+	init_DELAY(&aud_fx->COMB4[3], FX_REVERB_DELAY_MS - 15, 0.45, samprate, channels);
+	aud_fx->comb_in_gain = 0.7;
+	aud_fx->block_acc = fx_alloc_samples(FX_BLOCK_FRAMES * channels);
+
+	/*all pass 1 filter data*/
+	init_DELAY(&aud_fx->AP1, FX_REVERB_DELAY_MS, 0.75, samprate, channels);
+
+	/*high pass filter data (fuzz)*/
+	init_HPF(&aud_fx->HPF, samprate, FX_FUZZ_HPF_FREQ, FX_FILT_RES);
+
+	/*WahWah effect data*/
+	reset_WAHWAH(&aud_fx->wahData, samprate, 1.5, 0);
+
+	/*rate transposer and low pass filter (pitch)*/
+	int frames = audio_ctx->capture_buff_size / channels;
+	aud_fx->RT1.rBuff1 = fx_alloc_samples(frames);
+	aud_fx->RT1.rBuff2 = channels > 1 ? fx_alloc_samples(frames) : NULL;
+	aud_fx->RT1.wSize = FX_PITCH_WINDOW_MS * samprate * 0.001;
+	aud_fx->RT1.wBuff1 = fx_alloc_samples(aud_fx->RT1.wSize + 1);
+	aud_fx->RT1.wBuff2 = channels > 1 ? fx_alloc_samples(aud_fx->RT1.wSize + 1) : NULL;
+	init_LPF(&aud_fx->LPF1, samprate, samprate * 0.25, FX_FILT_RES);
+
+	return 0;
 }
 
 /*
@@ -1129,48 +1070,53 @@ void audio_fx_apply(audio_context_t *audio_ctx,
 	sample_t *data,
 	uint32_t mask)
 {
-	if(mask != AUDIO_FX_NONE)
-    {
-		if(verbosity > 2)
-			printf("AUDIO: Apllying Fx (0x%x)\n", mask);
-			
-		if(aud_fx == NULL)
-			audio_fx_init();
-		
+	if(mask == AUDIO_FX_NONE)
+	{
+		/*keep the fx data, just mark all fx as disabled*/
+		if(aud_fx != NULL)
+			aud_fx->mask = AUDIO_FX_NONE;
+		return;
+	}
+
+	if(verbosity > 2)
+		printf("AUDIO: Apllying Fx (0x%x)\n", mask);
+
+	/*only if audio_start wasn't called or the configuration changed*/
+	if(aud_fx == NULL ||
+		aud_fx->channels != audio_ctx->channels ||
+		aud_fx->buff_size != audio_ctx->capture_buff_size)
+	{
+		if(audio_fx_init(audio_ctx) != 0)
+			return;
+	}
+
+	/*fx turned on since the last buffer start from silence*/
+	audio_fx_reset(mask & ~aud_fx->mask);
+	aud_fx->mask = mask;
+
+	int channels = audio_ctx->channels;
+	int block_size = FX_BLOCK_FRAMES * channels;
+	int samp = 0;
+
+	for(samp = 0; samp < audio_ctx->capture_buff_size; samp += block_size)
+	{
+		sample_t *block = data + samp;
+		int size = MIN(block_size, audio_ctx->capture_buff_size - samp);
+
 		if(mask & AUDIO_FX_ECHO)
-			audio_fx_echo(audio_ctx, data, 300, 0.5);
-		else
-		{
-			close_DELAY(aud_fx->ECHO);
-			aud_fx->ECHO = NULL;
-		}
+			audio_fx_echo(&aud_fx->ECHO, block, size);
 
 		if(mask & AUDIO_FX_REVERB)
-			audio_fx_reverb(audio_ctx, data, 50);
-		else
-			close_reverb();
+			audio_fx_reverb(block, size);
 
 		if(mask & AUDIO_FX_FUZZ)
-			audio_fx_fuzz(audio_ctx, data);
-		else
-		{
-			close_FILT(aud_fx->HPF);
-			aud_fx->HPF = NULL;
-		}
+			audio_fx_fuzz(block, size, channels);
 
 		if(mask & AUDIO_FX_WAHWAH)
-			audio_fx_wahwah(audio_ctx, data, 1.5, 0, 0.7, 0.3, 2.5);
-		else
-		{
-			close_WAHWAH(aud_fx->wahData);
-			aud_fx->wahData = NULL;
-		}
-
-		if(mask & AUDIO_FX_DUCKY)
-			audio_fx_change_pitch(audio_ctx, data, 2);
-		else
-			close_pitch();
+			audio_fx_wahwah(&aud_fx->wahData, block, size, 0.7, 0.3, 2.5);
 	}
-	else
-		audio_fx_close();
+
+	/*pitch change works on the full buffer (resamples it)*/
+	if(mask & AUDIO_FX_DUCKY)
+		audio_fx_change_pitch(audio_ctx, data, FX_PITCH_RATE);
 }
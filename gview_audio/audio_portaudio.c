@@ -129,26 +129,15 @@ static int recordCallback (
 	if(statusFlags & paInputUnderflow)
 		fprintf( stderr, "AUDIO: portaudio buffer underflow\n" );
 
-	if(sample_index == 0)
-	{
-		audio_ctx->capture_buff_level[0] = 0;
-		audio_ctx->capture_buff_level[1] = 0;
-	}
-
-	int chan = 0;
-	/*store capture samples*/
+	/*
+	 * store capture samples
+	 * (the channels level is computed by the consumer in audio_get_next_buffer)
+	 */
 	for( i = 0; i < numSamples; ++i )
     {
         capture_buff[sample_index] = inputBuffer ? *rptr++ : 0;
         sample_index++;
 
-		/*store peak value*/
-		if(audio_ctx->capture_buff_level[chan] < capture_buff[sample_index])
-			audio_ctx->capture_buff_level[chan] = capture_buff[sample_index];
-		chan++;
-		if(chan >= audio_ctx->channels)
-			chan = 0;
-
         if(sample_index >= audio_ctx->capture_buff_size)
 		{
 			buff_ts = ts + ( i / audio_ctx->channels ) * frame_length;
@@ -156,8 +145,6 @@ static int recordCallback (
 			audio_fill_buffer(audio_ctx, buff_ts);
 
 			/*reset*/
-			audio_ctx->capture_buff_level[0] = 0;
-			audio_ctx->capture_buff_level[1] = 0;
 			sample_index = 0;
 		}
 	}
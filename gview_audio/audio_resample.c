@@ -0,0 +1,413 @@
+/*******************************************************************************#
+#           guvcview              http://guvcview.sourceforge.net               #
+#                                                                               #
+#           Paulo Assis <pj.assis@gmail.com>                                    #
+#                                                                               #
+# This program is free software; you can redistribute it and/or modify          #
+# it under the terms of the GNU General Public License as published by          #
+# the Free Software Foundation; either version 2 of the License, or             #
+# (at your option) any later version.                                           #
+#                                                                               #
+# This program is distributed in the hope that it will be useful,               #
+# but WITHOUT ANY WARRANTY; without even the implied warranty of                #
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the                 #
+# GNU General Public License for more details.                                  #
+#                                                                               #
+# You should have received a copy of the GNU General Public License             #
+# along with this program; if not, write to the Free Software                   #
+# Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA     #
+#                                                                               #
+********************************************************************************/
+
+/*******************************************************************************#
+#                                                                               #
+#  Audio library - clock drift correction                                       #
+#                                                                               #
+#  the audio sample clock (sound card crystal) drifts against the monotonic    #
+#  clock used for the video timestamps; the drift is estimated from the        #
+#  callback timestamps and the audio is resampled by a few ppm (polyphase      #
+#  windowed sinc) so that it stays locked to the monotonic clock               #
+#                                                                               #
+********************************************************************************/
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <errno.h>
+#include <assert.h>
+
+#ifdef __SSE2__
+	#include <emmintrin.h>
+#endif
+
+#include "gviewaudio.h"
+#include "audio.h"
+#include "gview.h"
+
+#ifndef M_PI
+#define M_PI		3.14159265358979323846
+#endif
+
+extern int verbosity;
+
+/*polyphase filter*/
+#define RESAMPLE_TAPS      (16)  /*taps per phase*/
+#define RESAMPLE_HALF_TAPS (RESAMPLE_TAPS / 2)
+#define RESAMPLE_PHASES    (256) /*phases (interpolated linearly)*/
+#define RESAMPLE_CUTOFF    (0.95)
+#define RESAMPLE_MAX_CHANNELS (8)
+
+/*drift controller*/
+#define DRIFT_MAX_PPM       (2000.0)  /*max correction*/
+#define DRIFT_SMOOTH_SEC    (5.0)     /*drift measurement smoothing time constant*/
+#define DRIFT_P_SEC         (20.0)    /*time to correct an error (proportional)*/
+#define DRIFT_I_SEC         (200.0)   /*integral time constant*/
+
+/*filter coeficients: RESAMPLE_PHASES + 1 rows (last row for interpolation)*/
+static float filter[RESAMPLE_PHASES + 1][RESAMPLE_TAPS] __attribute__((aligned(16)));
+
+static int rs_channels = 0;
+static int rs_samprate = 0;
+static int rs_capacity = 0;  /*fifo capacity in frames*/
+static int rs_fill = 0;      /*frames in fifo*/
+static double rs_pos = 0;    /*input position of the next output frame (in fifo frames)*/
+static float *rs_fifo[RESAMPLE_MAX_CHANNELS]; /*planar input fifo*/
+
+static audio_drift_stats_t rs_stats;
+static int64_t rs_drift_ref = 0;    /*first drift measurement (latency offset)*/
+static double rs_drift_smooth = 0;  /*smoothed drift (seconds)*/
+static double rs_integral = 0;      /*controller integral (ppm)*/
+static int rs_started = 0;
+
+/*
+ * build the polyphase filter table (blackman windowed sinc)
+ * args:
+ *   none
+ *
+ * asserts:
+ *   none
+ *
+ * returns: none
+ */
+static void resample_build_filter()
+{
+	int phase = 0;
+	for(phase = 0; phase <= RESAMPLE_PHASES; phase++)
+	{
+		double frac = (double) phase / RESAMPLE_PHASES;
+		double sum = 0;
+		int k = 0;
+
+		for(k = 0; k < RESAMPLE_TAPS; k++)
+		{
+			/*tap k is input frame i - (HALF_TAPS - 1) + k*/
+			double t = (k - (RESAMPLE_HALF_TAPS - 1)) - frac;
+			double x = t * RESAMPLE_CUTOFF;
+			double sinc = (fabs(x) < 1e-9) ? 1.0 : sin(M_PI * x) / (M_PI * x);
+			double w = (t + RESAMPLE_HALF_TAPS) / RESAMPLE_TAPS; /*[0 ; 1]*/
+			double window = 0.42 - 0.5 * cos(2 * M_PI * w) + 0.08 * cos(4 * M_PI * w);
+			if(w < 0 || w > 1)
+				window = 0;
+
+			filter[phase][k] = sinc * window;
+			sum += filter[phase][k];
+		}
+
+		/*unity gain*/
+		for(k = 0; k < RESAMPLE_TAPS; k++)
+			filter[phase][k] /= sum;
+	}
+}
+
+/*
+ * init the drift correction resampler
+ * args:
+ *   channels - audio channels
+ *   samprate - sample rate
+ *   frames - frames per buffer
+ *
+ * asserts:
+ *   none
+ *
+ * returns: error code (0 ok)
+ */
+int audio_resample_init(int channels, int samprate, int frames)
+{
+	audio_resample_close();
+
+	if(channels <= 0 || channels > RESAMPLE_MAX_CHANNELS || samprate <= 0 || frames <= 0)
+	{
+		fprintf(stderr, "AUDIO: (audio_resample_init) invalid configuration (%i channels)\n", channels);
+		return -1;
+	}
+
+	resample_build_filter();
+
+	rs_channels = channels;
+	rs_samprate = samprate;
+	/*one input buffer + one output buffer worth of frames (max correction is tiny)*/
+	rs_capacity = 2 * frames + 4 * RESAMPLE_TAPS;
+
+	int ch = 0;
+	for(ch = 0; ch < channels; ch++)
+	{
+		rs_fifo[ch] = calloc(rs_capacity, sizeof(float));
+		if(rs_fifo[ch] == NULL)
+		{
+			fprintf(stderr,"AUDIO: FATAL memory allocation failure (audio_resample_init): %s\n", strerror(errno));
+			exit(-1);
+		}
+	}
+
+	/*start with HALF_TAPS - 1 frames of silence so the first output is centered on frame 0*/
+	rs_fill = RESAMPLE_HALF_TAPS - 1;
+	rs_pos = RESAMPLE_HALF_TAPS - 1;
+
+	memset(&rs_stats, 0, sizeof(audio_drift_stats_t));
+	rs_drift_ref = 0;
+	rs_drift_smooth = 0;
+	rs_integral = 0;
+	rs_started = 0;
+
+	return 0;
+}
+
+/*
+ * close the drift correction resampler
+ * args:
+ *   none
+ *
+ * asserts:
+ *   none
+ *
+ * returns: none
+ */
+void audio_resample_close()
+{
+	if(rs_channels > 0 && verbosity > 0)
+		printf("AUDIO: drift correction - drift %.2f ms, error %.2f ms, correction %.1f ppm (%" PRIu64 " -> %" PRIu64 " frames)\n",
+			rs_stats.drift / 1e6, rs_stats.error / 1e6, rs_stats.correction_ppm,
+			rs_stats.frames_in, rs_stats.frames_out);
+
+	int ch = 0;
+	for(ch = 0; ch < RESAMPLE_MAX_CHANNELS; ch++)
+	{
+		if(rs_fifo[ch])
+			free(rs_fifo[ch]);
+		rs_fifo[ch] = NULL;
+	}
+
+	rs_channels = 0;
+	rs_capacity = 0;
+	rs_fill = 0;
+}
+
+/*
+ * update the drift estimation and the correction
+ * args:
+ *   frames - number of input frames in this buffer
+ *   drift - generated (sample clock) - real (monotonic) buffer end time in ns
+ *
+ * asserts:
+ *   none
+ *
+ * returns: none
+ */
+static void drift_update(int frames, int64_t drift)
+{
+	double dt = (double) frames / rs_samprate;
+
+	if(!rs_started)
+	{
+		/*the initial offset is just the capture latency*/
+		rs_drift_ref = drift;
+		rs_started = 1;
+	}
+
+	/*
+	 * drift grows when the sample clock runs faster than the monotonic
+	 * clock; the callback timestamps are jittery so smooth it
+	 */
+	double d = (drift - rs_drift_ref) / 1e9;
+	double alpha = dt / (DRIFT_SMOOTH_SEC + dt);
+	rs_drift_smooth += alpha * (d - rs_drift_smooth);
+
+	/*
+	 * error: time represented by the output samples minus the real time
+	 * of the input frames consumed to produce them (sample time - drift)
+	 */
+	double consumed = (double) rs_stats.frames_in - (rs_fill - rs_pos);
+	double in_time = consumed / rs_samprate;
+	double out_time = (double) rs_stats.frames_out / rs_samprate;
+	double error = out_time - (in_time - rs_drift_smooth);
+
+	/*PI controller: positive error -> too many output samples -> squeeze*/
+	rs_integral += (error / DRIFT_I_SEC) * dt * (1e6 / DRIFT_P_SEC);
+	rs_integral = MAX(MIN(rs_integral, DRIFT_MAX_PPM), -DRIFT_MAX_PPM);
+	double ppm = -((error * 1e6 / DRIFT_P_SEC) + rs_integral);
+	ppm = MAX(MIN(ppm, DRIFT_MAX_PPM), -DRIFT_MAX_PPM);
+
+	rs_stats.drift = (int64_t) (rs_drift_smooth * 1e9);
+	rs_stats.error = (int64_t) (error * 1e9);
+	rs_stats.correction_ppm = ppm;
+}
+
+/*
+ * push captured frames into the resampler and update the drift estimation
+ * args:
+ *   in - interleaved float samples
+ *   frames - number of frames
+ *   drift - generated (sample clock) - real (monotonic) buffer end time in ns
+ *
+ * asserts:
+ *   in is not null
+ *
+ * returns: error code (0 ok)
+ */
+int audio_resample_push(const sample_t *in, int frames, int64_t drift)
+{
+	/*asserts*/
+	assert(in != NULL);
+
+	/*discard the input frames that are no longer needed*/
+	int consumed = (int) rs_pos - (RESAMPLE_HALF_TAPS - 1);
+	if(consumed > 0)
+	{
+		int ch = 0;
+		for(ch = 0; ch < rs_channels; ch++)
+			memmove(rs_fifo[ch], rs_fifo[ch] + consumed, (rs_fill - consumed) * sizeof(float));
+		rs_fill -= consumed;
+		rs_pos -= consumed;
+	}
+
+	if(rs_fill + frames > rs_capacity)
+	{
+		fprintf(stderr, "AUDIO: (audio_resample_push) fifo overflow (%i + %i > %i)\n",
+			rs_fill, frames, rs_capacity);
+		return -1;
+	}
+
+	/*deinterleave*/
+	int i = 0;
+	if(rs_channels == 1)
+		memcpy(rs_fifo[0] + rs_fill, in, frames * sizeof(float));
+	else
+	{
+		int ch = 0;
+		for(i = 0; i < frames; i++)
+			for(ch = 0; ch < rs_channels; ch++)
+				rs_fifo[ch][rs_fill + i] = *in++;
+	}
+
+	drift_update(frames, drift);
+
+	rs_fill += frames;
+	rs_stats.frames_in += frames;
+
+	return 0;
+}
+
+/*
+ * compute one output sample (interpolated polyphase dot product)
+ * args:
+ *   src - planar input (first tap)
+ *   c0 - filter phase
+ *   c1 - next filter phase
+ *   frac - interpolation factor between phases
+ *
+ * asserts:
+ *   none
+ *
+ * returns: sample
+ */
+static inline float resample_dot(const float *src, const float *c0, const float *c1, float frac)
+{
+#ifdef __SSE2__
+	__m128 f = _mm_set1_ps(frac);
+	__m128 acc = _mm_setzero_ps();
+	int k = 0;
+	for(k = 0; k < RESAMPLE_TAPS; k += 4)
+	{
+		__m128 a = _mm_load_ps(c0 + k);
+		__m128 b = _mm_load_ps(c1 + k);
+		__m128 coef = _mm_add_ps(a, _mm_mul_ps(_mm_sub_ps(b, a), f));
+		acc = _mm_add_ps(acc, _mm_mul_ps(coef, _mm_loadu_ps(src + k)));
+	}
+	/*horizontal sum*/
+	acc = _mm_add_ps(acc, _mm_movehl_ps(acc, acc));
+	acc = _mm_add_ss(acc, _mm_shuffle_ps(acc, acc, 1));
+	return _mm_cvtss_f32(acc);
+#else
+	float acc = 0;
+	int k = 0;
+	for(k = 0; k < RESAMPLE_TAPS; k++)
+		acc += (c0[k] + (c1[k] - c0[k]) * frac) * src[k];
+	return acc;
+#endif
+}
+
+/*
+ * get resampled frames
+ * args:
+ *   out - interleaved float output buffer
+ *   frames - number of frames to get
+ *
+ * asserts:
+ *   out is not null
+ *
+ * returns: 0 if the frames were written, 1 if more input is needed
+ */
+int audio_resample_pull(sample_t *out, int frames)
+{
+	/*asserts*/
+	assert(out != NULL);
+
+	/*input frames per output frame*/
+	double step = 1.0 / (1.0 + rs_stats.correction_ppm * 1e-6);
+
+	/*last output needs input frames up to floor(pos) + HALF_TAPS*/
+	double last = rs_pos + (frames - 1) * step;
+	if((int) last + RESAMPLE_HALF_TAPS >= rs_fill)
+		return 1;
+
+	double pos = rs_pos;
+	int i = 0;
+	for(i = 0; i < frames; i++)
+	{
+		int index = (int) pos;
+		double phase_pos = (pos - index) * RESAMPLE_PHASES;
+		int phase = (int) phase_pos;
+		float frac = (float) (phase_pos - phase);
+		int first = index - (RESAMPLE_HALF_TAPS - 1);
+
+		int ch = 0;
+		for(ch = 0; ch < rs_channels; ch++)
+			*out++ = resample_dot(rs_fifo[ch] + first, filter[phase], filter[phase + 1], frac);
+
+		pos += step;
+	}
+
+	rs_pos = pos;
+	rs_stats.frames_out += frames;
+
+	return 0;
+}
+
+/*
+ * get the drift correction stats
+ * args:
+ *   stats - pointer to audio_drift_stats_t to fill
+ *
+ * asserts:
+ *   stats is not null
+ *
+ * returns: none
+ */
+void audio_resample_get_stats(audio_drift_stats_t *stats)
+{
+	/*asserts*/
+	assert(stats != NULL);
+
+	memcpy(stats, &rs_stats, sizeof(audio_drift_stats_t));
+}
@@ -78,9 +78,22 @@ typedef struct _audio_buff_t
 	void *data; /*sample buffer - usually sample_t (float)*/
 	int64_t timestamp;
 	int flag;
-	float level_meter[2]; /*average sample level*/
+	float level_meter[2]; /*channels peak level (absolute value)*/
 } audio_buff_t;
 
+/*
+ * audio clock drift correction stats
+ *   drift and error in nanoseconds
+ */
+typedef struct _audio_drift_stats_t
+{
+	int64_t drift;          /*sample clock - monotonic clock (smoothed)*/
+	int64_t error;          /*corrected audio time - monotonic time*/
+	double correction_ppm;  /*current resampling correction (ppm)*/
+	uint64_t frames_in;     /*captured frames*/
+	uint64_t frames_out;    /*frames after correction*/
+} audio_drift_stats_t;
+
 typedef struct _audio_device_t
 {
 	int id;                 /*audo device id*/
@@ -323,6 +336,61 @@ int audio_get_next_buffer(audio_context_t *audio_ctx,
 	int type,
 	uint32_t mask);
 
+/*
+ * wait for a captured buffer to be available in the ring
+ *   (replaces polling audio_get_next_buffer with a sleep)
+ * args:
+ *   audio_ctx - pointer to audio context
+ *   timeout_ms - max wait time in ms
+ *
+ * asserts:
+ *   audio_ctx is not null
+ *
+ * returns: 0 if a buffer is available, 1 on timeout
+ */
+int audio_wait_buffer(audio_context_t *audio_ctx, int timeout_ms);
+
+/*
+ * get the ring overflow count
+ * args:
+ *   audio_ctx - pointer to audio context
+ *
+ * asserts:
+ *   audio_ctx is not null
+ *
+ * returns: number of samples dropped since audio_start (ring full)
+ */
+uint64_t audio_get_overflow_samples(audio_context_t *audio_ctx);
+
+/*
+ * enable/disable the audio clock drift correction
+ *   (resamples the audio by a few ppm to lock it to the monotonic clock
+ *    used for the video timestamps) - must be set before audio_start
+ * args:
+ *   audio_ctx - pointer to audio context
+ *   enable - 1 enable (default); 0 disable
+ *
+ * asserts:
+ *   audio_ctx is not null
+ *
+ * returns: none
+ */
+void audio_set_drift_correction(audio_context_t *audio_ctx, int enable);
+
+/*
+ * get the audio clock drift correction stats
+ * args:
+ *   audio_ctx - pointer to audio context
+ *   stats - pointer to audio_drift_stats_t to fill
+ *
+ * asserts:
+ *   audio_ctx is not null
+ *   stats is not null
+ *
+ * returns: none
+ */
+void audio_get_drift_stats(audio_context_t *audio_ctx, audio_drift_stats_t *stats);
+
 /*
  * apply audio fx
  * args:
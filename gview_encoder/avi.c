@@ -62,7 +62,7 @@
 #define VERSION "1.0"
 #endif
 
-#define AVI_INDEX_CLUSTER_SIZE 16384
+#define AVI_INDEX_GROW_SIZE 16384 /*index entries added on each realloc*/
 
 #define AVIF_HASINDEX           0x00000010      /* Index at end of file */
 #define AVIF_MUSTUSEINDEX       0x00000020
@@ -72,7 +72,6 @@
 #define AVIF_COPYRIGHTED        0x00020000
 
 #define AVI_MAX_RIFF_SIZE       0x40000000LL    /*1Gb = 0x40000000LL*/
-#define AVI_MASTER_INDEX_SIZE   256
 #define AVI_MAX_STREAM_COUNT    10
 
 /* index flags */
@@ -106,9 +105,7 @@ static void avi_close_tag(avi_context_t *avi_ctx, int64_t start_pos)
 {
 	int64_t current_offset = io_get_offset(avi_ctx->writer);
 	int32_t size = (int32_t) (current_offset - start_pos);
-	io_seek(avi_ctx->writer, start_pos-4);
-	io_write_wl32(avi_ctx->writer, size);
-	io_seek(avi_ctx->writer, current_offset);
+	io_write_wl32_at(avi_ctx->writer, start_pos-4, size);
 
 	if(verbosity > 0)
 		printf("ENCODER: (avi) %" PRIu64 " closing tag at %" PRIu64 " with size %i\n",
@@ -116,6 +113,37 @@ static void avi_close_tag(avi_context_t *avi_ctx, int64_t start_pos)
 
 }
 
+/*
+ * store little endian values in a memory buffer
+ *   (indexes are serialized in memory and written at once)
+ * args:
+ *   p - pointer to buffer
+ *   val - value to store
+ *
+ * asserts:
+ *   none
+ *
+ * returns: pointer to the next buffer position
+ */
+static uint8_t *avi_put_wl16(uint8_t *p, uint16_t val)
+{
+	p[0] = (uint8_t) (val & 0xff);
+	p[1] = (uint8_t) (val >> 8);
+	return p + 2;
+}
+
+static uint8_t *avi_put_wl32(uint8_t *p, uint32_t val)
+{
+	p = avi_put_wl16(p, (uint16_t) (val & 0xffff));
+	return avi_put_wl16(p, (uint16_t) (val >> 16));
+}
+
+static uint8_t *avi_put_wl64(uint8_t *p, uint64_t val)
+{
+	p = avi_put_wl32(p, (uint32_t) (val & 0xffffffff));
+	return avi_put_wl32(p, (uint32_t) (val >> 32));
+}
+
 /*
  * Calculate audio sample size from number of bits and number of channels.
  *    This may have to be adjusted for eg. 12 bits and stereo
@@ -410,6 +438,7 @@ void avi_create_riff_header(avi_context_t *avi_ctx, avi_riff_t *riff)
 		char tag[5];
 		avi_index_t *indexes = (avi_index_t *) stream->indexes;
 		indexes->entry = indexes->ents_allocated = 0;
+		indexes->master_entries = 0;
 		indexes->indx_start = io_get_offset(avi_ctx->writer);
 		int64_t ix = avi_open_tag(avi_ctx, "JUNK");           // ’ix##’
 		io_write_wl16(avi_ctx->writer, 4);               // wLongsPerEntry must be 4 (size of each entry in aIndex array)
@@ -486,17 +515,16 @@ avi_riff_t *avi_get_riff(avi_context_t *avi_ctx, int index)
 
 static void clean_indexes(avi_context_t *avi_ctx)
 {
-	int i=0, j=0;
+	int i=0;
 
 	for (i=0; i<avi_ctx->stream_list_size; i++)
     {
         stream_io_t *stream = get_stream(avi_ctx->stream_list, i);
 
 		avi_index_t *indexes = (avi_index_t *) stream->indexes;
-		for (j=0; j<indexes->ents_allocated/AVI_INDEX_CLUSTER_SIZE; j++)
-             free(indexes->cluster[j]);
-        av_freep(&indexes->cluster);
-        indexes->ents_allocated = indexes->entry = 0;
+		free(indexes->ents);
+		indexes->ents = NULL;
+		indexes->ents_allocated = indexes->entry = 0;
     }
 }
 
@@ -530,7 +558,13 @@ avi_riff_t *avi_add_new_riff(avi_context_t *avi_ctx)
 
 	avi_ctx->riff_list_size++;
 
-	clean_indexes(avi_ctx);
+	/*start the riff index (entries stay allocated)*/
+	int i = 0;
+	for (i = 0; i < avi_ctx->stream_list_size; i++)
+	{
+		stream_io_t *stream = get_stream(avi_ctx->stream_list, i);
+		((avi_index_t *) stream->indexes)->entry = 0;
+	}
 
 	if(verbosity > 0)
 		printf("ENCODER: (avi) adding new RIFF (%i)\n", riff->id);
@@ -659,15 +693,12 @@ void avi_destroy_context(avi_context_t *avi_ctx)
 
 avi_I_entry_t *avi_get_ientry(avi_index_t *idx, int ent_id)
 {
-	int cl = ent_id / AVI_INDEX_CLUSTER_SIZE;
-    int id = ent_id % AVI_INDEX_CLUSTER_SIZE;
-    return &idx->cluster[cl][id];
+	return &idx->ents[ent_id];
 }
 
 static int avi_write_counters(avi_context_t *avi_ctx, avi_riff_t *riff)
 {
     int n, nb_frames = 0;
-    io_flush_buffer(avi_ctx->writer);
 
 	//int time_base_num = avi_ctx->time_base_num;
 	//int time_base_den = avi_ctx->time_base_den;
@@ -686,14 +717,12 @@ static int avi_write_counters(avi_context_t *avi_ctx, avi_riff_t *riff)
 		}
 		else
 		{
-			io_seek(avi_ctx->writer, stream->rate_hdr_strm);
-
 			if(stream->type == STREAM_TYPE_VIDEO && avi_ctx->fps > 0.001)
 			{
 				uint32_t rate =(uint32_t) FRAME_RATE_SCALE * lrintf(avi_ctx->fps);
 				if(verbosity > 0)
 					fprintf(stderr,"ENCODER: (avi) storing rate(%i)\n",rate);
-				io_write_wl32(avi_ctx->writer, rate);
+				io_write_wl32_at(avi_ctx->writer, stream->rate_hdr_strm, rate);
 			}
 		}
 
@@ -703,17 +732,15 @@ static int avi_write_counters(avi_context_t *avi_ctx, avi_riff_t *riff)
 		}
 		else
 		{
-			io_seek(avi_ctx->writer, stream->frames_hdr_strm);
-
 			if(stream->type == STREAM_TYPE_VIDEO)
 			{
-				io_write_wl32(avi_ctx->writer, stream->packet_count);
+				io_write_wl32_at(avi_ctx->writer, stream->frames_hdr_strm, stream->packet_count);
 				nb_frames = MAX(nb_frames, stream->packet_count);
 			}
 			else
 			{
 				int sampsize = avi_audio_sample_size(stream);
-				io_write_wl32(avi_ctx->writer, 4*stream->audio_strm_length/sampsize);
+				io_write_wl32_at(avi_ctx->writer, stream->frames_hdr_strm, 4*stream->audio_strm_length/sampsize);
 			}
 		}
     }
@@ -733,19 +760,16 @@ static int avi_write_counters(avi_context_t *avi_ctx, avi_riff_t *riff)
 
 			avi_ctx->avi_flags |= AVIF_HASINDEX;
 
-			io_seek(avi_ctx->writer, riff_1->time_delay_off);
-			io_write_wl32(avi_ctx->writer, us_per_frame);      // time_per_frame
-			io_write_wl32(avi_ctx->writer, 0);                 // data rate
-			io_write_wl32(avi_ctx->writer, 0);                 // Padding multiple size (2048)
-			io_write_wl32(avi_ctx->writer, avi_ctx->avi_flags);    // parameter Flags
-			//io_seek(avi_ctx->writer, riff_1->frames_hdr_all);
-			io_write_wl32(avi_ctx->writer, nb_frames);
+			int64_t off = riff_1->time_delay_off;
+			io_write_wl32_at(avi_ctx->writer, off, us_per_frame);         // time_per_frame
+			io_write_wl32_at(avi_ctx->writer, off + 4, 0);                // data rate
+			io_write_wl32_at(avi_ctx->writer, off + 8, 0);                // Padding multiple size (2048)
+			io_write_wl32_at(avi_ctx->writer, off + 12, avi_ctx->avi_flags); // parameter Flags
+			//riff_1->frames_hdr_all
+			io_write_wl32_at(avi_ctx->writer, off + 16, nb_frames);
 		}
     }
 
-	//return to position (EOF)
-    io_seek(avi_ctx->writer, file_size);
-
     return 0;
 }
 
@@ -763,75 +787,149 @@ static int avi_write_ix(avi_context_t *avi_ctx)
     for (i=0;i<avi_ctx->stream_list_size;i++)
     {
         stream_io_t *stream = get_stream(avi_ctx->stream_list, i);
-        int64_t ix, pos;
+        avi_index_t *indexes = (avi_index_t *) stream->indexes;
 
         avi_stream2fourcc(tag, stream);
 
         ix_tag[3] = '0' + i; /*only 10 streams supported*/
 
-        /* Writing AVI OpenDML leaf index chunk */
-        ix = io_get_offset(avi_ctx->writer);
-        io_write_4cc(avi_ctx->writer, ix_tag);     /* ix?? */
-        avi_index_t *indexes = (avi_index_t *) stream->indexes;
-        io_write_wl32(avi_ctx->writer, indexes->entry * 8 + 24);
-                                      /* chunk size */
-        io_write_wl16(avi_ctx->writer, 2);           /* wLongsPerEntry */
-        io_write_w8(avi_ctx->writer, 0);             /* bIndexSubType (0 == frame index) */
-        io_write_w8(avi_ctx->writer, AVI_INDEX_OF_CHUNKS); /* bIndexType (1 == AVI_INDEX_OF_CHUNKS) */
-        io_write_wl32(avi_ctx->writer, indexes->entry);
-                                      /* nEntriesInUse */
-        io_write_4cc(avi_ctx->writer, tag);        /* dwChunkId */
-        io_write_wl64(avi_ctx->writer, riff->movi_list);/* qwBaseOffset */
-        io_write_wl32(avi_ctx->writer, 0);             /* dwReserved_3 (must be 0) */
+        /* AVI OpenDML leaf index chunk (serialized and written at once) */
+        int ix_size = indexes->entry * 8 + 32;
+        uint8_t *buf = malloc(ix_size);
+        if(buf == NULL)
+        {
+			fprintf(stderr, "ENCODER: FATAL memory allocation failure (avi_write_ix): %s\n", strerror(errno));
+			exit(-1);
+		}
+
+        uint8_t *p = buf;
+        memcpy(p, ix_tag, 4);                    /* ix?? */
+        p = avi_put_wl32(p + 4, indexes->entry * 8 + 24);
+                                                 /* chunk size */
+        p = avi_put_wl16(p, 2);                  /* wLongsPerEntry */
+        *p++ = 0;                                /* bIndexSubType (0 == frame index) */
+        *p++ = AVI_INDEX_OF_CHUNKS;              /* bIndexType (1 == AVI_INDEX_OF_CHUNKS) */
+        p = avi_put_wl32(p, indexes->entry);     /* nEntriesInUse */
+        memcpy(p, tag, 4);                       /* dwChunkId */
+        p = avi_put_wl64(p + 4, riff->movi_list);/* qwBaseOffset */
+        p = avi_put_wl32(p, 0);                  /* dwReserved_3 (must be 0) */
 
         for (j=0; j< indexes->entry; j++)
         {
              avi_I_entry_t *ie = avi_get_ientry(indexes, j);
-             io_write_wl32(avi_ctx->writer, ie->pos + 8);
-             io_write_wl32(avi_ctx->writer, ((uint32_t)ie->len & ~0x80000000) |
+             p = avi_put_wl32(p, ie->pos + 8);
+             p = avi_put_wl32(p, ((uint32_t)ie->len & ~0x80000000) |
                           (ie->flags & 0x10 ? 0 : 0x80000000));
-         }
-         io_flush_buffer(avi_ctx->writer);
-         pos = io_get_offset(avi_ctx->writer); //current position
-         if(verbosity > 0)
+        }
+
+        int64_t ix = io_get_offset(avi_ctx->writer);
+        io_write_buf(avi_ctx->writer, buf, ix_size);
+        free(buf);
+
+        if(verbosity > 0)
 			printf("ENCODER: (avi) wrote ix %s with %i entries\n",
 				tag, indexes->entry);
 
-         /* Updating one entry in the AVI OpenDML master index */
-         io_seek(avi_ctx->writer, indexes->indx_start);
-         io_write_4cc(avi_ctx->writer, "indx");            /* enabling this entry */
-         io_skip(avi_ctx->writer, 8);
-         io_write_wl32(avi_ctx->writer, riff->id);         /* nEntriesInUse */
-         io_skip(avi_ctx->writer, 16*(riff->id));
-         io_write_wl64(avi_ctx->writer, ix);               /* qwOffset */
-         io_write_wl32(avi_ctx->writer, pos - ix);         /* dwSize */
-         io_write_wl32(avi_ctx->writer, indexes->entry);   /* dwDuration */
-
-		//return to position
-         io_seek(avi_ctx->writer, pos);
+        /* AVI OpenDML master index entry (written at close) */
+        avi_ix_entry_t *master = &indexes->master[riff->id - 1];
+        master->offset = ix;                     /* qwOffset */
+        master->size = ix_size;                  /* dwSize */
+        master->duration = indexes->entry;       /* dwDuration */
+        indexes->master_entries = riff->id;
     }
     return 0;
 }
 
-static int avi_write_idx1(avi_context_t *avi_ctx, avi_riff_t *riff)
+/*
+ * write the AVI OpenDML master indexes
+ *   (enables the indx chunk laid out as JUNK in the header,
+ *    with a single positional write for each stream)
+ * args:
+ *   avi_ctx - pointer to avi context
+ *
+ * asserts:
+ *   none
+ *
+ * returns: none
+ */
+static void avi_write_master_index(avi_context_t *avi_ctx)
 {
+    char tag[5];
+    int i, j;
+
+    for (i=0;i<avi_ctx->stream_list_size;i++)
+    {
+        stream_io_t *stream = get_stream(avi_ctx->stream_list, i);
+        avi_index_t *indexes = (avi_index_t *) stream->indexes;
+
+        if (indexes->master_entries <= 0)
+            continue;
+
+        int indx_size = 32 + 16 * indexes->master_entries;
+        uint8_t *buf = malloc(indx_size);
+        if(buf == NULL)
+        {
+			fprintf(stderr, "ENCODER: FATAL memory allocation failure (avi_write_master_index): %s\n", strerror(errno));
+			exit(-1);
+		}
+
+        uint8_t *p = buf;
+        memcpy(p, "indx", 4);                    /* enabling the index */
+        p = avi_put_wl32(p + 4, 24 + 16 * AVI_MASTER_INDEX_SIZE);
+                                                 /* chunk size (same as the JUNK chunk) */
+        p = avi_put_wl16(p, 4);                  /* wLongsPerEntry */
+        *p++ = 0;                                /* bIndexSubType */
+        *p++ = AVI_INDEX_OF_INDEXES;             /* bIndexType */
+        p = avi_put_wl32(p, indexes->master_entries);
+                                                 /* nEntriesInUse */
+        memcpy(p, avi_stream2fourcc(tag, stream), 4);
+                                                 /* dwChunkId */
+        p = avi_put_wl32(p + 4, 0);              /* dwReserved[3] */
+        p = avi_put_wl32(p, 0);
+        p = avi_put_wl32(p, 0);
+
+        for (j=0; j<indexes->master_entries; j++)
+        {
+            p = avi_put_wl64(p, indexes->master[j].offset);
+            p = avi_put_wl32(p, indexes->master[j].size);
+            p = avi_put_wl32(p, indexes->master[j].duration);
+        }
 
-    int64_t idx_chunk;
+        io_write_at(avi_ctx->writer, indexes->indx_start, buf, indx_size);
+        free(buf);
+    }
+}
+
+static int avi_write_idx1(avi_context_t *avi_ctx, avi_riff_t *riff)
+{
     int i;
     char tag[5];
 
-
     stream_io_t *stream;
     avi_I_entry_t *ie = 0, *tie;
     int empty, stream_id = -1;
+    int entries = 0;
 
-    idx_chunk = avi_open_tag(avi_ctx, "idx1");
     for (i=0;i<avi_ctx->stream_list_size;i++)
     {
             stream = get_stream(avi_ctx->stream_list, i);
             stream->entry=0;
+            entries += ((avi_index_t *) stream->indexes)->entry;
     }
 
+    /* serialize the whole idx1 chunk and write it at once */
+    int idx_size = 8 + 16 * entries;
+    uint8_t *buf = malloc(idx_size);
+    if(buf == NULL)
+    {
+		fprintf(stderr, "ENCODER: FATAL memory allocation failure (avi_write_idx1): %s\n", strerror(errno));
+		exit(-1);
+	}
+
+    uint8_t *p = buf;
+    memcpy(p, "idx1", 4);
+    p = avi_put_wl32(p + 4, 16 * entries);
+
     do
     {
         empty = 1;
@@ -854,17 +952,18 @@ static int avi_write_idx1(avi_context_t *avi_ctx, avi_riff_t *riff)
         if (!empty)
         {
             stream = get_stream(avi_ctx->stream_list, stream_id);
-            avi_stream2fourcc(tag, stream);
-            io_write_4cc(avi_ctx->writer, tag);
-            io_write_wl32(avi_ctx->writer, ie->flags);
-            io_write_wl32(avi_ctx->writer, ie->pos);
-            io_write_wl32(avi_ctx->writer, ie->len);
+            memcpy(p, avi_stream2fourcc(tag, stream), 4);
+            p = avi_put_wl32(p + 4, ie->flags);
+            p = avi_put_wl32(p, ie->pos);
+            p = avi_put_wl32(p, ie->len);
             stream->entry++;
         }
     }
     while (!empty);
 
-    avi_close_tag(avi_ctx, idx_chunk);
+    io_write_buf(avi_ctx->writer, buf, idx_size);
+    free(buf);
+
     if(verbosity > 0)
 		printf("ENCODER: (avi) wrote idx1\n");
     avi_write_counters(avi_ctx, riff);
@@ -919,47 +1018,36 @@ int avi_write_packet(
 
 
     avi_index_t *idx = (avi_index_t *) stream->indexes;
-    int cl = idx->entry / AVI_INDEX_CLUSTER_SIZE;
-    int id = idx->entry % AVI_INDEX_CLUSTER_SIZE;
     if (idx->ents_allocated <= idx->entry)
     {
-        idx->cluster = realloc(idx->cluster, (cl+1)*sizeof(void*));
-        if (idx->cluster == NULL)
+        idx->ents = realloc(idx->ents,
+            (idx->ents_allocated + AVI_INDEX_GROW_SIZE) * sizeof(avi_I_entry_t));
+        if (idx->ents == NULL)
         {
 			fprintf(stderr, "ENCODER: FATAL memory allocation failure (avi_write_packet): %s\n", strerror(errno));
 			exit(-1);
 		}
-	
-        idx->cluster[cl] = calloc(AVI_INDEX_CLUSTER_SIZE, sizeof(avi_I_entry_t));
-        if (idx->cluster[cl] == NULL)
-		{
-			fprintf(stderr, "ENCODER: FATAL memory allocation failure (avi_write_packet): %s\n", strerror(errno));
-			exit(-1);
-		}
-        idx->ents_allocated += AVI_INDEX_CLUSTER_SIZE;
+        idx->ents_allocated += AVI_INDEX_GROW_SIZE;
     }
 
-    idx->cluster[cl][id].flags = i_flags;
-    idx->cluster[cl][id].pos = io_get_offset(avi_ctx->writer) - riff->movi_list;
-    idx->cluster[cl][id].len = size;
-    idx->entry++;
+    avi_I_entry_t *ie = &idx->ents[idx->entry++];
+    ie->flags = i_flags;
+    ie->pos = io_get_offset(avi_ctx->writer) - riff->movi_list;
+    ie->len = size;
 
 
     io_write_4cc(avi_ctx->writer, tag);
     io_write_wl32(avi_ctx->writer, size);
-    io_write_buf(avi_ctx->writer, data, size);
+    io_write_buf_nocopy(avi_ctx->writer, data, size);
     if (size & 1)
         io_write_w8(avi_ctx->writer, 0);
 
-    io_flush_buffer(avi_ctx->writer);
-
     return 0;
 }
 
 int avi_close(avi_context_t *avi_ctx)
 {
     int res = 0;
-    int64_t file_size;
 
     avi_riff_t *riff = avi_get_last_riff(avi_ctx);
 
@@ -977,10 +1065,9 @@ int avi_close(avi_context_t *avi_ctx)
         avi_close_tag(avi_ctx, riff->movi_list);
         avi_close_tag(avi_ctx, riff->riff_start);
 
-        file_size = io_get_offset(avi_ctx->writer);
-        io_seek(avi_ctx->writer, avi_ctx->odml_list - 8);
-        io_write_4cc(avi_ctx->writer, "LIST"); /* Making this AVI OpenDML one */
-        io_skip(avi_ctx->writer, 16);
+        /* Making this AVI OpenDML one */
+        io_write_at(avi_ctx->writer, avi_ctx->odml_list - 8, (uint8_t *) "LIST", 4);
+        avi_write_master_index(avi_ctx);
 
 		int n = 0;
 		int nb_frames = 0;
@@ -1000,8 +1087,7 @@ int avi_close(avi_context_t *avi_ctx)
                         nb_frames += stream->packet_count;
             }
         }
-        io_write_wl32(avi_ctx->writer, nb_frames);
-        io_seek(avi_ctx->writer, file_size);
+        io_write_wl32_at(avi_ctx->writer, avi_ctx->odml_list + 12, nb_frames); /* dwTotalFrames */
 
         avi_write_counters(avi_ctx, riff);
     }
@@ -33,6 +33,7 @@
 
 #define AVI_MAX_TRACKS 8
 #define FRAME_RATE_SCALE 1000 //1000000
+#define AVI_MASTER_INDEX_SIZE 256 /*max riff count (OpenDML master index entries)*/
 
 typedef struct _video_index_entry_t
 {
@@ -53,12 +54,24 @@ typedef struct avi_I_entry_t
     unsigned int flags, pos, len;
 } avi_I_entry_t;
 
+/*OpenDML master index entry (one for each riff)*/
+typedef struct avi_ix_entry_t
+{
+    int64_t  offset;   /*ix chunk file offset*/
+    uint32_t size;     /*ix chunk size*/
+    uint32_t duration; /*ix chunk entries*/
+} avi_ix_entry_t;
+
 typedef struct avi_index_t
 {
     int64_t     indx_start;
     int         entry;
     int         ents_allocated;
-    avi_I_entry_t **cluster;
+    avi_I_entry_t *ents; /*index entries of the current riff (contiguous)*/
+
+    /*master index (written once at close)*/
+    avi_ix_entry_t master[AVI_MASTER_INDEX_SIZE];
+    int         master_entries;
 } avi_index_t;
 
 typedef struct _avi_riff_t
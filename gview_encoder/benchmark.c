@@ -0,0 +1,239 @@
+/*******************************************************************************#
+#           guvcview              http://guvcview.sourceforge.net               #
+#                                                                               #
+#           Paulo Assis <pj.assis@gmail.com>                                    #
+#                                                                               #
+# This program is free software; you can redistribute it and/or modify          #
+# it under the terms of the GNU General Public License as published by          #
+# the Free Software Foundation; either version 2 of the License, or             #
+# (at your option) any later version.                                           #
+#                                                                               #
+# This program is distributed in the hope that it will be useful,               #
+# but WITHOUT ANY WARRANTY; without even the implied warranty of                #
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the                 #
+# GNU General Public License for more details.                                  #
+#                                                                               #
+# You should have received a copy of the GNU General Public License             #
+# along with this program; if not, write to the Free Software                   #
+# Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA     #
+#                                                                               #
+********************************************************************************/
+
+/*******************************************************************************#
+#                                                                               #
+#  Encoder library - video encoder thread scaling benchmark                     #
+#                                                                               #
+********************************************************************************/
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <inttypes.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <errno.h>
+#include <linux/videodev2.h>
+/* support for internationalization - i18n */
+#include <locale.h>
+#include <libintl.h>
+
+#include "gviewencoder.h"
+#include "encoder.h"
+#include "gview.h"
+
+extern int verbosity;
+
+/*distinct synthetic frames (reused in every run)*/
+#define ENCODER_BENCHMARK_INPUT_FRAMES 8
+
+/*
+ * fill a synthetic yu12 frame (moving gradient with some noise)
+ * args:
+ *   frame - yu12 frame buffer
+ *   width - frame width
+ *   height - frame height
+ *   n - frame number
+ *   seed - pointer to noise generator state
+ *
+ * asserts:
+ *   none
+ *
+ * returns: none
+ */
+static void benchmark_fill_frame(uint8_t *frame, int width, int height, int n, uint32_t *seed)
+{
+	int i = 0;
+	int j = 0;
+
+	uint8_t *py = frame;
+	for(j = 0; j < height; j++)
+	{
+		for(i = 0; i < width; i++)
+		{
+			*seed ^= *seed << 13;
+			*seed ^= *seed >> 17;
+			*seed ^= *seed << 5;
+			*py++ = (uint8_t) (((i + j + 4 * n) & 0xff) ^ (*seed & 0x0f));
+		}
+	}
+
+	uint8_t *pu = frame + width * height;
+	uint8_t *pv = pu + (width * height) / 4;
+	for(j = 0; j < height / 2; j++)
+	{
+		for(i = 0; i < width / 2; i++)
+		{
+			*pu++ = (uint8_t) (128 + ((i - n) & 0x3f) - 32);
+			*pv++ = (uint8_t) (128 + ((j + n) & 0x3f) - 32);
+		}
+	}
+}
+
+/*
+ * encode the synthetic frames with a video codec
+ * args:
+ *   codec_ind - video codec list index
+ *   width - frame width
+ *   height - frame height
+ *   frames - number of frames to encode
+ *   threads - number of encoder threads
+ *   input - synthetic frames (ENCODER_BENCHMARK_INPUT_FRAMES, reused)
+ *
+ * asserts:
+ *   none
+ *
+ * returns: encoding frame rate (< 0 on error)
+ */
+static double benchmark_run(int codec_ind, int width, int height, int frames,
+	int threads, uint8_t **input)
+{
+	encoder_set_video_threads(threads);
+
+	encoder_context_t *encoder_ctx = encoder_init(
+		V4L2_PIX_FMT_YUV420,
+		codec_ind,
+		-1,
+		ENCODER_MUX_MKV,
+		width,
+		height,
+		1,
+		30,
+		0,
+		0);
+
+	if(encoder_ctx == NULL || encoder_ctx->enc_video_ctx == NULL ||
+		encoder_ctx->enc_video_ctx->codec_data == NULL)
+	{
+		encoder_close(encoder_ctx);
+		return -1;
+	}
+
+	struct timespec t_start, t_end;
+	clock_gettime(CLOCK_MONOTONIC, &t_start);
+
+	int i = 0;
+	for(i = 0; i < frames; i++)
+	{
+		encoder_ctx->enc_video_ctx->pts = (int64_t) i * NSEC_PER_SEC / 30;
+		encoder_encode_video(encoder_ctx, input[i % ENCODER_BENCHMARK_INPUT_FRAMES]);
+	}
+
+	/*delayed frames (frame threads)*/
+	encoder_ctx->enc_video_ctx->flush_delayed_frames = 1;
+	for(i = 0; i < MAX_DELAYED_FRAMES && !encoder_ctx->enc_video_ctx->flush_done; i++)
+		encoder_encode_video(encoder_ctx, NULL);
+
+	clock_gettime(CLOCK_MONOTONIC, &t_end);
+
+	encoder_close(encoder_ctx);
+
+	double elapsed = (double) (t_end.tv_sec - t_start.tv_sec) +
+		(double) (t_end.tv_nsec - t_start.tv_nsec) / NSEC_PER_SEC;
+
+	return (elapsed > 0) ? frames / elapsed : 0;
+}
+
+/*
+ * encode synthetic yu12 frames with every valid video codec
+ *  at 1 to max_threads threads and print the frame rate
+ *  and the scaling efficiency (speedup / threads)
+ * args:
+ *   width - frame width
+ *   height - frame height
+ *   frames - number of frames to encode in each run
+ *   max_threads - maximum number of threads (0 - number of cpu cores)
+ *
+ * asserts:
+ *    none
+ *
+ * returns: error code (video threads are reset to ENCODER_THREADS_DEFAULT)
+ */
+int encoder_video_benchmark(int width, int height, int frames, int max_threads)
+{
+	int i = 0;
+	int t = 0;
+
+	if(width <= 0 || height <= 0 || (width & 1) || (height & 1))
+	{
+		fprintf(stderr, "ENCODER: (benchmark) invalid resolution %ix%i\n", width, height);
+		return -1;
+	}
+	if(frames <= 0)
+		frames = 100;
+	if(max_threads <= 0)
+		max_threads = (int) sysconf(_SC_NPROCESSORS_ONLN);
+	if(max_threads < 1)
+		max_threads = 1;
+
+	/*keep encoder messages out of the results*/
+	int old_verbosity = verbosity;
+	verbosity = 0;
+
+	uint8_t *input[ENCODER_BENCHMARK_INPUT_FRAMES];
+	uint32_t seed = 0x9E3779B9;
+	for(i = 0; i < ENCODER_BENCHMARK_INPUT_FRAMES; i++)
+	{
+		input[i] = calloc((width * height * 3) / 2, sizeof(uint8_t));
+		if(input[i] == NULL)
+		{
+			fprintf(stderr, "ENCODER: FATAL memory allocation failure (encoder_video_benchmark): %s\n", strerror(errno));
+			exit(-1);
+		}
+		benchmark_fill_frame(input[i], width, height, i, &seed);
+	}
+
+	printf("ENCODER: video encoder benchmark %ix%i, %i frames, 1 to %i threads (auto: %i)\n",
+		width, height, frames, max_threads, encoder_get_auto_video_threads(width, height));
+	printf("%-24s %8s %10s %8s %10s\n", "codec", "threads", "fps", "speedup", "efficiency");
+
+	/*skip the raw codec (index 0)*/
+	for(i = 1; i < encoder_get_valid_video_codecs(); i++)
+	{
+		video_codec_t *defaults = encoder_get_video_codec_defaults(i);
+		double fps_1 = 0;
+
+		for(t = 1; t <= max_threads; t++)
+		{
+			double fps = benchmark_run(i, width, height, frames, t, input);
+			if(fps < 0)
+			{
+				printf("%-24s %8s\n", defaults->codec_name, "n/a");
+				break;
+			}
+			if(t == 1)
+				fps_1 = fps;
+
+			double speedup = (fps_1 > 0) ? fps / fps_1 : 0;
+			printf("%-24s %8i %10.1f %8.2f %9.0f%%\n",
+				defaults->codec_name, t, fps, speedup, 100 * speedup / t);
+		}
+	}
+
+	for(i = 0; i < ENCODER_BENCHMARK_INPUT_FRAMES; i++)
+		free(input[i]);
+
+	encoder_set_video_threads(ENCODER_THREADS_DEFAULT);
+	verbosity = old_verbosity;
+
+	return 0;
+}
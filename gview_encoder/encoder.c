@@ -40,6 +40,7 @@
 #include <linux/videodev2.h>
 #include <errno.h>
 #include <assert.h>
+#include <time.h>
 /* support for internationalization - i18n */
 #include <locale.h>
 #include <libintl.h>
@@ -48,11 +49,13 @@
 #include "gviewencoder.h"
 #include "encoder.h"
 #include "stream_io.h"
+#include "file_io.h"
 #include "gview.h"
 
 #if LIBAVUTIL_VER_AT_LEAST(52,2)
 #include <libavutil/channel_layout.h>
 #endif
+#include <libavutil/pixdesc.h>
 
 int verbosity = 0;
 
@@ -75,6 +78,48 @@ static int video_read_index = 0;
 static int video_write_index = 0;
 static int video_scheduler = 0;
 
+/*libav video encoder threads (ENCODER_THREADS_DEFAULT, ENCODER_THREADS_AUTO or count)*/
+#define ENCODER_MAX_VIDEO_THREADS 16
+static int video_threads = ENCODER_THREADS_DEFAULT;
+
+/*libav encoders input conversion (crop, scale and pixel format)*/
+static int video_crop_x = 0;
+static int video_crop_y = 0;
+static int video_crop_width = 0;  /*0 - no crop*/
+static int video_crop_height = 0;
+static int video_scale_width = 0; /*0 - no scaling*/
+static int video_scale_height = 0;
+static char video_pix_fmt[32] = ""; /*empty - codec default*/
+static int video_motion = 0; /*ENCODER_MOTION_XXX flags*/
+
+/*
+ * encoder load governor (libav encoders):
+ *  frames are dropped at evenly spaced intervals when the
+ *  encode time is over the frame time or the ring buffer fills up
+ */
+#define ENCODER_GOV_MIN_KEEP (0.25) /*always encode at least 1 in 4 frames*/
+static double gov_encode_time = 0; /*average frame encode time (ms)*/
+static double gov_frame_time = 0;  /*average capture frame interval (ms)*/
+static double gov_keep_ratio = 1.0; /*fraction of frames encoded*/
+static double gov_keep_acc = 0;
+static int64_t gov_last_ts = 0;
+static int64_t gov_dropped = 0;
+static int gov_enabled = 1;
+
+/*
+ * pre-roll buffer (packets kept before recording starts):
+ *  same slots as the video ring buffer, with the frame data
+ *  stored in a single preallocated ring (fixed memory budget)
+ */
+static __MUTEX_TYPE preroll_mutex = __STATIC_MUTEX_INIT;
+static int64_t preroll_time = 0; /*nanosec*/
+static uint8_t *preroll_data = NULL; /*frame data ring*/
+static int preroll_data_size = 0;
+static video_buffer_t *preroll_list = NULL;
+static int preroll_list_size = 0;
+static int preroll_head = 0; /*oldest packet index*/
+static int preroll_count = 0;
+
 /*
  * set verbosity
  * args:
@@ -90,6 +135,313 @@ void encoder_set_verbosity(int value)
 	verbosity = value;
 }
 
+/*
+ * set output file write flags (used for new files)
+ * args:
+ *   flags - ENCODER_IO_XXX flags (0 - default buffered writes)
+ *
+ * asserts:
+ *    none
+ *
+ * returns: none
+ */
+void encoder_set_file_io_flags(int flags)
+{
+	io_set_file_flags(flags);
+}
+
+/*
+ * set the libav video encoder threads (used for new encoders)
+ * args:
+ *   threads - number of threads or
+ *      ENCODER_THREADS_DEFAULT - codec list default
+ *      ENCODER_THREADS_AUTO - set from the cpu core count and resolution
+ *
+ * asserts:
+ *    none
+ *
+ * returns: none
+ */
+void encoder_set_video_threads(int threads)
+{
+	video_threads = (threads < 0) ? ENCODER_THREADS_AUTO : threads;
+}
+
+/*
+ * enable or disable the encoder load governor (frame dropping)
+ *   should be disabled when frame timestamps don't follow the
+ *   capture rate (e.g. time-lapse video)
+ * args:
+ *   enable - flag (1 - enabled, default; 0 - disabled)
+ *
+ * asserts:
+ *    none
+ *
+ * returns: none
+ */
+void encoder_set_video_governor(int enable)
+{
+	gov_enabled = enable ? 1 : 0;
+}
+
+/*
+ * get the number of video encoder threads in auto mode
+ *  (one thread for each 640x360 block, leaving a core
+ *   for capture and render on hosts with more than 2 cores)
+ * args:
+ *   width - video width
+ *   height - video height
+ *
+ * asserts:
+ *    none
+ *
+ * returns: number of threads
+ */
+int encoder_get_auto_video_threads(int width, int height)
+{
+	int cores = (int) sysconf(_SC_NPROCESSORS_ONLN);
+	if(cores < 1)
+		cores = 1;
+	if(cores > 2)
+		cores--;
+
+	int threads = (width * height + (640 * 360) - 1) / (640 * 360);
+
+	if(threads > cores)
+		threads = cores;
+	if(threads > ENCODER_MAX_VIDEO_THREADS)
+		threads = ENCODER_MAX_VIDEO_THREADS;
+	if(threads < 1)
+		threads = 1;
+
+	return threads;
+}
+
+/*
+ * set the crop rectangle of the capture frame for libav encoders
+ *  (used for new encoders, values are rounded down to even numbers)
+ * args:
+ *   x - left offset
+ *   y - top offset
+ *   width - crop width (0 - no crop)
+ *   height - crop height (0 - no crop)
+ *
+ * asserts:
+ *    none
+ *
+ * returns: none
+ */
+void encoder_set_video_crop(int x, int y, int width, int height)
+{
+	video_crop_x = MAX(x, 0) & ~1;
+	video_crop_y = MAX(y, 0) & ~1;
+	video_crop_width = MAX(width, 0) & ~1;
+	video_crop_height = MAX(height, 0) & ~1;
+}
+
+/*
+ * set the encoded frame size for libav encoders (used for new encoders)
+ *   the (cropped) capture frame is scaled to this size
+ * args:
+ *   width - encoded width (0 - from height keeping the aspect ratio)
+ *   height - encoded height (0 - from width keeping the aspect ratio)
+ *   (both 0 - no scaling)
+ *
+ * asserts:
+ *    none
+ *
+ * returns: none
+ */
+void encoder_set_video_scale(int width, int height)
+{
+	video_scale_width = MAX(width, 0) & ~1;
+	video_scale_height = MAX(height, 0) & ~1;
+}
+
+/*
+ * set the pixel format for libav encoders (used for new encoders)
+ *   the yu12 input is converted if the codec supports the format
+ * args:
+ *   pix_fmt - libav pixel format name, e.g. yuv422p or nv12 (NULL - codec default)
+ *
+ * asserts:
+ *    none
+ *
+ * returns: none
+ */
+void encoder_set_video_pix_fmt(const char *pix_fmt)
+{
+	video_pix_fmt[0] = '\0';
+	if(pix_fmt)
+		strncpy(video_pix_fmt, pix_fmt, sizeof(video_pix_fmt) - 1);
+}
+
+/*
+ * set motion aware encoding for libav encoders (used for new encoders)
+ * args:
+ *   flags - ENCODER_MOTION_XXX flags (0 - disabled)
+ *
+ * asserts:
+ *    none
+ *
+ * returns: none
+ */
+void encoder_set_video_motion(int flags)
+{
+	video_motion = flags & (ENCODER_MOTION_ROI | ENCODER_MOTION_SKIP);
+}
+
+/*
+ * set the input conversion rectangle and the encoded frame size
+ *  (encoder_ctx video size is changed to the encoded size)
+ * args:
+ *   encoder_ctx - pointer to encoder context
+ *   codec_data - pointer to video codec data
+ *
+ * asserts:
+ *   none
+ *
+ * returns: none
+ */
+static void encoder_set_video_conversion(encoder_context_t *encoder_ctx,
+	encoder_codec_data_t *codec_data)
+{
+	int in_width = encoder_ctx->video_width;
+	int in_height = encoder_ctx->video_height;
+
+	codec_data->in_width = in_width;
+	codec_data->in_height = in_height;
+
+	codec_data->crop_x = 0;
+	codec_data->crop_y = 0;
+	codec_data->crop_width = in_width;
+	codec_data->crop_height = in_height;
+
+	if(video_crop_width > 0 && video_crop_height > 0)
+	{
+		if(video_crop_x + video_crop_width <= in_width &&
+			video_crop_y + video_crop_height <= in_height)
+		{
+			codec_data->crop_x = video_crop_x;
+			codec_data->crop_y = video_crop_y;
+			codec_data->crop_width = video_crop_width;
+			codec_data->crop_height = video_crop_height;
+		}
+		else
+			fprintf(stderr, "ENCODER: crop %ix%i+%i+%i is outside the %ix%i frame - not cropping\n",
+				video_crop_width, video_crop_height, video_crop_x, video_crop_y,
+				in_width, in_height);
+	}
+
+	int width = video_scale_width;
+	int height = video_scale_height;
+	if(width <= 0 && height <= 0)
+	{
+		width = codec_data->crop_width;
+		height = codec_data->crop_height;
+	}
+	else if(width <= 0)
+		width = (int) (((int64_t) codec_data->crop_width * height / codec_data->crop_height) & ~1);
+	else if(height <= 0)
+		height = (int) (((int64_t) codec_data->crop_height * width / codec_data->crop_width) & ~1);
+
+	encoder_ctx->video_width = MAX(width, 2);
+	encoder_ctx->video_height = MAX(height, 2);
+}
+
+/*
+ * check if a video codec takes a pixel format
+ * args:
+ *   codec - pointer to libav codec
+ *   pix_fmt - pixel format
+ *
+ * asserts:
+ *   none
+ *
+ * returns: 1 if supported (or unknown), 0 otherwise
+ */
+static int encoder_codec_has_pix_fmt(const AVCodec *codec, enum AVPixelFormat pix_fmt)
+{
+	if(!codec->pix_fmts)
+		return 1;
+
+	const enum AVPixelFormat *p = codec->pix_fmts;
+	for(; *p != AV_PIX_FMT_NONE; p++)
+		if(*p == pix_fmt)
+			return 1;
+
+	return 0;
+}
+
+/*
+ * set the video codec thread count and type
+ * args:
+ *   codec_data - pointer to video codec data
+ *   video_defaults - pointer to video codec defaults
+ *   width - video width
+ *   height - video height
+ *
+ * asserts:
+ *   none
+ *
+ * returns: none
+ */
+static void encoder_set_video_threading(encoder_codec_data_t *codec_data,
+	video_codec_t *video_defaults, int width, int height)
+{
+	AVCodecContext *codec_context = codec_data->codec_context;
+	int threads = video_threads;
+
+	if(threads == ENCODER_THREADS_DEFAULT)
+	{
+		if (video_defaults->num_threads > 0)
+			codec_context->thread_count = video_defaults->num_threads;
+		return;
+	}
+
+	if(threads == ENCODER_THREADS_AUTO)
+	{
+		/*codecs set as single threaded in the codec list*/
+		if(video_defaults->num_threads == 1)
+		{
+			codec_context->thread_count = 1;
+			return;
+		}
+		threads = encoder_get_auto_video_threads(width, height);
+	}
+
+	int caps = codec_data->codec->capabilities;
+
+#ifdef AV_CODEC_CAP_OTHER_THREADS
+	if(caps & AV_CODEC_CAP_OTHER_THREADS)
+#else
+	if(caps & AV_CODEC_CAP_AUTO_THREADS)
+#endif
+	{
+		/*external library threads (x264, x265, vpx): frame threads scale best*/
+		codec_context->thread_type = FF_THREAD_FRAME;
+	}
+	else if(caps & AV_CODEC_CAP_SLICE_THREADS)
+	{
+		/*no added latency - at most one slice per macroblock row*/
+		int mb_rows = (height + 15) / 16;
+		if(threads > mb_rows)
+			threads = mb_rows;
+		codec_context->thread_type = FF_THREAD_SLICE;
+	}
+	else if(caps & AV_CODEC_CAP_FRAME_THREADS)
+		codec_context->thread_type = FF_THREAD_FRAME;
+	else
+		threads = 1;
+
+	codec_context->thread_count = threads;
+
+	if(verbosity > 0)
+		printf("ENCODER: video encoder %s using %i thread(s) (%s)\n",
+			video_defaults->codec_name, threads,
+			(threads > 1 && codec_context->thread_type == FF_THREAD_SLICE) ? "slice" : "frame");
+}
+
 /*
  * allocate video ring buffer
  * args:
@@ -98,6 +450,7 @@ void encoder_set_verbosity(int value)
  *   fps_den - frames per sec (denominator)
  *   fps_num - frames per sec (numerator)
  *   codec_ind - video codec index (0 -raw)
+ *   held_frames - frames that may stay referenced by the encoder
  *
  * asserts:
  *   none
@@ -109,11 +462,13 @@ static void encoder_alloc_video_ring_buffer(
 	int video_height,
 	int fps_den,
 	int fps_num,
-	int codec_ind)
+	int codec_ind,
+	int held_frames)
 {
 	video_ring_buffer_size = (fps_den * 3) / (fps_num * 2); /* 1.5 sec */
 	if(video_ring_buffer_size < 20)
 		video_ring_buffer_size = 20; /*at least 20 frames buffer*/
+	video_ring_buffer_size += held_frames;
 	video_ring_buffer = calloc(video_ring_buffer_size, sizeof(video_buffer_t));
 	if(video_ring_buffer == NULL)
 	{
@@ -265,26 +620,12 @@ static void encoder_set_raw_video_input(
 			strncpy(video_defaults->compressor, "MJPG", 5);
 			video_defaults->mkv_4cc = v4l2_fourcc('M','J','P','G');
 			strncpy(video_defaults->mkv_codec, "V_MS/VFW/FOURCC", 25);
-			encoder_ctx->enc_video_ctx->outbuf_size =  (encoder_ctx->video_width * encoder_ctx->video_height) / 2;
-			encoder_ctx->enc_video_ctx->outbuf = calloc(encoder_ctx->enc_video_ctx->outbuf_size, sizeof(uint8_t));
-			if(encoder_ctx->enc_video_ctx->outbuf == NULL)
-			{
-				fprintf(stderr, "ENCODER: FATAL memory allocation failure (encoder_video_init): %s\n", strerror(errno));
-				exit(-1);
-			}
 			break;
 
 		case V4L2_PIX_FMT_H264:
 			strncpy(video_defaults->compressor, "H264", 5);
 			video_defaults->mkv_4cc = v4l2_fourcc('H','2','6','4');
 			strncpy(video_defaults->mkv_codec, "V_MPEG4/ISO/AVC", 25);
-			encoder_ctx->enc_video_ctx->outbuf_size = (encoder_ctx->video_width * encoder_ctx->video_height) / 2;
-			encoder_ctx->enc_video_ctx->outbuf = calloc(encoder_ctx->enc_video_ctx->outbuf_size, sizeof(uint8_t));
-			if(encoder_ctx->enc_video_ctx->outbuf == NULL)
-			{
-				fprintf(stderr, "ENCODER: FATAL memory allocation failure (encoder_video_init): %s\n", strerror(errno));
-				exit(-1);
-			}
 			break;
 
 		default:
@@ -299,13 +640,6 @@ static void encoder_set_raw_video_input(
 			strncpy(video_defaults->compressor, fourcc, 5);
 			video_defaults->mkv_4cc = encoder_ctx->input_format; //v4l2_fourcc('Y','U','Y','2')
 			strncpy(video_defaults->mkv_codec, "V_MS/VFW/FOURCC", 25);
-			encoder_ctx->enc_video_ctx->outbuf_size = encoder_ctx->video_width * encoder_ctx->video_height * 3; //max of 3 bytes per pixel
-			encoder_ctx->enc_video_ctx->outbuf = calloc(encoder_ctx->enc_video_ctx->outbuf_size, sizeof(uint8_t));
-			if(encoder_ctx->enc_video_ctx->outbuf == NULL)
-			{
-				fprintf(stderr, "ENCODER: FATAL memory allocation failure (encoder_video_init): %s\n", strerror(errno));
-				exit(-1);
-			}
 			break;
 		}
 	}
@@ -396,18 +730,6 @@ static encoder_video_context_t *encoder_video_init(encoder_context_t *encoder_ct
 		video_defaults = encoder_get_video_codec_defaults(0);
 		encoder_set_raw_video_input(encoder_ctx, video_defaults);
 
-		//alloc outbuf
-		if(enc_video_ctx->outbuf_size <= 0)
-			enc_video_ctx->outbuf_size = 240000;//1792
-		if(enc_video_ctx->outbuf != NULL)
-			free(enc_video_ctx->outbuf);
-		enc_video_ctx->outbuf = calloc(enc_video_ctx->outbuf_size, sizeof(uint8_t));
-		if(enc_video_ctx->outbuf == NULL)
-		{
-			fprintf(stderr, "ENCODER: FATAL memory allocation failure (encoder_video_init): %s\n", strerror(errno));
-			exit(-1);
-		}
-
 		return (enc_video_ctx);
 	}
 
@@ -423,14 +745,17 @@ static encoder_video_context_t *encoder_video_init(encoder_context_t *encoder_ct
 		exit(-1);
 	}
 
+	/*crop and scale (sets the encoded video size)*/
+	encoder_set_video_conversion(encoder_ctx, video_codec_data);
+
 	/*set codec defaults*/
 	video_codec_data->codec_context->bit_rate = video_defaults->bit_rate;
 	video_codec_data->codec_context->width = encoder_ctx->video_width;
 	video_codec_data->codec_context->height = encoder_ctx->video_height;
 
 	video_codec_data->codec_context->flags |= video_defaults->flags;
-	if (video_defaults->num_threads > 0)
-		video_codec_data->codec_context->thread_count = video_defaults->num_threads;
+	encoder_set_video_threading(video_codec_data, video_defaults,
+		encoder_ctx->video_width, encoder_ctx->video_height);
 	/*
 	 * mb_decision:
 	 * 0 (FF_MB_DECISION_SIMPLE) Use mbcmp (default).
@@ -474,6 +799,17 @@ static encoder_video_context_t *encoder_video_init(encoder_context_t *encoder_ct
 	video_codec_data->codec_context->codec_type = AVMEDIA_TYPE_VIDEO;
 
 	video_codec_data->codec_context->pix_fmt =  video_defaults->pix_fmt; //only yuv420p available for mpeg
+	/*requested pixel format (the yu12 input is converted)*/
+	if(video_pix_fmt[0] != '\0')
+	{
+		enum AVPixelFormat pix_fmt = av_get_pix_fmt(video_pix_fmt);
+		if(pix_fmt != AV_PIX_FMT_NONE && sws_isSupportedOutput(pix_fmt) &&
+			encoder_codec_has_pix_fmt(video_codec_data->codec, pix_fmt))
+			video_codec_data->codec_context->pix_fmt = pix_fmt;
+		else
+			fprintf(stderr, "ENCODER: pixel format %s not supported by %s - using codec default\n",
+				video_pix_fmt, video_defaults->codec_name);
+	}
 	if(video_defaults->fps)
 		video_codec_data->codec_context->time_base = (AVRational){1, video_defaults->fps}; //use codec properties fps
 	else if (encoder_ctx->fps_den >= 5)
@@ -501,6 +837,24 @@ static encoder_video_context_t *encoder_video_init(encoder_context_t *encoder_ct
 	   av_dict_set(&video_codec_data->private_options, "preset", "ultrafast", 0);
 	}
 
+	/*crop, scale or pixel format conversion of the yu12 input*/
+	if(encoder_video_scaler_init(video_codec_data,
+		encoder_get_auto_video_threads(video_codec_data->in_width, video_codec_data->in_height)) < 0)
+	{
+		fprintf(stderr, "ENCODER: couldn't set the video input conversion - using %ix%i yu12 input\n",
+			video_codec_data->in_width, video_codec_data->in_height);
+		/*no crop or scale: yu12 input is encoded in place*/
+		video_codec_data->crop_x = 0;
+		video_codec_data->crop_y = 0;
+		video_codec_data->crop_width = video_codec_data->in_width;
+		video_codec_data->crop_height = video_codec_data->in_height;
+		encoder_ctx->video_width = video_codec_data->in_width;
+		encoder_ctx->video_height = video_codec_data->in_height;
+		video_codec_data->codec_context->width = encoder_ctx->video_width;
+		video_codec_data->codec_context->height = encoder_ctx->video_height;
+		video_codec_data->codec_context->pix_fmt = AV_PIX_FMT_YUV420P;
+	}
+
 	int ret = 0;
 	/* open codec*/
 	if ((ret = avcodec_open2(
@@ -509,6 +863,10 @@ static encoder_video_context_t *encoder_video_init(encoder_context_t *encoder_ct
 		&video_codec_data->private_options)) < 0)
 	{
 		fprintf(stderr, "ENCODER: could not open video codec (%s): %i - using raw input\n", video_defaults->codec_name, ret);
+		/*raw input is not converted*/
+		encoder_ctx->video_width = video_codec_data->in_width;
+		encoder_ctx->video_height = video_codec_data->in_height;
+		encoder_video_scaler_close(video_codec_data);
 		free(video_codec_data->codec_context);
 		video_codec_data->codec_context = NULL;
 		video_codec_data->codec = 0;
@@ -517,18 +875,6 @@ static encoder_video_context_t *encoder_video_init(encoder_context_t *encoder_ct
 		video_defaults = encoder_get_video_codec_defaults(0);
 		encoder_set_raw_video_input(encoder_ctx, video_defaults);
 
-		//alloc outbuf
-		if(enc_video_ctx->outbuf_size <= 0)
-			enc_video_ctx->outbuf_size = 240000;//1792
-		if(enc_video_ctx->outbuf != NULL)
-			free(enc_video_ctx->outbuf);
-		enc_video_ctx->outbuf = calloc(enc_video_ctx->outbuf_size, sizeof(uint8_t));
-		if(enc_video_ctx->outbuf == NULL)
-		{
-			fprintf(stderr, "ENCODER: FATAL memory allocation failure (encoder_video_init): %s\n", strerror(errno));
-			exit(-1);
-		}
-
 		return (enc_video_ctx);
 	}
 
@@ -549,6 +895,13 @@ static encoder_video_context_t *encoder_video_init(encoder_context_t *encoder_ct
 		exit(-1);
 	}
 
+	/*motion aware encoding (roi only for codecs that take quantizer offsets)*/
+	int motion_flags = video_motion;
+	if(!video_defaults->motion_roi)
+		motion_flags &= ~ENCODER_MOTION_ROI;
+	if(motion_flags)
+		video_codec_data->motion = encoder_motion_create(motion_flags);
+
 	/*set the codec data in codec context*/
 	enc_video_ctx->codec_data = (void *) video_codec_data;
 
@@ -556,18 +909,7 @@ static encoder_video_context_t *encoder_video_init(encoder_context_t *encoder_ct
 
 	enc_video_ctx->monotonic_pts = video_defaults->monotonic_pts;
 
-	//alloc outbuf
-	enc_video_ctx->outbuf_size = (encoder_ctx->video_width * encoder_ctx->video_height) / 2;
-	if(enc_video_ctx->outbuf_size <= 0)
-		enc_video_ctx->outbuf_size = 240000;//1792
-	if(enc_video_ctx->outbuf != NULL)
-		free(enc_video_ctx->outbuf);
-	enc_video_ctx->outbuf = calloc(enc_video_ctx->outbuf_size, sizeof(uint8_t));
-	if(enc_video_ctx->outbuf == NULL)
-	{
-		fprintf(stderr, "ENCODER: FATAL memory allocation failure (encoder_video_init): %s\n", strerror(errno));
-		exit(-1);
-	}
+	/*coded packets are muxed from the libav packet (no outbuf)*/
 
 	enc_video_ctx->read_df = -1;
 	enc_video_ctx->write_df = -1;
@@ -932,6 +1274,31 @@ int encoder_get_max_audio_sample_fmt()
 	return AV_SAMPLE_FMT_NB-1;
 }
 
+/*
+ * get the number of used frames in the video ring buffer
+ *  (called with the buffer mutex locked)
+ * args:
+ *   none
+ *
+ * asserts:
+ *   none
+ *
+ * returns: number of used frames
+ */
+static int encoder_video_buffer_used()
+{
+	int diff_ind = 0;
+
+	if(video_write_index > video_read_index)
+		diff_ind = video_write_index - video_read_index;
+	else if(video_write_index < video_read_index)
+		diff_ind = (video_ring_buffer_size - video_read_index) + video_write_index;
+	else if(video_ring_buffer[video_read_index].flag != VIDEO_BUFF_FREE)
+		diff_ind = video_ring_buffer_size; /*full*/
+
+	return diff_ind;
+}
+
 /*
  * get an estimated write loop sleep time to avoid a ring buffer overrun
  * args:
@@ -953,10 +1320,7 @@ double encoder_buff_scheduler(int mode, double thresh, double max_time)
 
 	__LOCK_MUTEX( __PMUTEX );
 	/* try to balance buffer overrun in read/write operations */
-	if(video_write_index >= video_read_index)
-		diff_ind = video_write_index - video_read_index;
-	else
-		diff_ind = (video_ring_buffer_size - video_read_index) + video_write_index;
+	diff_ind = encoder_video_buffer_used();
 	__UNLOCK_MUTEX( __PMUTEX );
 
 	/*clip ring buffer threshold*/
@@ -1096,12 +1460,22 @@ encoder_context_t *encoder_init(
 		encoder_ctx->audio_channels = 0; /*no audio*/
 
 	/****************** ring buffer *****************/
+	/*frames kept referenced by libav (frame threads and b-frame delay)*/
+	int held_frames = 0;
+	if(encoder_ctx->enc_video_ctx && encoder_ctx->enc_video_ctx->codec_data)
+	{
+		AVCodecContext *avctx =
+			((encoder_codec_data_t *) encoder_ctx->enc_video_ctx->codec_data)->codec_context;
+		held_frames = MAX(avctx->thread_count, 1) + avctx->max_b_frames + avctx->delay;
+	}
+
 	encoder_alloc_video_ring_buffer(
 		video_width,
 		video_height,
 		fps_den,
 		fps_num,
-		video_codec_ind);
+		video_codec_ind,
+		held_frames);
 
 	return encoder_ctx;
 }
@@ -1124,15 +1498,6 @@ int encoder_add_video_frame(uint8_t *frame, int size, int64_t timestamp, int isK
 	if(!video_ring_buffer)
 		return -1;
 
-	if (reference_pts == 0)
-	{
-		reference_pts = timestamp; /*first frame ts*/
-		if(verbosity > 0)
-			printf("ENCODER: ref ts = %" PRId64 "\n", timestamp);
-	}
-
-	int64_t pts = timestamp - reference_pts;
-
 	__LOCK_MUTEX( __PMUTEX );
 	int flag = video_ring_buffer[video_write_index].flag;
 	__UNLOCK_MUTEX( __PMUTEX );
@@ -1153,7 +1518,7 @@ int encoder_add_video_frame(uint8_t *frame, int size, int64_t timestamp, int isK
 	}
 	memcpy(video_ring_buffer[video_write_index].frame, frame, size);
 	video_ring_buffer[video_write_index].frame_size = size;
-	video_ring_buffer[video_write_index].timestamp = pts;
+	video_ring_buffer[video_write_index].timestamp = timestamp;
 	video_ring_buffer[video_write_index].keyframe = isKeyframe;
 
 	__LOCK_MUTEX( __PMUTEX );
@@ -1165,63 +1530,632 @@ int encoder_add_video_frame(uint8_t *frame, int size, int64_t timestamp, int isK
 }
 
 /*
- * process next video frame on the ring buffer (encode and mux to file)
+ * allocate the pre-roll buffer (keeps the last frames before recording)
+ *   memory is allocated once, it keeps direct input frames
+ *   or the encoded packets of a standby encoder
  * args:
- *   encoder_ctx - pointer to encoder context
+ *   preroll_sec - pre-roll time (in seconds)
+ *   mem_size - pre-roll memory budget (in Mbytes)
  *
  * asserts:
- *   encoder_ctx is not null
+ *   none
  *
  * returns: error code
  */
-int encoder_process_next_video_buffer(encoder_context_t *encoder_ctx)
+int encoder_preroll_init(int preroll_sec, int mem_size)
 {
-	/*assertions*/
-	assert(encoder_ctx != NULL);
-
-	__LOCK_MUTEX( __PMUTEX );
-
-	int flag = video_ring_buffer[video_read_index].flag;
+	encoder_preroll_close();
 
-	__UNLOCK_MUTEX ( __PMUTEX );
+	if(preroll_sec <= 0 || mem_size <= 0)
+		return -1;
 
-	if(flag == VIDEO_BUFF_FREE)
-		return 1; /*all done*/
+	__LOCK_MUTEX( &preroll_mutex );
 
-	/*timestamp is zero indexed*/
-	encoder_ctx->enc_video_ctx->pts = video_ring_buffer[video_read_index].timestamp;
+	preroll_time = (int64_t) preroll_sec * NSEC_PER_SEC;
+	preroll_data_size = mem_size * 1024 * 1024;
+	preroll_list_size = preroll_sec * ENCODER_PREROLL_MAX_FPS + 1;
 
-	/*raw (direct input)*/
-	if(encoder_ctx->video_codec_ind == 0)
+	preroll_data = malloc(preroll_data_size);
+	preroll_list = calloc(preroll_list_size, sizeof(video_buffer_t));
+	if(preroll_data == NULL || preroll_list == NULL)
 	{
-		/*outbuf_coded_size must already be set*/
-		encoder_ctx->enc_video_ctx->outbuf_coded_size = video_ring_buffer[video_read_index].frame_size;
-		if(video_ring_buffer[video_read_index].keyframe)
-			encoder_ctx->enc_video_ctx->flags |= AV_PKT_FLAG_KEY;
+		fprintf(stderr, "ENCODER: FATAL memory allocation failure (encoder_preroll_init): %s\n", strerror(errno));
+		exit(-1);
 	}
 
-	encoder_encode_video(encoder_ctx, video_ring_buffer[video_read_index].frame);
-
-	/*mux the frame*/
-	__LOCK_MUTEX( __PMUTEX );
-
-	video_ring_buffer[video_read_index].flag = VIDEO_BUFF_FREE;
-	NEXT_IND(video_read_index, video_ring_buffer_size);
+	preroll_head = 0;
+	preroll_count = 0;
 
-	__UNLOCK_MUTEX ( __PMUTEX );
+	__UNLOCK_MUTEX( &preroll_mutex );
 
-	encoder_write_video_data(encoder_ctx);
+	if(verbosity > 0)
+		printf("ENCODER: pre-roll buffer of %i sec (%i Mbytes)\n", preroll_sec, mem_size);
 
 	return 0;
 }
 
 /*
- * process all used video frames from buffer
-  * args:
- *   encoder_ctx - pointer to encoder context
+ * drop the oldest GOP from the pre-roll buffer
+ *  (must be called with preroll_mutex locked)
+ * args:
+ *   none
  *
  * asserts:
- *   encoder_ctx is not null
+ *   none
+ *
+ * returns: none
+ */
+static void preroll_drop_gop()
+{
+	if(preroll_count <= 0)
+		return;
+
+	/*drop the head packet and all the packets up to the next keyframe*/
+	do
+	{
+		NEXT_IND(preroll_head, preroll_list_size);
+		preroll_count--;
+	}
+	while(preroll_count > 0 && !preroll_list[preroll_head].keyframe);
+}
+
+/*
+ * store a direct input frame or encoded packet in the pre-roll buffer
+ *   older frames are dropped a GOP at a time, so that
+ *   the buffer always starts with a keyframe
+ * args:
+ *   frame - pointer to frame data
+ *   size - frame size (in bytes), 0 for a repeated (not encoded) frame
+ *   timestamp - frame timestamp (in nanosec)
+ *   isKeyframe - flag if it's a key(IDR) frame
+ *
+ * asserts:
+ *   none
+ *
+ * returns: error code
+ */
+int encoder_preroll_add_frame(uint8_t *frame, int size, int64_t timestamp, int isKeyframe)
+{
+	if(!preroll_list || size < 0)
+		return -1;
+
+	__LOCK_MUTEX( &preroll_mutex );
+
+	/*the buffer must start with a keyframe*/
+	if(preroll_count == 0 && !isKeyframe)
+	{
+		__UNLOCK_MUTEX( &preroll_mutex );
+		return -1;
+	}
+
+	if(size > preroll_data_size)
+	{
+		fprintf(stderr, "ENCODER: frame (%i bytes) larger than pre-roll buffer (%i bytes)\n",
+			size, preroll_data_size);
+		preroll_count = 0;
+		__UNLOCK_MUTEX( &preroll_mutex );
+		return -1;
+	}
+
+	/*find room for the frame data (drop old GOPs if needed)*/
+	int offset = 0;
+	while(preroll_count > 0)
+	{
+		int tail = (preroll_head + preroll_count - 1) % preroll_list_size;
+		int head_offset = preroll_list[preroll_head].frame - preroll_data;
+		int tail_end = (preroll_list[tail].frame - preroll_data) + preroll_list[tail].frame_size;
+
+		if(preroll_count < preroll_list_size)
+		{
+			if(head_offset < tail_end)
+			{
+				/*free space at [tail_end, end) and [0, head_offset)*/
+				if(tail_end + size <= preroll_data_size)
+				{
+					offset = tail_end;
+					break;
+				}
+				else if(size <= head_offset)
+				{
+					offset = 0;
+					break;
+				}
+			}
+			else if(tail_end + size <= head_offset)
+			{
+				/*wrapped: free space at [tail_end, head_offset)*/
+				offset = tail_end;
+				break;
+			}
+		}
+
+		preroll_drop_gop();
+
+		/*the frame belongs to the dropped GOP*/
+		if(preroll_count == 0 && !isKeyframe)
+		{
+			if(verbosity > 0)
+				printf("ENCODER: pre-roll buffer full - dropping GOP\n");
+			__UNLOCK_MUTEX( &preroll_mutex );
+			return -1;
+		}
+	}
+
+	int ind = (preroll_head + preroll_count) % preroll_list_size;
+	if(size > 0)
+		memcpy(preroll_data + offset, frame, size);
+	preroll_list[ind].frame = preroll_data + offset;
+	preroll_list[ind].frame_size = size;
+	preroll_list[ind].timestamp = timestamp;
+	preroll_list[ind].keyframe = isKeyframe;
+	preroll_list[ind].flag = VIDEO_BUFF_USED;
+	preroll_count++;
+
+	/*drop the oldest GOP if the next one still covers the pre-roll time*/
+	while(preroll_count > 1)
+	{
+		int i = 0;
+		ind = preroll_head;
+		for(i = 1; i < preroll_count; i++)
+		{
+			NEXT_IND(ind, preroll_list_size);
+			if(preroll_list[ind].keyframe)
+				break;
+		}
+
+		if(i >= preroll_count || timestamp - preroll_list[ind].timestamp < preroll_time)
+			break;
+
+		preroll_drop_gop();
+	}
+
+	__UNLOCK_MUTEX( &preroll_mutex );
+
+	return 0;
+}
+
+/*
+ * discard all frames in the pre-roll buffer
+ * args:
+ *   none
+ *
+ * asserts:
+ *   none
+ *
+ * returns: none
+ */
+void encoder_preroll_reset()
+{
+	__LOCK_MUTEX( &preroll_mutex );
+	preroll_head = 0;
+	preroll_count = 0;
+	__UNLOCK_MUTEX( &preroll_mutex );
+}
+
+/*
+ * free the pre-roll buffer
+ * args:
+ *   none
+ *
+ * asserts:
+ *   none
+ *
+ * returns: none
+ */
+void encoder_preroll_close()
+{
+	__LOCK_MUTEX( &preroll_mutex );
+
+	if(preroll_data)
+		free(preroll_data);
+	preroll_data = NULL;
+	preroll_data_size = 0;
+
+	if(preroll_list)
+		free(preroll_list);
+	preroll_list = NULL;
+	preroll_list_size = 0;
+
+	preroll_head = 0;
+	preroll_count = 0;
+	preroll_time = 0;
+
+	__UNLOCK_MUTEX( &preroll_mutex );
+}
+
+/*
+ * shift the video timestamps to a new reference
+ *  (pending delayed frames and last pts of a running encoder)
+ * args:
+ *   enc_video_ctx - pointer to encoder video context
+ *   new_reference - new reference timestamp (ns)
+ *
+ * asserts:
+ *   enc_video_ctx is not null
+ *
+ * returns: none
+ */
+static void encoder_rebase_video_pts(encoder_video_context_t *enc_video_ctx, int64_t new_reference)
+{
+	/*assertions*/
+	assert(enc_video_ctx != NULL);
+
+	int64_t delta = reference_pts - new_reference;
+	int i = 0;
+
+	for(i = 0; i < MAX_DELAYED_FRAMES; i++)
+		enc_video_ctx->delayed_pts[i] += delta;
+
+	last_video_pts += delta;
+	reference_pts = new_reference;
+}
+
+/*
+ * write the pre-roll buffer frames to the muxer (and empty it)
+ *   video timestamps will start at the first pre-roll frame,
+ *   a standby encoder keeps going (its packets go to the muxer)
+ * args:
+ *   encoder_ctx - pointer to encoder context
+ *
+ * asserts:
+ *   encoder_ctx is not null
+ *
+ * returns: number of written frames
+ */
+int encoder_preroll_flush(encoder_context_t *encoder_ctx)
+{
+	/*assertions*/
+	assert(encoder_ctx != NULL);
+
+	encoder_video_context_t *enc_video_ctx = encoder_ctx->enc_video_ctx;
+
+	int standby = encoder_ctx->preroll_encode;
+	encoder_ctx->preroll_encode = 0;
+	encoder_ctx->preroll_time = 0;
+
+	__LOCK_MUTEX( &preroll_mutex );
+
+	int count = preroll_count;
+
+	if(count <= 0 || !enc_video_ctx)
+	{
+		preroll_count = 0;
+		__UNLOCK_MUTEX( &preroll_mutex );
+
+		/*standby encoder: time from the last frame and start on a keyframe*/
+		if(standby && enc_video_ctx && reference_pts != 0)
+		{
+			encoder_rebase_video_pts(enc_video_ctx, reference_pts + last_video_pts);
+			enc_video_ctx->force_keyframe = 1;
+		}
+		return 0;
+	}
+
+	int64_t first_ts = preroll_list[preroll_head].timestamp;
+	int64_t last_ts = first_ts;
+
+	/*write directly from the pre-roll ring (no copy to outbuf)*/
+	while(preroll_count > 0)
+	{
+		video_buffer_t *pkt = &preroll_list[preroll_head];
+
+		enc_video_ctx->packet = pkt->frame;
+		enc_video_ctx->outbuf_coded_size = pkt->frame_size;
+		enc_video_ctx->duplicate = (pkt->frame_size == 0);
+		enc_video_ctx->pts = pkt->timestamp - first_ts;
+		enc_video_ctx->dts = AV_NOPTS_VALUE;
+		enc_video_ctx->flags = pkt->keyframe ? AV_PKT_FLAG_KEY : 0;
+		enc_video_ctx->duration = pkt->timestamp - last_ts;
+
+		/*also counts the frame (avi frame rate)*/
+		encoder_write_video_data(encoder_ctx);
+
+		if(pkt->frame_size > 0)
+			last_ts = pkt->timestamp;
+		pkt->flag = VIDEO_BUFF_FREE;
+		NEXT_IND(preroll_head, preroll_list_size);
+		preroll_count--;
+	}
+
+	enc_video_ctx->packet = NULL;
+	enc_video_ctx->outbuf_coded_size = 0;
+	enc_video_ctx->duplicate = 0;
+	preroll_head = 0;
+
+	__UNLOCK_MUTEX( &preroll_mutex );
+
+	/*next frames are timed from the first pre-roll frame*/
+	if(standby && reference_pts != 0)
+		encoder_rebase_video_pts(enc_video_ctx, first_ts);
+	else
+	{
+		reference_pts = first_ts;
+		last_video_pts = last_ts - first_ts;
+	}
+
+	/*pre-roll length (add a frame duration for the last frame)*/
+	encoder_ctx->preroll_time = last_ts - first_ts;
+	if(count > 1)
+		encoder_ctx->preroll_time += (last_ts - first_ts) / (count - 1);
+
+	if(verbosity > 0)
+		printf("ENCODER: wrote %i pre-roll frames (%" PRId64 " ms)\n",
+			count, encoder_ctx->preroll_time / 1000000);
+
+	return count;
+}
+
+/*
+ * keep the last encoded packet in the pre-roll buffer (standby encoder)
+ * args:
+ *   encoder_ctx - pointer to encoder context
+ *
+ * asserts:
+ *   encoder_ctx is not null
+ *
+ * returns: error code
+ */
+static int encoder_preroll_store_video_data(encoder_context_t *encoder_ctx)
+{
+	/*assertions*/
+	assert(encoder_ctx != NULL);
+
+	encoder_video_context_t *enc_video_ctx = encoder_ctx->enc_video_ctx;
+
+	/*delayed frame: no packet yet*/
+	if(enc_video_ctx->outbuf_coded_size <= 0 && !enc_video_ctx->duplicate)
+		return -1;
+
+	int size = MAX(enc_video_ctx->outbuf_coded_size, 0);
+
+	return encoder_preroll_add_frame(
+		enc_video_ctx->packet,
+		size,
+		enc_video_ctx->pts + reference_pts,
+		size > 0 && (enc_video_ctx->flags & AV_PKT_FLAG_KEY));
+}
+
+/*
+ * update the load governor and check if the next frame should be dropped
+ *  the keep ratio follows the encode time to frame time ratio,
+ *  lowered further as the ring buffer fills up; drops are evenly spaced
+ *  (timestamps are kept, so the motion stays even at a lower frame rate)
+ * args:
+ *   encoder_ctx - pointer to encoder context
+ *   timestamp - frame timestamp (ns)
+ *   used - used frames in the ring buffer
+ *
+ * asserts:
+ *   none
+ *
+ * returns: 1 if the frame should be dropped, 0 otherwise
+ */
+static int encoder_governor_drop(encoder_context_t *encoder_ctx, int64_t timestamp, int used)
+{
+	/*capture frame interval*/
+	if(gov_last_ts > 0 && timestamp > gov_last_ts)
+	{
+		double interval = (double) (timestamp - gov_last_ts) / 1E6;
+		gov_frame_time = (gov_frame_time > 0) ? 0.9 * gov_frame_time + 0.1 * interval : interval;
+	}
+	gov_last_ts = timestamp;
+
+	if(gov_frame_time <= 0 || gov_encode_time <= 0)
+		return 0;
+
+	/*frames the encoder can keep up with*/
+	double target = gov_frame_time / gov_encode_time;
+
+	/*ring buffer over 25%: drop harder*/
+	double fill = (double) used / video_ring_buffer_size;
+	if(fill > 0.25)
+		target *= 1.0 - (fill - 0.25);
+
+	if(target > 1.0)
+		target = 1.0;
+
+	gov_keep_ratio += 0.1 * (target - gov_keep_ratio);
+	if(gov_keep_ratio < ENCODER_GOV_MIN_KEEP)
+		gov_keep_ratio = ENCODER_GOV_MIN_KEEP;
+
+	/*requested keyframes (segment split) are never dropped*/
+	if(gov_keep_ratio > 0.99 || encoder_ctx->enc_video_ctx->force_keyframe)
+	{
+		gov_keep_acc = 0;
+		return 0;
+	}
+
+	gov_keep_acc += gov_keep_ratio;
+	if(gov_keep_acc >= 1.0)
+	{
+		gov_keep_acc -= 1.0;
+		return 0;
+	}
+
+	gov_dropped++;
+
+	if(verbosity > 2)
+		printf("ENCODER: governor dropped frame (keep %.2f, encode %.1f ms, frame %.1f ms, buffer %i)\n",
+			gov_keep_ratio, gov_encode_time, gov_frame_time, used);
+
+	return 1;
+}
+
+/*
+ * libav frame buffer free callback: releases the ring slot
+ *  (may be called from a libav encoder thread)
+ * args:
+ *   opaque - pointer to the video ring buffer slot
+ *   data - slot frame data
+ *
+ * asserts:
+ *   none
+ *
+ * returns: none
+ */
+static void encoder_release_video_slot(void *opaque, uint8_t *data)
+{
+	video_buffer_t *slot = (video_buffer_t *) opaque;
+
+	__LOCK_MUTEX( __PMUTEX );
+	slot->flag = VIDEO_BUFF_FREE;
+	__UNLOCK_MUTEX ( __PMUTEX );
+}
+
+/*
+ * wrap a video ring buffer slot in a libav buffer reference
+ *  for the next encoded frame, the slot is held (VIDEO_BUFF_ENCODING)
+ *  until libav releases its last reference
+ * args:
+ *   encoder_ctx - pointer to encoder context
+ *   index - ring buffer slot index
+ *
+ * asserts:
+ *   encoder_ctx is not null
+ *
+ * returns: 1 if the slot is held by the reference, 0 otherwise (libav copies the frame)
+ */
+static int encoder_ref_video_slot(encoder_context_t *encoder_ctx, int index)
+{
+	/*assertions*/
+	assert(encoder_ctx != NULL);
+
+	encoder_codec_data_t *video_codec_data =
+		(encoder_codec_data_t *) encoder_ctx->enc_video_ctx->codec_data;
+
+	if(!video_codec_data)
+		return 0;
+
+	av_buffer_unref(&video_codec_data->frame_ref);
+	video_codec_data->frame_ref = av_buffer_create(
+		video_ring_buffer[index].frame,
+		video_frame_max_size,
+		encoder_release_video_slot,
+		&video_ring_buffer[index],
+		0);
+
+	if(!video_codec_data->frame_ref)
+		return 0;
+
+	__LOCK_MUTEX( __PMUTEX );
+	video_ring_buffer[index].flag = VIDEO_BUFF_ENCODING;
+	__UNLOCK_MUTEX ( __PMUTEX );
+
+	return 1;
+}
+
+/*
+ * process next video frame on the ring buffer (encode and mux to file)
+ * args:
+ *   encoder_ctx - pointer to encoder context
+ *
+ * asserts:
+ *   encoder_ctx is not null
+ *
+ * returns: error code
+ */
+int encoder_process_next_video_buffer(encoder_context_t *encoder_ctx)
+{
+	/*assertions*/
+	assert(encoder_ctx != NULL);
+
+	__LOCK_MUTEX( __PMUTEX );
+
+	int flag = video_ring_buffer[video_read_index].flag;
+
+	__UNLOCK_MUTEX ( __PMUTEX );
+
+	if(flag == VIDEO_BUFF_FREE)
+		return 1; /*all done*/
+
+	/*
+	 * the reference is set on the first processed frame
+	 * (or by the pre-roll flush) so that timestamps are zero indexed
+	 */
+	if (reference_pts == 0)
+	{
+		reference_pts = video_ring_buffer[video_read_index].timestamp; /*first frame ts*/
+		if(verbosity > 0)
+			printf("ENCODER: ref ts = %" PRId64 "\n", reference_pts);
+	}
+
+	encoder_ctx->enc_video_ctx->pts = video_ring_buffer[video_read_index].timestamp - reference_pts;
+
+	/*libav encoders: drop frames if encoding can't keep up*/
+	if(encoder_ctx->video_codec_ind > 0 && gov_enabled)
+	{
+		__LOCK_MUTEX( __PMUTEX );
+		int used = encoder_video_buffer_used();
+		__UNLOCK_MUTEX ( __PMUTEX );
+
+		if(encoder_governor_drop(encoder_ctx, video_ring_buffer[video_read_index].timestamp, used))
+		{
+			__LOCK_MUTEX( __PMUTEX );
+			video_ring_buffer[video_read_index].flag = VIDEO_BUFF_FREE;
+			NEXT_IND(video_read_index, video_ring_buffer_size);
+			__UNLOCK_MUTEX ( __PMUTEX );
+
+			return 0;
+		}
+	}
+
+	/*libav: the encoder references the ring slot instead of copying it*/
+	int slot_held = 0;
+	if(encoder_ctx->video_codec_ind > 0)
+		slot_held = encoder_ref_video_slot(encoder_ctx, video_read_index);
+
+	struct timespec t_start, t_end;
+	clock_gettime(CLOCK_MONOTONIC, &t_start);
+
+	/*raw (direct input)*/
+	if(encoder_ctx->video_codec_ind == 0)
+	{
+		/*outbuf_coded_size must already be set*/
+		encoder_ctx->enc_video_ctx->outbuf_coded_size = video_ring_buffer[video_read_index].frame_size;
+		/*enc_video_ctx->flags are not changed by the raw encoder*/
+		encoder_ctx->enc_video_ctx->flags = 0;
+		if(video_ring_buffer[video_read_index].keyframe)
+		{
+			encoder_ctx->enc_video_ctx->flags |= AV_PKT_FLAG_KEY;
+			encoder_ctx->enc_video_ctx->force_keyframe = 0;
+		}
+	}
+
+	encoder_encode_video(encoder_ctx, video_ring_buffer[video_read_index].frame);
+
+	clock_gettime(CLOCK_MONOTONIC, &t_end);
+	double encode_time = (double) (t_end.tv_sec - t_start.tv_sec) * 1E3 +
+		(double) (t_end.tv_nsec - t_start.tv_nsec) / 1E6;
+	gov_encode_time = (gov_encode_time > 0) ? 0.9 * gov_encode_time + 0.1 * encode_time : encode_time;
+
+	/*
+	 * mux the frame (direct input is written from the ring slot),
+	 * a standby encoder keeps it in the pre-roll buffer
+	 */
+	if(encoder_ctx->preroll_encode)
+		encoder_preroll_store_video_data(encoder_ctx);
+	else
+		encoder_write_video_data(encoder_ctx);
+
+	__LOCK_MUTEX( __PMUTEX );
+
+	/*a referenced slot is freed when libav releases it*/
+	if(!slot_held)
+		video_ring_buffer[video_read_index].flag = VIDEO_BUFF_FREE;
+	NEXT_IND(video_read_index, video_ring_buffer_size);
+
+	__UNLOCK_MUTEX ( __PMUTEX );
+
+	return 0;
+}
+
+/*
+ * process all used video frames from buffer
+  * args:
+ *   encoder_ctx - pointer to encoder context
+ *
+ * asserts:
+ *   encoder_ctx is not null
  *
  * returns: error code
  */
@@ -1486,6 +2420,8 @@ int encoder_encode_video(encoder_context_t *encoder_ctx, void *input_frame)
 		return outsize;
 	}
 
+	enc_video_ctx->duplicate = 0;
+
 	/*raw - direct input no software encoding*/
 	if(encoder_ctx->video_codec_ind == 0)
 	{
@@ -1502,15 +2438,8 @@ int encoder_encode_video(encoder_context_t *encoder_ctx, void *input_frame)
 		}
 		/*outbuf_coded_size must already be set*/
 		outsize = enc_video_ctx->outbuf_coded_size;
-		if(outsize > enc_video_ctx->outbuf_size)
-		{
-			enc_video_ctx->outbuf_size = outsize;
-			if(enc_video_ctx->outbuf)
-				free(enc_video_ctx->outbuf);
-			enc_video_ctx->outbuf = calloc(enc_video_ctx->outbuf_size, sizeof(uint8_t));
-		}
-		memcpy(enc_video_ctx->outbuf, input_frame, outsize);
-		enc_video_ctx->flags = 0;
+		/*mux straight from the input frame (valid until the ring slot is freed)*/
+		enc_video_ctx->packet = (uint8_t *) input_frame;
 		/*enc_video_ctx->flags must be set*/
 		enc_video_ctx->dts = AV_NOPTS_VALUE;
 
@@ -1524,8 +2453,9 @@ int encoder_encode_video(encoder_context_t *encoder_ctx, void *input_frame)
 
 	encoder_codec_data_t *video_codec_data = (encoder_codec_data_t *) enc_video_ctx->codec_data;
 
+	/*reference counted frame: libav keeps a reference instead of a copy*/
 	if(input_frame != NULL)
-		prepare_video_frame(video_codec_data, input_frame, encoder_ctx->video_width, encoder_ctx->video_height);
+		prepare_video_frame(video_codec_data, input_frame);
 
 	if(!enc_video_ctx->monotonic_pts) //generate a real pts based on the frame timestamp
 	{
@@ -1538,6 +2468,28 @@ int encoder_encode_video(encoder_context_t *encoder_ctx, void *input_frame)
 			(video_codec_data->codec_context->time_base.num * 1000 / video_codec_data->codec_context->time_base.den) * 90;
 	}
 
+	/*motion aware encoding: unchanged frames are not encoded*/
+	if(input_frame != NULL && video_codec_data->motion &&
+		encoder_motion_frame(video_codec_data->motion, video_codec_data->frame,
+			enc_video_ctx->pts, enc_video_ctx->force_keyframe))
+	{
+		/*release the input (ring slot or converted frame)*/
+		av_buffer_unref(&video_codec_data->frame->buf[0]);
+		last_video_pts = enc_video_ctx->pts;
+		enc_video_ctx->duplicate = 1;
+		enc_video_ctx->outbuf_coded_size = 0;
+		return 0;
+	}
+
+	/*segmented recording: start the next segment with a keyframe*/
+	if(enc_video_ctx->force_keyframe)
+	{
+		video_codec_data->frame->pict_type = AV_PICTURE_TYPE_I;
+		enc_video_ctx->force_keyframe = 0;
+	}
+	else
+		video_codec_data->frame->pict_type = AV_PICTURE_TYPE_NONE;
+
 	if(enc_video_ctx->flush_delayed_frames)
 	{
 		if(!enc_video_ctx->flushed_buffers)
@@ -1568,6 +2520,9 @@ int encoder_encode_video(encoder_context_t *encoder_ctx, void *input_frame)
 			pkt, NULL, /*NULL flushes the encoder buffers*/
 			&got_packet);
 
+	/*drop our frame reference (libav holds its own while it needs the data)*/
+	av_buffer_unref(&video_codec_data->frame->buf[0]);
+
 	if(ret < 0)
 	{
 		fprintf(stderr, "ENCODER: Error encoding video frame: %i\n", ret);
@@ -1584,10 +2539,11 @@ int encoder_encode_video(encoder_context_t *encoder_ctx, void *input_frame)
 		enc_video_ctx->flags = pkt->flags;
 		enc_video_ctx->duration = pkt->duration;
 
-		if(pkt->size <= enc_video_ctx->outbuf_size)
-			memcpy(enc_video_ctx->outbuf, pkt->data, pkt->size);
-		else
-			fprintf(stderr, "video packet size is bigger than output buffer(%i>%i)\n",pkt->size, enc_video_ctx->outbuf_size);
+		/*
+		 * mux from the packet data: pkt keeps the reference
+		 * until the next avcodec_receive_packet (or encoder close)
+		 */
+		enc_video_ctx->packet = pkt->data;
 
     	/* free any side data since we cannot return it */
     	if (pkt->side_data_elems > 0)
@@ -1599,8 +2555,6 @@ int encoder_encode_video(encoder_context_t *encoder_ctx, void *input_frame)
         	pkt->side_data_elems = 0;
     	}
     	outsize = pkt->size;
-
-			av_packet_unref(pkt);
     }
 
 	if(enc_video_ctx->flush_delayed_frames && ((outsize == 0) || !got_packet))
@@ -1796,10 +2750,11 @@ int encoder_encode_audio(encoder_context_t *encoder_ctx, void *audio_data)
  */
 void encoder_close(encoder_context_t *encoder_ctx)
 {
-	encoder_clean_video_ring_buffer();
-
 	if(!encoder_ctx)
+	{
+		encoder_clean_video_ring_buffer();
 		return;
+	}
 
 	encoder_video_context_t *enc_video_ctx = encoder_ctx->enc_video_ctx;
 	encoder_audio_context_t *enc_audio_ctx = encoder_ctx->enc_audio_ctx;
@@ -1834,6 +2789,10 @@ void encoder_close(encoder_context_t *encoder_ctx)
 			if(video_codec_data->outpkt)
 				av_packet_free(&video_codec_data->outpkt);
 
+			av_buffer_unref(&video_codec_data->frame_ref);
+			encoder_video_scaler_close(video_codec_data);
+			encoder_motion_destroy(video_codec_data->motion);
+
 			free(video_codec_data);
 		}
 
@@ -1847,6 +2806,9 @@ void encoder_close(encoder_context_t *encoder_ctx)
 		free(enc_video_ctx);
 	}
 
+	/*libav released all ring slot references*/
+	encoder_clean_video_ring_buffer();
+
 	/*close audio codec*/
 	if(enc_audio_ctx)
 	{
@@ -1889,4 +2851,15 @@ void encoder_close(encoder_context_t *encoder_ctx)
 	video_read_index = 0;
 	video_write_index = 0;
 	video_scheduler = 0;
+
+	if(gov_dropped > 0 && verbosity > 0)
+		printf("ENCODER: governor dropped %" PRId64 " frames (encode %.1f ms per frame)\n",
+			gov_dropped, gov_encode_time);
+
+	gov_encode_time = 0;
+	gov_frame_time = 0;
+	gov_keep_ratio = 1.0;
+	gov_keep_acc = 0;
+	gov_last_ts = 0;
+	gov_dropped = 0;
 }
@@ -38,6 +38,7 @@
 	#endif
 #include <libavutil/avutil.h>
 #endif
+#include <libswscale/swscale.h>
 
 #define LIBAVCODEC_VER_AT_LEAST(major,minor)  (LIBAVCODEC_VERSION_MAJOR > major || \
                                               (LIBAVCODEC_VERSION_MAJOR == major && \
@@ -51,6 +52,10 @@
 #define LIBAVUTIL_VER_AT_LEAST(major,minor) 0
 #endif
 
+#define LIBSWSCALE_VER_AT_LEAST(major,minor)  (LIBSWSCALE_VERSION_MAJOR > major || \
+                                              (LIBSWSCALE_VERSION_MAJOR == major && \
+                                               LIBSWSCALE_VERSION_MINOR >= minor))
+
 #ifndef X264_ME_HEX
 #define X264_ME_HEX 1
 #endif
@@ -122,6 +127,31 @@
 /*video buffer flags*/
 #define VIDEO_BUFF_FREE    (0)
 #define VIDEO_BUFF_USED    (1)
+#define VIDEO_BUFF_ENCODING (2) /*referenced by the libav encoder*/
+
+/*motion aware encoding: macroblock change detection*/
+#define ENCODER_MOTION_BLOCK     16
+#define ENCODER_MOTION_THRESHOLD 5 /*mean absolute luma difference of a changed block*/
+#define ENCODER_MOTION_STATIC_QOFFSET {1, 5} /*static blocks quantizer offset (-1 to 1)*/
+#define ENCODER_MOTION_MAX_SKIP  (1000000000LL) /*encode at least a frame per second (ns)*/
+
+typedef struct _encoder_motion_t
+{
+	int flags;          /*ENCODER_MOTION_XXX*/
+	int width;          /*reference luma size*/
+	int height;
+	int mb_cols;
+	int mb_rows;
+	uint8_t *prev;      /*luma of the last encoded frame*/
+	uint8_t *blocks;    /*changed flag for each block*/
+	int64_t last_pts;   /*last encoded frame timestamp (ns)*/
+	int64_t skipped;    /*unchanged frames not encoded*/
+} encoder_motion_t;
+
+/*motion triggered recording: downscaled luma difference*/
+#define ENCODER_TRIGGER_SCALE     8  /*luma is downscaled by 8x8 (cell mean)*/
+#define ENCODER_TRIGGER_THRESHOLD 12 /*absolute cell difference of a changed cell*/
+#define ENCODER_TRIGGER_MAX_AREA  100 /*changed area (permille) at the lowest sensitivity*/
 
 /*
  * codec data struct used for encoder context
@@ -135,6 +165,20 @@ typedef struct _encoder_codec_data_t
 	AVCodecContext *codec_context;
 	AVFrame *frame;
 	AVPacket *outpkt;
+	AVBufferRef *frame_ref; /*ring slot reference for the next frame (NULL: libav copies the data)*/
+
+	/*yu12 input conversion (crop, scale, pixel format)*/
+	int in_width;   /*input (capture) frame size*/
+	int in_height;
+	int crop_x;     /*encoded input rectangle (even values)*/
+	int crop_y;
+	int crop_width;
+	int crop_height;
+	struct SwsContext *sws_context; /*NULL: the codec takes the yu12 input as is*/
+	AVFrame *src_frame;             /*conversion source (cropped input)*/
+	AVBufferPool *frame_pool;       /*converted frames (held by libav while needed)*/
+
+	encoder_motion_t *motion;       /*change detector (NULL - disabled)*/
 } encoder_codec_data_t;
 
 typedef struct _bmp_info_header_t
@@ -152,6 +196,20 @@ typedef struct _bmp_info_header_t
 	uint32_t   biClrImportant;
 }  __attribute__ ((packed)) bmp_info_header_t;
 
+/*
+ * write the pre-roll buffer frames to the muxer (and empty it)
+ *   video timestamps will start at the first pre-roll frame,
+ *   a standby encoder keeps going (its packets go to the muxer)
+ * args:
+ *   encoder_ctx - pointer to encoder context
+ *
+ * asserts:
+ *   encoder_ctx is not null
+ *
+ * returns: number of written frames
+ */
+int encoder_preroll_flush(encoder_context_t *encoder_ctx);
+
 /*
  * get default mkv_codecPriv
  * args:
@@ -185,13 +243,79 @@ int avpriv_split_xiph_headers(
 		uint8_t *header_start[3],
         int header_len[3]);
 
+/*
+ * set up the yu12 input conversion (crop, scale and pixel format)
+ *  for the video codec context settings (size and pixel format)
+ * args:
+ *    video_codec_data - pointer to video codec data
+ *    threads - conversion threads
+ *
+ * asserts:
+ *    video_codec_data is not null
+ *
+ * returns: error code (0 - no conversion needed or conversion set)
+ */
+int encoder_video_scaler_init(encoder_codec_data_t *video_codec_data, int threads);
+
+/*
+ * clean the yu12 input conversion data
+ * args:
+ *    video_codec_data - pointer to video codec data
+ *
+ * asserts:
+ *    video_codec_data is not null
+ *
+ * returns: none
+ */
+void encoder_video_scaler_close(encoder_codec_data_t *video_codec_data);
+
+/*
+ * create a change detector
+ * args:
+ *   flags - ENCODER_MOTION_XXX flags
+ *
+ * asserts:
+ *   none
+ *
+ * returns: pointer to change detector data
+ */
+encoder_motion_t *encoder_motion_create(int flags);
+
+/*
+ * check a frame before encoding: unchanged frames may be skipped and
+ *  static blocks get a lower quality (region of interest side data)
+ * args:
+ *   motion - pointer to change detector data
+ *   frame - frame to encode
+ *   pts - frame timestamp (ns)
+ *   force - the frame must be encoded (e.g. forced keyframe)
+ *
+ * asserts:
+ *   motion is not null
+ *   frame is not null
+ *
+ * returns: 1 if the frame should be skipped, 0 otherwise
+ */
+int encoder_motion_frame(encoder_motion_t *motion, AVFrame *frame, int64_t pts, int force);
+
+/*
+ * destroy a change detector
+ * args:
+ *   motion - pointer to change detector data
+ *
+ * asserts:
+ *   none
+ *
+ * returns: none
+ */
+void encoder_motion_destroy(encoder_motion_t *motion);
+
 /*
  * set yu12 frame in codec data frame
+ *  (cropped in place or converted to the codec format and size)
  * args:
  *    video_codec_data - pointer to video codec data
- *    inp - input data (yu12)
- *    width - frame width
- *    height - frame height
+ *    inp - input data (yu12 at in_width x in_height)
  *
  * asserts:
  *    video_codec_data is not null
@@ -199,7 +323,7 @@ int avpriv_split_xiph_headers(
  *
  * returns: none
  */
-void prepare_video_frame(encoder_codec_data_t *encoder_ctx, uint8_t *inp, int width, int height);
+void prepare_video_frame(encoder_codec_data_t *video_codec_data, uint8_t *inp);
 
 
 /*
@@ -22,11 +22,20 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <sys/mman.h>
+#include <stdint.h>
+#include <time.h>
 #include <unistd.h>
 #include <fcntl.h>
 #include <string.h>
 #include <errno.h>
 #include <assert.h>
+#include <pthread.h>
+#ifdef HAVE_LIBURING
+#include <liburing.h>
+#endif
 /* support for internationalization - i18n */
 #include <locale.h>
 #include <libintl.h>
@@ -35,34 +44,863 @@
 #include "file_io.h"
 #include "gview.h"
 
+extern int verbosity;
+
+/*output file flags (ENCODER_IO_XXX) for new file writers*/
+static int io_file_flags = 0;
+
+/*queued job data ownership*/
+#define IO_JOB_COPY     0 /*malloc'ed copy (freed when written)*/
+#define IO_JOB_POOLED   1 /*pool buffer (returned to the pool when written)*/
+
+/*a queued positional write*/
+typedef struct _io_job_t
+{
+	int64_t offset;  /*file offset*/
+	uint8_t *data;   /*data to write (NULL: sync request)*/
+	int size;        /*data size*/
+	int kind;        /*data ownership (IO_JOB_XXX)*/
+} io_job_t;
+
+/*a job (or part of it) ready to be written*/
+typedef struct _io_seg_t
+{
+	int fd;          /*buffered or O_DIRECT file descriptor*/
+	uint8_t *data;
+	size_t size;
+	int64_t offset;
+} io_seg_t;
+
+struct _io_async_t
+{
+	__THREAD_TYPE thread;
+	__MUTEX_TYPE mutex;
+	__COND_TYPE work_cond;  /*signaled when jobs are queued*/
+	__COND_TYPE space_cond; /*signaled when jobs are done*/
+	int running;            /*writer thread is running*/
+	int stop;               /*request writer thread exit*/
+
+	io_job_t jobs[IO_ASYNC_QUEUE_SIZE];
+	int job_head;           /*next free job slot*/
+	int job_tail;           /*oldest queued (or in flight) job*/
+	int job_count;          /*queued + in flight jobs*/
+
+	uint8_t *pool[IO_ASYNC_BUFFERS];      /*aligned write buffers*/
+	uint8_t *free_bufs[IO_ASYNC_BUFFERS]; /*buffers available to the writer*/
+	int free_count;
+
+	int error;              /*first write error (errno)*/
+	int error_reported;
+
+	int flags;              /*ENCODER_IO_XXX flags (set on init)*/
+	int stream;             /*non seekable output (pipe or socket): sequential writes only*/
+	int64_t stream_pos;     /*bytes written to the stream*/
+
+	/*writer thread only*/
+	int direct_fd;          /*O_DIRECT file descriptor (-1 if none)*/
+	int direct_disabled;    /*O_DIRECT writes failed (using buffered writes)*/
+	int prealloc;           /*fallocate is enabled*/
+	int64_t alloc_end;      /*end of the preallocated file space*/
+	int64_t cache_lo;       /*last written range (to drop from page cache)*/
+	int64_t cache_hi;
+	struct timespec t_first;/*first write*/
+	struct timespec t_last; /*last write completed*/
+
+	int uring;              /*using the io_uring backend*/
+	uint64_t bytes_written;
+	uint64_t write_calls;
+	uint64_t stalls;        /*times the encoder had to wait for the disk*/
+};
+
+/*
+ * write a data block at offset (retries on short writes)
+ * args:
+ *   fd - file descriptor
+ *   data - data to write
+ *   size - data size
+ *   offset - file offset
+ *
+ * asserts:
+ *   none
+ *
+ * returns: 0 or errno on error
+ */
+static int io_pwrite_all(int fd, uint8_t *data, size_t size, int64_t offset)
+{
+	while(size > 0)
+	{
+		ssize_t ret = pwrite(fd, data, size, (off_t) offset);
+		if(ret < 0)
+		{
+			if(errno == EINTR)
+				continue;
+			return errno;
+		}
+		if(ret == 0)
+			return EIO;
+
+		data += ret;
+		size -= ret;
+		offset += ret;
+	}
+
+	return 0;
+}
+
+/*
+ * write the remaining of a segment after a short or failed write
+ *  O_DIRECT failures are retried with buffered writes
+ * args:
+ *   async - pointer to async writer data
+ *   fd - buffered file descriptor
+ *   seg - pointer to segment
+ *   done - bytes already written
+ *   err - write error (errno) or 0
+ *
+ * asserts:
+ *   none
+ *
+ * returns: 0 or errno on error
+ */
+static int io_async_complete_seg(io_async_t *async, int fd, io_seg_t *seg, size_t done, int err)
+{
+	if(err == EINVAL && seg->fd != fd)
+	{
+		if(!async->direct_disabled)
+			fprintf(stderr, "ENCODER: (io_async) O_DIRECT write failed - using buffered writes\n");
+		async->direct_disabled = 1;
+		err = 0;
+	}
+
+	if(err)
+		return err;
+
+	if(done >= seg->size)
+		return 0;
+
+	/*a direct write may stop at any point: finish it buffered*/
+	return io_pwrite_all(fd, seg->data + done, seg->size - done, seg->offset + done);
+}
+
+/*
+ * write a batch of segments with pwritev (contiguous segments are merged)
+ * args:
+ *   async - pointer to async writer data
+ *   fd - buffered file descriptor
+ *   segs - segments to write (in queue order)
+ *   n - number of segments
+ *
+ * asserts:
+ *   none
+ *
+ * returns: 0 or errno on error
+ */
+static int io_async_write_batch(io_async_t *async, int fd, io_seg_t *segs, int n)
+{
+	struct iovec iov[IO_ASYNC_MAX_SEGS];
+	int i = 0;
+
+	while(i < n)
+	{
+		int64_t offset = segs[i].offset;
+		size_t total = 0;
+		int j = i;
+		/*O_DIRECT segments are written buffered if direct writes failed*/
+		int seg_fd = async->direct_disabled ? fd : segs[i].fd;
+
+		do
+		{
+			iov[j-i].iov_base = segs[j].data;
+			iov[j-i].iov_len = segs[j].size;
+			total += segs[j].size;
+			j++;
+		}
+		while(j < n && segs[j].fd == segs[i].fd &&
+			segs[j].offset == offset + (int64_t) total);
+
+		ssize_t ret = pwritev(seg_fd, iov, j - i, (off_t) offset);
+		async->write_calls++;
+
+		int err = 0;
+		if(ret < 0)
+		{
+			if(errno != EINTR)
+				err = errno;
+			ret = 0;
+		}
+
+		/*complete short writes segment by segment*/
+		size_t done = ret;
+		int k = 0;
+		for(k = i; k < j; k++)
+		{
+			if(!err && done >= segs[k].size)
+			{
+				done -= segs[k].size;
+				continue;
+			}
+
+			int ret_err = io_async_complete_seg(async, fd, &segs[k], done, err);
+			if(ret_err)
+				return ret_err;
+			done = 0;
+			err = 0;
+		}
+
+		i = j;
+	}
+
+	return 0;
+}
+
+/*
+ * write a batch of segments to a non seekable output (pipe or socket),
+ *  segments must continue at the stream position (no patches behind it)
+ * args:
+ *   async - pointer to async writer data
+ *   fd - file descriptor
+ *   segs - segments to write (in queue order)
+ *   n - number of segments
+ *
+ * asserts:
+ *   none
+ *
+ * returns: 0 or errno on error
+ */
+static int io_async_write_stream(io_async_t *async, int fd, io_seg_t *segs, int n)
+{
+	int i = 0;
+
+	for(i = 0; i < n; i++)
+	{
+		if(segs[i].offset != async->stream_pos)
+		{
+			fprintf(stderr, "ENCODER: (io_async) can't write at %" PRId64 " on a non seekable output (at %" PRId64 ")\n",
+				segs[i].offset, async->stream_pos);
+			return ESPIPE;
+		}
+
+		uint8_t *data = segs[i].data;
+		size_t size = segs[i].size;
+		while(size > 0)
+		{
+			ssize_t ret = write(fd, data, size);
+			if(ret < 0)
+			{
+				if(errno == EINTR)
+					continue;
+				return errno;
+			}
+
+			data += ret;
+			size -= ret;
+		}
+
+		async->stream_pos += segs[i].size;
+		async->write_calls++;
+	}
+
+	return 0;
+}
+
+#ifdef HAVE_LIBURING
+/*
+ * write a batch of segments with io_uring
+ * args:
+ *   async - pointer to async writer data
+ *   ring - pointer to io_uring
+ *   fd - buffered file descriptor
+ *   segs - segments to write (in queue order)
+ *   n - number of segments
+ *
+ * asserts:
+ *   none
+ *
+ * returns: 0 or errno on error
+ */
+static int io_async_write_uring(io_async_t *async, struct io_uring *ring, int fd, io_seg_t *segs, int n)
+{
+	int i = 0;
+	int k = 0;
+
+	for(i = 0; i < n; i++)
+	{
+		struct io_uring_sqe *sqe = io_uring_get_sqe(ring);
+		if(sqe == NULL)
+			break;
+
+		io_uring_prep_write(sqe, segs[i].fd, segs[i].data, segs[i].size, segs[i].offset);
+		io_uring_sqe_set_data(sqe, &segs[i]);
+
+		/*overlapping writes (header patches) must land in queue order*/
+		for(k = 0; k < i; k++)
+		{
+			if(segs[i].offset < segs[k].offset + (int64_t) segs[k].size &&
+				segs[k].offset < segs[i].offset + (int64_t) segs[i].size)
+			{
+				sqe->flags |= IOSQE_IO_DRAIN;
+				break;
+			}
+		}
+	}
+
+	int submitted = io_uring_submit(ring);
+	async->write_calls++;
+	if(submitted < 0)
+		return io_async_write_batch(async, fd, segs, n);
+
+	int err = 0;
+	for(k = 0; k < submitted; k++)
+	{
+		struct io_uring_cqe *cqe = NULL;
+		int ret = io_uring_wait_cqe(ring, &cqe);
+		if(ret < 0)
+		{
+			if(ret == -EINTR)
+			{
+				k--;
+				continue;
+			}
+			return -ret;
+		}
+
+		io_seg_t *seg = (io_seg_t *) io_uring_cqe_get_data(cqe);
+		int res = cqe->res;
+		io_uring_cqe_seen(ring, cqe);
+
+		int seg_err = (res < 0) ? -res : 0;
+		if(res < 0)
+			res = 0;
+		if((seg_err || (size_t) res < seg->size) && !err)
+			err = io_async_complete_seg(async, fd, seg, res, seg_err);
+	}
+
+	/*segments that didn't fit the submission queue*/
+	if(!err && submitted < n)
+		err = io_async_write_batch(async, fd, segs + submitted, n - submitted);
+
+	return err;
+}
+#endif
+
+/*
+ * split a job in segments: with O_DIRECT the aligned body of the
+ *  job is written directly and the unaligned head and tail buffered
+ * args:
+ *   async - pointer to async writer data
+ *   fd - buffered file descriptor
+ *   job - pointer to job
+ *   seg - pointer to segment list (3 free entries)
+ *
+ * asserts:
+ *   none
+ *
+ * returns: number of segments
+ */
+static int io_async_split_job(io_async_t *async, int fd, io_job_t *job, io_seg_t *seg)
+{
+	size_t size = job->size;
+	size_t head = (IO_DIRECT_ALIGN - (job->offset % IO_DIRECT_ALIGN)) % IO_DIRECT_ALIGN;
+	size_t body = 0;
+
+	if(async->direct_fd >= 0 && !async->direct_disabled && head < size &&
+		((uintptr_t) (job->data + head) % IO_DIRECT_ALIGN) == 0)
+		body = ((size - head) / IO_DIRECT_ALIGN) * IO_DIRECT_ALIGN;
+
+	if(body == 0)
+	{
+		seg[0].fd = fd;
+		seg[0].data = job->data;
+		seg[0].size = size;
+		seg[0].offset = job->offset;
+		return 1;
+	}
+
+	int n = 0;
+	if(head > 0)
+	{
+		seg[n].fd = fd;
+		seg[n].data = job->data;
+		seg[n].size = head;
+		seg[n].offset = job->offset;
+		n++;
+	}
+
+	seg[n].fd = async->direct_fd;
+	seg[n].data = job->data + head;
+	seg[n].size = body;
+	seg[n].offset = job->offset + head;
+	n++;
+
+	if(head + body < size)
+	{
+		seg[n].fd = fd;
+		seg[n].data = job->data + head + body;
+		seg[n].size = size - head - body;
+		seg[n].offset = job->offset + head + body;
+		n++;
+	}
+
+	return n;
+}
+
+/*
+ * grow the preallocated file space (in IO_PREALLOC_EXTENT steps)
+ *  up to end, the file size is not changed
+ * args:
+ *   async - pointer to async writer data
+ *   fd - file descriptor
+ *   end - end of the data to be written
+ *
+ * asserts:
+ *   none
+ *
+ * returns: none
+ */
+static void io_async_prealloc(io_async_t *async, int fd, int64_t end)
+{
+	if(!async->prealloc || end <= async->alloc_end)
+		return;
+
+	int64_t new_end = ((end + IO_PREALLOC_EXTENT - 1) / IO_PREALLOC_EXTENT) * IO_PREALLOC_EXTENT;
+
+	if(fallocate(fd, FALLOC_FL_KEEP_SIZE, async->alloc_end, new_end - async->alloc_end) != 0)
+	{
+		fprintf(stderr, "ENCODER: (io_async) fallocate failed: %s - disabling preallocation\n",
+			strerror(errno));
+		async->prealloc = 0;
+		return;
+	}
+
+	async->alloc_end = new_end;
+}
+
+/*
+ * start writeback of the new written range and drop the
+ *  previous one (written back by now) from the page cache
+ * args:
+ *   async - pointer to async writer data
+ *   fd - file descriptor
+ *   lo - start of the written range
+ *   hi - end of the written range
+ *
+ * asserts:
+ *   none
+ *
+ * returns: none
+ */
+static void io_async_drop_cache(io_async_t *async, int fd, int64_t lo, int64_t hi)
+{
+	if(hi > lo)
+		sync_file_range(fd, lo, hi - lo, SYNC_FILE_RANGE_WRITE);
+
+	if(async->cache_hi > async->cache_lo)
+	{
+		int64_t len = async->cache_hi - async->cache_lo;
+		sync_file_range(fd, async->cache_lo, len,
+			SYNC_FILE_RANGE_WAIT_BEFORE | SYNC_FILE_RANGE_WRITE | SYNC_FILE_RANGE_WAIT_AFTER);
+		posix_fadvise(fd, async->cache_lo, len, POSIX_FADV_DONTNEED);
+	}
+
+	async->cache_lo = lo;
+	async->cache_hi = hi;
+}
+
+/*
+ * writer thread: writes queued jobs to the file
+ * args:
+ *   data - pointer to io_writer
+ *
+ * asserts:
+ *   none
+ *
+ * returns: NULL
+ */
+static void *io_async_thread(void *data)
+{
+	io_writer_t *writer = (io_writer_t *) data;
+	io_async_t *async = writer->async;
+	io_job_t batch[IO_ASYNC_BATCH];
+	io_seg_t segs[IO_ASYNC_MAX_SEGS];
+	int i = 0;
+
+#ifdef HAVE_LIBURING
+	struct io_uring ring;
+	async->uring = !async->stream && (io_uring_queue_init(IO_ASYNC_MAX_SEGS, &ring, 0) == 0);
+	if(!async->uring && verbosity > 0)
+		printf("ENCODER: (io_async) io_uring not available - using pwrite\n");
+#endif
+
+	__LOCK_MUTEX(&async->mutex);
+	while(1)
+	{
+		while(async->job_count == 0 && !async->stop)
+			pthread_cond_wait(&async->work_cond, &async->mutex);
+
+		if(async->job_count == 0)
+			break; /*stop requested and queue is empty*/
+
+		/*jobs stay in the queue (counted) until written*/
+		int n = MIN(async->job_count, IO_ASYNC_BATCH);
+		for(i = 0; i < n; i++)
+			batch[i] = async->jobs[(async->job_tail + i) % IO_ASYNC_QUEUE_SIZE];
+
+		__UNLOCK_MUTEX(&async->mutex);
+
+		if(async->bytes_written == 0)
+			clock_gettime(CLOCK_MONOTONIC, &async->t_first);
+
+		int nsegs = 0;
+		int do_sync = 0;
+		int64_t lo = INT64_MAX;
+		int64_t hi = 0;
+		for(i = 0; i < n; i++)
+		{
+			/*sync requests are done after the batch is written*/
+			if(batch[i].data == NULL)
+			{
+				do_sync = 1;
+				continue;
+			}
+			nsegs += io_async_split_job(async, writer->fd, &batch[i], segs + nsegs);
+			lo = MIN(lo, batch[i].offset);
+			hi = MAX(hi, batch[i].offset + batch[i].size);
+		}
+
+		io_async_prealloc(async, writer->fd, hi);
+
+		int err = 0;
+		if(nsegs > 0)
+		{
+			if(async->stream)
+				err = io_async_write_stream(async, writer->fd, segs, nsegs);
+			else
+#ifdef HAVE_LIBURING
+			if(async->uring)
+				err = io_async_write_uring(async, &ring, writer->fd, segs, nsegs);
+			else
+#endif
+				err = io_async_write_batch(async, writer->fd, segs, nsegs);
+		}
+
+		if(do_sync && !async->stream && fdatasync(writer->fd) != 0 && !err)
+			err = errno;
+
+		if(async->flags & ENCODER_IO_DONTNEED)
+			io_async_drop_cache(async, writer->fd, lo, hi);
+
+		clock_gettime(CLOCK_MONOTONIC, &async->t_last);
+
+		__LOCK_MUTEX(&async->mutex);
+
+		if(err && !async->error)
+			async->error = err;
+
+		for(i = 0; i < n; i++)
+		{
+			async->bytes_written += batch[i].size;
+			if(batch[i].kind == IO_JOB_POOLED)
+				async->free_bufs[async->free_count++] = batch[i].data;
+			else if(batch[i].kind == IO_JOB_COPY)
+				free(batch[i].data);
+		}
+		async->job_tail = (async->job_tail + n) % IO_ASYNC_QUEUE_SIZE;
+		async->job_count -= n;
+
+		__COND_BCAST(&async->space_cond);
+	}
+	__UNLOCK_MUTEX(&async->mutex);
+
+	/*drop the last written range*/
+	if(async->flags & ENCODER_IO_DONTNEED)
+		io_async_drop_cache(async, writer->fd, 0, 0);
+
+#ifdef HAVE_LIBURING
+	if(async->uring)
+		io_uring_queue_exit(&ring);
+#endif
+
+	return NULL;
+}
+
+/*
+ * get a free pool buffer, waits for the writer thread if none
+ *  (called with the async mutex locked)
+ * args:
+ *   async - pointer to async writer data
+ *
+ * asserts:
+ *   none
+ *
+ * returns: pointer to buffer
+ */
+static uint8_t *io_async_get_buffer(io_async_t *async)
+{
+	if(async->free_count <= 0)
+		async->stalls++;
+
+	while(async->free_count <= 0)
+		pthread_cond_wait(&async->space_cond, &async->mutex);
+
+	return async->free_bufs[--async->free_count];
+}
+
+/*
+ * queue a positional write for the writer thread
+ *  (called with the async mutex locked)
+ * args:
+ *   writer - pointer to io_writer
+ *   offset - file offset
+ *   data - data to write (pool buffer or malloc'ed copy)
+ *   size - data size
+ *   kind - data ownership (IO_JOB_XXX)
+ *
+ * asserts:
+ *   none
+ *
+ * returns: none
+ */
+static void io_async_queue(io_writer_t *writer, int64_t offset, uint8_t *data, int size, int kind)
+{
+	io_async_t *async = writer->async;
+
+	if(!async->running)
+	{
+		/*no writer thread: synchronous (buffered) write*/
+		if(data == NULL)
+		{
+			if(!async->stream && fdatasync(writer->fd) != 0 && !async->error)
+				async->error = errno;
+			return;
+		}
+
+		int err = 0;
+		if(async->stream)
+		{
+			io_seg_t seg = {writer->fd, data, size, offset};
+			err = io_async_write_stream(async, writer->fd, &seg, 1);
+		}
+		else
+			err = io_pwrite_all(writer->fd, data, size, offset);
+		if(err && !async->error)
+			async->error = err;
+		async->bytes_written += size;
+		async->write_calls++;
+		if(kind == IO_JOB_POOLED)
+			async->free_bufs[async->free_count++] = data;
+		else if(kind == IO_JOB_COPY)
+			free(data);
+		return;
+	}
+
+	if(async->job_count >= IO_ASYNC_QUEUE_SIZE)
+		async->stalls++;
+
+	while(async->job_count >= IO_ASYNC_QUEUE_SIZE)
+		pthread_cond_wait(&async->space_cond, &async->mutex);
+
+	io_job_t *job = &async->jobs[async->job_head];
+	job->offset = offset;
+	job->data = data;
+	job->size = size;
+	job->kind = kind;
+
+	async->job_head = (async->job_head + 1) % IO_ASYNC_QUEUE_SIZE;
+	async->job_count++;
+
+	__COND_SIGNAL(&async->work_cond);
+}
+
+/*
+ * set up the writer thread and buffer pool for a file writer
+ * args:
+ *   writer - pointer to io_writer
+ *   direct_fd - O_DIRECT file descriptor (-1 if none)
+ *   flags - ENCODER_IO_XXX flags
+ *   stream - non seekable output (pipe or socket)
+ *
+ * asserts:
+ *   none
+ *
+ * returns: none
+ */
+static void io_async_init(io_writer_t *writer, int direct_fd, int flags, int stream)
+{
+	io_async_t *async = calloc(1, sizeof(io_async_t));
+	if(async == NULL)
+	{
+		fprintf(stderr, "ENCODER: FATAL memory allocation failure (io_async_init): %s\n", strerror(errno));
+		exit(-1);
+	}
+
+	int i = 0;
+	for(i = 0; i < IO_ASYNC_BUFFERS; i++)
+	{
+		/*page aligned (also fits O_DIRECT requirements)*/
+		void *buf = NULL;
+		int ret = posix_memalign(&buf, IO_DIRECT_ALIGN, writer->buffer_size);
+		if(ret != 0)
+		{
+			fprintf(stderr, "ENCODER: FATAL memory allocation failure (io_async_init): %s\n", strerror(ret));
+			exit(-1);
+		}
+		async->pool[i] = (uint8_t *) buf;
+		async->free_bufs[i] = async->pool[i];
+	}
+	async->free_count = IO_ASYNC_BUFFERS;
+
+	async->flags = flags;
+	async->stream = stream;
+	async->direct_fd = direct_fd;
+	async->prealloc = (flags & ENCODER_IO_PREALLOC) ? 1 : 0;
+
+	__INIT_MUTEX(&async->mutex);
+	__INIT_COND(&async->work_cond);
+	__INIT_COND(&async->space_cond);
+
+	writer->async = async;
+	writer->buffer = async->free_bufs[--async->free_count];
+
+	if(__THREAD_CREATE(&async->thread, io_async_thread, writer))
+		fprintf(stderr, "ENCODER: (io_async) writer thread creation failed - using synchronous writes\n");
+	else
+		async->running = 1;
+}
+
+/*
+ * get the amount of file data in the page cache
+ * args:
+ *   fd - file descriptor (opened for reading)
+ *   size - file size
+ *
+ * asserts:
+ *   none
+ *
+ * returns: cached bytes (-1 on error)
+ */
+static int64_t io_cached_bytes(int fd, int64_t size)
+{
+	if(size <= 0)
+		return 0;
+
+	long page_size = sysconf(_SC_PAGESIZE);
+	size_t pages = (size + page_size - 1) / page_size;
+
+	void *map = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+	if(map == MAP_FAILED)
+		return -1;
+
+	unsigned char *vec = malloc(pages);
+	if(vec == NULL)
+	{
+		fprintf(stderr, "ENCODER: FATAL memory allocation failure (io_cached_bytes): %s\n", strerror(errno));
+		exit(-1);
+	}
+
+	int64_t cached = 0;
+	if(mincore(map, size, vec) == 0)
+	{
+		size_t i = 0;
+		for(i = 0; i < pages; i++)
+			cached += vec[i] & 1;
+		cached *= page_size;
+	}
+	else
+		cached = -1;
+
+	free(vec);
+	munmap(map, size);
+
+	return cached;
+}
 
 /*
- * get the file position pointer
+ * drain the write queue, stop the writer thread and clean up
  * args:
  *   writer - pointer to io_writer
  *
  * asserts:
- *   writer is not null
+ *   none
  *
- * returns: the file position pointer
+ * returns: none
  */
-static int64_t io_tell(io_writer_t *writer)
+static void io_async_close(io_writer_t *writer)
 {
-	/*assertions*/
-	assert(writer != NULL);
+	io_async_t *async = writer->async;
 
-	if(writer->fp == NULL)
+	if(async->running)
 	{
-		fprintf(stderr, "ENCODER: (io_tell) no file pointer associated with io_writer (mem only ?)\n");
-		return -1;
+		__LOCK_MUTEX(&async->mutex);
+		async->stop = 1;
+		__COND_SIGNAL(&async->work_cond);
+		__UNLOCK_MUTEX(&async->mutex);
+
+		__THREAD_JOIN(async->thread);
+		async->running = 0;
+	}
+
+	if(async->error)
+		fprintf(stderr, "ENCODER: (io_async) file write error: %s\n", strerror(async->error));
+
+	/*release the space preallocated beyond the end of file*/
+	if(async->flags & ENCODER_IO_PREALLOC)
+	{
+		if(ftruncate(writer->fd, writer->size) != 0)
+			fprintf(stderr, "ENCODER: (io_async) couldn't truncate file: %s\n", strerror(errno));
+	}
+
+	if(verbosity > 0)
+	{
+		double elapsed = (async->t_last.tv_sec - async->t_first.tv_sec) +
+			(async->t_last.tv_nsec - async->t_first.tv_nsec) / (double) NSEC_PER_SEC;
+		double rate = (elapsed > 0) ? async->bytes_written / (elapsed * 1024 * 1024) : 0;
+		int64_t cached = io_cached_bytes(writer->fd, writer->size);
+
+		printf("ENCODER: (io_async) wrote %" PRIu64 " bytes in %" PRIu64 " calls (%s%s%s%s) with %" PRIu64 " stalls\n",
+			async->bytes_written, async->write_calls,
+			async->uring ? "io_uring" : "pwrite",
+			(async->flags & ENCODER_IO_PREALLOC) ? " prealloc" : "",
+			(async->direct_fd >= 0 && !async->direct_disabled) ? " direct" : "",
+			(async->flags & ENCODER_IO_DONTNEED) ? " dontneed" : "",
+			async->stalls);
+		printf("ENCODER: (io_async) sustained write rate %.1f MiB/s, %" PRId64 " KiB (%.1f%%) of the file in page cache\n",
+			rate, cached / 1024,
+			(writer->size > 0 && cached >= 0) ? 100.0 * cached / writer->size : 0.0);
 	}
-	/*flush the file buffer*/
-	fflush(writer->fp);
 
-	/*return the file pointer position*/
-	return ((int64_t) ftello(writer->fp));
+	if(async->direct_fd >= 0)
+		close(async->direct_fd);
+
+	__CLOSE_COND(&async->work_cond);
+	__CLOSE_COND(&async->space_cond);
+	__CLOSE_MUTEX(&async->mutex);
+
+	int i = 0;
+	for(i = 0; i < IO_ASYNC_BUFFERS; i++)
+		free(async->pool[i]);
+
+	free(async);
+	writer->async = NULL;
+	writer->buffer = NULL;
+}
+
+/*
+ * set the output file flags for new file writers
+ * args:
+ *   flags - ENCODER_IO_XXX flags
+ *
+ * asserts:
+ *   none
+ *
+ * returns: none
+ */
+void io_set_file_flags(int flags)
+{
+	io_file_flags = flags;
 }
 
+static int64_t io_queue_buffer(io_writer_t *writer);
+
 /* flush a mem only writer(buf_writer) into a file writer
  * args:
  *   file_writer - pointer to a file io_writer
@@ -102,34 +940,68 @@ io_writer_t *io_create_writer(const char *filename, int max_size)
 		exit(-1);
 	}
 
-	if(max_size > 0)
-		writer->buffer_size = max_size;
-	else
-		writer->buffer_size = IO_BUFFER_SIZE;
-
-	writer->buffer = calloc(writer->buffer_size, sizeof(uint8_t));
-	if(writer->buffer == NULL)
-	{
-		fprintf(stderr, "ENCODER: FATAL memory allocation failure (io_create_writer): %s\n", strerror(errno));
-		exit(-1);
-	}
-	
-	writer->buf_ptr = writer->buffer;
-	writer->buf_end = writer->buf_ptr + writer->buffer_size;
+	writer->fd = -1;
 
 	if(filename != NULL)
 	{
-		writer->fp = fopen(filename, "wb");
-		if (writer->fp == NULL)
+		int flags = io_file_flags;
+		int direct_fd = -1;
+		struct stat st;
+
+		/*read access is only needed for the page cache statistics*/
+		writer->fd = open(filename, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0666);
+		if (writer->fd < 0)
 		{
 			fprintf(stderr, "ENCODER: Could not open file for writing: %s\n",
 				strerror(errno));
 			free(writer);
 			return NULL;
 		}
+
+		/*pipes and sockets: sequential writes only, no file space tricks*/
+		int stream = (fstat(writer->fd, &st) == 0 && !S_ISREG(st.st_mode) && !S_ISBLK(st.st_mode));
+		if(stream)
+		{
+			if(verbosity > 0)
+				printf("ENCODER: %s is not seekable - writing as a stream\n", filename);
+			flags &= ~(ENCODER_IO_DIRECT | ENCODER_IO_PREALLOC | ENCODER_IO_DONTNEED);
+		}
+
+		if(flags & ENCODER_IO_DIRECT)
+		{
+			/*aligned data goes through a second O_DIRECT descriptor*/
+			direct_fd = open(filename, O_WRONLY | O_DIRECT | O_CLOEXEC);
+			if(direct_fd < 0)
+			{
+				fprintf(stderr, "ENCODER: O_DIRECT not supported for %s (%s) - dropping written data from page cache instead\n",
+					filename, strerror(errno));
+				flags |= ENCODER_IO_DONTNEED;
+			}
+		}
+
+		/*file writer: data is handed to the writer thread in large buffers*/
+		writer->buffer_size = (max_size > 0) ? max_size : IO_ASYNC_BUFFER_SIZE;
+		/*O_DIRECT needs full aligned blocks*/
+		if(direct_fd >= 0)
+			writer->buffer_size = ((writer->buffer_size + IO_DIRECT_ALIGN - 1) / IO_DIRECT_ALIGN) * IO_DIRECT_ALIGN;
+		io_async_init(writer, direct_fd, flags, stream);
 	}
 	else
-		writer->fp = NULL; /*mem only writer (must be flushed to a file writer*/
+	{
+		/*mem only writer (must be flushed to a file writer)*/
+		writer->buffer_size = (max_size > 0) ? max_size : IO_BUFFER_SIZE;
+
+		writer->buffer = calloc(writer->buffer_size, sizeof(uint8_t));
+		if(writer->buffer == NULL)
+		{
+			fprintf(stderr, "ENCODER: FATAL memory allocation failure (io_create_writer): %s\n", strerror(errno));
+			exit(-1);
+		}
+	}
+
+	writer->buf_ptr = writer->buffer;
+	writer->buf_high = writer->buffer;
+	writer->buf_end = writer->buf_ptr + writer->buffer_size;
 
 	return writer;
 }
@@ -149,22 +1021,23 @@ void io_destroy_writer(io_writer_t *writer)
 	/*assertions*/
 	assert(writer != NULL);
 
-	if(writer->fp != NULL)
+	if(writer->fd >= 0)
 	{
-		/* flush the buffer to file*/
-		io_flush_buffer(writer);
-		/* flush the file buffer*/
-		fflush(writer->fp);
-		/* close the file pointer */
-		fclose(writer->fp);
+		/* queue the buffer data*/
+		io_queue_buffer(writer);
+		/* wait for all pending writes and free the buffer pool*/
+		io_async_close(writer);
+		/* close the file */
+		close(writer->fd);
+		writer->fd = -1;
 	}
-
-	/*clean the mem buffer*/
-	free(writer->buffer);
+	else
+		free(writer->buffer); /*clean the mem buffer*/
 }
 
 /*
- * flush the writer buffer to disk
+ * queue the writer buffer data for the writer thread
+ *  and replace the buffer with a free one
  * args:
  *   writer - pointer to io_writer
  *
@@ -173,55 +1046,144 @@ void io_destroy_writer(io_writer_t *writer)
  *
  * returns: current offset
  */
-int64_t io_flush_buffer(io_writer_t *writer)
+static int64_t io_queue_buffer(io_writer_t *writer)
 {
 	/*assertions*/
 	assert(writer != NULL);
 
-	if(writer->fp == NULL)
+	if(writer->fd < 0)
 	{
 		fprintf(stderr, "ENCODER: (io_flush) no file pointer associated with writer (mem only ?)\n");
 		fprintf(stderr, "ENCODER: (io_flush) try to increase buffer size\n");
 		return -1;
 	}
 
-	size_t nitems = 0;
-	if (writer->buf_ptr > writer->buffer)
-	{
-		nitems= writer->buf_ptr - writer->buffer;
-		if(fwrite(writer->buffer, 1, nitems, writer->fp) < nitems)
-		{
-			fprintf(stderr, "ENCODER: (io_flush) file write error: %s\n", strerror(errno));
-			return -1;
-		}
-	}
-	else if (writer->buf_ptr < writer->buffer)
+	if (writer->buf_ptr < writer->buffer)
 	{
 		fprintf(stderr, "ENCODER: (io_flush) bad buffer pointer - dropping buffer\n");
 		writer->buf_ptr = writer->buffer;
+		writer->buf_high = writer->buffer;
 		return -1;
 	}
 
-	int64_t size_inc = nitems - (writer->size - writer->position);
-	if(size_inc > 0)
-		writer->size += size_inc;
+	if(writer->buf_ptr > writer->buf_high)
+		writer->buf_high = writer->buf_ptr;
+
+	int nitems = writer->buf_high - writer->buffer;
+	/*writing continues at the current offset*/
+	int64_t offset = io_get_offset(writer);
+	int error = 0;
+
+	if(nitems > 0)
+	{
+		io_async_t *async = writer->async;
+
+		__LOCK_MUTEX(&async->mutex);
+
+		if(nitems < IO_ASYNC_COPY_SIZE)
+		{
+			/*small flush (e.g. header patch): queue a copy and keep the buffer*/
+			uint8_t *data = malloc(nitems);
+			if(data == NULL)
+			{
+				fprintf(stderr, "ENCODER: FATAL memory allocation failure (io_queue_buffer): %s\n", strerror(errno));
+				exit(-1);
+			}
+			memcpy(data, writer->buffer, nitems);
+			io_async_queue(writer, writer->position, data, nitems, IO_JOB_COPY);
+		}
+		else
+		{
+			io_async_queue(writer, writer->position, writer->buffer, nitems, IO_JOB_POOLED);
+			writer->buffer = io_async_get_buffer(async);
+		}
+
+		if(async->error && !async->error_reported)
+		{
+			error = async->error;
+			async->error_reported = 1;
+		}
 
-	writer->position = io_tell(writer); /*update current file pointer position*/
+		__UNLOCK_MUTEX(&async->mutex);
+
+		if(writer->position + nitems > writer->size)
+			writer->size = writer->position + nitems;
+	}
 
+	writer->position = offset;
 	writer->buf_ptr = writer->buffer;
+	writer->buf_high = writer->buffer;
+	writer->buf_end = writer->buffer + writer->buffer_size;
 
-	/*should never happen*/
-	if(writer->position > writer->size)
+	if(error)
 	{
-		fprintf(stderr, "ENCODER: (io_flush) file pointer ( %" PRIu64 " ) above expected file size ( %" PRIu64 " )\n", writer->position, writer->size);
-		writer->size = writer->position;
+		fprintf(stderr, "ENCODER: (io_flush) file write error: %s\n", strerror(error));
+		return -1;
 	}
 
 	return writer->position;
 }
 
+/*
+ * flush the writer buffer to disk
+ *  the data is queued for the writer thread and
+ *  the buffer is replaced with a free one
+ * args:
+ *   writer - pointer to io_writer
+ *
+ * asserts:
+ *   writer is not null
+ *
+ * returns: current offset
+ */
+int64_t io_flush_buffer(io_writer_t *writer)
+{
+	/*assertions*/
+	assert(writer != NULL);
+
+	/*
+	 * O_DIRECT: keep appended data until the buffer is full
+	 * so that file blocks are written aligned
+	 */
+	if(writer->async != NULL && (writer->async->flags & ENCODER_IO_DIRECT) &&
+		writer->buf_ptr >= writer->buf_high && writer->buf_ptr < writer->buf_end)
+		return io_get_offset(writer);
+
+	return io_queue_buffer(writer);
+}
+
+/*
+ * flush the writer buffer and request the writer thread
+ *  to sync the file data to disk (after all queued writes)
+ * args:
+ *   writer - pointer to io_writer
+ *
+ * asserts:
+ *   writer is not null
+ *
+ * returns: error code
+ */
+int io_sync(io_writer_t *writer)
+{
+	/*assertions*/
+	assert(writer != NULL);
+
+	if(writer->fd < 0)
+		return -1;
+
+	int64_t offset = io_queue_buffer(writer);
+
+	__LOCK_MUTEX(&writer->async->mutex);
+	io_async_queue(writer, io_get_offset(writer), NULL, 0, IO_JOB_COPY);
+	__UNLOCK_MUTEX(&writer->async->mutex);
+
+	return (offset < 0) ? -1 : 0;
+}
+
 /*
  * move the writer pointer to position
+ *  no disk access is done, data is written at the
+ *  new position with positional writes
  * args:
  *   writer - pointer to io_writer
  *   position - new position offset
@@ -236,39 +1198,35 @@ int io_seek(io_writer_t *writer, int64_t position)
 	/*assertions*/
 	assert(writer != NULL);
 
-	int ret = 0;
+	if(writer->buf_ptr > writer->buf_high)
+		writer->buf_high = writer->buf_ptr;
 
-	if(position <= writer->size) //position is on the file
+	/*position is on the buffer*/
+	if(position >= writer->position &&
+		position <= writer->position + (writer->buf_high - writer->buffer))
 	{
-		if(writer->fp == NULL)
-		{
-			fprintf(stderr, "ENCODER: (io_seek) no file pointer associated with writer (mem only ?)\n");
-			return -1;
-		}
-		/*flush the memory buffer (we need an empty buffer)*/
-		io_flush_buffer(writer);
-		/*try to move the file pointer to position*/
-		int ret = fseeko(writer->fp, position, SEEK_SET);
-		if(ret != 0)
-			fprintf(stderr, "ENCODER: (io_seek) seek to file position %" PRIu64 "failed\n", position);
-		else
-			writer->position = io_tell(writer); /*update current file pointer position*/
+		writer->buf_ptr = writer->buffer + (position - writer->position);
+		return 0;
+	}
 
-		/*we are now on position with an empty memory buffer*/
+	if(writer->fd < 0)
+	{
+		fprintf(stderr, "ENCODER: (io_seek) no file pointer associated with writer (mem only ?)\n");
+		return -1;
 	}
-	else /* position is on the buffer*/
+
+	if(position < 0)
 	{
-		/*move file pointer to EOF*/
-		if(writer->position != writer->size)
-		{
-			fseeko(writer->fp, writer->size, SEEK_SET);
-			writer->position = writer->size;
-		}
-		/*move buffer pointer to position*/
-		writer->buf_ptr = writer->buffer + (position - writer->size);
+		fprintf(stderr, "ENCODER: (io_seek) seek to file position %" PRId64 " failed\n", position);
+		return -1;
 	}
 
-	return ret;
+	/*queue the buffer data (we need an empty buffer)*/
+	io_queue_buffer(writer);
+	/*the buffer now maps to position*/
+	writer->position = position;
+
+	return 0;
 }
 
 /*
@@ -287,21 +1245,10 @@ int io_skip(io_writer_t *writer, int offset)
 	/*assertions*/
 	assert(writer != NULL);
 
-	if(writer->fp == NULL)
-	{
-		fprintf(stderr, "ENCODER: (io_skip) no file pointer associated with writer (mem only ?)\n");
-		return -1;
-	}
-	/*flush the memory buffer (clean buffer)*/
-	io_flush_buffer(writer);
-	/*try to move the file pointer to position*/
-	int ret = fseeko(writer->fp, offset, SEEK_CUR);
+	int ret = io_seek(writer, io_get_offset(writer) + offset);
 	if(ret != 0)
 		fprintf(stderr, "ENCODER: (io_skip) skip file pointer by 0x%x failed\n", offset);
 
-	writer->position = io_tell(writer); //update current file pointer position
-
-	/*we are on position with an empty memory buffer*/
 	return ret;
 }
 
@@ -334,6 +1281,113 @@ int64_t io_get_offset(io_writer_t *writer)
 	return offset;
 }
 
+/*
+ * write a buffer of size at offset without moving the writer position
+ *  (used for patching headers and indexes)
+ * args:
+ *   writer - pointer to io_writer
+ *   offset - file offset
+ *   buf - data buffer to write
+ *   size - size of buffer
+ *
+ * asserts:
+ *   writer is not null
+ *
+ * returns: error code
+ */
+int io_write_at(io_writer_t *writer, int64_t offset, uint8_t *buf, int size)
+{
+	/*assertions*/
+	assert(writer != NULL);
+
+	if(writer->buf_ptr > writer->buf_high)
+		writer->buf_high = writer->buf_ptr;
+
+	int64_t buf_end = writer->position + (writer->buf_high - writer->buffer);
+
+	/*data is still on the buffer*/
+	if(offset >= writer->position && offset + size <= buf_end)
+	{
+		memcpy(writer->buffer + (offset - writer->position), buf, size);
+		return 0;
+	}
+
+	/*data was already handed to the writer thread: queue a positional write*/
+	if(writer->fd >= 0 && offset >= 0 && offset + size <= writer->position)
+	{
+		uint8_t *data = malloc(size);
+		if(data == NULL)
+		{
+			fprintf(stderr, "ENCODER: FATAL memory allocation failure (io_write_at): %s\n", strerror(errno));
+			exit(-1);
+		}
+		memcpy(data, buf, size);
+
+		__LOCK_MUTEX(&writer->async->mutex);
+		io_async_queue(writer, offset, data, size, IO_JOB_COPY);
+		__UNLOCK_MUTEX(&writer->async->mutex);
+
+		if(offset + size > writer->size)
+			writer->size = offset + size;
+
+		return 0;
+	}
+
+	/*data crosses the buffer limits: seek, write and return*/
+	int64_t current = io_get_offset(writer);
+	if(io_seek(writer, offset) < 0)
+		return -1;
+	io_write_buf(writer, buf, size);
+	return io_seek(writer, current);
+}
+
+/*
+ * write 4 octets (little endian) at offset
+ * args:
+ *   writer - pointer to io_writer
+ *   offset - file offset
+ *   val - value to write
+ *
+ * asserts:
+ *   writer is not null
+ *
+ * returns: error code
+ */
+int io_write_wl32_at(io_writer_t *writer, int64_t offset, uint32_t val)
+{
+	uint8_t buf[4];
+
+	buf[0] = (uint8_t) val;
+	buf[1] = (uint8_t) (val >> 8);
+	buf[2] = (uint8_t) (val >> 16);
+	buf[3] = (uint8_t) (val >> 24);
+
+	return io_write_at(writer, offset, buf, 4);
+}
+
+/*
+ * write 8 octets (little endian) at offset
+ * args:
+ *   writer - pointer to io_writer
+ *   offset - file offset
+ *   val - value to write
+ *
+ * asserts:
+ *   writer is not null
+ *
+ * returns: error code
+ */
+int io_write_wl64_at(io_writer_t *writer, int64_t offset, uint64_t val)
+{
+	uint8_t buf[8];
+	int i = 0;
+
+	for(i = 0; i < 8; i++)
+		buf[i] = (uint8_t) (val >> (8 * i));
+
+	return io_write_at(writer, offset, buf, 8);
+}
+
 /*
  * write 1 octet
  * args:
@@ -354,6 +1408,8 @@ void io_write_w8(io_writer_t *writer, uint8_t b)
 
 /*
  * write a buffer of size
+ *   (muxer elements are serialized in memory and written with
+ *    a single call, so the common case is a single bounds check)
  * args:
  *   writer - pointer to io_writer
  *   buf - data buffer to write
@@ -366,6 +1422,14 @@ void io_write_w8(io_writer_t *writer, uint8_t b)
  */
 void io_write_buf(io_writer_t *writer, uint8_t *buf, int size)
 {
+	/*fast path: fits in the buffer*/
+	if(size > 0 && size < writer->buf_end - writer->buf_ptr)
+	{
+		memcpy(writer->buf_ptr, buf, size);
+		writer->buf_ptr += size;
+		return;
+	}
+
 	while (size > 0)
 	{
 		int len = writer->buf_end - writer->buf_ptr;
@@ -385,6 +1449,61 @@ void io_write_buf(io_writer_t *writer, uint8_t *buf, int size)
     }
 }
 
+/*
+ * write a large buffer (e.g. a video frame) without going through the writer buffer
+ *  the buffered data is queued first and buf is copied straight to
+ *  free pool buffers queued right after it (written with a single pwritev),
+ *  the call doesn't wait for the write (only for a free pool buffer)
+ *  small buffers, mem only and O_DIRECT writers use io_write_buf
+ * args:
+ *   writer - pointer to io_writer
+ *   buf - data buffer to write
+ *   size - size of buffer
+ *
+ * asserts:
+ *   writer is not null
+ *
+ * returns: none
+ */
+void io_write_buf_nocopy(io_writer_t *writer, uint8_t *buf, int size)
+{
+	/*assertions*/
+	assert(writer != NULL);
+
+	io_async_t *async = writer->async;
+
+	if(async == NULL || size < IO_NOCOPY_MIN_SIZE || (async->flags & ENCODER_IO_DIRECT))
+	{
+		io_write_buf(writer, buf, size);
+		return;
+	}
+
+	/*queue the buffered data (e.g. the block header) first*/
+	io_queue_buffer(writer);
+
+	int64_t offset = writer->position;
+
+	__LOCK_MUTEX(&async->mutex);
+
+	while(size > 0)
+	{
+		int len = MIN(size, writer->buffer_size);
+		uint8_t *data = io_async_get_buffer(async);
+		memcpy(data, buf, len);
+		io_async_queue(writer, offset, data, len, IO_JOB_POOLED);
+
+		offset += len;
+		buf += len;
+		size -= len;
+	}
+
+	__UNLOCK_MUTEX(&async->mutex);
+
+	writer->position = offset;
+	if(writer->position > writer->size)
+		writer->size = writer->position;
+}
+
 /*
  * write 2 octets (little endian)
  * args:
@@ -31,19 +31,53 @@
 
 #define IO_BUFFER_SIZE 32768
 
+/*file writers: size and number of (page aligned) buffers handed to the writer thread*/
+#define IO_ASYNC_BUFFER_SIZE (1024*1024)
+#define IO_ASYNC_BUFFERS     8
+/*max queued positional writes*/
+#define IO_ASYNC_QUEUE_SIZE  64
+/*max jobs written by the writer thread in one go*/
+#define IO_ASYNC_BATCH       16
+/*smaller flushes (header patches) are copied and the buffer kept*/
+#define IO_ASYNC_COPY_SIZE   4096
+/*max write segments in a batch (a job may be split in 3 for O_DIRECT)*/
+#define IO_ASYNC_MAX_SEGS    (3*IO_ASYNC_BATCH)
+/*io_write_buf_nocopy: smaller buffers go through the writer buffer (io_write_buf)*/
+#define IO_NOCOPY_MIN_SIZE   (128*1024)
+/*O_DIRECT buffer, offset and size alignment*/
+#define IO_DIRECT_ALIGN      4096
+/*file space is preallocated in steps of (ENCODER_IO_PREALLOC)*/
+#define IO_PREALLOC_EXTENT   (64*1024*1024)
+
+typedef struct _io_async_t io_async_t;
+
 typedef struct _io_writer_t
 {
-	FILE *fp;      /* file pointer     */
+	int fd;             /* file descriptor (-1 for mem only writer) */
+	io_async_t *async;  /* writer thread data (file writers only) */
 
 	uint8_t *buffer;  /* Start of the buffer. */
     int buffer_size;  /* Maximum buffer size */
     uint8_t *buf_ptr; /* Current position in the buffer */
     uint8_t *buf_end; /* End of the buffer. */
+    uint8_t *buf_high;/* Highest position written in the buffer (updated on seek/flush) */
 
 	int64_t size; //file size (end of file position)
-	int64_t position; //file pointer position (updates on buffer flush)
+	int64_t position; //file offset of the buffer start (updates on buffer flush/seek)
 } io_writer_t;
 
+/*
+ * set the output file flags for new file writers
+ * args:
+ *   flags - ENCODER_IO_XXX flags
+ *
+ * asserts:
+ *   none
+ *
+ * returns: none
+ */
+void io_set_file_flags(int flags);
+
 /*
  * create a new writer:
  * args:
@@ -71,6 +105,8 @@ void io_destroy_writer(io_writer_t *writer);
 
 /*
  * flush the writer buffer to disk
+ *  the data is queued for the writer thread and
+ *  the buffer is replaced with a free one
  * args:
  *   writer - pointer to io_writer
  *
@@ -81,8 +117,23 @@ void io_destroy_writer(io_writer_t *writer);
  */
 int64_t io_flush_buffer(io_writer_t *writer);
 
+/*
+ * flush the writer buffer and request the writer thread
+ *  to sync the file data to disk (after all queued writes)
+ * args:
+ *   writer - pointer to io_writer
+ *
+ * asserts:
+ *   writer is not null
+ *
+ * returns: error code
+ */
+int io_sync(io_writer_t *writer);
+
 /*
  * move the writer pointer to position
+ *  no disk access is done, data is written at the
+ *  new position with positional writes
  * args:
  *   writer - pointer to io_writer
  *   position - new position offset
@@ -119,6 +170,50 @@ int io_skip(io_writer_t *writer, int offset);
  */
 int64_t io_get_offset(io_writer_t *writer);
 
+/*
+ * write a buffer of size at offset without moving the writer position
+ *  (used for patching headers and indexes)
+ * args:
+ *   writer - pointer to io_writer
+ *   offset - file offset
+ *   buf - data buffer to write
+ *   size - size of buffer
+ *
+ * asserts:
+ *   writer is not null
+ *
+ * returns: error code
+ */
+int io_write_at(io_writer_t *writer, int64_t offset, uint8_t *buf, int size);
+
+/*
+ * write 4 octets (little endian) at offset
+ * args:
+ *   writer - pointer to io_writer
+ *   offset - file offset
+ *   val - value to write
+ *
+ * asserts:
+ *   writer is not null
+ *
+ * returns: error code
+ */
+int io_write_wl32_at(io_writer_t *writer, int64_t offset, uint32_t val);
+
+/*
+ * write 8 octets (little endian) at offset
+ * args:
+ *   writer - pointer to io_writer
+ *   offset - file offset
+ *   val - value to write
+ *
+ * asserts:
+ *   writer is not null
+ *
+ * returns: error code
+ */
+int io_write_wl64_at(io_writer_t *writer, int64_t offset, uint64_t val);
+
 /*
  * write 1 octet
  * args:
@@ -146,6 +241,21 @@ void io_write_w8(io_writer_t *writer, uint8_t b);
  */
 void io_write_buf(io_writer_t *writer, uint8_t *buf, int size);
 
+/*
+ * write a large buffer straight to free pool buffers
+ *  (not through the writer buffer)
+ * args:
+ *   writer - pointer to io_writer
+ *   buf - data buffer to write
+ *   size - size of buffer
+ *
+ * asserts:
+ *   writer is not null
+ *
+ * returns: none
+ */
+void io_write_buf_nocopy(io_writer_t *writer, uint8_t *buf, int size);
+
 /*
  * write 2 octets (little endian)
  * args:
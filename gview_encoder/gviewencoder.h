@@ -48,6 +48,7 @@ __BEGIN_DECLS
 #define ENCODER_MUX_MKV        (0)
 #define ENCODER_MUX_WEBM       (1)
 #define ENCODER_MUX_AVI        (2)
+#define ENCODER_MUX_MP4        (3)
 
 /*Scheduler Modes*/
 #define ENCODER_SCHED_LIN  (0)
@@ -63,6 +64,26 @@ __BEGIN_DECLS
 
 #define MAX_DELAYED_FRAMES 68  /*Maximum supported delayed frames*/
 
+#define ENCODER_PREROLL_MAX_FPS 120 /*sizes the pre-roll packet list*/
+
+/*motion aware encoding flags (encoder_set_video_motion)*/
+#define ENCODER_MOTION_ROI  (1<<0) /*lower the quality of static blocks (h264, hevc, vp9)*/
+#define ENCODER_MOTION_SKIP (1<<1) /*don't encode unchanged frames*/
+
+/*output file write flags (encoder_set_file_io_flags)*/
+#define ENCODER_IO_PREALLOC (1<<0) /*fallocate the file in large extents (truncated on close)*/
+#define ENCODER_IO_DIRECT   (1<<1) /*write aligned data with O_DIRECT (bypass page cache)*/
+#define ENCODER_IO_DONTNEED (1<<2) /*drop written data from the page cache*/
+
+/*libav video encoder threads (encoder_set_video_threads)*/
+#define ENCODER_THREADS_DEFAULT (0)  /*codec list default*/
+#define ENCODER_THREADS_AUTO    (-1) /*from the cpu core count and resolution*/
+
+/*segmented recording status (encoder_muxer_get_segment_status)*/
+#define ENCODER_SEGMENT_NONE  (0) /*no next segment file*/
+#define ENCODER_SEGMENT_READY (1) /*next segment file opened*/
+#define ENCODER_SEGMENT_SPLIT (2) /*switch on the next video keyframe*/
+
 /*video buffer*/
 typedef struct _video_buffer_t
 {
@@ -70,7 +91,7 @@ typedef struct _video_buffer_t
 	int frame_size;
 	int64_t timestamp;
 	int keyframe;  /* 1-keyframe; 0-non keyframe (only for direct input)*/
-	int flag;      /*VIDEO_BUFF_FREE | VIDEO_BUFF_USED*/
+	int flag;      /*VIDEO_BUFF_FREE | VIDEO_BUFF_USED | VIDEO_BUFF_ENCODING*/
 } video_buffer_t;
 
 /*video codec properties*/
@@ -110,6 +131,7 @@ typedef struct _video_codec_t
 	int num_threads;          //lavc num threads
 	int flags;                //lavc flags
 	int monotonic_pts;		  //use monotonic pts instead of timestamp based
+	int motion_roi;           //codec takes region of interest quantizer offsets
 } video_codec_t;
 
 /*audio codec properties*/
@@ -154,6 +176,7 @@ typedef struct _encoder_video_context_t
 	int outbuf_size;
 	uint8_t* outbuf;
 	int outbuf_coded_size;
+	uint8_t* packet; /*coded data to mux: libav packet data or a view of the input frame (direct input)*/
 
 	int64_t framecount;
 
@@ -162,6 +185,9 @@ typedef struct _encoder_video_context_t
 	int flags;
 	int duration;
 
+	int force_keyframe; /*encode the next frame as a keyframe*/
+	int duplicate; /*the last frame was not encoded (unchanged): repeat the previous one*/
+
 } encoder_video_context_t;
 
 /*Audio*/
@@ -218,6 +244,9 @@ typedef struct _encoder_context_t
 	int h264_sps_size;
 	uint8_t *h264_sps;
 
+	int64_t preroll_time; /*pre-roll video written at the file start (ns)*/
+	int preroll_encode; /*standby: encoded frames go to the pre-roll buffer (until the muxer starts)*/
+
 } encoder_context_t;
 
 /*
@@ -232,6 +261,132 @@ typedef struct _encoder_context_t
  */
 void encoder_set_verbosity(int value);
 
+/*
+ * set output file write flags (used for new files)
+ * args:
+ *   flags - ENCODER_IO_XXX flags (0 - default buffered writes)
+ *
+ * asserts:
+ *    none
+ *
+ * returns: none
+ */
+void encoder_set_file_io_flags(int flags);
+
+/*
+ * set the libav video encoder threads (used for new encoders)
+ * args:
+ *   threads - number of threads or
+ *      ENCODER_THREADS_DEFAULT - codec list default
+ *      ENCODER_THREADS_AUTO - set from the cpu core count and resolution
+ *
+ * asserts:
+ *    none
+ *
+ * returns: none
+ */
+void encoder_set_video_threads(int threads);
+
+/*
+ * enable or disable the encoder load governor (frame dropping)
+ *   should be disabled when frame timestamps don't follow the
+ *   capture rate (e.g. time-lapse video)
+ * args:
+ *   enable - flag (1 - enabled, default; 0 - disabled)
+ *
+ * asserts:
+ *    none
+ *
+ * returns: none
+ */
+void encoder_set_video_governor(int enable);
+
+/*
+ * get the number of video encoder threads in auto mode
+ * args:
+ *   width - video width
+ *   height - video height
+ *
+ * asserts:
+ *    none
+ *
+ * returns: number of threads
+ */
+int encoder_get_auto_video_threads(int width, int height);
+
+/*
+ * set the crop rectangle of the capture frame for libav encoders
+ *  (used for new encoders, values are rounded down to even numbers)
+ * args:
+ *   x - left offset
+ *   y - top offset
+ *   width - crop width (0 - no crop)
+ *   height - crop height (0 - no crop)
+ *
+ * asserts:
+ *    none
+ *
+ * returns: none
+ */
+void encoder_set_video_crop(int x, int y, int width, int height);
+
+/*
+ * set the encoded frame size for libav encoders (used for new encoders)
+ *   the (cropped) capture frame is scaled to this size
+ * args:
+ *   width - encoded width (0 - from height keeping the aspect ratio)
+ *   height - encoded height (0 - from width keeping the aspect ratio)
+ *   (both 0 - no scaling)
+ *
+ * asserts:
+ *    none
+ *
+ * returns: none
+ */
+void encoder_set_video_scale(int width, int height);
+
+/*
+ * set the pixel format for libav encoders (used for new encoders)
+ *   the yu12 input is converted if the codec supports the format
+ * args:
+ *   pix_fmt - libav pixel format name, e.g. yuv422p or nv12 (NULL - codec default)
+ *
+ * asserts:
+ *    none
+ *
+ * returns: none
+ */
+void encoder_set_video_pix_fmt(const char *pix_fmt);
+
+/*
+ * set motion aware encoding for libav encoders (used for new encoders)
+ * args:
+ *   flags - ENCODER_MOTION_XXX flags (0 - disabled)
+ *
+ * asserts:
+ *    none
+ *
+ * returns: none
+ */
+void encoder_set_video_motion(int flags);
+
+/*
+ * encode synthetic yu12 frames with every valid video codec
+ *  at 1 to max_threads threads and print the frame rate
+ *  and the scaling efficiency (speedup / threads)
+ * args:
+ *   width - frame width
+ *   height - frame height
+ *   frames - number of frames to encode in each run
+ *   max_threads - maximum number of threads (0 - number of cpu cores)
+ *
+ * asserts:
+ *    none
+ *
+ * returns: error code
+ */
+int encoder_video_benchmark(int width, int height, int frames, int max_threads);
+
 /*
  * get valid video codec count
  * args:
@@ -311,7 +466,7 @@ const char *encoder_get_audio_codec_description(int codec_ind);
  *   video_codec_ind - video codec list index
  *   audio_codec_ind - audio codec list index
  *   muxer_id - file muxer:
- *        ENCODER_MUX_MKV; ENCODER_MUX_WEBM; ENCODER_MUX_AVI
+ *        ENCODER_MUX_MKV; ENCODER_MUX_WEBM; ENCODER_MUX_AVI; ENCODER_MUX_MP4
  *   video_width - video frame width
  *   video_height - video frame height
  *   fps_num - fps numerator
@@ -361,6 +516,100 @@ void encoder_muxer_init(encoder_context_t *encoder_ctx, const char *filename);
  */
 void encoder_muxer_close(encoder_context_t *encoder_ctx);
 
+/*
+ * open the next segment file ahead of time (writes the file header)
+ *  the muxer will switch to it on the first keyframe after
+ *  a call to encoder_muxer_split
+ * args:
+ *   encoder_ctx - pointer to encoder context
+ *   filename - next segment filename
+ *
+ * asserts:
+ *   encoder_ctx is not null
+ *   encoder_ctx->enc_video_ctx is not null
+ *   filename is not null
+ *
+ * returns: error code
+ */
+int encoder_muxer_prepare_next(encoder_context_t *encoder_ctx, const char *filename);
+
+/*
+ * request a switch to the prepared segment file
+ *  on the next video keyframe (forces a keyframe on the next encoded frame)
+ * args:
+ *   encoder_ctx - pointer to encoder context
+ *
+ * asserts:
+ *   encoder_ctx is not null
+ *   encoder_ctx->enc_video_ctx is not null
+ *
+ * returns: error code
+ */
+int encoder_muxer_split(encoder_context_t *encoder_ctx);
+
+/*
+ * get the segment status
+ * args:
+ *   none
+ *
+ * asserts:
+ *   none
+ *
+ * returns: ENCODER_SEGMENT_NONE  - no next segment file
+ *          ENCODER_SEGMENT_READY - next segment file prepared
+ *          ENCODER_SEGMENT_SPLIT - waiting for a keyframe to switch
+ */
+int encoder_muxer_get_segment_status();
+
+/*
+ * get the current segment duration
+ * args:
+ *   encoder_ctx - pointer to encoder context
+ *
+ * asserts:
+ *   encoder_ctx is not null
+ *   encoder_ctx->enc_video_ctx is not null
+ *
+ * returns: segment duration in ns
+ */
+int64_t encoder_muxer_get_segment_duration(encoder_context_t *encoder_ctx);
+
+/*
+ * get the current segment file size
+ * args:
+ *   none
+ *
+ * asserts:
+ *   none
+ *
+ * returns: segment size in bytes
+ */
+int64_t encoder_muxer_get_segment_size();
+
+/*
+ * set the matroska index checkpoint interval (used for new files)
+ * args:
+ *   interval - checkpoint interval in seconds (0 - disabled)
+ *
+ * asserts:
+ *   none
+ *
+ * returns: none
+ */
+void encoder_set_mkv_checkpoint(int interval);
+
+/*
+ * rebuild the index of an unfinished (crashed) matroska file
+ * args:
+ *   filename - matroska file
+ *
+ * asserts:
+ *   filename is not null
+ *
+ * returns: error code (0 - E_OK)
+ */
+int encoder_mkv_recover(const char *filename);
+
 /*
  * get video list codec entry for codec index
  * args:
@@ -593,6 +842,106 @@ double encoder_buff_scheduler(int mode, double thresh, double max_time);
  */
 int encoder_add_video_frame(uint8_t *frame, int size, int64_t timestamp, int isKeyframe);
 
+/*
+ * allocate the pre-roll buffer (keeps the last frames before recording)
+ *   memory is allocated once, it keeps direct input frames
+ *   or the encoded packets of a standby encoder
+ * args:
+ *   preroll_sec - pre-roll time (in seconds)
+ *   mem_size - pre-roll memory budget (in Mbytes)
+ *
+ * asserts:
+ *   none
+ *
+ * returns: error code
+ */
+int encoder_preroll_init(int preroll_sec, int mem_size);
+
+/*
+ * store a direct input frame or encoded packet in the pre-roll buffer
+ *   older frames are dropped a GOP at a time, so that
+ *   the buffer always starts with a keyframe
+ * args:
+ *   frame - pointer to frame data
+ *   size - frame size (in bytes), 0 for a repeated (not encoded) frame
+ *   timestamp - frame timestamp (in nanosec)
+ *   isKeyframe - flag if it's a key(IDR) frame
+ *
+ * asserts:
+ *   none
+ *
+ * returns: error code
+ */
+int encoder_preroll_add_frame(uint8_t *frame, int size, int64_t timestamp, int isKeyframe);
+
+/*
+ * discard all frames in the pre-roll buffer
+ * args:
+ *   none
+ *
+ * asserts:
+ *   none
+ *
+ * returns: none
+ */
+void encoder_preroll_reset();
+
+/*
+ * free the pre-roll buffer
+ * args:
+ *   none
+ *
+ * asserts:
+ *   none
+ *
+ * returns: none
+ */
+void encoder_preroll_close();
+
+/*
+ * set up the motion trigger (starts and stops event recordings)
+ *   the luma is downscaled and compared with the last analysed frame,
+ *   motion starts over the sensitivity area and only ends after the
+ *   changed area stays below half of it for hold_sec
+ * args:
+ *   sensitivity - 1 (large changes only) to 100 (0 - disabled)
+ *   interval - analyse one in every interval frames
+ *   hold_sec - time (in seconds) motion is held after the last change
+ *
+ * asserts:
+ *   none
+ *
+ * returns: error code
+ */
+int encoder_motion_trigger_init(int sensitivity, int interval, int hold_sec);
+
+/*
+ * run the motion trigger on a captured frame
+ * args:
+ *   frame - pointer to yu12 frame data (only the luma is used)
+ *   width - frame width
+ *   height - frame height
+ *   timestamp - frame timestamp (in nanosec)
+ *
+ * asserts:
+ *   none
+ *
+ * returns: motion state (1 - motion; 0 - no motion)
+ */
+int encoder_motion_trigger_frame(uint8_t *frame, int width, int height, int64_t timestamp);
+
+/*
+ * free the motion trigger data
+ * args:
+ *   none
+ *
+ * asserts:
+ *   none
+ *
+ * returns: none
+ */
+void encoder_motion_trigger_close();
+
 /*
  * process next video frame on the ring buffer (encode and mux to file)
  * args:
@@ -33,21 +33,159 @@
 #include <locale.h>
 #include <libintl.h>
 
+#include <libavutil/imgutils.h>
+#include <libavutil/opt.h>
+#include <libavutil/pixdesc.h>
+
 #include "gviewencoder.h"
 #include "encoder.h"
 
+extern int verbosity;
+
 #define AV_RB16(x)                           \
     ((((const uint8_t*)(x))[0] << 8) |          \
       ((const uint8_t*)(x))[1])
 
 
+/*converted frame buffers alignment (simd)*/
+#define ENCODER_FRAME_ALIGN 32
+
+/*
+ * libav buffer free callback for input data we don't own
+ * args:
+ *    opaque - not used
+ *    data - not used
+ *
+ * asserts:
+ *    none
+ *
+ * returns: none
+ */
+static void encoder_buffer_no_free(void *opaque, uint8_t *data)
+{
+}
+
+/*
+ * set up the yu12 input conversion (crop, scale and pixel format)
+ *  for the video codec context settings (size and pixel format)
+ * args:
+ *    video_codec_data - pointer to video codec data
+ *    threads - conversion threads
+ *
+ * asserts:
+ *    video_codec_data is not null
+ *
+ * returns: error code (0 - no conversion needed or conversion set)
+ */
+int encoder_video_scaler_init(encoder_codec_data_t *video_codec_data, int threads)
+{
+	/*assertions*/
+	assert(video_codec_data);
+
+	AVCodecContext *avctx = video_codec_data->codec_context;
+
+	/*fast path: yu12 layout at the crop size is encoded in place (no copy)*/
+	if(avctx->width == video_codec_data->crop_width &&
+		avctx->height == video_codec_data->crop_height &&
+		(avctx->pix_fmt == AV_PIX_FMT_YUV420P || avctx->pix_fmt == AV_PIX_FMT_YUVJ420P))
+		return 0;
+
+#if LIBSWSCALE_VER_AT_LEAST(6,1)
+	/*the frame api spreads the conversion over slice threads*/
+	video_codec_data->sws_context = sws_alloc_context();
+	if(video_codec_data->sws_context)
+	{
+		struct SwsContext *sws = video_codec_data->sws_context;
+		av_opt_set_int(sws, "srcw", video_codec_data->crop_width, 0);
+		av_opt_set_int(sws, "srch", video_codec_data->crop_height, 0);
+		av_opt_set_int(sws, "src_format", AV_PIX_FMT_YUV420P, 0);
+		av_opt_set_int(sws, "dstw", avctx->width, 0);
+		av_opt_set_int(sws, "dsth", avctx->height, 0);
+		av_opt_set_int(sws, "dst_format", avctx->pix_fmt, 0);
+		av_opt_set_int(sws, "sws_flags", SWS_BILINEAR, 0);
+		av_opt_set_int(sws, "threads", threads, 0);
+
+		if(sws_init_context(sws, NULL, NULL) < 0)
+		{
+			sws_freeContext(sws);
+			video_codec_data->sws_context = NULL;
+		}
+	}
+#else
+	/*single threaded*/
+	video_codec_data->sws_context = sws_getContext(
+		video_codec_data->crop_width,
+		video_codec_data->crop_height,
+		AV_PIX_FMT_YUV420P,
+		avctx->width,
+		avctx->height,
+		avctx->pix_fmt,
+		SWS_BILINEAR,
+		NULL, NULL, NULL);
+#endif
+
+	if(video_codec_data->sws_context == NULL)
+	{
+		fprintf(stderr, "ENCODER: couldn't convert %ix%i yu12 to %ix%i %s\n",
+			video_codec_data->crop_width, video_codec_data->crop_height,
+			avctx->width, avctx->height, av_get_pix_fmt_name(avctx->pix_fmt));
+		return -1;
+	}
+
+	video_codec_data->src_frame = av_frame_alloc();
+	video_codec_data->frame_pool = av_buffer_pool_init(
+		av_image_get_buffer_size(avctx->pix_fmt, avctx->width, avctx->height, ENCODER_FRAME_ALIGN),
+		NULL);
+
+	if(video_codec_data->src_frame == NULL || video_codec_data->frame_pool == NULL)
+	{
+		fprintf(stderr, "ENCODER: FATAL memory allocation failure (encoder_video_scaler_init): %s\n", strerror(errno));
+		exit(-1);
+	}
+
+	if(verbosity > 0)
+		printf("ENCODER: converting %ix%i+%i+%i yu12 input to %ix%i %s (%i threads)\n",
+			video_codec_data->crop_width, video_codec_data->crop_height,
+			video_codec_data->crop_x, video_codec_data->crop_y,
+			avctx->width, avctx->height, av_get_pix_fmt_name(avctx->pix_fmt),
+			LIBSWSCALE_VER_AT_LEAST(6,1) ? threads : 1);
+
+	return 0;
+}
+
+/*
+ * clean the yu12 input conversion data
+ * args:
+ *    video_codec_data - pointer to video codec data
+ *
+ * asserts:
+ *    video_codec_data is not null
+ *
+ * returns: none
+ */
+void encoder_video_scaler_close(encoder_codec_data_t *video_codec_data)
+{
+	/*assertions*/
+	assert(video_codec_data);
+
+	if(video_codec_data->sws_context)
+		sws_freeContext(video_codec_data->sws_context);
+	video_codec_data->sws_context = NULL;
+
+	if(video_codec_data->src_frame)
+		av_frame_free(&video_codec_data->src_frame);
+
+	/*buffers still referenced are freed when released*/
+	if(video_codec_data->frame_pool)
+		av_buffer_pool_uninit(&video_codec_data->frame_pool);
+}
+
 /*
  * set yu12 frame in codec data frame
+ *  (cropped in place or converted to the codec format and size)
  * args:
  *    video_codec_data - pointer to video codec data
- *    inp - input data (yu12)
- *    width - frame width
- *    height - frame height 
+ *    inp - input data (yu12 at in_width x in_height)
  *
  * asserts:
  *    video_codec_data is not null
@@ -55,24 +193,93 @@
  *
  * returns: none
  */
-void prepare_video_frame(encoder_codec_data_t *video_codec_data, uint8_t *inp, int width, int height)
+void prepare_video_frame(encoder_codec_data_t *video_codec_data, uint8_t *inp)
 {
 	/*assertions*/
 	assert(video_codec_data);
 	assert(inp);
 
+	int width = video_codec_data->in_width;
+	int height = video_codec_data->in_height;
 	int size = width * height;
 
-	video_codec_data->frame->format = AV_PIX_FMT_YUV420P;
-	video_codec_data->frame->width = width;
-	video_codec_data->frame->height = height;
-	
-	video_codec_data->frame->data[0] = inp; //Y
-	video_codec_data->frame->data[1] = inp + size; //U
-	video_codec_data->frame->data[2] = video_codec_data->frame->data[1] + size/4; //V
-	video_codec_data->frame->linesize[0] = width;
-	video_codec_data->frame->linesize[1] = width / 2;
-	video_codec_data->frame->linesize[2] = width / 2;
+	/*crop rectangle planes*/
+	uint8_t *data[3];
+	int linesize[3];
+	data[0] = inp + video_codec_data->crop_y * width + video_codec_data->crop_x; //Y
+	data[1] = inp + size + (video_codec_data->crop_y / 2) * (width / 2) + video_codec_data->crop_x / 2; //U
+	data[2] = data[1] + size/4; //V
+	linesize[0] = width;
+	linesize[1] = width / 2;
+	linesize[2] = width / 2;
+
+	AVFrame *frame = video_codec_data->frame;
+
+	if(video_codec_data->sws_context == NULL)
+	{
+		frame->format = AV_PIX_FMT_YUV420P;
+		frame->width = video_codec_data->crop_width;
+		frame->height = video_codec_data->crop_height;
+
+		frame->data[0] = data[0];
+		frame->data[1] = data[1];
+		frame->data[2] = data[2];
+		frame->linesize[0] = linesize[0];
+		frame->linesize[1] = linesize[1];
+		frame->linesize[2] = linesize[2];
+
+		/*ring slot reference (if any) is handed to libav with the frame*/
+		frame->buf[0] = video_codec_data->frame_ref;
+		video_codec_data->frame_ref = NULL;
+		return;
+	}
+
+	AVCodecContext *avctx = video_codec_data->codec_context;
+
+	/*converted frames come from the pool: libav keeps them referenced*/
+	AVBufferRef *out = av_buffer_pool_get(video_codec_data->frame_pool);
+	if(out == NULL)
+	{
+		fprintf(stderr, "ENCODER: FATAL memory allocation failure (prepare_video_frame): %s\n", strerror(errno));
+		exit(-1);
+	}
+
+	frame->format = avctx->pix_fmt;
+	frame->width = avctx->width;
+	frame->height = avctx->height;
+	av_image_fill_arrays(frame->data, frame->linesize, out->data,
+		avctx->pix_fmt, avctx->width, avctx->height, ENCODER_FRAME_ALIGN);
+	frame->buf[0] = out;
+
+#if LIBSWSCALE_VER_AT_LEAST(6,1)
+	AVFrame *src = video_codec_data->src_frame;
+	src->format = AV_PIX_FMT_YUV420P;
+	src->width = video_codec_data->crop_width;
+	src->height = video_codec_data->crop_height;
+	int i = 0;
+	for(i = 0; i < 3; i++)
+	{
+		src->data[i] = data[i];
+		src->linesize[i] = linesize[i];
+	}
+	/*a reference counted source is not copied by swscale*/
+	src->buf[0] = video_codec_data->frame_ref;
+	video_codec_data->frame_ref = NULL;
+	if(src->buf[0] == NULL)
+		src->buf[0] = av_buffer_create(inp, size + size/2, encoder_buffer_no_free, NULL, AV_BUFFER_FLAG_READONLY);
+
+	if(src->buf[0] == NULL || sws_scale_frame(video_codec_data->sws_context, frame, src) < 0)
+		fprintf(stderr, "ENCODER: (prepare_video_frame) frame conversion failed\n");
+
+	/*releases the input (ring slot)*/
+	av_frame_unref(src);
+#else
+	sws_scale(video_codec_data->sws_context, (const uint8_t * const *) data, linesize,
+		0, video_codec_data->crop_height, frame->data, frame->linesize);
+
+	/*input (ring slot) no longer needed*/
+	av_buffer_unref(&video_codec_data->frame_ref);
+#endif
 }
 
 /*
@@ -71,6 +71,9 @@
 /** per-cuepoint - 2 1-byte EBML IDs, 2 1-byte EBML sizes, 8-byte uint max */
 #define MAX_CUEPOINT_SIZE(num_tracks) 12 + MAX_CUETRACKPOS_SIZE*num_tracks
 
+/** duration - 2-byte EBML ID, 1-byte EBML size, 8-byte double */
+#define MKV_DURATION_SIZE 11
+
 /*default audio frames per buffer*/
 #define AUDBUFF_FRAMES  1152
 
@@ -112,12 +115,20 @@ static int ebml_id_size(unsigned int id)
     return bytes;
 }
 
+/** store an id in a buffer (returns the number of bytes) */
+static int ebml_id_buf(uint8_t *buf, unsigned int id)
+{
+    int i, bytes = ebml_id_size(id);
+    for (i = 0; i < bytes; i++)
+        buf[i] = (uint8_t) (id >> (bytes - 1 - i)*8);
+    return bytes;
+}
+
 /** write an id */
 static void mkv_put_ebml_id(mkv_context_t *mkv_ctx, unsigned int id)
 {
-    int i = ebml_id_size(id);
-    while (i--)
-        io_write_w8(mkv_ctx->writer, id >> (i*8));
+    uint8_t buf[4];
+    io_write_buf(mkv_ctx->writer, buf, ebml_id_buf(buf, id));
 }
 
 /**
@@ -129,9 +140,10 @@ static void mkv_put_ebml_size_unknown(mkv_context_t *mkv_ctx, int bytes)
 {
     if(bytes <= 8) //max is 64 bits
     {
-		io_write_w8(mkv_ctx->writer, 0x1ff >> bytes);
-		while (--bytes)
-			io_write_w8(mkv_ctx->writer, 0xff);
+		uint8_t buf[8];
+		memset(buf, 0xff, sizeof(buf));
+		buf[0] = 0x1ff >> bytes;
+		io_write_buf(mkv_ctx->writer, buf, bytes);
 	}
 	else
 		fprintf(stderr, "mkv_ctx: bad unknown size (%i > 8) bytes)\n", bytes);
@@ -149,12 +161,13 @@ static int ebml_num_size(uint64_t num)
 }
 
 /**
- * Write a number in EBML variable length format.
+ * Store a number in EBML variable length format in a buffer.
  *
  * @param bytes The number of bytes that need to be used to write the number.
  *              If zero, any number of bytes can be used.
+ * @return The number of bytes stored (0 on error).
  */
-static void mkv_put_ebml_num(mkv_context_t *mkv_ctx, uint64_t num, int bytes)
+static int ebml_num_buf(uint8_t *buf, uint64_t num, int bytes)
 {
     int i, needed_bytes = ebml_num_size(num);
 
@@ -162,7 +175,7 @@ static void mkv_put_ebml_num(mkv_context_t *mkv_ctx, uint64_t num, int bytes)
     if(num >= (1ULL<<56)-1)
     {
 		fprintf(stderr, "ENCODER: (matroska) ebml number: %" PRIu64 "\n", num);
-		return;
+		return 0;
 	}
 
     if (bytes == 0)
@@ -173,38 +186,72 @@ static void mkv_put_ebml_num(mkv_context_t *mkv_ctx, uint64_t num, int bytes)
     if(bytes < needed_bytes)
     {
 		fprintf(stderr, "ENCODER: (matroska) bad requested size for ebml number: %" PRIu64 " (%i < %i)\n", num, bytes, needed_bytes);
-		return;
+		return 0;
 	}
 
     num |= 1ULL << bytes*7;
-    for (i = bytes - 1; i >= 0; i--)
-        io_write_w8(mkv_ctx->writer, num >> i*8);
+    for (i = 0; i < bytes; i++)
+        buf[i] = (uint8_t) (num >> (bytes - 1 - i)*8);
+    return bytes;
 }
 
-static void mkv_put_ebml_uint(mkv_context_t *mkv_ctx, unsigned int elementid, uint64_t val)
+/**
+ * Write a number in EBML variable length format.
+ *
+ * @param bytes The number of bytes that need to be used to write the number.
+ *              If zero, any number of bytes can be used.
+ */
+static void mkv_put_ebml_num(mkv_context_t *mkv_ctx, uint64_t num, int bytes)
+{
+    uint8_t buf[8];
+    int len = ebml_num_buf(buf, num, bytes);
+    if(len > 0)
+        io_write_buf(mkv_ctx->writer, buf, len);
+}
+
+/**
+ * Store an unsigned integer element (id, size and value) in a buffer.
+ *
+ * @param buf The buffer (at least 13 bytes).
+ * @return The number of bytes stored.
+ */
+static int ebml_uint_buf(uint8_t *buf, unsigned int elementid, uint64_t val)
 {
     int i, bytes = 1;
     uint64_t tmp = val;
     while (tmp>>=8) bytes++;
 
-    mkv_put_ebml_id(mkv_ctx, elementid);
-    mkv_put_ebml_num(mkv_ctx, bytes, 0);
+    int len = ebml_id_buf(buf, elementid);
+    len += ebml_num_buf(buf + len, bytes, 0);
     for (i = bytes - 1; i >= 0; i--)
-        io_write_w8(mkv_ctx->writer, val >> i*8);
+        buf[len++] = (uint8_t) (val >> i*8);
+    return len;
+}
+
+static void mkv_put_ebml_uint(mkv_context_t *mkv_ctx, unsigned int elementid, uint64_t val)
+{
+    uint8_t buf[13];
+    io_write_buf(mkv_ctx->writer, buf, ebml_uint_buf(buf, elementid, val));
 }
 
 static void mkv_put_ebml_float(mkv_context_t *mkv_ctx, unsigned int elementid, double val)
 {
-    mkv_put_ebml_id(mkv_ctx, elementid);
-    mkv_put_ebml_num(mkv_ctx, 8, 0);
-    io_write_wb64(mkv_ctx->writer, mkv_double2int(val));
+    uint8_t buf[13];
+    int i, len = ebml_id_buf(buf, elementid);
+    len += ebml_num_buf(buf + len, 8, 0);
+    uint64_t num = mkv_double2int(val);
+    for (i = 7; i >= 0; i--)
+        buf[len++] = (uint8_t) (num >> i*8);
+    io_write_buf(mkv_ctx->writer, buf, len);
 }
 
 static void mkv_put_ebml_binary(mkv_context_t *mkv_ctx, unsigned int elementid,
                             void *buf, int size)
 {
-    mkv_put_ebml_id(mkv_ctx, elementid);
-    mkv_put_ebml_num(mkv_ctx, size, 0);
+    uint8_t header[12];
+    int len = ebml_id_buf(header, elementid);
+    len += ebml_num_buf(header + len, size, 0);
+    io_write_buf(mkv_ctx->writer, header, len);
     io_write_buf(mkv_ctx->writer, buf, size);
 }
 
@@ -221,6 +268,7 @@ static void mkv_put_ebml_string(mkv_context_t *mkv_ctx, unsigned int elementid,
  */
 static void mkv_put_ebml_void(mkv_context_t *mkv_ctx, uint64_t size)
 {
+    static uint8_t zeros[256];
     int64_t currentpos = io_get_offset(mkv_ctx->writer);
 
     if(size < 2)
@@ -236,8 +284,14 @@ static void mkv_put_ebml_void(mkv_context_t *mkv_ctx, uint64_t size)
         mkv_put_ebml_num(mkv_ctx, size-1, 0);
     else
         mkv_put_ebml_num(mkv_ctx, size-9, 8);
-    while(io_get_offset(mkv_ctx->writer) < currentpos + size)
-        io_write_w8(mkv_ctx->writer, 0);
+
+    int64_t left = currentpos + size - io_get_offset(mkv_ctx->writer);
+    while(left > 0)
+    {
+        int len = (left > (int64_t) sizeof(zeros)) ? (int) sizeof(zeros) : (int) left;
+        io_write_buf(mkv_ctx->writer, zeros, len);
+        left -= len;
+    }
 }
 
 static ebml_master_t mkv_start_ebml_master(mkv_context_t *mkv_ctx,
@@ -254,11 +308,21 @@ static ebml_master_t mkv_start_ebml_master(mkv_context_t *mkv_ctx,
 static void mkv_end_ebml_master(mkv_context_t *mkv_ctx, ebml_master_t master)
 {
     int64_t pos = io_get_offset(mkv_ctx->writer);
+    uint64_t num = pos - master.pos;
+    uint8_t buf[8];
+    int i;
+
+    if(master.sizebytes > 8 || ebml_num_size(num) > master.sizebytes)
+    {
+		fprintf(stderr, "ENCODER: (matroska) bad requested size for ebml master: %" PRIu64 " (%i bytes)\n", num, master.sizebytes);
+		return;
+	}
 
-    if (io_seek(mkv_ctx->writer, master.pos - master.sizebytes) < 0)
-        return;
-    mkv_put_ebml_num(mkv_ctx, pos - master.pos, master.sizebytes);
-	io_seek(mkv_ctx->writer, pos);
+    /* patch the reserved size field with a positional write */
+    num |= 1ULL << master.sizebytes*7;
+    for (i = 0; i < master.sizebytes; i++)
+        buf[i] = (uint8_t) (num >> (master.sizebytes - 1 - i)*8);
+    io_write_at(mkv_ctx->writer, master.pos - master.sizebytes, buf, master.sizebytes);
 }
 
 //static void mkv_put_xiph_size(mkv_context_t* mkv_ctx, int size)
@@ -334,6 +398,31 @@ static int mkv_add_seekhead_entry(mkv_seekhead_t *seekhead,
     return 0;
 }
 
+/**
+ * Write the seek head element (and its entries) at the current position.
+ */
+static void mkv_put_seekhead(mkv_context_t* mkv_ctx, mkv_seekhead_t *seekhead)
+{
+    ebml_master_t metaseek, seekentry;
+    int i;
+
+    metaseek = mkv_start_ebml_master(mkv_ctx, MATROSKA_ID_SEEKHEAD, seekhead->reserved_size);
+    for (i = 0; i < seekhead->num_entries; i++)
+    {
+        mkv_seekhead_entry_t *entry = &seekhead->entries[i];
+
+        seekentry = mkv_start_ebml_master(mkv_ctx, MATROSKA_ID_SEEKENTRY, MAX_SEEKENTRY_SIZE);
+
+        mkv_put_ebml_id(mkv_ctx, MATROSKA_ID_SEEKID);
+        mkv_put_ebml_num(mkv_ctx, ebml_id_size(entry->elementid), 0);
+        mkv_put_ebml_id(mkv_ctx, entry->elementid);
+
+        mkv_put_ebml_uint(mkv_ctx, MATROSKA_ID_SEEKPOSITION, entry->segmentpos);
+        mkv_end_ebml_master(mkv_ctx, seekentry);
+    }
+    mkv_end_ebml_master(mkv_ctx, metaseek);
+}
+
 /**
  * Write the seek head to the file and free it. If a maximum number of
  * elements was specified to mkv_start_seekhead(), the seek head will
@@ -345,9 +434,7 @@ static int mkv_add_seekhead_entry(mkv_seekhead_t *seekhead,
  */
 static int64_t mkv_write_seekhead(mkv_context_t* mkv_ctx, mkv_seekhead_t *seekhead)
 {
-    ebml_master_t metaseek, seekentry;
     int64_t currentpos;
-    int i;
 
     currentpos = io_get_offset(mkv_ctx->writer);
 
@@ -361,21 +448,7 @@ static int64_t mkv_write_seekhead(mkv_context_t* mkv_ctx, mkv_seekhead_t *seekhe
         }
     }
 
-    metaseek = mkv_start_ebml_master(mkv_ctx, MATROSKA_ID_SEEKHEAD, seekhead->reserved_size);
-    for (i = 0; i < seekhead->num_entries; i++)
-    {
-        mkv_seekhead_entry_t *entry = &seekhead->entries[i];
-
-        seekentry = mkv_start_ebml_master(mkv_ctx, MATROSKA_ID_SEEKENTRY, MAX_SEEKENTRY_SIZE);
-
-        mkv_put_ebml_id(mkv_ctx, MATROSKA_ID_SEEKID);
-        mkv_put_ebml_num(mkv_ctx, ebml_id_size(entry->elementid), 0);
-        mkv_put_ebml_id(mkv_ctx, entry->elementid);
-
-        mkv_put_ebml_uint(mkv_ctx, MATROSKA_ID_SEEKPOSITION, entry->segmentpos);
-        mkv_end_ebml_master(mkv_ctx, seekentry);
-    }
-    mkv_end_ebml_master(mkv_ctx, metaseek);
+    mkv_put_seekhead(mkv_ctx, seekhead);
 
     if (seekhead->reserved_size > 0) {
         uint64_t remaining = seekhead->filepos + seekhead->reserved_size - io_get_offset(mkv_ctx->writer);
@@ -464,6 +537,136 @@ static int64_t mkv_write_cues(mkv_context_t *mkv_ctx, mkv_cues_t *cues, int num_
     return currentpos;
 }
 
+/**
+ * Redirect the element writes to a memory buffer of size bytes,
+ * used to build elements that are patched in the file with a
+ * single positional write.
+ *
+ * @return The file writer (to be restored by mkv_end_mem_write).
+ */
+static io_writer_t *mkv_start_mem_write(mkv_context_t *mkv_ctx, int size)
+{
+    io_writer_t *file_writer = mkv_ctx->writer;
+
+    /*one extra byte: a full buffer would trigger a flush*/
+    mkv_ctx->writer = io_create_writer(NULL, size + 1);
+    return file_writer;
+}
+
+/**
+ * Write the memory buffer data at offset in the file and
+ * restore the file writer.
+ */
+static int mkv_end_mem_write(mkv_context_t *mkv_ctx, io_writer_t *file_writer, int64_t offset)
+{
+    io_writer_t *mem_writer = mkv_ctx->writer;
+    int size = (int) io_get_offset(mem_writer);
+
+    mkv_ctx->writer = file_writer;
+
+    int ret = io_write_at(file_writer, offset, mem_writer->buffer, size);
+    io_destroy_writer(mem_writer);
+    free(mem_writer);
+
+    return ret;
+}
+
+/**
+ * Store the duration element in a buffer (it fills the space reserved
+ * in the segment info).
+ *
+ * @param buf The buffer (at least MKV_DURATION_SIZE bytes).
+ * @return The number of bytes stored.
+ */
+static int mkv_duration_buf(uint8_t *buf, int64_t duration)
+{
+    /* id (2) + size (1) + double (8) */
+    uint64_t val = mkv_double2int((float) duration);
+    int i;
+
+    buf[0] = (uint8_t) (MATROSKA_ID_DURATION >> 8);
+    buf[1] = (uint8_t) MATROSKA_ID_DURATION;
+    buf[2] = 0x80 | 8;
+    for (i = 0; i < 8; i++)
+        buf[3 + i] = (uint8_t) (val >> (7 - i)*8);
+    return MKV_DURATION_SIZE;
+}
+
+/**
+ * Patch the duration (in the space reserved in the segment info).
+ */
+static void mkv_write_duration(mkv_context_t *mkv_ctx)
+{
+    uint8_t buf[MKV_DURATION_SIZE];
+    io_write_at(mkv_ctx->writer, mkv_ctx->duration_offset, buf,
+        mkv_duration_buf(buf, mkv_ctx->duration));
+}
+
+/**
+ * Write the cues in the space reserved after the tracks (checkpoint mode).
+ * If the cues don't fit, only every n-th cue point is written.
+ *
+ * @return 0 if all the cue points were written, 1 if some were left out.
+ */
+static int mkv_write_cues_checkpoint(mkv_context_t *mkv_ctx)
+{
+    mkv_cues_t *cues = mkv_ctx->cues;
+    /*cues id and size (12) and a void element for the remaining space (10)*/
+    int max_entries = (MKV_CHECKPOINT_CUES_SIZE - 22) /
+        (MAX_CUEPOINT_SIZE(mkv_ctx->stream_list_size));
+    int step = (cues->num_entries + max_entries - 1) / max_entries;
+    int i = 0;
+
+    /*a cues element must have at least one cue point: keep the void*/
+    if (cues->num_entries <= 0)
+        return 0;
+
+    if (step < 1)
+        step = 1;
+
+    mkv_cues_t checkpoint = *cues;
+
+    if (step > 1)
+    {
+        checkpoint.entries = calloc(max_entries, sizeof(mkv_cuepoint_t));
+        if (checkpoint.entries == NULL)
+        {
+            fprintf(stderr, "ENCODER: FATAL memory allocation failure (mkv_write_cues_checkpoint): %s\n", strerror(errno));
+            exit(-1);
+        }
+        checkpoint.num_entries = 0;
+        for (i = 0; i < cues->num_entries; i += step)
+            checkpoint.entries[checkpoint.num_entries++] = cues->entries[i];
+    }
+
+    io_writer_t *file_writer = mkv_start_mem_write(mkv_ctx, MKV_CHECKPOINT_CUES_SIZE);
+
+    mkv_write_cues(mkv_ctx, &checkpoint, mkv_ctx->stream_list_size);
+    mkv_put_ebml_void(mkv_ctx, MKV_CHECKPOINT_CUES_SIZE - io_get_offset(mkv_ctx->writer));
+
+    mkv_end_mem_write(mkv_ctx, file_writer, mkv_ctx->cues_reserved_pos);
+
+    if (step > 1)
+        free(checkpoint.entries);
+
+    return (step > 1) ? 1 : 0;
+}
+
+/**
+ * Checkpoint: update the cues and duration in the file and
+ * sync it to disk, so that the file is seekable after a crash.
+ */
+static void mkv_write_checkpoint(mkv_context_t *mkv_ctx)
+{
+    if (verbosity > 1)
+        printf("ENCODER: (matroska) checkpoint with %i cue points\n", mkv_ctx->cues->num_entries);
+
+    mkv_write_cues_checkpoint(mkv_ctx);
+    mkv_write_duration(mkv_ctx);
+
+    io_sync(mkv_ctx->writer);
+}
+
 static void mkv_write_codecprivate(mkv_context_t *mkv_ctx, stream_io_t *stream)
 {
 	if (stream->extra_data_size && stream->extra_data != NULL)
@@ -653,12 +856,27 @@ int mkv_write_header(mkv_context_t *mkv_ctx)
     /* reserve space for the duration*/
     mkv_ctx->duration = 0;
     mkv_ctx->duration_offset = io_get_offset(mkv_ctx->writer);
-    mkv_put_ebml_void(mkv_ctx, 11); /* assumes double-precision float to be written*/
+    mkv_put_ebml_void(mkv_ctx, MKV_DURATION_SIZE); /* assumes double-precision float to be written*/
     mkv_end_ebml_master(mkv_ctx, segment_info);
 
     ret = mkv_write_tracks(mkv_ctx);
     if (ret < 0) return ret;
 
+    if (mkv_ctx->checkpoint_interval > 0)
+    {
+        /* reserve space for the cues (patched on each checkpoint)*/
+        mkv_ctx->cues_reserved_pos = io_get_offset(mkv_ctx->writer);
+        mkv_put_ebml_void(mkv_ctx, MKV_CHECKPOINT_CUES_SIZE);
+
+        ret = mkv_add_seekhead_entry(mkv_ctx->main_seekhead, MATROSKA_ID_CUES, mkv_ctx->cues_reserved_pos);
+        if (ret < 0) return ret;
+
+        /* all level 1 elements are known: write the seekhead now*/
+        io_writer_t *file_writer = mkv_start_mem_write(mkv_ctx, mkv_ctx->main_seekhead->reserved_size);
+        mkv_put_seekhead(mkv_ctx, mkv_ctx->main_seekhead);
+        mkv_put_ebml_void(mkv_ctx, mkv_ctx->main_seekhead->reserved_size - io_get_offset(mkv_ctx->writer));
+        mkv_end_mem_write(mkv_ctx, file_writer, mkv_ctx->main_seekhead->filepos);
+    }
 
     mkv_ctx->cues = mkv_start_cues(mkv_ctx->segment_offset);
     if (mkv_ctx->cues == NULL)
@@ -758,12 +976,42 @@ static void mkv_write_block(mkv_context_t* mkv_ctx,
 	if(!!(flags & AV_PKT_FLAG_KEY)) //for simple block
 		block_flags |= 0x80;
 
-    mkv_put_ebml_id(mkv_ctx, blockid);
-    mkv_put_ebml_num(mkv_ctx, size+4, 0);
-    io_write_w8(mkv_ctx->writer, 0x80 | (stream_index + 1));// this assumes stream_index is less than 126
-    io_write_wb16(mkv_ctx->writer, pts - mkv_ctx->cluster_pts); //pts and cluster_pts are scaled
-    io_write_w8(mkv_ctx->writer, block_flags);
-    io_write_buf(mkv_ctx->writer, data, size);
+    /*block header: id, size, track number, relative timecode and flags*/
+    uint8_t header[16];
+    uint16_t timecode = (uint16_t) (pts - mkv_ctx->cluster_pts); //pts and cluster_pts are scaled
+    int len = ebml_id_buf(header, blockid);
+    len += ebml_num_buf(header + len, size+4, 0);
+    header[len++] = 0x80 | (stream_index + 1);// this assumes stream_index is less than 126
+    header[len++] = (uint8_t) (timecode >> 8);
+    header[len++] = (uint8_t) (timecode & 0xff);
+    header[len++] = block_flags;
+
+    io_write_buf(mkv_ctx->writer, header, len);
+    io_write_buf_nocopy(mkv_ctx->writer, data, size);
+}
+
+/*cluster id and an 8 byte unknown size (patched when the cluster ends)*/
+static const uint8_t mkv_cluster_header[12] =
+	{0x1F, 0x43, 0xB6, 0x75, 0x01, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF};
+
+/**
+ * Start a new cluster (header and timecode written at once).
+ *
+ * @param ts The cluster timecode (scaled).
+ */
+static void mkv_start_cluster(mkv_context_t* mkv_ctx, uint64_t ts)
+{
+    uint8_t buf[sizeof(mkv_cluster_header) + 13];
+
+    mkv_ctx->cluster_pos = io_get_offset(mkv_ctx->writer);
+
+    memcpy(buf, mkv_cluster_header, sizeof(mkv_cluster_header));
+    int len = sizeof(mkv_cluster_header) +
+        ebml_uint_buf(buf + sizeof(mkv_cluster_header), MATROSKA_ID_CLUSTERTIMECODE, ts);
+    io_write_buf(mkv_ctx->writer, buf, len);
+
+    mkv_ctx->cluster = (ebml_master_t){ mkv_ctx->cluster_pos + sizeof(mkv_cluster_header), 8 };
+    mkv_ctx->cluster_pts = ts;
 }
 
 static int mkv_write_packet_internal(mkv_context_t* mkv_ctx,
@@ -784,12 +1032,7 @@ static int mkv_write_packet_internal(mkv_context_t* mkv_ctx,
 	stream->packet_count++;
 
     if (!mkv_ctx->cluster_pos)
-    {
-        mkv_ctx->cluster_pos = io_get_offset(mkv_ctx->writer);
-        mkv_ctx->cluster = mkv_start_ebml_master(mkv_ctx, MATROSKA_ID_CLUSTER, 0);
-        mkv_put_ebml_uint(mkv_ctx, MATROSKA_ID_CLUSTERTIMECODE, MAX(0, ts));
-		mkv_ctx->cluster_pts = MAX(0, ts);
-    }
+        mkv_start_cluster(mkv_ctx, MAX(0, ts));
 
 	if(use_simpleblock)
 		mkv_write_block(mkv_ctx, MATROSKA_ID_SIMPLEBLOCK, stream_index, data, size, ts, flags);
@@ -896,7 +1139,11 @@ int mkv_write_packet(mkv_context_t* mkv_ctx,
     int ret, keyframe = !!(flags & AV_PKT_FLAG_KEY);
     uint64_t ts = pts;
 
-	ts -= mkv_ctx->first_pts;
+	/*segment files start at the first keyframe pts*/
+	if(pts > mkv_ctx->first_pts)
+		ts -= mkv_ctx->first_pts;
+	else
+		ts = 0;
 
     int cluster_size = io_get_offset(mkv_ctx->writer) - mkv_ctx->cluster_pos;
 
@@ -946,6 +1193,14 @@ int mkv_write_packet(mkv_context_t* mkv_ctx,
     {
         mkv_end_ebml_master(mkv_ctx, mkv_ctx->cluster);
         mkv_ctx->cluster_pos = 0;
+
+        /*crash safe output: checkpoint between clusters*/
+        if (mkv_ctx->checkpoint_interval > 0 &&
+            ts >= mkv_ctx->checkpoint_last + mkv_ctx->checkpoint_interval)
+        {
+            mkv_write_checkpoint(mkv_ctx);
+            mkv_ctx->checkpoint_last = ts;
+        }
     }
 
     /*
@@ -962,7 +1217,7 @@ int mkv_write_packet(mkv_context_t* mkv_ctx,
 
 int mkv_close(mkv_context_t* mkv_ctx)
 {
-    int64_t currentpos, cuespos;
+    int64_t cuespos;
     int ret;
 	printf("ENCODER: (matroska) closing context\n");
 
@@ -995,7 +1250,38 @@ int mkv_close(mkv_context_t* mkv_ctx)
 	if(mkv_ctx->cluster_pos)
 		mkv_end_ebml_master(mkv_ctx, mkv_ctx->cluster);
 
-	if (mkv_ctx->cues->num_entries)
+	if (mkv_ctx->checkpoint_interval > 0 && !mkv_ctx->cues->num_entries)
+	{
+		/*no cue points: the reserved space is left as void*/
+		mkv_ctx->main_seekhead->num_entries--;
+	}
+	else if (mkv_ctx->checkpoint_interval > 0)
+	{
+		/*
+		 * the seekhead (already written) points to the reserved space:
+		 * if not all cue points fit there, write the full cues at the
+		 * end and void the reserved space
+		 */
+		if (mkv_write_cues_checkpoint(mkv_ctx) > 0)
+		{
+			int i = 0;
+			uint8_t buf[9];
+			uint64_t num = (MKV_CHECKPOINT_CUES_SIZE - 9) | (1ULL << 56);
+
+			printf("ENCODER: (matroska)writing cues\n");
+			cuespos = mkv_write_cues(mkv_ctx, mkv_ctx->cues, mkv_ctx->stream_list_size);
+
+			for (i = 0; i < mkv_ctx->main_seekhead->num_entries; i++)
+				if (mkv_ctx->main_seekhead->entries[i].elementid == MATROSKA_ID_CUES)
+					mkv_ctx->main_seekhead->entries[i].segmentpos = cuespos - mkv_ctx->segment_offset;
+
+			buf[0] = EBML_ID_VOID;
+			for (i = 0; i < 8; i++)
+				buf[1 + i] = (uint8_t) (num >> (7 - i)*8);
+			io_write_at(mkv_ctx->writer, mkv_ctx->cues_reserved_pos, buf, 9);
+		}
+	}
+	else if (mkv_ctx->cues->num_entries)
 	{
 		printf("ENCODER: (matroska)writing cues\n");
 		cuespos = mkv_write_cues(mkv_ctx, mkv_ctx->cues, mkv_ctx->stream_list_size);
@@ -1008,11 +1294,7 @@ int mkv_close(mkv_context_t* mkv_ctx)
 
     // update the duration
     fprintf(stderr,"ENCODER: (matroska) end duration = %" PRIu64 " (%f) \n", mkv_ctx->duration, (float) mkv_ctx->duration);
-    currentpos = io_get_offset(mkv_ctx->writer);
-    io_seek(mkv_ctx->writer, mkv_ctx->duration_offset);
-
-    mkv_put_ebml_float(mkv_ctx, MATROSKA_ID_DURATION, (float) mkv_ctx->duration);
-	io_seek(mkv_ctx->writer, currentpos);
+    mkv_write_duration(mkv_ctx);
 
     mkv_end_ebml_master(mkv_ctx, mkv_ctx->segment);
     av_freep(&mkv_ctx->cues->entries);
@@ -1021,6 +1303,426 @@ int mkv_close(mkv_context_t* mkv_ctx)
     return 0;
 }
 
+/**
+ * Recovery: read an EBML element header (id and size) at offset.
+ *
+ * @param size Stores the element data size (-1 if unknown).
+ * @param size_len Stores the number of bytes used by the size.
+ * @return The header size (id + size) or 0 on error.
+ */
+static int mkv_read_element(int fd, int64_t offset, int64_t file_size,
+	uint32_t *id, int64_t *size, int *size_len)
+{
+	uint8_t buf[12];
+	int n = (int) MIN(12, file_size - offset);
+	int id_len = 1;
+	int len = 1;
+	int i = 0;
+
+	if(n <= 0 || pread(fd, buf, n, offset) != n)
+		return 0;
+
+	/*id (1 to 4 bytes, marker bit included)*/
+	while(id_len <= 4 && !(buf[0] & (0x80 >> (id_len - 1))))
+		id_len++;
+	if(id_len > 4 || id_len >= n)
+		return 0;
+
+	*id = 0;
+	for(i = 0; i < id_len; i++)
+		*id = (*id << 8) | buf[i];
+
+	/*size (1 to 8 bytes, all ones means unknown)*/
+	uint8_t *sp = buf + id_len;
+	while(len <= 8 && !(sp[0] & (0x80 >> (len - 1))))
+		len++;
+	if(len > 8 || id_len + len > n)
+		return 0;
+
+	uint64_t mask = (0x80 >> (len - 1)) - 1;
+	uint64_t val = sp[0] & mask;
+	int unknown = (val == mask);
+	for(i = 1; i < len; i++)
+	{
+		val = (val << 8) | sp[i];
+		unknown = unknown && (sp[i] == 0xff);
+	}
+
+	*size = unknown ? -1 : (int64_t) val;
+	*size_len = len;
+
+	return id_len + len;
+}
+
+/**
+ * Recovery: read a big endian unsigned integer element value.
+ *
+ * @param size The value size in bytes (maximum: 8).
+ */
+static uint64_t mkv_read_uint(int fd, int64_t offset, int size)
+{
+	uint8_t buf[8];
+	uint64_t val = 0;
+	int i = 0;
+
+	if(size > 8 || pread(fd, buf, size, offset) != size)
+		return 0;
+
+	for(i = 0; i < size; i++)
+		val = (val << 8) | buf[i];
+
+	return val;
+}
+
+/**
+ * Recovery: patch the EBML size field (len bytes) at offset.
+ *
+ * @return 0 on success, -1 on error.
+ */
+static int mkv_patch_size(int fd, int64_t offset, uint64_t num, int len)
+{
+	uint8_t buf[8];
+	int i = 0;
+
+	if(len > 8 || ebml_num_size(num) > len)
+		return -1;
+
+	num |= 1ULL << len*7;
+	for (i = 0; i < len; i++)
+		buf[i] = (uint8_t) (num >> (len - 1 - i)*8);
+
+	return (pwrite(fd, buf, len, offset) == len) ? 0 : -1;
+}
+
+/**
+ * Recovery: scan the blocks of a cluster, adding cue points for the
+ * video keyframes.
+ *
+ * @param limit The end of the cluster (or file) data.
+ * @param duration Updated with the max block timestamp.
+ * @return The end of the last complete cluster element.
+ */
+static int64_t mkv_recover_cluster(int fd, int64_t cluster_pos, int64_t data_pos,
+	int64_t limit, int64_t file_size, int video_track,
+	mkv_cues_t *cues, uint64_t *duration)
+{
+	uint64_t cluster_ts = 0;
+	int64_t pos = data_pos;
+
+	while(pos < limit)
+	{
+		uint32_t id;
+		int64_t size;
+		int size_len;
+		int hdr = mkv_read_element(fd, pos, file_size, &id, &size, &size_len);
+
+		/*truncated element*/
+		if(!hdr || size < 0 || pos + hdr + size > limit)
+			break;
+		/*next level 1 element (end of an unknown size cluster)*/
+		if(ebml_id_size(id) == 4)
+			break;
+
+		if(id == MATROSKA_ID_CLUSTERTIMECODE)
+			cluster_ts = mkv_read_uint(fd, pos + hdr, (int) size);
+		else if(id == MATROSKA_ID_SIMPLEBLOCK || id == MATROSKA_ID_BLOCKGROUP)
+		{
+			int64_t block_pos = pos + hdr;
+			int keyframe = 0;
+
+			if(id == MATROSKA_ID_BLOCKGROUP)
+			{
+				/*find the block, keyframes have no reference block*/
+				int64_t gpos = pos + hdr;
+				block_pos = -1;
+				keyframe = 1;
+				while(gpos < pos + hdr + size)
+				{
+					uint32_t gid;
+					int64_t gsize;
+					int glen;
+					int ghdr = mkv_read_element(fd, gpos, file_size, &gid, &gsize, &glen);
+					if(!ghdr || gsize < 0)
+						break;
+					if(gid == MATROSKA_ID_BLOCK)
+						block_pos = gpos + ghdr;
+					else if(gid == MATROSKA_ID_BLOCKREFERENCE)
+						keyframe = 0;
+					gpos += ghdr + gsize;
+				}
+			}
+
+			uint8_t bh[4];
+			if(block_pos >= 0 && pread(fd, bh, 4, block_pos) == 4)
+			{
+				/*track number (1 byte), relative timecode, flags*/
+				int track = bh[0] & 0x7f;
+				int16_t rel_ts = (int16_t) ((bh[1] << 8) | bh[2]);
+				int64_t ts = (int64_t) cluster_ts + rel_ts;
+
+				if(id == MATROSKA_ID_SIMPLEBLOCK)
+					keyframe = !!(bh[3] & 0x80);
+
+				if(ts > 0 && (uint64_t) ts > *duration)
+					*duration = ts;
+
+				if(track == video_track && keyframe)
+					mkv_add_cuepoint(cues, track - 1, ts, cluster_pos);
+			}
+		}
+
+		pos += hdr + size;
+	}
+
+	return pos;
+}
+
+/** rebuild the index (cues, seekhead, duration and sizes)
+ *  of an unfinished file by scanning its clusters */
+int mkv_recover(const char *filename)
+{
+	uint32_t id;
+	int64_t size;
+	int size_len;
+	int hdr;
+
+	int fd = open(filename, O_RDWR);
+	if(fd < 0)
+	{
+		fprintf(stderr, "ENCODER: (matroska) couldn't open %s: %s\n", filename, strerror(errno));
+		return -1;
+	}
+
+	int64_t file_size = lseek(fd, 0, SEEK_END);
+
+	/*ebml header*/
+	hdr = mkv_read_element(fd, 0, file_size, &id, &size, &size_len);
+	if(!hdr || id != EBML_ID_HEADER || size < 0)
+	{
+		fprintf(stderr, "ENCODER: (matroska) %s is not a matroska file\n", filename);
+		close(fd);
+		return -1;
+	}
+
+	/*segment*/
+	int64_t pos = hdr + size;
+	hdr = mkv_read_element(fd, pos, file_size, &id, &size, &size_len);
+	if(!hdr || id != MATROSKA_ID_SEGMENT)
+	{
+		fprintf(stderr, "ENCODER: (matroska) no segment found in %s\n", filename);
+		close(fd);
+		return -1;
+	}
+
+	int64_t segment_size_pos = pos + hdr - size_len;
+	int segment_size_len = size_len;
+	int64_t segment_offset = pos + hdr;
+
+	int64_t seekhead_space = 0; /*seekhead and void elements at the segment start*/
+	int64_t info_pos = -1;
+	int64_t tracks_pos = -1;
+	int64_t duration_pos = -1;
+	int64_t old_cues_pos = -1;
+	int64_t old_cues_size = 0;
+	int video_track = -1;
+	int n_clusters = 0;
+	uint64_t duration = 0;
+	int64_t data_end = segment_offset;
+
+	mkv_cues_t *cues = mkv_start_cues(segment_offset);
+
+	/*scan the level 1 elements*/
+	pos = segment_offset;
+	while(pos < file_size)
+	{
+		hdr = mkv_read_element(fd, pos, file_size, &id, &size, &size_len);
+		if(!hdr)
+			break;
+
+		int64_t data_pos = pos + hdr;
+
+		if(id == MATROSKA_ID_CLUSTER)
+		{
+			int complete = (size >= 0 && data_pos + size <= file_size);
+			int64_t limit = complete ? data_pos + size : file_size;
+			int64_t end = mkv_recover_cluster(fd, pos, data_pos, limit, file_size,
+				video_track, cues, &duration);
+
+			if(complete)
+				end = data_pos + size;
+			else if(mkv_patch_size(fd, pos + hdr - size_len, end - data_pos, size_len) < 0)
+			{
+				fprintf(stderr, "ENCODER: (matroska) couldn't fix cluster size at %" PRId64 "\n", pos);
+				break;
+			}
+
+			n_clusters++;
+			data_end = end;
+			pos = end;
+
+			/*truncated cluster: this is the end of the recoverable data*/
+			if(!complete && (end >= file_size || !mkv_read_element(fd, end, file_size, &id, &size, &size_len)))
+				break;
+			continue;
+		}
+
+		/*truncated element*/
+		if(size < 0 || data_pos + size > file_size)
+			break;
+
+		if((id == MATROSKA_ID_SEEKHEAD || id == EBML_ID_VOID) &&
+			pos == segment_offset + seekhead_space)
+			seekhead_space += hdr + size;
+		else if(id == MATROSKA_ID_INFO)
+		{
+			int64_t cpos = data_pos;
+			info_pos = pos;
+			while(cpos < data_pos + size)
+			{
+				uint32_t cid;
+				int64_t csize;
+				int clen;
+				int chdr = mkv_read_element(fd, cpos, file_size, &cid, &csize, &clen);
+				if(!chdr || csize < 0)
+					break;
+				/*duration or the void reserved for it*/
+				if((cid == MATROSKA_ID_DURATION && chdr + csize == MKV_DURATION_SIZE) ||
+					(cid == EBML_ID_VOID && chdr + csize == MKV_DURATION_SIZE && duration_pos < 0))
+					duration_pos = cpos;
+				cpos += chdr + csize;
+			}
+		}
+		else if(id == MATROSKA_ID_TRACKS)
+		{
+			int64_t tpos = data_pos;
+			tracks_pos = pos;
+			while(tpos < data_pos + size)
+			{
+				uint32_t tid;
+				int64_t tsize;
+				int tlen;
+				int thdr = mkv_read_element(fd, tpos, file_size, &tid, &tsize, &tlen);
+				if(!thdr || tsize < 0)
+					break;
+				if(tid == MATROSKA_ID_TRACKENTRY)
+				{
+					int64_t cpos = tpos + thdr;
+					int number = 0;
+					int type = 0;
+					while(cpos < tpos + thdr + tsize)
+					{
+						uint32_t cid;
+						int64_t csize;
+						int clen;
+						int chdr = mkv_read_element(fd, cpos, file_size, &cid, &csize, &clen);
+						if(!chdr || csize < 0)
+							break;
+						if(cid == MATROSKA_ID_TRACKNUMBER)
+							number = (int) mkv_read_uint(fd, cpos + chdr, (int) csize);
+						else if(cid == MATROSKA_ID_TRACKTYPE)
+							type = (int) mkv_read_uint(fd, cpos + chdr, (int) csize);
+						cpos += chdr + csize;
+					}
+					if(type == MATROSKA_TRACK_TYPE_VIDEO && video_track < 0)
+						video_track = number;
+				}
+				tpos += thdr + tsize;
+			}
+		}
+		else if(id == MATROSKA_ID_CUES)
+		{
+			old_cues_pos = pos;
+			old_cues_size = hdr + size;
+		}
+
+		data_end = data_pos + size;
+		pos = data_end;
+	}
+
+	printf("ENCODER: (matroska) %s: %i clusters, %i cue points, %" PRId64 " of %" PRId64 " bytes recovered\n",
+		filename, n_clusters, cues->num_entries, data_end, file_size);
+
+	/*drop the truncated data*/
+	if(data_end < file_size && ftruncate(fd, data_end) != 0)
+		fprintf(stderr, "ENCODER: (matroska) couldn't truncate %s: %s\n", filename, strerror(errno));
+
+	/*void the old cues (a checkpoint)*/
+	if(old_cues_pos >= 0 && old_cues_size >= 9)
+	{
+		uint8_t buf = EBML_ID_VOID;
+		if(pwrite(fd, &buf, 1, old_cues_pos) == 1)
+			mkv_patch_size(fd, old_cues_pos + 1, old_cues_size - 9, 8);
+	}
+
+	mkv_context_t mkv_ctx;
+	memset(&mkv_ctx, 0, sizeof(mkv_context_t));
+
+	/*write the new cues at the end*/
+	int64_t cues_pos = -1;
+	if(cues->num_entries > 0)
+	{
+		mkv_ctx.writer = io_create_writer(NULL, cues->num_entries * (MAX_CUEPOINT_SIZE(1)) + 32);
+		mkv_write_cues(&mkv_ctx, cues, 1);
+
+		int cues_size = (int) io_get_offset(mkv_ctx.writer);
+		if(pwrite(fd, mkv_ctx.writer->buffer, cues_size, data_end) == cues_size)
+		{
+			cues_pos = data_end;
+			data_end += cues_size;
+		}
+		io_destroy_writer(mkv_ctx.writer);
+		free(mkv_ctx.writer);
+	}
+
+	/*seekhead*/
+	mkv_seekhead_t *seekhead = mkv_start_seekhead(&mkv_ctx, segment_offset, 0);
+	seekhead->reserved_size = (int) seekhead_space;
+	if(info_pos >= 0)
+		mkv_add_seekhead_entry(seekhead, MATROSKA_ID_INFO, info_pos);
+	if(tracks_pos >= 0)
+		mkv_add_seekhead_entry(seekhead, MATROSKA_ID_TRACKS, tracks_pos);
+	if(cues_pos >= 0)
+		mkv_add_seekhead_entry(seekhead, MATROSKA_ID_CUES, cues_pos);
+
+	if(seekhead->num_entries * MAX_SEEKENTRY_SIZE + 13 <= seekhead_space)
+	{
+		mkv_ctx.writer = io_create_writer(NULL, (int) seekhead_space + 1);
+		mkv_put_seekhead(&mkv_ctx, seekhead);
+		mkv_put_ebml_void(&mkv_ctx, seekhead_space - io_get_offset(mkv_ctx.writer));
+		if(pwrite(fd, mkv_ctx.writer->buffer, seekhead_space, segment_offset) != seekhead_space)
+			fprintf(stderr, "ENCODER: (matroska) couldn't write seekhead: %s\n", strerror(errno));
+		io_destroy_writer(mkv_ctx.writer);
+		free(mkv_ctx.writer);
+	}
+	else
+		fprintf(stderr, "ENCODER: (matroska) no space for the seekhead - not updated\n");
+
+	free(seekhead->entries);
+	free(seekhead);
+
+	/*duration*/
+	if(duration_pos >= 0)
+	{
+		uint8_t buf[MKV_DURATION_SIZE];
+		int len = mkv_duration_buf(buf, (int64_t) duration);
+		if(pwrite(fd, buf, len, duration_pos) != len)
+			fprintf(stderr, "ENCODER: (matroska) couldn't write duration: %s\n", strerror(errno));
+	}
+
+	/*segment size*/
+	if(mkv_patch_size(fd, segment_size_pos, data_end - segment_offset, segment_size_len) < 0)
+		fprintf(stderr, "ENCODER: (matroska) couldn't write segment size\n");
+
+	free(cues->entries);
+	free(cues);
+
+	if(fsync(fd) != 0)
+		fprintf(stderr, "ENCODER: (matroska) couldn't sync %s: %s\n", filename, strerror(errno));
+	close(fd);
+
+	return 0;
+}
+
 mkv_context_t *mkv_create_context(const char* filename, int mode)
 {
 	mkv_context_t *mkv_ctx = calloc(1, sizeof(mkv_context_t));
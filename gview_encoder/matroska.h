@@ -225,6 +225,9 @@ typedef enum {
 } MatroskaTrackEncodingCompAlgo;
 */
 
+/*space reserved after the tracks for the cues (checkpoint mode)*/
+#define MKV_CHECKPOINT_CUES_SIZE (512*1024)
+
 typedef struct ebml_master_t
 {
     int64_t         pos;                ///< absolute offset in the file where the master's elements start
@@ -288,6 +291,11 @@ typedef struct mkv_context_t
 
 	uint64_t      timescale;
 	uint64_t      first_pts; /*pts of first packet*/
+
+	/*crash safe output: cues and duration are patched periodically*/
+	int64_t       checkpoint_interval; /*in ns (0 - disabled)*/
+	int64_t       checkpoint_last;     /*ts of the last checkpoint (ns)*/
+	int64_t       cues_reserved_pos;   /*file offset of the space reserved for the cues*/
 	
     /*stored audio packets list (ring buffer)*/
 	mkv_packet_buff_t *pkt_buffer_list;
@@ -339,4 +347,8 @@ int mkv_close(mkv_context_t *mkv_ctx);
 /** destroy the muxer context (clean up)*/
 void mkv_destroy_context(mkv_context_t *mkv_ctx);
 
+/** rebuild the index (cues, seekhead, duration and sizes)
+ *  of an unfinished file by scanning its clusters */
+int mkv_recover(const char *filename);
+
 #endif
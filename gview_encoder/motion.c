@@ -0,0 +1,654 @@
+/*******************************************************************************#
+#           guvcview              http://guvcview.sourceforge.net               #
+#                                                                               #
+#           Paulo Assis <pj.assis@gmail.com>                                    #
+#                                                                               #
+# This program is free software; you can redistribute it and/or modify          #
+# it under the terms of the GNU General Public License as published by          #
+# the Free Software Foundation; either version 2 of the License, or             #
+# (at your option) any later version.                                           #
+#                                                                               #
+# This program is distributed in the hope that it will be useful,               #
+# but WITHOUT ANY WARRANTY; without even the implied warranty of                #
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the                 #
+# GNU General Public License for more details.                                  #
+#                                                                               #
+# You should have received a copy of the GNU General Public License             #
+# along with this program; if not, write to the Free Software                   #
+# Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA     #
+#                                                                               #
+********************************************************************************/
+
+
+/*******************************************************************************#
+#                                                                               #
+#  Encoder library - macroblock change detection (motion aware encoding)       #
+#                                                                               #
+********************************************************************************/
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <inttypes.h>
+#include <string.h>
+#include <errno.h>
+#include <assert.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+#include "gviewencoder.h"
+#include "encoder.h"
+#include "gview.h"
+
+#include <libavutil/pixdesc.h>
+
+extern int verbosity;
+
+/*
+ * sum of absolute differences of a 16 pixel wide block
+ * args:
+ *   a - pointer to first block
+ *   a_stride - first block line size
+ *   b - pointer to second block
+ *   b_stride - second block line size
+ *   height - block height (max 16)
+ *
+ * asserts:
+ *   none
+ *
+ * returns: block sad
+ */
+static uint32_t motion_sad_16(const uint8_t *a, int a_stride, const uint8_t *b, int b_stride, int height)
+{
+	int y = 0;
+
+#if defined(__SSE2__)
+	__m128i acc = _mm_setzero_si128();
+	for(y = 0; y < height; y++)
+	{
+		__m128i va = _mm_loadu_si128((const __m128i *) a);
+		__m128i vb = _mm_loadu_si128((const __m128i *) b);
+		acc = _mm_add_epi64(acc, _mm_sad_epu8(va, vb));
+		a += a_stride;
+		b += b_stride;
+	}
+	return (uint32_t) (_mm_cvtsi128_si32(acc) + _mm_cvtsi128_si32(_mm_srli_si128(acc, 8)));
+#elif defined(__ARM_NEON)
+	uint16x8_t acc = vdupq_n_u16(0);
+	for(y = 0; y < height; y++)
+	{
+		uint8x16_t va = vld1q_u8(a);
+		uint8x16_t vb = vld1q_u8(b);
+		acc = vabal_u8(acc, vget_low_u8(va), vget_low_u8(vb));
+		acc = vabal_u8(acc, vget_high_u8(va), vget_high_u8(vb));
+		a += a_stride;
+		b += b_stride;
+	}
+	uint64x2_t sum = vpaddlq_u32(vpaddlq_u16(acc));
+	return (uint32_t) (vgetq_lane_u64(sum, 0) + vgetq_lane_u64(sum, 1));
+#else
+	uint32_t sad = 0;
+	int x = 0;
+	for(y = 0; y < height; y++)
+	{
+		for(x = 0; x < 16; x++)
+			sad += abs(a[x] - b[x]);
+		a += a_stride;
+		b += b_stride;
+	}
+	return sad;
+#endif
+}
+
+/*
+ * sum of absolute differences of a block (any size)
+ * args:
+ *   a - pointer to first block
+ *   a_stride - first block line size
+ *   b - pointer to second block
+ *   b_stride - second block line size
+ *   width - block width
+ *   height - block height
+ *
+ * asserts:
+ *   none
+ *
+ * returns: block sad
+ */
+static uint32_t motion_sad(const uint8_t *a, int a_stride, const uint8_t *b, int b_stride, int width, int height)
+{
+	if(width == 16)
+		return motion_sad_16(a, a_stride, b, b_stride, height);
+
+	uint32_t sad = 0;
+	int x = 0;
+	int y = 0;
+	for(y = 0; y < height; y++)
+	{
+		for(x = 0; x < width; x++)
+			sad += abs(a[x] - b[x]);
+		a += a_stride;
+		b += b_stride;
+	}
+	return sad;
+}
+
+/*
+ * create a change detector
+ * args:
+ *   flags - ENCODER_MOTION_XXX flags
+ *
+ * asserts:
+ *   none
+ *
+ * returns: pointer to change detector data
+ */
+encoder_motion_t *encoder_motion_create(int flags)
+{
+	encoder_motion_t *motion = calloc(1, sizeof(encoder_motion_t));
+	if(motion == NULL)
+	{
+		fprintf(stderr, "ENCODER: FATAL memory allocation failure (encoder_motion_create): %s\n", strerror(errno));
+		exit(-1);
+	}
+
+	motion->flags = flags;
+	motion->last_pts = -1;
+
+	return motion;
+}
+
+/*
+ * compare the frame luma with the last encoded frame (per macroblock)
+ * args:
+ *   motion - pointer to change detector data
+ *   frame - frame to compare
+ *
+ * asserts:
+ *   none
+ *
+ * returns: number of changed blocks (-1 if no reference frame)
+ */
+static int motion_compare(encoder_motion_t *motion, AVFrame *frame)
+{
+	int mb_cols = (frame->width + ENCODER_MOTION_BLOCK - 1) / ENCODER_MOTION_BLOCK;
+	int mb_rows = (frame->height + ENCODER_MOTION_BLOCK - 1) / ENCODER_MOTION_BLOCK;
+
+	if(motion->width != frame->width || motion->height != frame->height)
+	{
+		/*first frame (or new size): no reference*/
+		free(motion->prev);
+		free(motion->blocks);
+		motion->width = frame->width;
+		motion->height = frame->height;
+		motion->mb_cols = mb_cols;
+		motion->mb_rows = mb_rows;
+		motion->prev = malloc(frame->width * frame->height);
+		motion->blocks = calloc(mb_cols * mb_rows, sizeof(uint8_t));
+		if(motion->prev == NULL || motion->blocks == NULL)
+		{
+			fprintf(stderr, "ENCODER: FATAL memory allocation failure (encoder_motion_frame): %s\n", strerror(errno));
+			exit(-1);
+		}
+		return -1;
+	}
+
+	int changed = 0;
+	int i = 0;
+	int j = 0;
+	for(j = 0; j < mb_rows; j++)
+	{
+		int y = j * ENCODER_MOTION_BLOCK;
+		int h = MIN(ENCODER_MOTION_BLOCK, frame->height - y);
+		for(i = 0; i < mb_cols; i++)
+		{
+			int x = i * ENCODER_MOTION_BLOCK;
+			int w = MIN(ENCODER_MOTION_BLOCK, frame->width - x);
+			uint32_t sad = motion_sad(
+				frame->data[0] + y * frame->linesize[0] + x, frame->linesize[0],
+				motion->prev + y * motion->width + x, motion->width,
+				w, h);
+
+			/*mean absolute difference over the sensor noise level*/
+			uint8_t block_changed = (sad > (uint32_t) (ENCODER_MOTION_THRESHOLD * w * h)) ? 1 : 0;
+			motion->blocks[j * mb_cols + i] = block_changed;
+			changed += block_changed;
+		}
+	}
+
+	return changed;
+}
+
+#if LIBAVUTIL_VER_AT_LEAST(56,29)
+/*
+ * attach the static blocks as regions of interest with a
+ *  positive quantizer offset (lower quality) to the frame
+ *  runs of static blocks in a row are one region, regions
+ *  with the same columns in consecutive rows are merged
+ * args:
+ *   motion - pointer to change detector data
+ *   frame - frame to encode
+ *
+ * asserts:
+ *   none
+ *
+ * returns: number of regions
+ */
+static int motion_set_roi(encoder_motion_t *motion, AVFrame *frame)
+{
+	int max_rois = motion->mb_rows * ((motion->mb_cols + 1) / 2);
+	AVRegionOfInterest *roi = malloc(max_rois * sizeof(AVRegionOfInterest));
+	int *open = malloc(2 * (motion->mb_cols + 1) * sizeof(int));
+	if(roi == NULL || open == NULL)
+	{
+		fprintf(stderr, "ENCODER: FATAL memory allocation failure (encoder_motion_frame): %s\n", strerror(errno));
+		exit(-1);
+	}
+	/*regions ending on the previous row (sorted by column)*/
+	int *prev_open = open;
+	int *cur_open = open + motion->mb_cols + 1;
+	int n_prev = 0;
+	int n = 0;
+	int i = 0;
+	int j = 0;
+
+	for(j = 0; j < motion->mb_rows; j++)
+	{
+		uint8_t *row = motion->blocks + j * motion->mb_cols;
+		int n_cur = 0;
+		int k = 0;
+
+		for(i = 0; i < motion->mb_cols; i++)
+		{
+			if(row[i])
+				continue;
+
+			int start = i;
+			while(i < motion->mb_cols && !row[i])
+				i++;
+
+			int left = start * ENCODER_MOTION_BLOCK;
+			int right = MIN(i * ENCODER_MOTION_BLOCK, frame->width);
+			int bottom = MIN((j + 1) * ENCODER_MOTION_BLOCK, frame->height);
+
+			while(k < n_prev && roi[prev_open[k]].left < left)
+				k++;
+
+			if(k < n_prev && roi[prev_open[k]].left == left && roi[prev_open[k]].right == right)
+			{
+				roi[prev_open[k]].bottom = bottom;
+				cur_open[n_cur++] = prev_open[k];
+			}
+			else
+			{
+				roi[n].self_size = sizeof(AVRegionOfInterest);
+				roi[n].top = j * ENCODER_MOTION_BLOCK;
+				roi[n].bottom = bottom;
+				roi[n].left = left;
+				roi[n].right = right;
+				roi[n].qoffset = (AVRational) ENCODER_MOTION_STATIC_QOFFSET;
+				cur_open[n_cur++] = n++;
+			}
+		}
+
+		int *tmp = prev_open;
+		prev_open = cur_open;
+		cur_open = tmp;
+		n_prev = n_cur;
+	}
+
+	if(n > 0)
+	{
+		AVFrameSideData *sd = av_frame_new_side_data(frame,
+			AV_FRAME_DATA_REGIONS_OF_INTEREST, n * sizeof(AVRegionOfInterest));
+		if(sd)
+			memcpy(sd->data, roi, n * sizeof(AVRegionOfInterest));
+		else
+			n = 0;
+	}
+
+	free(open);
+	free(roi);
+
+	return n;
+}
+#endif
+
+/*
+ * check a frame before encoding: unchanged frames may be skipped and
+ *  static blocks get a lower quality (region of interest side data)
+ * args:
+ *   motion - pointer to change detector data
+ *   frame - frame to encode
+ *   pts - frame timestamp (ns)
+ *   force - the frame must be encoded (e.g. forced keyframe)
+ *
+ * asserts:
+ *   motion is not null
+ *   frame is not null
+ *
+ * returns: 1 if the frame should be skipped, 0 otherwise
+ */
+int encoder_motion_frame(encoder_motion_t *motion, AVFrame *frame, int64_t pts, int force)
+{
+	/*assertions*/
+	assert(motion != NULL);
+	assert(frame != NULL);
+
+#if LIBAVUTIL_VER_AT_LEAST(56,29)
+	av_frame_remove_side_data(frame, AV_FRAME_DATA_REGIONS_OF_INTEREST);
+#endif
+
+	/*the first plane must be 8 bit luma*/
+	const AVPixFmtDescriptor *desc = av_pix_fmt_desc_get(frame->format);
+	if(!desc || (desc->flags & AV_PIX_FMT_FLAG_RGB) || desc->nb_components < 3 ||
+		desc->comp[0].plane != 0 || desc->comp[0].step != 1 || desc->comp[0].depth != 8)
+		return 0;
+
+	int changed = motion_compare(motion, frame);
+
+	if(changed == 0 && !force && (motion->flags & ENCODER_MOTION_SKIP) &&
+		pts - motion->last_pts < ENCODER_MOTION_MAX_SKIP)
+	{
+		motion->skipped++;
+		return 1;
+	}
+
+#if LIBAVUTIL_VER_AT_LEAST(56,29)
+	if(changed >= 0 && (motion->flags & ENCODER_MOTION_ROI))
+		motion_set_roi(motion, frame);
+#endif
+
+	/*the encoded frame is the next reference*/
+	int y = 0;
+	for(y = 0; y < frame->height; y++)
+		memcpy(motion->prev + y * motion->width,
+			frame->data[0] + y * frame->linesize[0], frame->width);
+
+	motion->last_pts = pts;
+
+	return 0;
+}
+
+/*
+ * destroy a change detector
+ * args:
+ *   motion - pointer to change detector data
+ *
+ * asserts:
+ *   none
+ *
+ * returns: none
+ */
+void encoder_motion_destroy(encoder_motion_t *motion)
+{
+	if(!motion)
+		return;
+
+	if(motion->skipped > 0 && verbosity > 0)
+		printf("ENCODER: skipped %" PRId64 " unchanged video frames\n", motion->skipped);
+
+	free(motion->prev);
+	free(motion->blocks);
+	free(motion);
+}
+
+/*motion trigger (only used by the capture thread)*/
+static int trigger_sensitivity = 0; /*0 - disabled*/
+static int trigger_interval = 1;
+static int64_t trigger_hold = 0; /*nanosec*/
+static int trigger_cols = 0; /*downscaled luma size*/
+static int trigger_rows = 0;
+static uint8_t *trigger_ref = NULL; /*downscaled luma of the last analysed frame*/
+static uint8_t *trigger_cur = NULL;
+static int trigger_ref_valid = 0;
+static int trigger_count = 0; /*frames since the last analysed frame*/
+static int trigger_state = 0;
+static int64_t trigger_last_motion = 0; /*timestamp of the last change*/
+
+/*
+ * downscale a line of ENCODER_TRIGGER_SCALE (8) luma lines
+ *   each 8x8 cell is replaced by its mean
+ * args:
+ *   src - pointer to first luma line
+ *   stride - luma line size
+ *   dst - pointer to downscaled line
+ *   cols - number of cells
+ *
+ * asserts:
+ *   none
+ *
+ * returns: none
+ */
+static void trigger_downscale_line(const uint8_t *src, int stride, uint8_t *dst, int cols)
+{
+	int x = 0;
+	int y = 0;
+
+#if defined(__SSE2__)
+	/*sad against zero sums each group of 8 bytes*/
+	__m128i zero = _mm_setzero_si128();
+	for(x = 0; x + 2 <= cols; x += 2)
+	{
+		const uint8_t *p = src + x * 8;
+		__m128i acc = _mm_setzero_si128();
+		for(y = 0; y < 8; y++)
+			acc = _mm_add_epi64(acc,
+				_mm_sad_epu8(_mm_loadu_si128((const __m128i *) (p + y * stride)), zero));
+		dst[x] = (uint8_t) (_mm_cvtsi128_si32(acc) >> 6);
+		dst[x + 1] = (uint8_t) (_mm_cvtsi128_si32(_mm_srli_si128(acc, 8)) >> 6);
+	}
+#elif defined(__ARM_NEON)
+	for(x = 0; x + 2 <= cols; x += 2)
+	{
+		const uint8_t *p = src + x * 8;
+		uint16x8_t acc = vdupq_n_u16(0);
+		for(y = 0; y < 8; y++)
+			acc = vpadalq_u8(acc, vld1q_u8(p + y * stride));
+		uint64x2_t sum = vpaddlq_u32(vpaddlq_u16(acc));
+		dst[x] = (uint8_t) (vgetq_lane_u64(sum, 0) >> 6);
+		dst[x + 1] = (uint8_t) (vgetq_lane_u64(sum, 1) >> 6);
+	}
+#endif
+
+	for(; x < cols; x++)
+	{
+		const uint8_t *p = src + x * 8;
+		uint32_t sum = 0;
+		int i = 0;
+		for(y = 0; y < 8; y++)
+			for(i = 0; i < 8; i++)
+				sum += p[y * stride + i];
+		dst[x] = (uint8_t) (sum >> 6);
+	}
+}
+
+/*
+ * count the changed cells of two downscaled frames
+ * args:
+ *   a - pointer to first downscaled frame
+ *   b - pointer to second downscaled frame
+ *   size - number of cells
+ *   threshold - absolute difference of a changed cell
+ *
+ * asserts:
+ *   none
+ *
+ * returns: number of cells with a difference over threshold
+ */
+static int trigger_count_changed(const uint8_t *a, const uint8_t *b, int size, uint8_t threshold)
+{
+	int count = 0;
+	int i = 0;
+
+#if defined(__SSE2__)
+	__m128i zero = _mm_setzero_si128();
+	__m128i thr = _mm_set1_epi8((char) threshold);
+	for(i = 0; i + 16 <= size; i += 16)
+	{
+		__m128i va = _mm_loadu_si128((const __m128i *) (a + i));
+		__m128i vb = _mm_loadu_si128((const __m128i *) (b + i));
+		__m128i diff = _mm_or_si128(_mm_subs_epu8(va, vb), _mm_subs_epu8(vb, va));
+		/*cells not over the threshold saturate to zero*/
+		__m128i same = _mm_cmpeq_epi8(_mm_subs_epu8(diff, thr), zero);
+		count += 16 - __builtin_popcount(_mm_movemask_epi8(same));
+	}
+#elif defined(__ARM_NEON)
+	uint8x16_t thr = vdupq_n_u8(threshold);
+	for(i = 0; i + 16 <= size; i += 16)
+	{
+		uint8x16_t changed = vcgtq_u8(vabdq_u8(vld1q_u8(a + i), vld1q_u8(b + i)), thr);
+		uint64x2_t sum = vpaddlq_u32(vpaddlq_u16(vpaddlq_u8(vshrq_n_u8(changed, 7))));
+		count += (int) (vgetq_lane_u64(sum, 0) + vgetq_lane_u64(sum, 1));
+	}
+#endif
+
+	for(; i < size; i++)
+		if(abs(a[i] - b[i]) > threshold)
+			count++;
+
+	return count;
+}
+
+/*
+ * set up the motion trigger (starts and stops event recordings)
+ *   the luma is downscaled and compared with the last analysed frame,
+ *   motion starts over the sensitivity area and only ends after the
+ *   changed area stays below half of it for hold_sec
+ * args:
+ *   sensitivity - 1 (large changes only) to 100 (0 - disabled)
+ *   interval - analyse one in every interval frames
+ *   hold_sec - time (in seconds) motion is held after the last change
+ *
+ * asserts:
+ *   none
+ *
+ * returns: error code
+ */
+int encoder_motion_trigger_init(int sensitivity, int interval, int hold_sec)
+{
+	encoder_motion_trigger_close();
+
+	if(sensitivity <= 0)
+		return 0;
+
+	trigger_sensitivity = (sensitivity > 100) ? 100 : sensitivity;
+	trigger_interval = (interval < 1) ? 1 : interval;
+	trigger_hold = (int64_t) ((hold_sec < 0) ? 0 : hold_sec) * NSEC_PER_SEC;
+
+	if(verbosity > 0)
+		printf("ENCODER: motion trigger (sensitivity %i, every %i frames, hold %i sec)\n",
+			trigger_sensitivity, trigger_interval, hold_sec);
+
+	return 0;
+}
+
+/*
+ * run the motion trigger on a captured frame
+ * args:
+ *   frame - pointer to yu12 frame data (only the luma is used)
+ *   width - frame width
+ *   height - frame height
+ *   timestamp - frame timestamp (in nanosec)
+ *
+ * asserts:
+ *   none
+ *
+ * returns: motion state (1 - motion; 0 - no motion)
+ */
+int encoder_motion_trigger_frame(uint8_t *frame, int width, int height, int64_t timestamp)
+{
+	if(trigger_sensitivity <= 0 || frame == NULL)
+		return 0;
+
+	/*only analyse every interval frames*/
+	if(trigger_ref_valid && ++trigger_count < trigger_interval)
+		return trigger_state;
+	trigger_count = 0;
+
+	int cols = width / ENCODER_TRIGGER_SCALE;
+	int rows = height / ENCODER_TRIGGER_SCALE;
+	if(cols <= 0 || rows <= 0)
+		return trigger_state;
+
+	/*(re)allocate on resolution changes*/
+	if(cols != trigger_cols || rows != trigger_rows)
+	{
+		free(trigger_ref);
+		free(trigger_cur);
+		trigger_ref = calloc(cols * rows, sizeof(uint8_t));
+		trigger_cur = calloc(cols * rows, sizeof(uint8_t));
+		if(trigger_ref == NULL || trigger_cur == NULL)
+		{
+			fprintf(stderr, "ENCODER: FATAL memory allocation failure (encoder_motion_trigger_frame): %s\n", strerror(errno));
+			exit(-1);
+		}
+		trigger_cols = cols;
+		trigger_rows = rows;
+		trigger_ref_valid = 0;
+	}
+
+	int y = 0;
+	for(y = 0; y < rows; y++)
+		trigger_downscale_line(frame + y * ENCODER_TRIGGER_SCALE * width, width,
+			trigger_cur + y * cols, cols);
+
+	if(trigger_ref_valid)
+	{
+		int changed = trigger_count_changed(trigger_ref, trigger_cur,
+			cols * rows, ENCODER_TRIGGER_THRESHOLD);
+		/*changed area in permille (sensitivity 100 triggers at 0.1%)*/
+		int area = (int) (((int64_t) changed * 1000) / (cols * rows));
+		int on_area = (ENCODER_TRIGGER_MAX_AREA * (101 - trigger_sensitivity)) / 100;
+
+		/*hysteresis: start over on_area, keep going over half of it*/
+		if(area >= on_area || (trigger_state && area >= on_area / 2))
+		{
+			if(!trigger_state && verbosity > 0)
+				printf("ENCODER: motion detected (%i permille changed)\n", area);
+			trigger_state = 1;
+			trigger_last_motion = timestamp;
+		}
+		else if(trigger_state && timestamp - trigger_last_motion > trigger_hold)
+		{
+			if(verbosity > 0)
+				printf("ENCODER: motion ended\n");
+			trigger_state = 0;
+		}
+	}
+
+	/*the current frame is the next reference*/
+	uint8_t *tmp = trigger_ref;
+	trigger_ref = trigger_cur;
+	trigger_cur = tmp;
+	trigger_ref_valid = 1;
+
+	return trigger_state;
+}
+
+/*
+ * free the motion trigger data
+ * args:
+ *   none
+ *
+ * asserts:
+ *   none
+ *
+ * returns: none
+ */
+void encoder_motion_trigger_close()
+{
+	free(trigger_ref);
+	free(trigger_cur);
+	trigger_ref = NULL;
+	trigger_cur = NULL;
+	trigger_cols = 0;
+	trigger_rows = 0;
+	trigger_ref_valid = 0;
+	trigger_count = 0;
+	trigger_state = 0;
+	trigger_sensitivity = 0;
+}
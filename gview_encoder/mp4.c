@@ -0,0 +1,1278 @@
+/*******************************************************************************#
+#           guvcview              http://guvcview.sourceforge.net               #
+#                                                                               #
+#           Paulo Assis <pj.assis@gmail.com>                                    #
+#                                                                               #
+# This program is free software; you can redistribute it and/or modify          #
+# it under the terms of the GNU General Public License as published by          #
+# the Free Software Foundation; either version 2 of the License, or             #
+# (at your option) any later version.                                           #
+#                                                                               #
+# This program is distributed in the hope that it will be useful,               #
+# but WITHOUT ANY WARRANTY; without even the implied warranty of                #
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the                 #
+# GNU General Public License for more details.                                  #
+#                                                                               #
+# You should have received a copy of the GNU General Public License             #
+# along with this program; if not, write to the Free Software                   #
+# Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA     #
+#                                                                               #
+********************************************************************************/
+
+/*
+ * fragmented mp4 (ISO BMFF) muxer:
+ *   ftyp + moov (no samples) are followed by moof + mdat fragments
+ *   starting on video keyframes; the samples of a fragment are buffered
+ *   so that every box is written once, in file order (no seeks), and
+ *   the file can be written to a pipe or socket.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <inttypes.h>
+#include <sys/types.h>
+#include <string.h>
+#include <errno.h>
+#include <assert.h>
+/* support for internationalization - i18n */
+#include <locale.h>
+#include <libintl.h>
+
+#include "gviewencoder.h"
+#include "encoder.h"
+#include "stream_io.h"
+#include "file_io.h"
+#include "mp4.h"
+#include "gview.h"
+
+extern int verbosity;
+
+/*
+ * write 3 octets (big endian)
+ * args:
+ *   writer - pointer to io_writer
+ *   val - value to write
+ *
+ * asserts:
+ *   none
+ *
+ * returns: none
+ */
+static void mp4_write_wb24(io_writer_t *writer, uint32_t val)
+{
+	io_write_w8(writer, (uint8_t) (val >> 16));
+	io_write_wb16(writer, (uint16_t) val);
+}
+
+/*
+ * start a box (size is set by mp4_end_box)
+ *  boxes are built in mem writers and copied to the file when complete
+ * args:
+ *   writer - pointer to (mem) io_writer
+ *   type - box type (4cc)
+ *
+ * asserts:
+ *   none
+ *
+ * returns: box position
+ */
+static int64_t mp4_start_box(io_writer_t *writer, const char *type)
+{
+	int64_t pos = io_get_offset(writer);
+
+	io_write_wb32(writer, 0);
+	io_write_4cc(writer, type);
+
+	return pos;
+}
+
+/*
+ * start a full box (box with version and flags)
+ * args:
+ *   writer - pointer to (mem) io_writer
+ *   type - box type (4cc)
+ *   version - box version
+ *   flags - box flags (24 bit)
+ *
+ * asserts:
+ *   none
+ *
+ * returns: box position
+ */
+static int64_t mp4_start_full_box(io_writer_t *writer, const char *type, int version, uint32_t flags)
+{
+	int64_t pos = mp4_start_box(writer, type);
+
+	io_write_w8(writer, (uint8_t) version);
+	mp4_write_wb24(writer, flags);
+
+	return pos;
+}
+
+/*
+ * set the box size
+ * args:
+ *   writer - pointer to (mem) io_writer
+ *   pos - box position
+ *
+ * asserts:
+ *   none
+ *
+ * returns: none
+ */
+static void mp4_end_box(io_writer_t *writer, int64_t pos)
+{
+	uint32_t size = (uint32_t) (io_get_offset(writer) - pos);
+	uint8_t buf[4];
+
+	buf[0] = (uint8_t) (size >> 24);
+	buf[1] = (uint8_t) (size >> 16);
+	buf[2] = (uint8_t) (size >> 8);
+	buf[3] = (uint8_t) size;
+
+	io_write_at(writer, pos, buf, 4);
+}
+
+/*
+ * copy a mem writer buffer to the file
+ * args:
+ *   mp4_ctx - pointer to mp4 context
+ *   mem_writer - pointer to mem io_writer (destroyed)
+ *
+ * asserts:
+ *   none
+ *
+ * returns: none
+ */
+static void mp4_write_mem(mp4_context_t *mp4_ctx, io_writer_t *mem_writer)
+{
+	io_write_buf(mp4_ctx->writer, mem_writer->buffer, (int) io_get_offset(mem_writer));
+	io_destroy_writer(mem_writer);
+	free(mem_writer);
+}
+
+/*
+ * write the unity matrix (tkhd and mvhd)
+ * args:
+ *   writer - pointer to io_writer
+ *
+ * asserts:
+ *   none
+ *
+ * returns: none
+ */
+static void mp4_write_matrix(io_writer_t *writer)
+{
+	io_write_wb32(writer, 0x00010000);
+	io_write_wb32(writer, 0);
+	io_write_wb32(writer, 0);
+	io_write_wb32(writer, 0);
+	io_write_wb32(writer, 0x00010000);
+	io_write_wb32(writer, 0);
+	io_write_wb32(writer, 0);
+	io_write_wb32(writer, 0);
+	io_write_wb32(writer, 0x40000000);
+}
+
+/*
+ * get the mpeg-4 systems object type for a codec
+ * args:
+ *   codec_id - codec id
+ *
+ * asserts:
+ *   none
+ *
+ * returns: object type indication (0 if not supported in mp4v/mp4a entries)
+ */
+static uint8_t mp4_get_object_type(int codec_id)
+{
+	switch(codec_id)
+	{
+		case AV_CODEC_ID_MPEG4:
+			return 0x20;
+		case AV_CODEC_ID_MPEG2VIDEO:
+			return 0x61; /*main profile*/
+		case AV_CODEC_ID_MPEG1VIDEO:
+			return 0x6A;
+		case AV_CODEC_ID_MJPEG:
+			return 0x6C;
+		case AV_CODEC_ID_AAC:
+			return 0x40;
+		case AV_CODEC_ID_MP2:
+		case AV_CODEC_ID_MP3:
+			return 0x6B;
+		default:
+			return 0;
+	}
+}
+
+/*
+ * write a descriptor tag and size (4 bytes size)
+ * args:
+ *   writer - pointer to io_writer
+ *   tag - descriptor tag
+ *   size - descriptor data size
+ *
+ * asserts:
+ *   none
+ *
+ * returns: none
+ */
+static void mp4_write_descr(io_writer_t *writer, uint8_t tag, uint32_t size)
+{
+	io_write_w8(writer, tag);
+	io_write_w8(writer, (uint8_t) (0x80 | ((size >> 21) & 0x7F)));
+	io_write_w8(writer, (uint8_t) (0x80 | ((size >> 14) & 0x7F)));
+	io_write_w8(writer, (uint8_t) (0x80 | ((size >> 7) & 0x7F)));
+	io_write_w8(writer, (uint8_t) (size & 0x7F));
+}
+
+/*
+ * write the elementary stream descriptor box (mp4v and mp4a entries)
+ * args:
+ *   writer - pointer to io_writer
+ *   stream - pointer to stream
+ *
+ * asserts:
+ *   none
+ *
+ * returns: none
+ */
+static void mp4_write_esds(io_writer_t *writer, stream_io_t *stream)
+{
+	int dsi_size = (stream->extra_data_size > 0 && stream->extra_data) ? stream->extra_data_size : 0;
+	int dcd_size = 13 + (dsi_size > 0 ? 5 + dsi_size : 0);
+
+	int64_t esds = mp4_start_full_box(writer, "esds", 0, 0);
+
+	/*ES descriptor*/
+	mp4_write_descr(writer, 0x03, 3 + 5 + dcd_size + 5 + 1);
+	io_write_wb16(writer, 0); /*ES_ID*/
+	io_write_w8(writer, 0); /*flags*/
+
+	/*decoder config descriptor*/
+	mp4_write_descr(writer, 0x04, dcd_size);
+	io_write_w8(writer, mp4_get_object_type(stream->codec_id));
+	/*stream type (4 - visual, 5 - audio) + upstream (0) + reserved (1)*/
+	io_write_w8(writer, (uint8_t) (((stream->type == STREAM_TYPE_VIDEO ? 0x04 : 0x05) << 2) | 1));
+	mp4_write_wb24(writer, 0); /*buffer size*/
+	io_write_wb32(writer, stream->mpgrate * 1000); /*max bit rate*/
+	io_write_wb32(writer, stream->mpgrate * 1000); /*avg bit rate*/
+
+	/*decoder specific info*/
+	if(dsi_size > 0)
+	{
+		mp4_write_descr(writer, 0x05, dsi_size);
+		io_write_buf(writer, stream->extra_data, dsi_size);
+	}
+
+	/*SL config descriptor (predefined: mp4)*/
+	mp4_write_descr(writer, 0x06, 1);
+	io_write_w8(writer, 0x02);
+
+	mp4_end_box(writer, esds);
+}
+
+/*
+ * build the avc decoder configuration from the SPS and PPS
+ *  in the first (length prefixed) video sample
+ * args:
+ *   mp4_ctx - pointer to mp4 context
+ *   data - sample data
+ *   size - sample size
+ *
+ * asserts:
+ *   none
+ *
+ * returns: error code
+ */
+static int mp4_build_avcc(mp4_context_t *mp4_ctx, uint8_t *data, int size)
+{
+	uint8_t *sps = NULL;
+	uint8_t *pps = NULL;
+	int sps_size = 0;
+	int pps_size = 0;
+	int pos = 0;
+
+	while(pos + 4 < size && (sps == NULL || pps == NULL))
+	{
+		int nal_size = (data[pos] << 24) | (data[pos+1] << 16) | (data[pos+2] << 8) | data[pos+3];
+		uint8_t *nal = data + pos + 4;
+
+		if(nal_size <= 0 || pos + 4 + nal_size > size)
+			break;
+
+		if((nal[0] & 0x1F) == 7 && sps == NULL && nal_size >= 4)
+		{
+			sps = nal;
+			sps_size = nal_size;
+		}
+		else if((nal[0] & 0x1F) == 8 && pps == NULL)
+		{
+			pps = nal;
+			pps_size = nal_size;
+		}
+
+		pos += 4 + nal_size;
+	}
+
+	if(sps == NULL || pps == NULL)
+	{
+		fprintf(stderr, "ENCODER: (mp4) no SPS/PPS in the first video frame - can't set the avc configuration\n");
+		return -1;
+	}
+
+	mp4_ctx->avcc_size = 6 + 2 + sps_size + 1 + 2 + pps_size;
+	mp4_ctx->avcc = calloc(mp4_ctx->avcc_size, sizeof(uint8_t));
+	if(mp4_ctx->avcc == NULL)
+	{
+		fprintf(stderr, "ENCODER: FATAL memory allocation failure (mp4_build_avcc): %s\n", strerror(errno));
+		exit(-1);
+	}
+
+	uint8_t *tp = mp4_ctx->avcc;
+	tp[0] = 1; /*version*/
+	tp[1] = sps[1]; /*profile*/
+	tp[2] = sps[2]; /*profile compat*/
+	tp[3] = sps[3]; /*level*/
+	tp[4] = 0xff; /*6 bits reserved + 2 bits nal size length - 1 (4 bytes)*/
+	tp[5] = 0xe1; /*3 bits reserved + 5 bits number of sps (1)*/
+	tp[6] = (uint8_t) (sps_size >> 8);
+	tp[7] = (uint8_t) sps_size;
+	memcpy(tp + 8, sps, sps_size);
+	tp += 8 + sps_size;
+	tp[0] = 1; /*number of pps*/
+	tp[1] = (uint8_t) (pps_size >> 8);
+	tp[2] = (uint8_t) pps_size;
+	memcpy(tp + 3, pps, pps_size);
+
+	return 0;
+}
+
+/*
+ * write the sample description entry for a stream
+ * args:
+ *   mp4_ctx - pointer to mp4 context
+ *   writer - pointer to io_writer
+ *   stream - pointer to stream
+ *
+ * asserts:
+ *   none
+ *
+ * returns: none
+ */
+static void mp4_write_sample_entry(mp4_context_t *mp4_ctx, io_writer_t *writer, stream_io_t *stream)
+{
+	int64_t entry = 0;
+	int i = 0;
+
+	if(stream->type == STREAM_TYPE_VIDEO)
+	{
+		entry = mp4_start_box(writer, (stream->codec_id == AV_CODEC_ID_H264) ? "avc1" : "mp4v");
+		for(i = 0; i < 6; i++)
+			io_write_w8(writer, 0); /*reserved*/
+		io_write_wb16(writer, 1); /*data reference index*/
+		io_write_wb16(writer, 0); /*pre defined*/
+		io_write_wb16(writer, 0); /*reserved*/
+		io_write_wb32(writer, 0); /*pre defined*/
+		io_write_wb32(writer, 0);
+		io_write_wb32(writer, 0);
+		io_write_wb16(writer, stream->width);
+		io_write_wb16(writer, stream->height);
+		io_write_wb32(writer, 0x00480000); /*72 dpi*/
+		io_write_wb32(writer, 0x00480000);
+		io_write_wb32(writer, 0); /*reserved*/
+		io_write_wb16(writer, 1); /*frame count*/
+		for(i = 0; i < 32; i++)
+			io_write_w8(writer, 0); /*compressor name*/
+		io_write_wb16(writer, 0x0018); /*depth*/
+		io_write_wb16(writer, 0xffff); /*pre defined*/
+
+		if(stream->codec_id == AV_CODEC_ID_H264)
+		{
+			int64_t avcc = mp4_start_box(writer, "avcC");
+			if(stream->extra_data_size > 0 && stream->extra_data)
+				io_write_buf(writer, stream->extra_data, stream->extra_data_size);
+			else if(mp4_ctx->avcc)
+				io_write_buf(writer, mp4_ctx->avcc, mp4_ctx->avcc_size);
+			mp4_end_box(writer, avcc);
+		}
+		else
+			mp4_write_esds(writer, stream);
+	}
+	else
+	{
+		entry = mp4_start_box(writer, "mp4a");
+		for(i = 0; i < 6; i++)
+			io_write_w8(writer, 0); /*reserved*/
+		io_write_wb16(writer, 1); /*data reference index*/
+		io_write_wb32(writer, 0); /*reserved*/
+		io_write_wb32(writer, 0);
+		io_write_wb16(writer, stream->a_chans);
+		io_write_wb16(writer, 16); /*sample size*/
+		io_write_wb16(writer, 0); /*pre defined*/
+		io_write_wb16(writer, 0); /*reserved*/
+		io_write_wb32(writer, (uint32_t) stream->a_rate << 16);
+
+		mp4_write_esds(writer, stream);
+	}
+
+	mp4_end_box(writer, entry);
+}
+
+/*
+ * write a track box (no samples: they go in the fragments)
+ * args:
+ *   mp4_ctx - pointer to mp4 context
+ *   writer - pointer to io_writer
+ *   stream - pointer to stream
+ *   track - pointer to track
+ *
+ * asserts:
+ *   none
+ *
+ * returns: none
+ */
+static void mp4_write_trak(mp4_context_t *mp4_ctx, io_writer_t *writer,
+	stream_io_t *stream, mp4_track_t *track)
+{
+	int video = (stream->type == STREAM_TYPE_VIDEO);
+
+	int64_t trak = mp4_start_box(writer, "trak");
+
+	int64_t tkhd = mp4_start_full_box(writer, "tkhd", 0, 0x000003); /*enabled + in movie*/
+	io_write_wb32(writer, 0); /*creation time*/
+	io_write_wb32(writer, 0); /*modification time*/
+	io_write_wb32(writer, track->track_id);
+	io_write_wb32(writer, 0); /*reserved*/
+	io_write_wb32(writer, 0); /*duration (fragmented)*/
+	io_write_wb32(writer, 0); /*reserved*/
+	io_write_wb32(writer, 0);
+	io_write_wb16(writer, 0); /*layer*/
+	io_write_wb16(writer, video ? 0 : 1); /*alternate group*/
+	io_write_wb16(writer, video ? 0 : 0x0100); /*volume*/
+	io_write_wb16(writer, 0); /*reserved*/
+	mp4_write_matrix(writer);
+	io_write_wb32(writer, video ? (uint32_t) stream->width << 16 : 0);
+	io_write_wb32(writer, video ? (uint32_t) stream->height << 16 : 0);
+	mp4_end_box(writer, tkhd);
+
+	int64_t mdia = mp4_start_box(writer, "mdia");
+
+	int64_t mdhd = mp4_start_full_box(writer, "mdhd", 0, 0);
+	io_write_wb32(writer, 0); /*creation time*/
+	io_write_wb32(writer, 0); /*modification time*/
+	io_write_wb32(writer, track->timescale);
+	io_write_wb32(writer, 0); /*duration*/
+	io_write_wb16(writer, 0x55C4); /*language: und*/
+	io_write_wb16(writer, 0); /*pre defined*/
+	mp4_end_box(writer, mdhd);
+
+	int64_t hdlr = mp4_start_full_box(writer, "hdlr", 0, 0);
+	io_write_wb32(writer, 0); /*pre defined*/
+	io_write_4cc(writer, video ? "vide" : "soun");
+	io_write_wb32(writer, 0); /*reserved*/
+	io_write_wb32(writer, 0);
+	io_write_wb32(writer, 0);
+	const char *name = video ? "VideoHandler" : "SoundHandler";
+	io_write_buf(writer, (uint8_t *) name, strlen(name) + 1);
+	mp4_end_box(writer, hdlr);
+
+	int64_t minf = mp4_start_box(writer, "minf");
+
+	int64_t mhd = 0;
+	if(video)
+	{
+		mhd = mp4_start_full_box(writer, "vmhd", 0, 1);
+		io_write_wb16(writer, 0); /*graphics mode*/
+		io_write_wb16(writer, 0); /*op color*/
+		io_write_wb16(writer, 0);
+		io_write_wb16(writer, 0);
+	}
+	else
+	{
+		mhd = mp4_start_full_box(writer, "smhd", 0, 0);
+		io_write_wb16(writer, 0); /*balance*/
+		io_write_wb16(writer, 0); /*reserved*/
+	}
+	mp4_end_box(writer, mhd);
+
+	int64_t dinf = mp4_start_box(writer, "dinf");
+	int64_t dref = mp4_start_full_box(writer, "dref", 0, 0);
+	io_write_wb32(writer, 1); /*entry count*/
+	int64_t url = mp4_start_full_box(writer, "url ", 0, 1); /*data in this file*/
+	mp4_end_box(writer, url);
+	mp4_end_box(writer, dref);
+	mp4_end_box(writer, dinf);
+
+	int64_t stbl = mp4_start_box(writer, "stbl");
+
+	int64_t stsd = mp4_start_full_box(writer, "stsd", 0, 0);
+	io_write_wb32(writer, 1); /*entry count*/
+	mp4_write_sample_entry(mp4_ctx, writer, stream);
+	mp4_end_box(writer, stsd);
+
+	/*empty sample tables*/
+	int64_t box = mp4_start_full_box(writer, "stts", 0, 0);
+	io_write_wb32(writer, 0);
+	mp4_end_box(writer, box);
+	box = mp4_start_full_box(writer, "stsc", 0, 0);
+	io_write_wb32(writer, 0);
+	mp4_end_box(writer, box);
+	box = mp4_start_full_box(writer, "stsz", 0, 0);
+	io_write_wb32(writer, 0); /*sample size*/
+	io_write_wb32(writer, 0); /*sample count*/
+	mp4_end_box(writer, box);
+	box = mp4_start_full_box(writer, "stco", 0, 0);
+	io_write_wb32(writer, 0);
+	mp4_end_box(writer, box);
+
+	mp4_end_box(writer, stbl);
+	mp4_end_box(writer, minf);
+	mp4_end_box(writer, mdia);
+	mp4_end_box(writer, trak);
+}
+
+/*
+ * write the init segment (ftyp + moov)
+ * args:
+ *   mp4_ctx - pointer to mp4 context
+ *
+ * asserts:
+ *   none
+ *
+ * returns: error code
+ */
+static int mp4_write_init_segment(mp4_context_t *mp4_ctx)
+{
+	int size = 1024;
+	int i = 0;
+
+	/*avc configuration from the stream*/
+	for(i = 0; i < mp4_ctx->stream_list_size; i++)
+	{
+		stream_io_t *stream = get_stream(mp4_ctx->stream_list, i);
+		mp4_track_t *track = &mp4_ctx->tracks[i];
+
+		if(stream->codec_id == AV_CODEC_ID_H264 && stream->extra_data_size <= 0 &&
+			mp4_ctx->avcc == NULL && track->num_samples > 0)
+			mp4_build_avcc(mp4_ctx, track->data, track->samples[0].size);
+
+		size += 1024 + stream->extra_data_size;
+	}
+	size += mp4_ctx->avcc_size;
+
+	/*one extra byte: a full buffer would trigger a flush*/
+	io_writer_t *writer = io_create_writer(NULL, size + 1);
+
+	int64_t ftyp = mp4_start_box(writer, "ftyp");
+	io_write_4cc(writer, "iso6"); /*major brand: tfdt and default-base-is-moof*/
+	io_write_wb32(writer, 0); /*minor version*/
+	io_write_4cc(writer, "iso6");
+	io_write_4cc(writer, "mp41");
+	mp4_end_box(writer, ftyp);
+
+	int64_t moov = mp4_start_box(writer, "moov");
+
+	int64_t mvhd = mp4_start_full_box(writer, "mvhd", 0, 0);
+	io_write_wb32(writer, 0); /*creation time*/
+	io_write_wb32(writer, 0); /*modification time*/
+	io_write_wb32(writer, 1000); /*timescale*/
+	io_write_wb32(writer, 0); /*duration (fragmented)*/
+	io_write_wb32(writer, 0x00010000); /*rate*/
+	io_write_wb16(writer, 0x0100); /*volume*/
+	io_write_wb16(writer, 0); /*reserved*/
+	io_write_wb32(writer, 0);
+	io_write_wb32(writer, 0);
+	mp4_write_matrix(writer);
+	for(i = 0; i < 6; i++)
+		io_write_wb32(writer, 0); /*pre defined*/
+
+	uint32_t next_track_id = 1;
+	for(i = 0; i < mp4_ctx->stream_list_size; i++)
+	{
+		if(mp4_ctx->tracks[i].supported)
+			mp4_ctx->tracks[i].track_id = next_track_id++;
+	}
+	io_write_wb32(writer, next_track_id);
+	mp4_end_box(writer, mvhd);
+
+	for(i = 0; i < mp4_ctx->stream_list_size; i++)
+	{
+		if(mp4_ctx->tracks[i].supported)
+			mp4_write_trak(mp4_ctx, writer, get_stream(mp4_ctx->stream_list, i), &mp4_ctx->tracks[i]);
+	}
+
+	/*fragment defaults (set in every fragment)*/
+	int64_t mvex = mp4_start_box(writer, "mvex");
+	for(i = 0; i < mp4_ctx->stream_list_size; i++)
+	{
+		if(!mp4_ctx->tracks[i].supported)
+			continue;
+
+		int64_t trex = mp4_start_full_box(writer, "trex", 0, 0);
+		io_write_wb32(writer, mp4_ctx->tracks[i].track_id);
+		io_write_wb32(writer, 1); /*sample description index*/
+		io_write_wb32(writer, 0); /*sample duration*/
+		io_write_wb32(writer, 0); /*sample size*/
+		io_write_wb32(writer, 0); /*sample flags*/
+		mp4_end_box(writer, trex);
+	}
+	mp4_end_box(writer, mvex);
+
+	mp4_end_box(writer, moov);
+
+	mp4_write_mem(mp4_ctx, writer);
+
+	mp4_ctx->header_written = 1;
+
+	return 0;
+}
+
+/*
+ * write the buffered samples as a fragment (moof + mdat)
+ * args:
+ *   mp4_ctx - pointer to mp4 context
+ *   next_video_dts - dts of the next video sample (-1 if none)
+ *
+ * asserts:
+ *   none
+ *
+ * returns: error code
+ */
+static int mp4_write_fragment(mp4_context_t *mp4_ctx, int64_t next_video_dts)
+{
+	int size = 64;
+	int64_t data_size = 0;
+	int i = 0;
+	int j = 0;
+
+	for(i = 0; i < mp4_ctx->stream_list_size; i++)
+	{
+		size += 64 + 12 * mp4_ctx->tracks[i].num_samples;
+		data_size += mp4_ctx->tracks[i].data_size;
+	}
+
+	if(data_size <= 0)
+		return 0;
+
+	if(!mp4_ctx->header_written)
+		mp4_write_init_segment(mp4_ctx);
+
+	int64_t moof_offset = io_get_offset(mp4_ctx->writer);
+	int video_traf = 0;
+	int traf_number = 0;
+	int64_t video_time = 0;
+
+	/*one extra byte: a full buffer would trigger a flush*/
+	io_writer_t *writer = io_create_writer(NULL, size + 1);
+
+	int64_t moof = mp4_start_box(writer, "moof");
+
+	int64_t mfhd = mp4_start_full_box(writer, "mfhd", 0, 0);
+	io_write_wb32(writer, ++mp4_ctx->sequence);
+	mp4_end_box(writer, mfhd);
+
+	for(i = 0; i < mp4_ctx->stream_list_size; i++)
+	{
+		stream_io_t *stream = get_stream(mp4_ctx->stream_list, i);
+		mp4_track_t *track = &mp4_ctx->tracks[i];
+		int video = (stream->type == STREAM_TYPE_VIDEO);
+
+		if(track->num_samples <= 0)
+			continue;
+
+		traf_number++;
+		if(video && !video_traf && track->samples[0].flags == MP4_SAMPLE_FLAGS_SYNC)
+		{
+			video_traf = traf_number;
+			video_time = track->samples[0].dts;
+		}
+
+		int64_t traf = mp4_start_box(writer, "traf");
+
+		/*default-base-is-moof (+ default sample flags for audio)*/
+		int64_t tfhd = mp4_start_full_box(writer, "tfhd", 0, video ? 0x020000 : 0x020020);
+		io_write_wb32(writer, track->track_id);
+		if(!video)
+			io_write_wb32(writer, MP4_SAMPLE_FLAGS_SYNC);
+		mp4_end_box(writer, tfhd);
+
+		int64_t tfdt = mp4_start_full_box(writer, "tfdt", 1, 0);
+		io_write_wb64(writer, (uint64_t) track->samples[0].dts);
+		mp4_end_box(writer, tfdt);
+
+		/*data offset + sample duration + sample size (+ sample flags for video)*/
+		int64_t trun = mp4_start_full_box(writer, "trun", 0, video ? 0x000701 : 0x000301);
+		io_write_wb32(writer, track->num_samples);
+		track->data_offset_pos = io_get_offset(writer);
+		io_write_wb32(writer, 0); /*data offset (set below)*/
+
+		for(j = 0; j < track->num_samples; j++)
+		{
+			uint32_t duration = track->last_duration;
+
+			if(j + 1 < track->num_samples)
+				duration = (uint32_t) (track->samples[j+1].dts - track->samples[j].dts);
+			else if(video && next_video_dts > track->samples[j].dts)
+				duration = (uint32_t) (next_video_dts - track->samples[j].dts);
+			else if(track->last_duration == 0)
+				duration = track->default_duration;
+
+			track->last_duration = duration;
+
+			io_write_wb32(writer, duration);
+			io_write_wb32(writer, track->samples[j].size);
+			if(video)
+				io_write_wb32(writer, track->samples[j].flags);
+		}
+		mp4_end_box(writer, trun);
+
+		mp4_end_box(writer, traf);
+	}
+
+	mp4_end_box(writer, moof);
+
+	/*data offsets: from the moof start to the track data in the mdat*/
+	int64_t offset = io_get_offset(writer) + 8;
+	for(i = 0; i < mp4_ctx->stream_list_size; i++)
+	{
+		mp4_track_t *track = &mp4_ctx->tracks[i];
+
+		if(track->num_samples <= 0)
+			continue;
+
+		uint8_t buf[4];
+		buf[0] = (uint8_t) (offset >> 24);
+		buf[1] = (uint8_t) (offset >> 16);
+		buf[2] = (uint8_t) (offset >> 8);
+		buf[3] = (uint8_t) offset;
+		io_write_at(writer, track->data_offset_pos, buf, 4);
+
+		offset += track->data_size;
+	}
+
+	mp4_write_mem(mp4_ctx, writer);
+
+	io_write_wb32(mp4_ctx->writer, (uint32_t) (8 + data_size));
+	io_write_4cc(mp4_ctx->writer, "mdat");
+	for(i = 0; i < mp4_ctx->stream_list_size; i++)
+	{
+		mp4_track_t *track = &mp4_ctx->tracks[i];
+
+		if(track->num_samples <= 0)
+			continue;
+
+		io_write_buf(mp4_ctx->writer, track->data, track->data_size);
+
+		track->last_dts = track->samples[track->num_samples - 1].dts;
+		track->num_samples = 0;
+		track->data_size = 0;
+	}
+
+	/*random access point*/
+	if(video_traf)
+	{
+		mp4_ctx->fragments = realloc(mp4_ctx->fragments,
+			(mp4_ctx->num_fragments + 1) * sizeof(mp4_fragment_entry_t));
+		if(mp4_ctx->fragments == NULL)
+		{
+			fprintf(stderr, "ENCODER: FATAL memory allocation failure (mp4_write_fragment): %s\n", strerror(errno));
+			exit(-1);
+		}
+
+		mp4_ctx->fragments[mp4_ctx->num_fragments].time = video_time;
+		mp4_ctx->fragments[mp4_ctx->num_fragments].moof_offset = moof_offset;
+		mp4_ctx->fragments[mp4_ctx->num_fragments].traf_number = (uint8_t) video_traf;
+		mp4_ctx->num_fragments++;
+	}
+
+	return 0;
+}
+
+/*
+ * grow the track fragment data buffer
+ * args:
+ *   track - pointer to track
+ *   size - needed free space
+ *
+ * asserts:
+ *   none
+ *
+ * returns: none
+ */
+static void mp4_track_reserve(mp4_track_t *track, int size)
+{
+	if(track->data_size + size <= track->data_max)
+		return;
+
+	track->data_max = MAX(2 * track->data_max, track->data_size + size);
+	track->data = realloc(track->data, track->data_max);
+	if(track->data == NULL)
+	{
+		fprintf(stderr, "ENCODER: FATAL memory allocation failure (mp4_track_reserve): %s\n", strerror(errno));
+		exit(-1);
+	}
+}
+
+/*
+ * find the next annex B start code (00 00 01 or 00 00 00 01)
+ * args:
+ *   data - data buffer
+ *   size - data size
+ *   pos - search start
+ *   sc_size - pointer to store the start code size (0 if none)
+ *
+ * asserts:
+ *   none
+ *
+ * returns: start code position (size if none)
+ */
+static int mp4_find_startcode(uint8_t *data, int size, int pos, int *sc_size)
+{
+	for(; pos + 3 <= size; pos++)
+	{
+		if(data[pos] != 0 || data[pos+1] != 0)
+			continue;
+
+		if(data[pos+2] == 1)
+		{
+			*sc_size = 3;
+			return pos;
+		}
+		if(pos + 4 <= size && data[pos+2] == 0 && data[pos+3] == 1)
+		{
+			*sc_size = 4;
+			return pos;
+		}
+	}
+
+	*sc_size = 0;
+	return size;
+}
+
+/*
+ * append the sample data to the track fragment data
+ *  h264 start codes are replaced by the nal size (4 bytes)
+ * args:
+ *   track - pointer to track
+ *   stream - pointer to stream
+ *   data - sample data
+ *   size - sample size
+ *
+ * asserts:
+ *   none
+ *
+ * returns: sample size in the fragment
+ */
+static int mp4_track_add_data(mp4_track_t *track, stream_io_t *stream, uint8_t *data, int size)
+{
+	int sc_size = 0;
+	int pos = 0;
+
+	if(stream->codec_id == AV_CODEC_ID_H264)
+		pos = mp4_find_startcode(data, size, 0, &sc_size);
+
+	/*not annex B: copy as is*/
+	if(sc_size == 0)
+	{
+		mp4_track_reserve(track, size);
+		memcpy(track->data + track->data_size, data, size);
+		track->data_size += size;
+		return size;
+	}
+
+	int start = track->data_size;
+	while(pos < size)
+	{
+		int next_size = 0;
+		int nal_start = pos + sc_size;
+		int next = mp4_find_startcode(data, size, nal_start, &next_size);
+		int nal_size = next - nal_start;
+
+		if(nal_size > 0)
+		{
+			mp4_track_reserve(track, nal_size + 4);
+			uint8_t *tp = track->data + track->data_size;
+			tp[0] = (uint8_t) (nal_size >> 24);
+			tp[1] = (uint8_t) (nal_size >> 16);
+			tp[2] = (uint8_t) (nal_size >> 8);
+			tp[3] = (uint8_t) nal_size;
+			memcpy(tp + 4, data + nal_start, nal_size);
+			track->data_size += nal_size + 4;
+		}
+
+		pos = next;
+		sc_size = next_size;
+	}
+
+	return track->data_size - start;
+}
+
+/*
+ * create a mp4 muxer context
+ * args:
+ *   filename - output file (may be a pipe or socket)
+ *
+ * asserts:
+ *   none
+ *
+ * returns: pointer to mp4 context
+ */
+mp4_context_t *mp4_create_context(const char *filename)
+{
+	mp4_context_t *mp4_ctx = calloc(1, sizeof(mp4_context_t));
+	if (mp4_ctx == NULL)
+	{
+		fprintf(stderr, "ENCODER: FATAL memory allocation failure (mp4_create_context): %s\n", strerror(errno));
+		exit(-1);
+	}
+
+	mp4_ctx->writer = io_create_writer(filename, 0);
+	mp4_ctx->stream_list = NULL;
+	mp4_ctx->tracks = NULL;
+
+	return mp4_ctx;
+}
+
+/*
+ * add a track for the new stream
+ * args:
+ *   mp4_ctx - pointer to mp4 context
+ *
+ * asserts:
+ *   none
+ *
+ * returns: pointer to the new track
+ */
+static mp4_track_t *mp4_add_track(mp4_context_t *mp4_ctx)
+{
+	mp4_ctx->tracks = realloc(mp4_ctx->tracks, mp4_ctx->stream_list_size * sizeof(mp4_track_t));
+	if(mp4_ctx->tracks == NULL)
+	{
+		fprintf(stderr, "ENCODER: FATAL memory allocation failure (mp4_add_track): %s\n", strerror(errno));
+		exit(-1);
+	}
+
+	mp4_track_t *track = &mp4_ctx->tracks[mp4_ctx->stream_list_size - 1];
+	memset(track, 0, sizeof(mp4_track_t));
+	track->last_dts = -1;
+
+	return track;
+}
+
+/*
+ * add a video stream
+ * args:
+ *   mp4_ctx - pointer to mp4 context
+ *   width - video width
+ *   height - video height
+ *   fps - frame rate (numerator)
+ *   fps_num - frame rate (denominator)
+ *   codec_id - video codec id
+ *
+ * asserts:
+ *   none
+ *
+ * returns: pointer to stream
+ */
+stream_io_t *mp4_add_video_stream(mp4_context_t *mp4_ctx,
+					int32_t width,
+					int32_t height,
+					int32_t fps,
+					int32_t fps_num,
+					int32_t codec_id)
+{
+	stream_io_t *stream = add_new_stream(&mp4_ctx->stream_list, &mp4_ctx->stream_list_size);
+	stream->type = STREAM_TYPE_VIDEO;
+	stream->width = width;
+	stream->height = height;
+	stream->codec_id = codec_id;
+	stream->fps = (fps_num > 0) ? (double) fps/fps_num : 0;
+	stream->indexes = NULL;
+
+	mp4_track_t *track = mp4_add_track(mp4_ctx);
+	track->supported = (codec_id == AV_CODEC_ID_H264 || mp4_get_object_type(codec_id) != 0);
+	track->timescale = MP4_VIDEO_TIMESCALE;
+	track->default_duration = (stream->fps > 0) ?
+		(uint32_t) (MP4_VIDEO_TIMESCALE / stream->fps) : MP4_VIDEO_TIMESCALE / 30;
+
+	if(!track->supported)
+		fprintf(stderr, "ENCODER: (mp4) video codec id 0x%x not supported in mp4 (use H264, MPEG4, MPEG1/2 or MJPEG)\n", codec_id);
+
+	return stream;
+}
+
+/*
+ * add an audio stream
+ * args:
+ *   mp4_ctx - pointer to mp4 context
+ *   channels - audio channels
+ *   rate - sample rate
+ *   bits - sample bits
+ *   mpgrate - bit rate (compressed formats)
+ *   codec_id - audio codec id
+ *   format - audio format (not used)
+ *
+ * asserts:
+ *   none
+ *
+ * returns: pointer to stream
+ */
+stream_io_t *mp4_add_audio_stream(mp4_context_t *mp4_ctx,
+					int32_t   channels,
+					int32_t   rate,
+					int32_t   bits,
+					int32_t   mpgrate,
+					int32_t   codec_id,
+					int32_t   format)
+{
+	stream_io_t *stream = add_new_stream(&mp4_ctx->stream_list, &mp4_ctx->stream_list_size);
+	stream->type = STREAM_TYPE_AUDIO;
+	stream->a_rate = rate;
+	stream->a_chans = channels;
+	stream->a_bits = bits;
+	stream->mpgrate = mpgrate;
+	stream->a_fmt = format;
+	stream->codec_id = codec_id;
+	stream->indexes = NULL;
+
+	mp4_track_t *track = mp4_add_track(mp4_ctx);
+	track->supported = (mp4_get_object_type(codec_id) != 0);
+	track->timescale = (rate > 0) ? rate : 48000;
+	track->default_duration = 1024;
+
+	if(!track->supported)
+		fprintf(stderr, "ENCODER: (mp4) audio codec id 0x%x not supported in mp4 (use AAC, MP2 or MP3) - dropping audio\n", codec_id);
+
+	return stream;
+}
+
+/*
+ * write the file header (init segment)
+ *  h264 streams without codec private data delay it
+ *  to the first fragment (the avc configuration is built from it)
+ * args:
+ *   mp4_ctx - pointer to mp4 context
+ *
+ * asserts:
+ *   mp4_ctx is not null
+ *
+ * returns: error code
+ */
+int mp4_write_header(mp4_context_t *mp4_ctx)
+{
+	assert(mp4_ctx != NULL);
+
+	int i = 0;
+	int ret = 0;
+
+	for(i = 0; i < mp4_ctx->stream_list_size; i++)
+	{
+		stream_io_t *stream = get_stream(mp4_ctx->stream_list, i);
+
+		if(stream->type == STREAM_TYPE_VIDEO && !mp4_ctx->tracks[i].supported)
+			ret = -2;
+
+		if(stream->type == STREAM_TYPE_AUDIO && stream->codec_id == AV_CODEC_ID_AAC)
+			mp4_ctx->tracks[i].default_duration = (mp4_ctx->audio_frame_size > 0) ? mp4_ctx->audio_frame_size : 1024;
+		else if(stream->type == STREAM_TYPE_AUDIO)
+			mp4_ctx->tracks[i].default_duration = (mp4_ctx->audio_frame_size > 0) ? mp4_ctx->audio_frame_size : 1152;
+
+		if(stream->codec_id == AV_CODEC_ID_H264 && stream->extra_data_size <= 0)
+			return ret;
+	}
+
+	mp4_write_init_segment(mp4_ctx);
+
+	return ret;
+}
+
+/*
+ * buffer a packet in the current fragment
+ *  (writes the fragment on a video keyframe)
+ * args:
+ *   mp4_ctx - pointer to mp4 context
+ *   stream_index - stream index
+ *   data - packet data
+ *   size - packet size
+ *   duration - packet duration (not used: set from the timestamps)
+ *   pts - packet timestamp (ns)
+ *   flags - packet flags
+ *
+ * asserts:
+ *   mp4_ctx is not null
+ *
+ * returns: error code
+ */
+int mp4_write_packet(mp4_context_t *mp4_ctx,
+					int stream_index,
+					uint8_t *data,
+					int size,
+					int duration,
+					uint64_t pts,
+					int flags)
+{
+	assert(mp4_ctx != NULL);
+
+	stream_io_t *stream = get_stream(mp4_ctx->stream_list, stream_index);
+
+	if(stream == NULL || size <= 0)
+		return -1;
+
+	mp4_track_t *track = &mp4_ctx->tracks[stream_index];
+
+	if(!track->supported)
+		return 0;
+
+	/*segment files start at the first keyframe pts*/
+	uint64_t ts = (pts > mp4_ctx->first_pts) ? pts - mp4_ctx->first_pts : 0;
+	int64_t dts = (int64_t) ((ts / 1000) * track->timescale / 1000000);
+
+	/*decode times must increase*/
+	int64_t last_dts = (track->num_samples > 0) ? track->samples[track->num_samples - 1].dts : track->last_dts;
+	if(last_dts >= 0 && dts <= last_dts)
+		dts = last_dts + 1;
+
+	/*intra only codecs: every frame is a keyframe*/
+	int keyframe = (flags & AV_PKT_FLAG_KEY) ||
+		stream->type == STREAM_TYPE_AUDIO ||
+		stream->codec_id == AV_CODEC_ID_MJPEG;
+
+	if(stream->type == STREAM_TYPE_VIDEO && track->num_samples > 0)
+	{
+		int64_t frag_duration = (dts - track->samples[0].dts) * 1000 / track->timescale;
+		int64_t frag_size = 0;
+		int i = 0;
+		for(i = 0; i < mp4_ctx->stream_list_size; i++)
+			frag_size += mp4_ctx->tracks[i].data_size;
+
+		if((keyframe && frag_duration >= MP4_FRAGMENT_DURATION) ||
+			frag_size > MP4_FRAGMENT_MAX_SIZE)
+			mp4_write_fragment(mp4_ctx, dts);
+	}
+
+	if(track->num_samples >= track->max_samples)
+	{
+		track->max_samples = (track->max_samples > 0) ? 2 * track->max_samples : 64;
+		track->samples = realloc(track->samples, track->max_samples * sizeof(mp4_sample_t));
+		if(track->samples == NULL)
+		{
+			fprintf(stderr, "ENCODER: FATAL memory allocation failure (mp4_write_packet): %s\n", strerror(errno));
+			exit(-1);
+		}
+	}
+
+	mp4_sample_t *sample = &track->samples[track->num_samples];
+	sample->size = mp4_track_add_data(track, stream, data, size);
+	sample->flags = keyframe ? MP4_SAMPLE_FLAGS_SYNC : MP4_SAMPLE_FLAGS_NON_SYNC;
+	sample->dts = dts;
+	track->num_samples++;
+
+	return 0;
+}
+
+/*
+ * write the last fragment and the random access index (mfra)
+ * args:
+ *   mp4_ctx - pointer to mp4 context
+ *
+ * asserts:
+ *   mp4_ctx is not null
+ *
+ * returns: error code
+ */
+int mp4_close(mp4_context_t *mp4_ctx)
+{
+	assert(mp4_ctx != NULL);
+
+	int i = 0;
+
+	if(verbosity > 0)
+		printf("ENCODER: (mp4) closing context\n");
+
+	mp4_write_fragment(mp4_ctx, -1);
+
+	if(!mp4_ctx->header_written)
+		mp4_write_init_segment(mp4_ctx);
+
+	/*random access index for the video track*/
+	uint32_t video_track_id = 0;
+	for(i = 0; i < mp4_ctx->stream_list_size; i++)
+	{
+		stream_io_t *stream = get_stream(mp4_ctx->stream_list, i);
+		if(stream->type == STREAM_TYPE_VIDEO && mp4_ctx->tracks[i].supported)
+		{
+			video_track_id = mp4_ctx->tracks[i].track_id;
+			break;
+		}
+	}
+
+	if(video_track_id > 0 && mp4_ctx->num_fragments > 0)
+	{
+		io_writer_t *writer = io_create_writer(NULL, 64 + 19 * mp4_ctx->num_fragments + 1);
+
+		int64_t mfra = mp4_start_box(writer, "mfra");
+
+		int64_t tfra = mp4_start_full_box(writer, "tfra", 1, 0);
+		io_write_wb32(writer, video_track_id);
+		io_write_wb32(writer, 0); /*traf, trun and sample numbers are 1 byte*/
+		io_write_wb32(writer, mp4_ctx->num_fragments);
+		for(i = 0; i < mp4_ctx->num_fragments; i++)
+		{
+			io_write_wb64(writer, (uint64_t) mp4_ctx->fragments[i].time);
+			io_write_wb64(writer, (uint64_t) mp4_ctx->fragments[i].moof_offset);
+			io_write_w8(writer, mp4_ctx->fragments[i].traf_number);
+			io_write_w8(writer, 1); /*trun number*/
+			io_write_w8(writer, 1); /*sample number*/
+		}
+		mp4_end_box(writer, tfra);
+
+		int64_t mfro = mp4_start_full_box(writer, "mfro", 0, 0);
+		io_write_wb32(writer, (uint32_t) (io_get_offset(writer) + 4 - mfra));
+		mp4_end_box(writer, mfro);
+
+		mp4_end_box(writer, mfra);
+
+		mp4_write_mem(mp4_ctx, writer);
+	}
+
+	return 0;
+}
+
+/*
+ * destroy the mp4 context (clean up)
+ * args:
+ *   mp4_ctx - pointer to mp4 context
+ *
+ * asserts:
+ *   none
+ *
+ * returns: none
+ */
+void mp4_destroy_context(mp4_context_t *mp4_ctx)
+{
+	int i = 0;
+
+	if(mp4_ctx == NULL)
+		return;
+
+	if(mp4_ctx->writer)
+	{
+		io_destroy_writer(mp4_ctx->writer);
+		free(mp4_ctx->writer);
+	}
+
+	for(i = 0; i < mp4_ctx->stream_list_size; i++)
+	{
+		free(mp4_ctx->tracks[i].samples);
+		free(mp4_ctx->tracks[i].data);
+	}
+	free(mp4_ctx->tracks);
+
+	destroy_stream_list(mp4_ctx->stream_list, &mp4_ctx->stream_list_size);
+
+	free(mp4_ctx->avcc);
+	free(mp4_ctx->fragments);
+	free(mp4_ctx);
+}
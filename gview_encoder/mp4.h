@@ -0,0 +1,135 @@
+/*******************************************************************************#
+#           guvcview              http://guvcview.sourceforge.net               #
+#                                                                               #
+#           Paulo Assis <pj.assis@gmail.com>                                    #
+#                                                                               #
+# This program is free software; you can redistribute it and/or modify          #
+# it under the terms of the GNU General Public License as published by          #
+# the Free Software Foundation; either version 2 of the License, or             #
+# (at your option) any later version.                                           #
+#                                                                               #
+# This program is distributed in the hope that it will be useful,               #
+# but WITHOUT ANY WARRANTY; without even the implied warranty of                #
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the                 #
+# GNU General Public License for more details.                                  #
+#                                                                               #
+# You should have received a copy of the GNU General Public License             #
+# along with this program; if not, write to the Free Software                   #
+# Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA     #
+#                                                                               #
+********************************************************************************/
+
+#ifndef MP4_H
+#define MP4_H
+
+#include <inttypes.h>
+#include <sys/types.h>
+
+#include "stream_io.h"
+#include "file_io.h"
+
+/*video track timescale (audio tracks use the sample rate)*/
+#define MP4_VIDEO_TIMESCALE 90000
+/*a new fragment starts on a video keyframe after this time (ms)*/
+#define MP4_FRAGMENT_DURATION 1000
+/*or on any video frame if the fragment data grows over this size*/
+#define MP4_FRAGMENT_MAX_SIZE (8*1024*1024)
+
+/*trun sample flags*/
+#define MP4_SAMPLE_FLAGS_SYNC     0x02000000 /*depends on no other sample*/
+#define MP4_SAMPLE_FLAGS_NON_SYNC 0x01010000 /*depends on others, non sync sample*/
+
+typedef struct _mp4_sample_t
+{
+	uint32_t size;
+	uint32_t flags;  /*trun sample flags*/
+	int64_t  dts;    /*in track timescale*/
+} mp4_sample_t;
+
+typedef struct _mp4_track_t
+{
+	int supported;             /*codec can be stored in mp4*/
+	uint32_t track_id;
+	uint32_t timescale;
+	uint32_t default_duration; /*nominal sample duration (track timescale)*/
+	uint32_t last_duration;    /*duration of the last written sample*/
+	int64_t  last_dts;         /*dts of the last written sample (-1 if none)*/
+
+	/*current fragment*/
+	mp4_sample_t *samples;
+	int num_samples;
+	int max_samples;
+	uint8_t *data;
+	int data_size;
+	int data_max;
+
+	int64_t data_offset_pos;   /*trun data offset position in the moof*/
+} mp4_track_t;
+
+typedef struct _mp4_fragment_entry_t
+{
+	int64_t  time;        /*video dts of the first fragment sample*/
+	int64_t  moof_offset; /*file offset of the moof*/
+	uint8_t  traf_number; /*video traf (1 based)*/
+} mp4_fragment_entry_t;
+
+typedef struct _mp4_context_t
+{
+	io_writer_t  *writer;
+
+	stream_io_t  *stream_list;
+	int           stream_list_size;
+	mp4_track_t  *tracks;  /*one for each stream (same index)*/
+
+	int       header_written; /*init segment (ftyp + moov) written*/
+	uint32_t  sequence;       /*fragment sequence number*/
+	uint64_t  first_pts;      /*pts of first packet (ns)*/
+	int       audio_frame_size;
+
+	/*avc decoder configuration built from the stream (if no codec private)*/
+	uint8_t  *avcc;
+	int       avcc_size;
+
+	/*random access index (written in the mfra box)*/
+	mp4_fragment_entry_t *fragments;
+	int       num_fragments;
+} mp4_context_t;
+
+/** create a muxer context*/
+mp4_context_t *mp4_create_context(const char *filename);
+
+/** add a video stream to the context */
+stream_io_t *mp4_add_video_stream(mp4_context_t *mp4_ctx,
+					int32_t width,
+					int32_t height,
+					int32_t fps,
+					int32_t fps_num,
+					int32_t codec_id);
+
+/** add a audio stream to the context */
+stream_io_t *mp4_add_audio_stream(mp4_context_t *mp4_ctx,
+					int32_t   channels,
+					int32_t   rate,
+					int32_t   bits,
+					int32_t   mpgrate,
+					int32_t   codec_id,
+					int32_t   format);
+
+/** write the init segment (may be delayed to the first fragment)*/
+int mp4_write_header(mp4_context_t *mp4_ctx);
+
+int mp4_write_packet(mp4_context_t *mp4_ctx,
+					int stream_index,
+					uint8_t *data,
+					int size,
+					int duration,
+					uint64_t pts,
+					int flags);
+
+/** write the last fragment and the random access index*/
+int mp4_close(mp4_context_t *mp4_ctx);
+
+/** destroy the muxer context (clean up)*/
+void mp4_destroy_context(mp4_context_t *mp4_ctx);
+
+#endif
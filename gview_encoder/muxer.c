@@ -48,6 +48,7 @@
 #include "encoder.h"
 #include "stream_io.h"
 #include "matroska.h"
+#include "mp4.h"
 #include "avi.h"
 #include "gview.h"
 
@@ -55,14 +56,375 @@ extern int verbosity;
 
 static mkv_context_t *mkv_ctx = NULL;
 static avi_context_t *avi_ctx = NULL;
+static mp4_context_t *mp4_ctx = NULL;
 
-static stream_io_t *video_stream = NULL;
-static stream_io_t *audio_stream = NULL;
+/*segmented recording: next file (opened ahead of the split)*/
+static mkv_context_t *next_mkv_ctx = NULL;
+static avi_context_t *next_avi_ctx = NULL;
+static mp4_context_t *next_mp4_ctx = NULL;
+static char *next_filename = NULL;
+static int segment_status = ENCODER_SEGMENT_NONE;
+
+/*current segment start (video pts and frame count)*/
+static int64_t segment_start_pts = -1;
+static int64_t segment_start_frame = 0;
+
+/*matroska index checkpoint interval in seconds (0 - disabled)*/
+static int mkv_checkpoint = 0;
 
 /*file mutex*/
 static __MUTEX_TYPE mutex = __STATIC_MUTEX_INIT;
 #define __PMUTEX &mutex
 
+/*
+ * create a file muxer context and write the file header
+ * args:
+ *   encoder_ctx - pointer to encoder context
+ *   filename - video filename
+ *   avi - pointer to avi context pointer (set for ENCODER_MUX_AVI)
+ *   mkv - pointer to mkv context pointer (set for ENCODER_MUX_MKV/WEBM)
+ *   mp4 - pointer to mp4 context pointer (set for ENCODER_MUX_MP4)
+ *
+ * asserts:
+ *   none
+ *
+ * returns: none
+ */
+static void muxer_create(encoder_context_t *encoder_ctx, const char *filename,
+	avi_context_t **avi, mkv_context_t **mkv, mp4_context_t **mp4)
+{
+	encoder_codec_data_t *video_codec_data = (encoder_codec_data_t *) encoder_ctx->enc_video_ctx->codec_data;
+	stream_io_t *video_stream = NULL;
+	stream_io_t *audio_stream = NULL;
+
+	int video_codec_id = AV_CODEC_ID_NONE;
+
+	if(encoder_ctx->video_codec_ind == 0) /*no codec_context*/
+	{
+		switch(encoder_ctx->input_format)
+		{
+			case V4L2_PIX_FMT_H264:
+				video_codec_id = AV_CODEC_ID_H264;
+				break;
+		}
+	}
+	else if(video_codec_data)
+	{
+		video_codec_id = video_codec_data->codec_context->codec_id;
+	}
+
+	switch (encoder_ctx->muxer_id)
+	{
+		case ENCODER_MUX_AVI:
+			*avi = avi_create_context(filename);
+
+			/*add video stream*/
+			video_stream = avi_add_video_stream(
+				*avi,
+				encoder_ctx->video_width,
+				encoder_ctx->video_height,
+				encoder_ctx->fps_den,
+				encoder_ctx->fps_num,
+				video_codec_id);
+
+			if(video_codec_id == AV_CODEC_ID_THEORA && video_codec_data)
+			{
+				video_stream->extra_data = (uint8_t *) video_codec_data->codec_context->extradata;
+				video_stream->extra_data_size = video_codec_data->codec_context->extradata_size;
+			}
+
+			/*add audio stream*/
+			if(encoder_ctx->enc_audio_ctx != NULL &&
+				encoder_ctx->audio_channels > 0)
+			{
+				encoder_codec_data_t *audio_codec_data = (encoder_codec_data_t *) encoder_ctx->enc_audio_ctx->codec_data;
+				if(audio_codec_data)
+				{
+					int acodec_ind = get_audio_codec_list_index(audio_codec_data->codec_context->codec_id);
+					/*sample size - only used for PCM*/
+					int32_t a_bits = encoder_get_audio_bits(acodec_ind);
+					/*bit rate (compressed formats)*/
+					int32_t b_rate = encoder_get_audio_bit_rate(acodec_ind);
+
+					audio_stream = avi_add_audio_stream(
+						*avi,
+						encoder_ctx->audio_channels,
+						encoder_ctx->audio_samprate,
+						a_bits,
+						b_rate,
+						audio_codec_data->codec_context->codec_id,
+						encoder_ctx->enc_audio_ctx->avi_4cc);
+
+					if(audio_codec_data->codec_context->codec_id == AV_CODEC_ID_VORBIS)
+					{
+						audio_stream->extra_data = (uint8_t *) audio_codec_data->codec_context->extradata;
+						audio_stream->extra_data_size = audio_codec_data->codec_context->extradata_size;
+					}
+				}
+			}
+
+			/* add first riff header */
+			avi_add_new_riff(*avi);
+
+			break;
+
+		case ENCODER_MUX_MP4:
+			*mp4 = mp4_create_context(filename);
+
+			/*raw mjpeg is stored as is (other raw formats are not supported)*/
+			if(encoder_ctx->video_codec_ind == 0 &&
+				(encoder_ctx->input_format == V4L2_PIX_FMT_MJPEG ||
+				 encoder_ctx->input_format == V4L2_PIX_FMT_JPEG))
+				video_codec_id = AV_CODEC_ID_MJPEG;
+
+			/*add video stream*/
+			video_stream = mp4_add_video_stream(
+				*mp4,
+				encoder_ctx->video_width,
+				encoder_ctx->video_height,
+				encoder_ctx->fps_den,
+				encoder_ctx->fps_num,
+				video_codec_id);
+
+			if(encoder_ctx->video_codec_ind == 0 &&
+				encoder_ctx->input_format == V4L2_PIX_FMT_H264)
+			{
+				/*avc configuration from the device SPS and PPS*/
+				video_stream->extra_data_size = encoder_set_video_mkvCodecPriv(encoder_ctx);
+				if(video_stream->extra_data_size > 0)
+					video_stream->extra_data = (uint8_t *) encoder_get_video_mkvCodecPriv(0);
+			}
+			else if(video_codec_id == AV_CODEC_ID_MPEG4 && video_codec_data)
+			{
+				video_stream->extra_data = (uint8_t *) video_codec_data->codec_context->extradata;
+				video_stream->extra_data_size = video_codec_data->codec_context->extradata_size;
+			}
+
+			/*add audio stream*/
+			if(encoder_ctx->enc_audio_ctx != NULL &&
+				encoder_ctx->audio_channels > 0)
+			{
+				encoder_codec_data_t *audio_codec_data = (encoder_codec_data_t *) encoder_ctx->enc_audio_ctx->codec_data;
+				if(audio_codec_data)
+				{
+					(*mp4)->audio_frame_size = audio_codec_data->codec_context->frame_size;
+
+					/*sample size - only used for PCM*/
+					int32_t a_bits = encoder_get_audio_bits(encoder_ctx->audio_codec_ind);
+					/*bit rate (compressed formats)*/
+					int32_t b_rate = encoder_get_audio_bit_rate(encoder_ctx->audio_codec_ind);
+
+					audio_stream = mp4_add_audio_stream(
+						*mp4,
+						encoder_ctx->audio_channels,
+						encoder_ctx->audio_samprate,
+						a_bits,
+						b_rate,
+						audio_codec_data->codec_context->codec_id,
+						encoder_ctx->enc_audio_ctx->avi_4cc);
+
+					/*AAC audio specific config*/
+					if(audio_codec_data->codec_context->codec_id == AV_CODEC_ID_AAC)
+					{
+						audio_stream->extra_data_size = encoder_set_audio_mkvCodecPriv(encoder_ctx);
+						if(audio_stream->extra_data_size > 0)
+							audio_stream->extra_data = encoder_get_audio_mkvCodecPriv(encoder_ctx->audio_codec_ind);
+					}
+				}
+			}
+
+			/* write the init segment */
+			if(mp4_write_header(*mp4) < 0)
+				fprintf(stderr, "ENCODER: (mp4) video codec not supported - no video will be stored\n");
+
+			break;
+
+		default:
+		case ENCODER_MUX_MKV:
+		case ENCODER_MUX_WEBM:
+			*mkv = mkv_create_context(filename, encoder_ctx->muxer_id);
+
+			/*add video stream*/
+			video_stream = mkv_add_video_stream(
+				*mkv,
+				encoder_ctx->video_width,
+				encoder_ctx->video_height,
+				encoder_ctx->fps_den,
+				encoder_ctx->fps_num,
+				video_codec_id);
+
+			video_stream->extra_data_size = encoder_set_video_mkvCodecPriv(encoder_ctx);
+
+			if(video_stream->extra_data_size > 0)
+			{
+				video_stream->extra_data = (uint8_t *) encoder_get_video_mkvCodecPriv(encoder_ctx->video_codec_ind);
+				if(encoder_ctx->input_format == V4L2_PIX_FMT_H264)
+					video_stream->h264_process = 1; //we need to process NALU marker
+			}
+
+			/*add audio stream*/
+			if(encoder_ctx->enc_audio_ctx != NULL &&
+				encoder_ctx->audio_channels > 0)
+			{
+				encoder_codec_data_t *audio_codec_data = (encoder_codec_data_t *) encoder_ctx->enc_audio_ctx->codec_data;
+				if(audio_codec_data)
+				{
+					(*mkv)->audio_frame_size = audio_codec_data->codec_context->frame_size;
+
+					/*sample size - only used for PCM*/
+					int32_t a_bits = encoder_get_audio_bits(encoder_ctx->audio_codec_ind);
+					/*bit rate (compressed formats)*/
+					int32_t b_rate = encoder_get_audio_bit_rate(encoder_ctx->audio_codec_ind);
+
+					audio_stream = mkv_add_audio_stream(
+						*mkv,
+						encoder_ctx->audio_channels,
+						encoder_ctx->audio_samprate,
+						a_bits,
+						b_rate,
+						audio_codec_data->codec_context->codec_id,
+						encoder_ctx->enc_audio_ctx->avi_4cc);
+
+					audio_stream->extra_data_size = encoder_set_audio_mkvCodecPriv(encoder_ctx);
+
+					if(audio_stream->extra_data_size > 0)
+						audio_stream->extra_data = encoder_get_audio_mkvCodecPriv(encoder_ctx->audio_codec_ind);
+				}
+			}
+
+			/*periodic cues checkpoint (crash safe file)*/
+			(*mkv)->checkpoint_interval = (int64_t) mkv_checkpoint * NSEC_PER_SEC;
+
+			/* write the file header */
+			mkv_write_header(*mkv);
+
+			break;
+
+	}
+}
+
+/*
+ * close a file muxer context (writes indexes and trailers)
+ * args:
+ *   avi - avi context (or NULL)
+ *   mkv - mkv context (or NULL)
+ *   mp4 - mp4 context (or NULL)
+ *   duration - video duration in the file (ns)
+ *   framecount - number of video frames in the file
+ *
+ * asserts:
+ *   none
+ *
+ * returns: none
+ */
+static void muxer_close_file(avi_context_t *avi, mkv_context_t *mkv,
+	mp4_context_t *mp4, int64_t duration, int64_t framecount)
+{
+	if (avi)
+	{
+		float tottime = (float) (duration / 1000000); // convert to miliseconds
+
+		if (verbosity > 0)
+			printf("ENCODER: (avi) time = %f\n", tottime);
+
+		if (tottime > 0)
+		{
+			/*try to find the real frame rate*/
+			avi->fps = (double) (framecount * 1000) / tottime;
+		}
+
+		if (verbosity > 0)
+			printf("ENCODER: (avi) %"PRId64" frames in %f ms [ %f fps]\n",
+				framecount, tottime, avi->fps);
+
+		//close sound ??
+		avi_close(avi);
+
+		avi_destroy_context(avi);
+	}
+
+	if(mkv)
+	{
+		mkv_close(mkv);
+
+		mkv_destroy_context(mkv);
+	}
+
+	if(mp4)
+	{
+		mp4_close(mp4);
+
+		mp4_destroy_context(mp4);
+	}
+}
+
+/*
+ * switch to the next segment file if a split is requested
+ *  and the current video packet is a keyframe
+ *  (called with the file mutex locked)
+ * args:
+ *   encoder_ctx - pointer to encoder context
+ *   old_avi - pointer to store the avi context to close
+ *   old_mkv - pointer to store the mkv context to close
+ *   old_mp4 - pointer to store the mp4 context to close
+ *   old_duration - pointer to store the old file video duration (ns)
+ *   old_frames - pointer to store the old file video frame count
+ *
+ * asserts:
+ *   none
+ *
+ * returns: 1 if switched to a new file, 0 otherwise
+ */
+static int muxer_segment_switch(encoder_context_t *encoder_ctx,
+	avi_context_t **old_avi, mkv_context_t **old_mkv, mp4_context_t **old_mp4,
+	int64_t *old_duration, int64_t *old_frames)
+{
+	encoder_video_context_t *enc_video_ctx = encoder_ctx->enc_video_ctx;
+
+	if(segment_status != ENCODER_SEGMENT_SPLIT)
+		return 0;
+
+	/*raw input other than h264 is intra only (every frame is a keyframe)*/
+	int keyframe = (enc_video_ctx->flags & AV_PKT_FLAG_KEY) ||
+		(encoder_ctx->video_codec_ind == 0 &&
+		 encoder_ctx->input_format != V4L2_PIX_FMT_H264);
+
+	if(!keyframe)
+		return 0;
+
+	*old_avi = avi_ctx;
+	*old_mkv = mkv_ctx;
+	*old_mp4 = mp4_ctx;
+	/*the keyframe is the first frame of the new segment*/
+	*old_duration = enc_video_ctx->pts - segment_start_pts;
+	*old_frames = enc_video_ctx->framecount - 1 - segment_start_frame;
+
+	avi_ctx = next_avi_ctx;
+	mkv_ctx = next_mkv_ctx;
+	mp4_ctx = next_mp4_ctx;
+	next_avi_ctx = NULL;
+	next_mkv_ctx = NULL;
+	next_mp4_ctx = NULL;
+
+	/*segment timestamps start at the keyframe*/
+	if(mkv_ctx)
+		mkv_ctx->first_pts = enc_video_ctx->pts;
+	if(mp4_ctx)
+		mp4_ctx->first_pts = enc_video_ctx->pts;
+
+	segment_start_pts = enc_video_ctx->pts;
+	segment_start_frame = enc_video_ctx->framecount - 1;
+	segment_status = ENCODER_SEGMENT_NONE;
+
+	if(verbosity > 0)
+		printf("ENCODER: switched to segment file %s\n", next_filename);
+
+	free(next_filename);
+	next_filename = NULL;
+
+	return 1;
+}
+
 /*
  * mux a video frame
  * args:
@@ -82,26 +444,56 @@ int encoder_write_video_data(encoder_context_t *encoder_ctx)
 	assert(enc_video_ctx);
 
 	if(enc_video_ctx->outbuf_coded_size <= 0)
+	{
+		/*
+		 * unchanged frame (not encoded): avi has a constant frame rate
+		 * so an empty chunk repeats the previous frame, the other
+		 * muxers use the next frame timestamp
+		 */
+		if(enc_video_ctx->duplicate && encoder_ctx->muxer_id == ENCODER_MUX_AVI)
+		{
+			__LOCK_MUTEX( __PMUTEX );
+			if(avi_ctx)
+			{
+				avi_write_packet(avi_ctx, 0, NULL, 0, AV_NOPTS_VALUE, 0, 0);
+				/*the repeated frame counts for the header frame rate*/
+				enc_video_ctx->framecount++;
+			}
+			__UNLOCK_MUTEX( __PMUTEX );
+		}
 		return -1;
+	}
 
 	enc_video_ctx->framecount++;
 
 	int ret =0;
 	int block_align = 1;
 
+	avi_context_t *old_avi = NULL;
+	mkv_context_t *old_mkv = NULL;
+	mp4_context_t *old_mp4 = NULL;
+	int64_t old_duration = 0;
+	int64_t old_frames = 0;
+
 	encoder_codec_data_t *video_codec_data = (encoder_codec_data_t *) enc_video_ctx->codec_data;
 
 	if(video_codec_data)
 		block_align = video_codec_data->codec_context->block_align;
 
 	__LOCK_MUTEX( __PMUTEX );
+
+	if(segment_start_pts < 0)
+		segment_start_pts = enc_video_ctx->pts;
+
+	muxer_segment_switch(encoder_ctx, &old_avi, &old_mkv, &old_mp4, &old_duration, &old_frames);
+
 	switch (encoder_ctx->muxer_id)
 	{
 		case ENCODER_MUX_AVI:
 			ret = avi_write_packet(
 					avi_ctx,
 					0,
-					enc_video_ctx->outbuf,
+					enc_video_ctx->packet,
 					enc_video_ctx->outbuf_coded_size,
 					enc_video_ctx->dts,
 					block_align,
@@ -113,7 +505,18 @@ int encoder_write_video_data(encoder_context_t *encoder_ctx)
 			ret = mkv_write_packet(
 					mkv_ctx,
 					0,
-					enc_video_ctx->outbuf,
+					enc_video_ctx->packet,
+					enc_video_ctx->outbuf_coded_size,
+					enc_video_ctx->duration,
+					enc_video_ctx->pts,
+					enc_video_ctx->flags);
+			break;
+
+		case ENCODER_MUX_MP4:
+			ret = mp4_write_packet(
+					mp4_ctx,
+					0,
+					enc_video_ctx->packet,
 					enc_video_ctx->outbuf_coded_size,
 					enc_video_ctx->duration,
 					enc_video_ctx->pts,
@@ -126,9 +529,14 @@ int encoder_write_video_data(encoder_context_t *encoder_ctx)
 	}
 	__UNLOCK_MUTEX( __PMUTEX );
 
+	/*finish the previous segment file (no longer used by the audio thread)*/
+	if(old_avi || old_mkv || old_mp4)
+		muxer_close_file(old_avi, old_mkv, old_mp4, old_duration, old_frames);
+
 	return (ret);
 }
 
+
 /*
  * mux a audio frame
  * args:
@@ -189,6 +597,17 @@ int encoder_write_audio_data(encoder_context_t *encoder_ctx)
 					enc_audio_ctx->flags);
 			break;
 
+		case ENCODER_MUX_MP4:
+			ret = mp4_write_packet(
+					mp4_ctx,
+					1,
+					enc_audio_ctx->outbuf,
+					enc_audio_ctx->outbuf_coded_size,
+					enc_audio_ctx->duration,
+					enc_audio_ctx->pts,
+					enc_audio_ctx->flags);
+			break;
+
 		default:
 
 			break;
@@ -216,151 +635,226 @@ void encoder_muxer_init(encoder_context_t *encoder_ctx, const char *filename)
 	assert(encoder_ctx != NULL);
 	assert(encoder_ctx->enc_video_ctx != NULL);
 
-	encoder_codec_data_t *video_codec_data = (encoder_codec_data_t *) encoder_ctx->enc_video_ctx->codec_data;
-
-	int video_codec_id = AV_CODEC_ID_NONE;
+	if(verbosity > 1)
+		printf("ENCODER: initializing muxer(%i)\n", encoder_ctx->muxer_id);
 
-	if(encoder_ctx->video_codec_ind == 0) /*no codec_context*/
+	if(avi_ctx != NULL)
 	{
-		switch(encoder_ctx->input_format)
-		{
-			case V4L2_PIX_FMT_H264:
-				video_codec_id = AV_CODEC_ID_H264;
-				break;
-		}
+		avi_destroy_context(avi_ctx);
+		avi_ctx = NULL;
 	}
-	else if(video_codec_data)
+	if(mkv_ctx != NULL)
 	{
-		video_codec_id = video_codec_data->codec_context->codec_id;
+		mkv_destroy_context(mkv_ctx);
+		mkv_ctx = NULL;
+	}
+	if(mp4_ctx != NULL)
+	{
+		mp4_destroy_context(mp4_ctx);
+		mp4_ctx = NULL;
 	}
 
-	if(verbosity > 1)
-		printf("ENCODER: initializing muxer(%i)\n", encoder_ctx->muxer_id);
+	segment_status = ENCODER_SEGMENT_NONE;
+	segment_start_pts = -1;
+	segment_start_frame = 0;
 
-	switch (encoder_ctx->muxer_id)
+	muxer_create(encoder_ctx, filename, &avi_ctx, &mkv_ctx, &mp4_ctx);
+
+	/*write the pre-roll frames (if any) at the file start*/
+	encoder_preroll_flush(encoder_ctx);
+}
+
+/*
+ * open the next segment file ahead of time (writes the file header)
+ *  the muxer will switch to it on the first keyframe after
+ *  a call to encoder_muxer_split
+ * args:
+ *   encoder_ctx - pointer to encoder context
+ *   filename - next segment filename
+ *
+ * asserts:
+ *   encoder_ctx is not null
+ *   encoder_ctx->enc_video_ctx is not null
+ *   filename is not null
+ *
+ * returns: error code
+ */
+int encoder_muxer_prepare_next(encoder_context_t *encoder_ctx, const char *filename)
+{
+	/*assertions*/
+	assert(encoder_ctx != NULL);
+	assert(encoder_ctx->enc_video_ctx != NULL);
+	assert(filename != NULL);
+
+	avi_context_t *avi = NULL;
+	mkv_context_t *mkv = NULL;
+	mp4_context_t *mp4 = NULL;
+
+	__LOCK_MUTEX( __PMUTEX );
+	int status = segment_status;
+	__UNLOCK_MUTEX( __PMUTEX );
+
+	if(status != ENCODER_SEGMENT_NONE)
 	{
-		case ENCODER_MUX_AVI:
-			if(avi_ctx != NULL)
-			{
-				avi_destroy_context(avi_ctx);
-				avi_ctx = NULL;
-			}
-			avi_ctx = avi_create_context(filename);
+		fprintf(stderr, "ENCODER: next segment file already prepared\n");
+		return -1;
+	}
 
-			/*add video stream*/
-			video_stream = avi_add_video_stream(
-				avi_ctx,
-				encoder_ctx->video_width,
-				encoder_ctx->video_height,
-				encoder_ctx->fps_den,
-				encoder_ctx->fps_num,
-				video_codec_id);
+	/*header writes may block: keep them out of the file mutex*/
+	muxer_create(encoder_ctx, filename, &avi, &mkv, &mp4);
 
-			if(video_codec_id == AV_CODEC_ID_THEORA && video_codec_data)
-			{
-				video_stream->extra_data = (uint8_t *) video_codec_data->codec_context->extradata;
-				video_stream->extra_data_size = video_codec_data->codec_context->extradata_size;
-			}
+	__LOCK_MUTEX( __PMUTEX );
+	next_avi_ctx = avi;
+	next_mkv_ctx = mkv;
+	next_mp4_ctx = mp4;
+	free(next_filename);
+	next_filename = strdup(filename);
+	segment_status = ENCODER_SEGMENT_READY;
+	__UNLOCK_MUTEX( __PMUTEX );
 
-			/*add audio stream*/
-			if(encoder_ctx->enc_audio_ctx != NULL &&
-				encoder_ctx->audio_channels > 0)
-			{
-				encoder_codec_data_t *audio_codec_data = (encoder_codec_data_t *) encoder_ctx->enc_audio_ctx->codec_data;
-				if(audio_codec_data)
-				{
-					int acodec_ind = get_audio_codec_list_index(audio_codec_data->codec_context->codec_id);
-					/*sample size - only used for PCM*/
-					int32_t a_bits = encoder_get_audio_bits(acodec_ind);
-					/*bit rate (compressed formats)*/
-					int32_t b_rate = encoder_get_audio_bit_rate(acodec_ind);
+	if(verbosity > 0)
+		printf("ENCODER: prepared next segment file %s\n", filename);
 
-					audio_stream = avi_add_audio_stream(
-						avi_ctx,
-						encoder_ctx->audio_channels,
-						encoder_ctx->audio_samprate,
-						a_bits,
-						b_rate,
-						audio_codec_data->codec_context->codec_id,
-						encoder_ctx->enc_audio_ctx->avi_4cc);
+	return 0;
+}
 
-					if(audio_codec_data->codec_context->codec_id == AV_CODEC_ID_VORBIS)
-					{
-						audio_stream->extra_data = (uint8_t *) audio_codec_data->codec_context->extradata;
-						audio_stream->extra_data_size = audio_codec_data->codec_context->extradata_size;
-					}
-				}
-			}
+/*
+ * request a switch to the prepared segment file
+ *  on the next video keyframe (forces a keyframe on the next encoded frame)
+ * args:
+ *   encoder_ctx - pointer to encoder context
+ *
+ * asserts:
+ *   encoder_ctx is not null
+ *   encoder_ctx->enc_video_ctx is not null
+ *
+ * returns: error code
+ */
+int encoder_muxer_split(encoder_context_t *encoder_ctx)
+{
+	/*assertions*/
+	assert(encoder_ctx != NULL);
+	assert(encoder_ctx->enc_video_ctx != NULL);
 
-			/* add first riff header */
-			avi_add_new_riff(avi_ctx);
+	int ret = 0;
 
-			break;
+	__LOCK_MUTEX( __PMUTEX );
+	if(segment_status == ENCODER_SEGMENT_READY)
+	{
+		segment_status = ENCODER_SEGMENT_SPLIT;
+		encoder_ctx->enc_video_ctx->force_keyframe = 1;
+	}
+	else if(segment_status == ENCODER_SEGMENT_NONE)
+		ret = -1;
+	__UNLOCK_MUTEX( __PMUTEX );
 
-		default:
-		case ENCODER_MUX_MKV:
-		case ENCODER_MUX_WEBM:
-			if(mkv_ctx != NULL)
-			{
-				mkv_destroy_context(mkv_ctx);
-				mkv_ctx = NULL;
-			}
-			mkv_ctx = mkv_create_context(filename, encoder_ctx->muxer_id);
+	return ret;
+}
 
-			/*add video stream*/
-			video_stream = mkv_add_video_stream(
-				mkv_ctx,
-				encoder_ctx->video_width,
-				encoder_ctx->video_height,
-				encoder_ctx->fps_den,
-				encoder_ctx->fps_num,
-				video_codec_id);
+/*
+ * get the segment status
+ * args:
+ *   none
+ *
+ * asserts:
+ *   none
+ *
+ * returns: ENCODER_SEGMENT_NONE  - no next segment file
+ *          ENCODER_SEGMENT_READY - next segment file prepared
+ *          ENCODER_SEGMENT_SPLIT - waiting for a keyframe to switch
+ */
+int encoder_muxer_get_segment_status()
+{
+	__LOCK_MUTEX( __PMUTEX );
+	int status = segment_status;
+	__UNLOCK_MUTEX( __PMUTEX );
 
-			video_stream->extra_data_size = encoder_set_video_mkvCodecPriv(encoder_ctx);
+	return status;
+}
 
-			if(video_stream->extra_data_size > 0)
-			{
-				video_stream->extra_data = (uint8_t *) encoder_get_video_mkvCodecPriv(encoder_ctx->video_codec_ind);
-				if(encoder_ctx->input_format == V4L2_PIX_FMT_H264)
-					video_stream->h264_process = 1; //we need to process NALU marker
-			}
+/*
+ * get the current segment duration
+ * args:
+ *   encoder_ctx - pointer to encoder context
+ *
+ * asserts:
+ *   encoder_ctx is not null
+ *   encoder_ctx->enc_video_ctx is not null
+ *
+ * returns: segment duration in ns
+ */
+int64_t encoder_muxer_get_segment_duration(encoder_context_t *encoder_ctx)
+{
+	/*assertions*/
+	assert(encoder_ctx != NULL);
+	assert(encoder_ctx->enc_video_ctx != NULL);
 
-			/*add audio stream*/
-			if(encoder_ctx->enc_audio_ctx != NULL &&
-				encoder_ctx->audio_channels > 0)
-			{
-				encoder_codec_data_t *audio_codec_data = (encoder_codec_data_t *) encoder_ctx->enc_audio_ctx->codec_data;
-				if(audio_codec_data)
-				{
-					mkv_ctx->audio_frame_size = audio_codec_data->codec_context->frame_size;
+	int64_t duration = 0;
 
-					/*sample size - only used for PCM*/
-					int32_t a_bits = encoder_get_audio_bits(encoder_ctx->audio_codec_ind);
-					/*bit rate (compressed formats)*/
-					int32_t b_rate = encoder_get_audio_bit_rate(encoder_ctx->audio_codec_ind);
+	__LOCK_MUTEX( __PMUTEX );
+	if(segment_start_pts >= 0)
+		duration = encoder_ctx->enc_video_ctx->pts - segment_start_pts;
+	__UNLOCK_MUTEX( __PMUTEX );
 
-					audio_stream = mkv_add_audio_stream(
-						mkv_ctx,
-						encoder_ctx->audio_channels,
-						encoder_ctx->audio_samprate,
-						a_bits,
-						b_rate,
-						audio_codec_data->codec_context->codec_id,
-						encoder_ctx->enc_audio_ctx->avi_4cc);
+	return duration;
+}
 
-					audio_stream->extra_data_size = encoder_set_audio_mkvCodecPriv(encoder_ctx);
+/*
+ * get the current segment file size
+ * args:
+ *   none
+ *
+ * asserts:
+ *   none
+ *
+ * returns: segment size in bytes
+ */
+int64_t encoder_muxer_get_segment_size()
+{
+	int64_t size = 0;
 
-					if(audio_stream->extra_data_size > 0)
-						audio_stream->extra_data = encoder_get_audio_mkvCodecPriv(encoder_ctx->audio_codec_ind);
-				}
-			}
+	__LOCK_MUTEX( __PMUTEX );
+	if(avi_ctx)
+		size = io_get_offset(avi_ctx->writer);
+	else if(mkv_ctx)
+		size = io_get_offset(mkv_ctx->writer);
+	else if(mp4_ctx)
+		size = io_get_offset(mp4_ctx->writer);
+	__UNLOCK_MUTEX( __PMUTEX );
 
-			/* write the file header */
-			mkv_write_header(mkv_ctx);
+	return size;
+}
 
-			break;
+/*
+ * set the matroska index checkpoint interval (used for new files)
+ * args:
+ *   interval - checkpoint interval in seconds (0 - disabled)
+ *
+ * asserts:
+ *   none
+ *
+ * returns: none
+ */
+void encoder_set_mkv_checkpoint(int interval)
+{
+	mkv_checkpoint = interval > 0 ? interval : 0;
+}
 
-	}
+/*
+ * rebuild the index of an unfinished (crashed) matroska file
+ * args:
+ *   filename - matroska file
+ *
+ * asserts:
+ *   filename is not null
+ *
+ * returns: error code (0 - E_OK)
+ */
+int encoder_mkv_recover(const char *filename)
+{
+	assert(filename != NULL);
+
+	return mkv_recover(filename);
 }
 
 /*
@@ -375,48 +869,39 @@ void encoder_muxer_init(encoder_context_t *encoder_ctx, const char *filename)
  */
 void encoder_muxer_close(encoder_context_t *encoder_ctx)
 {
-	switch (encoder_ctx->muxer_id)
+	/*last segment: from the segment start to the last frame pts*/
+	int64_t duration = encoder_ctx->enc_video_ctx->pts;
+	int64_t framecount = encoder_ctx->enc_video_ctx->framecount - segment_start_frame;
+	if(segment_start_frame > 0)
+		duration -= segment_start_pts;
+
+	muxer_close_file(avi_ctx, mkv_ctx, mp4_ctx, duration, framecount);
+	avi_ctx = NULL;
+	mkv_ctx = NULL;
+	mp4_ctx = NULL;
+
+	/*discard an unused next segment file*/
+	if(next_avi_ctx || next_mkv_ctx || next_mp4_ctx)
 	{
-		case ENCODER_MUX_AVI:
-			if (avi_ctx)
-			{
-				/*last frame pts*/
-				float tottime = (float) ((int64_t) (encoder_ctx->enc_video_ctx->pts) / 1000000); // convert to miliseconds
-
-				if (verbosity > 0)
-					printf("ENCODER: (avi) time = %f\n", tottime);
-
-				if (tottime > 0)
-				{
-					/*try to find the real frame rate*/
-					avi_ctx->fps = (double) (encoder_ctx->enc_video_ctx->framecount * 1000) / tottime;
-				}
-
-				if (verbosity > 0)
-					printf("ENCODER: (avi) %"PRId64" frames in %f ms [ %f fps]\n",
-						encoder_ctx->enc_video_ctx->framecount, tottime, avi_ctx->fps);
+		muxer_close_file(next_avi_ctx, next_mkv_ctx, next_mp4_ctx, 0, 0);
+		next_avi_ctx = NULL;
+		next_mkv_ctx = NULL;
+		next_mp4_ctx = NULL;
 
-				//close sound ??
-
-				avi_close(avi_ctx);
+		if(next_filename)
+		{
+			if(verbosity > 0)
+				printf("ENCODER: removing unused segment file %s\n", next_filename);
+			unlink(next_filename);
+		}
+	}
 
-				avi_destroy_context(avi_ctx);
-				avi_ctx = NULL;
-			}
-			break;
+	free(next_filename);
+	next_filename = NULL;
 
-		default:
-		case ENCODER_MUX_MKV:
-		case ENCODER_MUX_WEBM:
-			if(mkv_ctx != NULL)
-			{
-				mkv_close(mkv_ctx);
-
-				mkv_destroy_context(mkv_ctx);
-				mkv_ctx = NULL;
-			}
-			break;
-	}
+	segment_status = ENCODER_SEGMENT_NONE;
+	segment_start_pts = -1;
+	segment_start_frame = 0;
 }
 
 /*
@@ -444,7 +929,6 @@ int encoder_disk_supervisor(int treshold, const char *path)
     uint64_t total_kbytes=0;
     struct statfs buf;
 
-
     statfs(path, &buf);
 
     total_kbytes= buf.f_blocks * (buf.f_bsize/1024);
@@ -365,6 +365,7 @@ static video_codec_t listSupCodecs[] =
 		.pix_fmt      = AV_PIX_FMT_YUV420P,
 		.fps          = 0,
 		.monotonic_pts= 1,
+		.motion_roi   = 1,
 		.bit_rate     = 1500000,
 		.qmax         = 51,
 		.qmin         = 10,
@@ -406,6 +407,7 @@ static video_codec_t listSupCodecs[] =
 		.pix_fmt      = AV_PIX_FMT_YUV420P,
 		.fps          = 0,
 		.monotonic_pts= 1,
+		.motion_roi   = 1,
 		.bit_rate     = 1500000,
 		.qmax         = 51,
 		.qmin         = 10,
@@ -480,6 +482,7 @@ static video_codec_t listSupCodecs[] =
 		.pix_fmt      = AV_PIX_FMT_YUV420P,
 		.fps          = 0,
 		.monotonic_pts= 1,
+		.motion_roi   = 1,
 		.bit_rate     = 600000,
 		.qmax         = 51,
 		.qmin         = 11,
@@ -43,6 +43,8 @@ __BEGIN_DECLS
 #define RENDER_NONE     (0)
 #define RENDER_SDL      (1)
 #define RENDER_SFML     (2)
+#define RENDER_NULL     (3) /*no display - counts frames and render path cost*/
+#define RENDER_SHM      (4) /*no display - publishes frames to shared memory*/
 
 #define EV_QUIT      (0)
 #define EV_KEY_UP    (1)
@@ -74,6 +76,21 @@ __BEGIN_DECLS
 #define REND_OSD_VUMETER_MONO   (1<<0)
 #define REND_OSD_VUMETER_STEREO (1<<1)
 #define REND_OSD_CROSSHAIR      (1<<2)
+#define REND_OSD_HISTOGRAM      (1<<3)
+#define REND_OSD_WAVEFORM       (1<<4)
+#define REND_OSD_FOCUS_PEAK     (1<<5)
+
+/*image analysis (REND_OSD_HISTOGRAM | REND_OSD_WAVEFORM | REND_OSD_FOCUS_PEAK)*/
+#define RENDER_WAVEFORM_COLUMNS (128)
+#define RENDER_WAVEFORM_LEVELS  (64)
+
+/*shared memory render (RENDER_SHM)*/
+#define RENDER_SHM_DEFAULT_NAME "/guvcview-render"
+#define RENDER_SHM_MAGIC        (0x4D485347) /*GSHM*/
+#define RENDER_SHM_VERSION      (1)
+#define RENDER_SHM_SLOTS        (3)
+/*same value as V4L2_PIX_FMT_YUV420 (v4l2_fourcc('Y','U','1','2'))*/
+#define RENDER_SHM_FORMAT_YU12  (0x32315559)
 
 typedef int (*render_event_callback)(void *data);
 
@@ -84,6 +101,71 @@ typedef struct _render_events_t
 	void *data;
 
 } render_events_t;
+
+/*
+ * render path statistics (all times in nanoseconds)
+ */
+typedef struct _render_stats_t
+{
+	uint64_t frames;         /*number of rendered frames*/
+	uint64_t skipped;        /*frames not displayed (preview fps limit)*/
+	uint64_t fx_time;        /*accumulated time spent in render_frame_fx*/
+	uint64_t osd_time;       /*accumulated time spent in render_frame_osd*/
+	uint64_t render_time;    /*accumulated time spent in render_frame*/
+	uint64_t max_frame_time; /*worst fx + osd + render time for a single frame*/
+} render_stats_t;
+
+/*
+ * live image analysis results (computed on a subsampled luma grid)
+ */
+typedef struct _render_analysis_t
+{
+	uint32_t sequence;       /*result number (starting at 1)*/
+	uint32_t samples;        /*number of analysed luma samples*/
+	uint32_t histogram[256]; /*luma histogram*/
+	/*luma distribution per frame column (level 0 is black)*/
+	uint16_t waveform[RENDER_WAVEFORM_COLUMNS][RENDER_WAVEFORM_LEVELS];
+	uint32_t waveform_scale; /*max possible count for a waveform cell*/
+	uint32_t peak_cells;     /*number of grid cells above the focus peaking threshold*/
+} render_analysis_t;
+
+/*
+ * shared memory render layout
+ *
+ * the segment starts with a render_shm_header_t followed by
+ * num_slots yu12 frames (frame_size bytes each) at slot[i].offset
+ *
+ * each slot is protected by a seqlock, readers should:
+ *   1- read latest (acquire) and pick slot[latest]
+ *   2- read seq (acquire), retry if odd (write in progress)
+ *   3- copy the frame data and slot info
+ *   4- read seq again (after an acquire fence), retry if it changed
+ *
+ * magic is set to 0 when the render closes (e.g. resolution change),
+ * readers should then unmap and attach again.
+ */
+typedef struct _render_shm_slot_t
+{
+	uint32_t seq;          /*seqlock counter (odd while writing)*/
+	uint32_t reserved;
+	uint64_t frame_index;  /*frame number (starting at 1)*/
+	uint64_t timestamp;    /*monotonic time of publication (ns)*/
+	uint64_t offset;       /*frame data offset from the segment start*/
+} render_shm_slot_t;
+
+typedef struct _render_shm_header_t
+{
+	uint32_t magic;        /*RENDER_SHM_MAGIC (0 if closed)*/
+	uint32_t version;      /*RENDER_SHM_VERSION*/
+	uint32_t width;        /*frame width*/
+	uint32_t height;       /*frame height*/
+	uint32_t format;       /*frame format (RENDER_SHM_FORMAT_YU12)*/
+	uint32_t frame_size;   /*frame size in bytes*/
+	uint32_t num_slots;    /*number of frame slots*/
+	uint32_t latest;       /*index of the last published slot*/
+	render_shm_slot_t slot[RENDER_SHM_SLOTS];
+} render_shm_header_t;
+
 /*
  * set verbosity
  * args:
@@ -168,6 +250,60 @@ int render_get_width();
  */
 int render_get_height();
 
+/*
+ * set the shared memory object name used by RENDER_SHM
+ * args:
+ *   name - shm object name (e.g. "/guvcview-video0")
+ *          if NULL RENDER_SHM_DEFAULT_NAME is used
+ *
+ * asserts:
+ *    none
+ *
+ * returns: none
+ */
+void render_set_shm_name(const char *name);
+
+/*
+ * set the preview frame rate limit
+ *   frames are still processed (fx, osd) at the capture rate
+ *   but only uploaded to the render engine at this rate
+ * args:
+ *   fps - max preview frame rate (0 - render every frame)
+ *
+ * asserts:
+ *    none
+ *
+ * returns: none
+ */
+void render_set_preview_fps(int fps);
+
+/*
+ * get the render path statistics
+ * args:
+ *   stats - pointer to render_stats_t struct to fill
+ *
+ * asserts:
+ *   stats is not null
+ *
+ * returns: none
+ */
+void render_get_stats(render_stats_t *stats);
+
+/*
+ * get a copy of the last image analysis results
+ *   analysis only runs while one of the analysis osd flags
+ *   (REND_OSD_HISTOGRAM, REND_OSD_WAVEFORM, REND_OSD_FOCUS_PEAK) is set,
+ *   must be called from the render thread (e.g. a render event callback)
+ * args:
+ *   data - pointer to render_analysis_t struct to fill
+ *
+ * asserts:
+ *   data is not null
+ *
+ * returns: error code (0 ok, -1 no data available)
+ */
+int render_get_analysis(render_analysis_t *data);
+
 /*
  * render initialization
  * args:
@@ -180,6 +316,8 @@ int render_get_height();
  *              2- maximized
  *   win_w - window width (0 use render width)
  *   win_h - window height (0 use render height)
+ *           if the window is at least 2 times smaller than the frame
+ *           a downscaled frame is rendered
  *
  * asserts:
  *   none
@@ -35,14 +35,19 @@
 #include <unistd.h>
 #include <fcntl.h>
 #include <string.h>
+#include <limits.h>
 #include <errno.h>
 #include <assert.h>
 /* support for internationalization - i18n */
 #include <locale.h>
 #include <libintl.h>
 
+#include "gview.h"
 #include "gviewrender.h"
 #include "render.h"
+#include "render_null.h"
+#include "render_shm.h"
+#include "core_time.h"
 #include "../config.h"
 
 #if ENABLE_SDL2
@@ -61,11 +66,24 @@ static int render_api = RENDER_SDL;
 static int my_width = 0;
 static int my_height = 0;
 
+/*preview size (smaller than my_width x my_height if downscaling)*/
+static int my_preview_width = 0;
+static int my_preview_height = 0;
+
+/*preview frame rate limit*/
+static uint64_t my_preview_interval = 0; /*ns (0 - render all frames)*/
+static uint64_t my_preview_next_time = 0;
+
 static uint32_t my_osd_mask = REND_OSD_NONE;
 static uint32_t my_crosshair_color_rgb = 0x0000FF00;
 
 static float osd_vu_level[2] = {0, 0};
 
+static char my_shm_name[NAME_MAX] = RENDER_SHM_DEFAULT_NAME;
+
+static render_stats_t my_render_stats;
+static uint64_t my_frame_time = 0; /*fx + osd + render time for the current frame*/
+
 static render_events_t render_events_list[] =
 {
 	{
@@ -253,6 +271,60 @@ int render_get_height()
 	return my_height;
 }
 
+/*
+ * set the shared memory object name used by RENDER_SHM
+ * args:
+ *   name - shm object name (e.g. "/guvcview-video0")
+ *          if NULL RENDER_SHM_DEFAULT_NAME is used
+ *
+ * asserts:
+ *    none
+ *
+ * returns: none
+ */
+void render_set_shm_name(const char *name)
+{
+	if(name == NULL)
+		name = RENDER_SHM_DEFAULT_NAME;
+
+	strncpy(my_shm_name, name, NAME_MAX - 1);
+	my_shm_name[NAME_MAX - 1] = '\0';
+}
+
+/*
+ * set the preview frame rate limit
+ * args:
+ *   fps - max preview frame rate (0 - render every frame)
+ *
+ * asserts:
+ *    none
+ *
+ * returns: none
+ */
+void render_set_preview_fps(int fps)
+{
+	my_preview_interval = (fps > 0) ? (uint64_t) (NSEC_PER_SEC / fps) : 0;
+	my_preview_next_time = 0;
+}
+
+/*
+ * get the render path statistics
+ * args:
+ *   stats - pointer to render_stats_t struct to fill
+ *
+ * asserts:
+ *   stats is not null
+ *
+ * returns: none
+ */
+void render_get_stats(render_stats_t *stats)
+{
+	/*asserts*/
+	assert(stats != NULL);
+
+	memcpy(stats, &my_render_stats, sizeof(render_stats_t));
+}
+
 /*
  * render initialization
  * args:
@@ -280,20 +352,43 @@ int render_init(int render, int width, int height, int flags, int win_w, int win
 	my_width = width;
 	my_height = height;
 
+	memset(&my_render_stats, 0, sizeof(render_stats_t));
+	my_frame_time = 0;
+	my_preview_next_time = 0;
+
+	/*
+	 * if the window is smaller than the frame
+	 * upload a downscaled frame instead of the full one
+	 */
+	my_preview_width = my_width;
+	my_preview_height = my_height;
+
+	if(render_api != RENDER_NONE)
+		render_scale_init(my_width, my_height, win_w, win_h,
+			&my_preview_width, &my_preview_height);
+
 	switch(render_api)
 	{
 		case RENDER_NONE:
 			break;
 
+		case RENDER_NULL:
+			ret = init_render_null(my_preview_width, my_preview_height);
+			break;
+
+		case RENDER_SHM:
+			ret = init_render_shm(my_preview_width, my_preview_height, my_shm_name);
+			break;
+
 		#if ENABLE_SFML
 		case RENDER_SFML:
-			ret = init_render_sfml(my_width, my_height, flags, win_w, win_h);
+			ret = init_render_sfml(my_preview_width, my_preview_height, flags, win_w, win_h);
 			break;
 		#endif
 
 		#if ENABLE_SDL2
 		case RENDER_SDL:
-			ret = init_render_sdl2(my_width, my_height, flags, win_w, win_h);
+			ret = init_render_sdl2(my_preview_width, my_preview_height, flags, win_w, win_h);
 			break;
 		#endif
 
@@ -302,8 +397,11 @@ int render_init(int render, int width, int height, int flags, int win_w, int win
 			break;
 	}
 
-	if(ret)
+	if(ret || render_api == RENDER_NONE)
+	{
 		render_api = RENDER_NONE;
+		render_scale_close();
+	}
 
 	return ret;
 }
@@ -324,7 +422,13 @@ void render_frame_fx(uint8_t *frame, uint32_t mask)
 	/*asserts*/
 	assert(frame != NULL);
 
+	uint64_t t0 = ns_time_monotonic();
+
 	render_fx_apply(frame, my_width, my_height, mask);
+
+	uint64_t delta = ns_time_monotonic() - t0;
+	my_render_stats.fx_time += delta;
+	my_frame_time += delta;
 }
 
 /*
@@ -339,9 +443,14 @@ void render_frame_fx(uint8_t *frame, uint32_t mask)
  */
 void render_frame_osd(uint8_t *frame)
 {
+	uint64_t t0 = ns_time_monotonic();
+
 	float vu_level[2];
 	render_get_vu_level(vu_level);
 
+	/*image analysis (must run first, on the frame without osd)*/
+	render_osd_analysis(frame, my_width, my_height, render_get_osd_mask());
+
 	/*osd vu meter*/
 	if(((render_get_osd_mask() &
 		(REND_OSD_VUMETER_MONO | REND_OSD_VUMETER_STEREO))) != 0)
@@ -349,6 +458,41 @@ void render_frame_osd(uint8_t *frame)
 	/*osd crosshair*/
 	if(((render_get_osd_mask() & REND_OSD_CROSSHAIR)) != 0)
 		render_osd_crosshair(frame, my_width, my_height);
+
+	uint64_t delta = ns_time_monotonic() - t0;
+	my_render_stats.osd_time += delta;
+	my_frame_time += delta;
+}
+
+/*
+ * dispatch the render events (for skipped frames)
+ * args:
+ *   none
+ *
+ * asserts:
+ *   none
+ *
+ * returns: none
+ */
+static void render_dispatch_events()
+{
+	switch(render_api)
+	{
+		#if ENABLE_SFML
+		case RENDER_SFML:
+			render_sfml_dispatch_events();
+			break;
+		#endif
+
+		#if ENABLE_SDL2
+		case RENDER_SDL:
+			render_sdl2_dispatch_events();
+			break;
+		#endif
+
+		default:
+			break;
+	}
 }
 
 /*
@@ -366,22 +510,53 @@ int render_frame(uint8_t *frame)
 	/*asserts*/
 	assert(frame != NULL);
 
+	uint64_t t0 = ns_time_monotonic();
+
+	/*preview frame rate limit: skip the frame but keep handling events*/
+	if(my_preview_interval > 0 && render_api != RENDER_NONE)
+	{
+		/*allow a 1/4 interval jitter on the capture timing*/
+		if(t0 + my_preview_interval / 4 < my_preview_next_time)
+		{
+			render_dispatch_events();
+			my_render_stats.skipped++;
+			my_frame_time = 0;
+			return 0;
+		}
+
+		my_preview_next_time += my_preview_interval;
+		if(my_preview_next_time < t0)
+			my_preview_next_time = t0 + my_preview_interval;
+	}
+
 	int ret = 0;
 	switch(render_api)
 	{
 		case RENDER_NONE:
 			break;
 
+		case RENDER_NULL:
+			ret = render_null_frame(render_scale_frame(frame),
+				my_preview_width, my_preview_height);
+			break;
+
+		case RENDER_SHM:
+			ret = render_shm_frame(render_scale_frame(frame),
+				my_preview_width, my_preview_height);
+			break;
+
 		#if ENABLE_SFML
 		case RENDER_SFML:
-			ret = render_sfml_frame(frame, my_width, my_height);
+			ret = render_sfml_frame(render_scale_frame(frame),
+				my_preview_width, my_preview_height);
 			render_sfml_dispatch_events();
 			break;
 		#endif
 
 		#if ENABLE_SDL2
 		case RENDER_SDL:
-			ret = render_sdl2_frame(frame, my_width, my_height);
+			ret = render_sdl2_frame(render_scale_frame(frame),
+				my_preview_width, my_preview_height);
 			render_sdl2_dispatch_events();
 			break;
 		#endif
@@ -390,6 +565,15 @@ int render_frame(uint8_t *frame)
 			break;
 	}
 
+	uint64_t delta = ns_time_monotonic() - t0;
+	my_render_stats.render_time += delta;
+	my_frame_time += delta;
+
+	my_render_stats.frames++;
+	if(my_frame_time > my_render_stats.max_frame_time)
+		my_render_stats.max_frame_time = my_frame_time;
+	my_frame_time = 0;
+
 	return ret;
 }
 
@@ -444,6 +628,14 @@ void render_close()
 		case RENDER_NONE:
 			break;
 
+		case RENDER_NULL:
+			render_null_clean();
+			break;
+
+		case RENDER_SHM:
+			render_shm_clean();
+			break;
+
 		#if ENABLE_SFML
 		case RENDER_SFML:
 			render_sfml_clean();
@@ -463,8 +655,18 @@ void render_close()
 	/*clean fx data*/
 	render_clean_fx();
 
+	/*clean the preview scaler*/
+	render_scale_close();
+
+	/*clean the osd sprites*/
+	render_osd_vu_meter_clean();
+	render_osd_crosshair_clean();
+	render_osd_analysis_clean();
+
 	my_width = 0;
 	my_height = 0;
+	my_preview_width = 0;
+	my_preview_height = 0;
 }
 
 /*
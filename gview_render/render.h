@@ -26,6 +26,34 @@
 
 #ifndef RENDER_H
 #define RENDER_H
+
+#include <inttypes.h>
+
+typedef struct _yuv_color_t
+{
+	uint8_t y;
+	uint8_t u;
+	uint8_t v;
+} yuv_color_t;
+
+/*
+ * cached OSD element: yu12 planes with alpha masks
+ * blended into the frame rectangle at (x, y)
+ */
+typedef struct _osd_sprite_t
+{
+	int x;              /*top left x coordinate in the frame (even)*/
+	int y;              /*top left y coordinate in the frame (even)*/
+	int width;          /*sprite width (even)*/
+	int height;         /*sprite height (even)*/
+	uint8_t *data;      /*sprite buffer (planes and masks)*/
+	uint8_t *y_plane;
+	uint8_t *u_plane;
+	uint8_t *v_plane;
+	uint8_t *alpha;     /*luma alpha mask (width x height)*/
+	uint8_t *alpha_uv;  /*chroma alpha mask (width/2 x height/2)*/
+	uint64_t key;       /*state the sprite was drawn for*/
+} osd_sprite_t;
 /*
  * render a vu meter
  * args:
@@ -41,6 +69,18 @@
  */
 void render_osd_vu_meter(uint8_t *frame, int width, int height, float vu_level[2]);
 
+/*
+ * free the vu meter osd sprite
+ * args:
+ *   none
+ *
+ * asserts:
+ *   none
+ *
+ * returns: none
+ */
+void render_osd_vu_meter_clean();
+
 /*
  * render a crosshair
  * args:
@@ -55,6 +95,163 @@ void render_osd_vu_meter(uint8_t *frame, int width, int height, float vu_level[2
  */
 void render_osd_crosshair(uint8_t *frame, int width, int height);
 
+/*
+ * free the crosshair osd sprite
+ * args:
+ *   none
+ *
+ * asserts:
+ *   none
+ *
+ * returns: none
+ */
+void render_osd_crosshair_clean();
+
+/*
+ * render the image analysis osd (histogram, waveform and focus peaking)
+ * args:
+ *   frame - pointer to yu12 frame data
+ *   width - frame width
+ *   height - frame height
+ *   mask - osd mask
+ *
+ * asserts:
+ *   none
+ *
+ * returns: none
+ */
+void render_osd_analysis(uint8_t *frame, int width, int height, uint32_t mask);
+
+/*
+ * free the image analysis osd sprites
+ * args:
+ *   none
+ *
+ * asserts:
+ *   none
+ *
+ * returns: none
+ */
+void render_osd_analysis_clean();
+
+/*
+ * submit a frame for analysis (never blocks)
+ * args:
+ *   frame - pointer to yu12 frame (before any osd)
+ *   width - frame width
+ *   height - frame height
+ *
+ * asserts:
+ *   frame is not null
+ *
+ * returns: 0 if the frame was submitted, 1 if dropped (worker busy), < 0 on error
+ */
+int render_analysis_submit(uint8_t *frame, int width, int height);
+
+/*
+ * get the last analysis results
+ *   must be called from the thread that submits the frames,
+ *   the worker only writes the other result buffer, so results
+ *   stay valid until render_analysis_submit is called twice
+ * args:
+ *   mask - pointer to store the focus peaking mask (can be null)
+ *   mask_w - pointer to store the mask width (can be null)
+ *   mask_h - pointer to store the mask height (can be null)
+ *   step - pointer to store the mask step in frame pixels (can be null)
+ *
+ * asserts:
+ *   none
+ *
+ * returns: pointer to results (null if none available)
+ */
+render_analysis_t *render_analysis_get_results(uint8_t **mask, int *mask_w, int *mask_h, int *step);
+
+/*
+ * stop the analysis worker and free its data
+ * args:
+ *   none
+ *
+ * asserts:
+ *   none
+ *
+ * returns: none
+ */
+void render_analysis_close();
+
+/*
+ * (re)allocate a sprite
+ * args:
+ *   sprite - pointer to sprite
+ *   x - sprite top left x coordinate in the frame
+ *   y - sprite top left y coordinate in the frame
+ *   width - sprite width
+ *   height - sprite height
+ *
+ * asserts:
+ *   sprite is not null
+ *
+ * returns: 1 if the sprite buffers were reallocated (must be redrawn), 0 otherwise
+ */
+int render_osd_sprite_alloc(osd_sprite_t *sprite, int x, int y, int width, int height);
+
+/*
+ * clear a sprite (make it fully transparent)
+ * args:
+ *   sprite - pointer to sprite
+ *
+ * asserts:
+ *   sprite is not null
+ *
+ * returns: none
+ */
+void render_osd_sprite_clear(osd_sprite_t *sprite);
+
+/*
+ * draw an opaque box in a sprite
+ * args:
+ *   sprite - pointer to sprite
+ *   x - box top left x coordinate (in sprite)
+ *   y - box top left y coordinate (in sprite)
+ *   width - box width
+ *   height - box height
+ *   color - box color
+ *
+ * asserts:
+ *   sprite is not null
+ *   color is not null
+ *
+ * returns: none
+ */
+void render_osd_sprite_box(osd_sprite_t *sprite, int x, int y, int width, int height, yuv_color_t *color);
+
+/*
+ * blend a sprite into a yu12 frame (only the sprite rectangle is touched)
+ * args:
+ *   sprite - pointer to sprite
+ *   frame - pointer to yu12 frame data
+ *   width - frame width
+ *   height - frame height
+ *
+ * asserts:
+ *   sprite is not null
+ *   frame is not null
+ *
+ * returns: none
+ */
+void render_osd_sprite_blit(osd_sprite_t *sprite, uint8_t *frame, int width, int height);
+
+/*
+ * free sprite buffers
+ * args:
+ *   sprite - pointer to sprite
+ *
+ * asserts:
+ *   sprite is not null
+ *
+ * returns: none
+ */
+void render_osd_sprite_free(osd_sprite_t *sprite);
+
 /*
  * Apply fx filters
  * args:
@@ -70,4 +267,46 @@ void render_osd_crosshair(uint8_t *frame, int width, int height);
  */
 void render_fx_apply(uint8_t *frame, int width, int height, uint32_t mask);
 
+/*
+ * init the preview scaler
+ * args:
+ *   width - source frame width
+ *   height - source frame height
+ *   win_w - target (window) width (0 - no scaling)
+ *   win_h - target (window) height (0 - no scaling)
+ *   scaled_w - pointer to store the scaled frame width
+ *   scaled_h - pointer to store the scaled frame height
+ *
+ * asserts:
+ *   scaled_w is not null
+ *   scaled_h is not null
+ *
+ * returns: 1 if scaling is active, 0 otherwise
+ */
+int render_scale_init(int width, int height, int win_w, int win_h, int *scaled_w, int *scaled_h);
+
+/*
+ * scale a frame to the preview size
+ * args:
+ *   frame - pointer to source frame (yu12)
+ *
+ * asserts:
+ *   frame is not null
+ *
+ * returns: pointer to the scaled frame (or frame if scaling is not active)
+ */
+uint8_t *render_scale_frame(uint8_t *frame);
+
+/*
+ * close the preview scaler
+ * args:
+ *   none
+ *
+ * asserts:
+ *   none
+ *
+ * returns: none
+ */
+void render_scale_close();
+
 #endif
\ No newline at end of file
@@ -0,0 +1,492 @@
+/*******************************************************************************#
+#           guvcview              http://guvcview.sourceforge.net               #
+#                                                                               #
+#           Paulo Assis <pj.assis@gmail.com>                                    #
+#                                                                               #
+# This program is free software; you can redistribute it and/or modify          #
+# it under the terms of the GNU General Public License as published by          #
+# the Free Software Foundation; either version 2 of the License, or             #
+# (at your option) any later version.                                           #
+#                                                                               #
+# This program is distributed in the hope that it will be useful,               #
+# but WITHOUT ANY WARRANTY; without even the implied warranty of                #
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the                 #
+# GNU General Public License for more details.                                  #
+#                                                                               #
+# You should have received a copy of the GNU General Public License             #
+# along with this program; if not, write to the Free Software                   #
+# Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA     #
+#                                                                               #
+********************************************************************************/
+
+/*******************************************************************************#
+#                                                                               #
+#  Render library - live image analysis                                         #
+#                                                                               #
+#  luma histogram, waveform and focus peaking mask computed on a subsampled     #
+#  luma grid by a worker thread; the render thread only copies the grid and    #
+#  never waits for the worker (frames are dropped while it is busy)            #
+#                                                                               #
+********************************************************************************/
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <inttypes.h>
+#include <string.h>
+#include <errno.h>
+#include <semaphore.h>
+#include <assert.h>
+
+#ifdef __SSE2__
+	#include <emmintrin.h>
+#endif
+
+#include "gview.h"
+#include "gviewrender.h"
+#include "render.h"
+#include "../config.h"
+
+/*max analysis grid width (the grid step is adjusted to it)*/
+#define ANALYSIS_MAX_GRID_W (960)
+
+/*edge magnitude threshold for focus peaking*/
+#define FOCUS_PEAK_THRESHOLD (40)
+
+extern int verbosity;
+
+static int analysis_width = 0;  /*frame width*/
+static int analysis_height = 0; /*frame height*/
+static int grid_step = 1;       /*grid subsample step (power of 2)*/
+static int grid_w = 0;
+static int grid_h = 0;
+
+static uint8_t *grid = NULL;   /*subsampled luma (render thread -> worker)*/
+
+/*double buffered results (worker -> render thread)*/
+static render_analysis_t results[2];
+static uint8_t *peak_mask[2] = {NULL, NULL};
+static int front = 0; /*index of the last published result*/
+
+static __THREAD_TYPE analysis_thread;
+static sem_t analysis_sem;
+static int analysis_running = 0;
+static int analysis_busy = 0; /*worker is processing the grid*/
+static int analysis_quit = 0;
+static uint32_t analysis_sequence = 0;
+static uint64_t analysis_dropped = 0;
+
+/*
+ * copy a luma row subsampled by 2
+ * args:
+ *   dst - destination row
+ *   src - source row
+ *   width - destination width
+ *
+ * asserts:
+ *   none
+ *
+ * returns: none
+ */
+static void subsample_row_2(uint8_t *dst, const uint8_t *src, int width)
+{
+	int x = 0;
+#ifdef __SSE2__
+	const __m128i mask = _mm_set1_epi16(0x00FF);
+	for(; x + 16 <= width; x += 16)
+	{
+		__m128i a = _mm_and_si128(_mm_loadu_si128((const __m128i *) (src + 2 * x)), mask);
+		__m128i b = _mm_and_si128(_mm_loadu_si128((const __m128i *) (src + 2 * x + 16)), mask);
+		_mm_storeu_si128((__m128i *) (dst + x), _mm_packus_epi16(a, b));
+	}
+#endif
+	for(; x < width; x++)
+		dst[x] = src[2 * x];
+}
+
+/*
+ * extract the subsampled luma grid from a yu12 frame
+ *   (same direct luma plane access as focus_extract_Y in v4l2core)
+ * args:
+ *   frame - pointer to yu12 frame
+ *
+ * asserts:
+ *   none
+ *
+ * returns: none
+ */
+static void extract_grid(uint8_t *frame)
+{
+	int y = 0;
+	for(y = 0; y < grid_h; y++)
+	{
+		const uint8_t *src = frame + (y * grid_step * analysis_width);
+		uint8_t *dst = grid + (y * grid_w);
+
+		switch(grid_step)
+		{
+			case 1:
+				memcpy(dst, src, grid_w);
+				break;
+			case 2:
+				subsample_row_2(dst, src, grid_w);
+				break;
+			default:
+			{
+				int x = 0;
+				for(x = 0; x < grid_w; x++)
+					dst[x] = src[x * grid_step];
+				break;
+			}
+		}
+	}
+}
+
+/*
+ * compute the focus peaking mask (central difference edge magnitude)
+ * args:
+ *   mask - pointer to mask (grid_w x grid_h) - 0xFF for edges
+ *
+ * asserts:
+ *   none
+ *
+ * returns: number of edge cells
+ */
+static int compute_peak_mask(uint8_t *mask)
+{
+	int count = 0;
+
+	memset(mask, 0, grid_w * grid_h);
+
+	int y = 0;
+	for(y = 1; y < grid_h - 1; y++)
+	{
+		const uint8_t *up = grid + ((y - 1) * grid_w);
+		const uint8_t *cur = grid + (y * grid_w);
+		const uint8_t *down = grid + ((y + 1) * grid_w);
+		uint8_t *m = mask + (y * grid_w);
+
+		int x = 1;
+#ifdef __SSE2__
+		const __m128i th = _mm_set1_epi8(FOCUS_PEAK_THRESHOLD);
+		const __m128i zero = _mm_setzero_si128();
+		for(; x + 16 <= grid_w - 1; x += 16)
+		{
+			__m128i l = _mm_loadu_si128((const __m128i *) (cur + x - 1));
+			__m128i r = _mm_loadu_si128((const __m128i *) (cur + x + 1));
+			__m128i u = _mm_loadu_si128((const __m128i *) (up + x));
+			__m128i d = _mm_loadu_si128((const __m128i *) (down + x));
+
+			/*|r - l| + |d - u| (saturated)*/
+			__m128i gx = _mm_or_si128(_mm_subs_epu8(r, l), _mm_subs_epu8(l, r));
+			__m128i gy = _mm_or_si128(_mm_subs_epu8(d, u), _mm_subs_epu8(u, d));
+			__m128i mag = _mm_adds_epu8(gx, gy);
+
+			/*mag > threshold*/
+			__m128i edge = _mm_xor_si128(
+				_mm_cmpeq_epi8(_mm_subs_epu8(mag, th), zero),
+				_mm_set1_epi8((char) 0xFF));
+
+			_mm_storeu_si128((__m128i *) (m + x), edge);
+			count += __builtin_popcount(_mm_movemask_epi8(edge));
+		}
+#endif
+		for(; x < grid_w - 1; x++)
+		{
+			int mag = abs(cur[x + 1] - cur[x - 1]) + abs(down[x] - up[x]);
+			if(mag > FOCUS_PEAK_THRESHOLD)
+			{
+				m[x] = 0xFF;
+				count++;
+			}
+		}
+	}
+
+	return count;
+}
+
+/*
+ * compute the histogram and waveform of the grid
+ * args:
+ *   res - pointer to results
+ *
+ * asserts:
+ *   none
+ *
+ * returns: none
+ */
+static void compute_levels(render_analysis_t *res)
+{
+	/*4 partial histograms avoid stalls on repeated values*/
+	uint32_t hist[4][256];
+	memset(hist, 0, sizeof(hist));
+	memset(res->waveform, 0, sizeof(res->waveform));
+
+	/*grid column -> waveform column*/
+	int x = 0;
+	int y = 0;
+	for(y = 0; y < grid_h; y++)
+	{
+		const uint8_t *p = grid + (y * grid_w);
+
+		for(x = 0; x + 4 <= grid_w; x += 4)
+		{
+			hist[0][p[x]]++;
+			hist[1][p[x + 1]]++;
+			hist[2][p[x + 2]]++;
+			hist[3][p[x + 3]]++;
+		}
+		for(; x < grid_w; x++)
+			hist[0][p[x]]++;
+
+		for(x = 0; x < grid_w; x++)
+		{
+			int col = (x * RENDER_WAVEFORM_COLUMNS) / grid_w;
+			int level = (p[x] * RENDER_WAVEFORM_LEVELS) >> 8;
+			if(res->waveform[col][level] < UINT16_MAX)
+				res->waveform[col][level]++;
+		}
+	}
+
+	int i = 0;
+	for(i = 0; i < 256; i++)
+		res->histogram[i] = hist[0][i] + hist[1][i] + hist[2][i] + hist[3][i];
+
+	res->samples = grid_w * grid_h;
+	res->waveform_scale = grid_h * ((grid_w + RENDER_WAVEFORM_COLUMNS - 1) / RENDER_WAVEFORM_COLUMNS);
+}
+
+/*
+ * analysis worker thread loop
+ * args:
+ *   data - pointer to user data (not used)
+ *
+ * asserts:
+ *   none
+ *
+ * returns: pointer to return code
+ */
+static void *analysis_thread_loop(void *data)
+{
+	while(1)
+	{
+		sem_wait(&analysis_sem);
+
+		if(__atomic_load_n(&analysis_quit, __ATOMIC_ACQUIRE))
+			break;
+
+		/*the back buffer is never read by the render thread*/
+		int back = front ^ 1;
+		render_analysis_t *res = &results[back];
+
+		compute_levels(res);
+		res->peak_cells = compute_peak_mask(peak_mask[back]);
+		res->sequence = ++analysis_sequence;
+
+		__atomic_store_n(&front, back, __ATOMIC_RELEASE);
+		__atomic_store_n(&analysis_busy, 0, __ATOMIC_RELEASE);
+	}
+
+	return ((void *) 0);
+}
+
+/*
+ * init the analysis engine for a frame size
+ * args:
+ *   width - frame width
+ *   height - frame height
+ *
+ * asserts:
+ *   none
+ *
+ * returns: error code (0 ok)
+ */
+static int analysis_init(int width, int height)
+{
+	render_analysis_close();
+
+	analysis_width = width;
+	analysis_height = height;
+
+	grid_step = 1;
+	while(width / grid_step > ANALYSIS_MAX_GRID_W)
+		grid_step *= 2;
+
+	grid_w = width / grid_step;
+	grid_h = height / grid_step;
+
+	grid = calloc(grid_w * grid_h, sizeof(uint8_t));
+	peak_mask[0] = calloc(grid_w * grid_h, sizeof(uint8_t));
+	peak_mask[1] = calloc(grid_w * grid_h, sizeof(uint8_t));
+	if(grid == NULL || peak_mask[0] == NULL || peak_mask[1] == NULL)
+	{
+		fprintf(stderr, "RENDER: FATAL memory allocation failure (analysis_init): %s\n", strerror(errno));
+		exit(-1);
+	}
+
+	memset(results, 0, sizeof(results));
+	front = 0;
+	analysis_busy = 0;
+	analysis_quit = 0;
+	analysis_sequence = 0;
+	analysis_dropped = 0;
+
+	sem_init(&analysis_sem, 0, 0);
+
+	if(__THREAD_CREATE(&analysis_thread, analysis_thread_loop, NULL))
+	{
+		fprintf(stderr, "RENDER: couldn't create the analysis thread\n");
+		sem_destroy(&analysis_sem);
+		render_analysis_close();
+		return -1;
+	}
+
+	analysis_running = 1;
+
+	if(verbosity > 0)
+		printf("RENDER: image analysis grid %ix%i (step %i)\n", grid_w, grid_h, grid_step);
+
+	return 0;
+}
+
+/*
+ * submit a frame for analysis (never blocks)
+ * args:
+ *   frame - pointer to yu12 frame (before any osd)
+ *   width - frame width
+ *   height - frame height
+ *
+ * asserts:
+ *   frame is not null
+ *
+ * returns: 0 if the frame was submitted, 1 if dropped (worker busy), < 0 on error
+ */
+int render_analysis_submit(uint8_t *frame, int width, int height)
+{
+	/*asserts*/
+	assert(frame != NULL);
+
+	if(!analysis_running || width != analysis_width || height != analysis_height)
+	{
+		if(analysis_init(width, height) != 0)
+			return -1;
+	}
+
+	if(__atomic_load_n(&analysis_busy, __ATOMIC_ACQUIRE))
+	{
+		analysis_dropped++;
+		return 1;
+	}
+
+	/*worker is idle: the grid is ours*/
+	extract_grid(frame);
+
+	__atomic_store_n(&analysis_busy, 1, __ATOMIC_RELEASE);
+	sem_post(&analysis_sem);
+
+	return 0;
+}
+
+/*
+ * get the last analysis results
+ *   must be called from the thread that submits the frames,
+ *   the worker only writes the other result buffer, so results
+ *   stay valid until render_analysis_submit is called twice
+ * args:
+ *   mask - pointer to store the focus peaking mask (can be null)
+ *   mask_w - pointer to store the mask width (can be null)
+ *   mask_h - pointer to store the mask height (can be null)
+ *   step - pointer to store the mask step in frame pixels (can be null)
+ *
+ * asserts:
+ *   none
+ *
+ * returns: pointer to results (null if none available)
+ */
+render_analysis_t *render_analysis_get_results(uint8_t **mask, int *mask_w, int *mask_h, int *step)
+{
+	if(!analysis_running)
+		return NULL;
+
+	int index = __atomic_load_n(&front, __ATOMIC_ACQUIRE);
+
+	if(results[index].sequence == 0)
+		return NULL;
+
+	if(mask)
+		*mask = peak_mask[index];
+	if(mask_w)
+		*mask_w = grid_w;
+	if(mask_h)
+		*mask_h = grid_h;
+	if(step)
+		*step = grid_step;
+
+	return &results[index];
+}
+
+/*
+ * get a copy of the last image analysis results
+ *   (histogram and waveform, see REND_OSD_HISTOGRAM ...)
+ * args:
+ *   data - pointer to render_analysis_t struct to fill
+ *
+ * asserts:
+ *   data is not null
+ *
+ * returns: error code (0 ok, -1 no data available)
+ */
+int render_get_analysis(render_analysis_t *data)
+{
+	/*asserts*/
+	assert(data != NULL);
+
+	render_analysis_t *res = render_analysis_get_results(NULL, NULL, NULL, NULL);
+	if(res == NULL)
+		return -1;
+
+	memcpy(data, res, sizeof(render_analysis_t));
+	return 0;
+}
+
+/*
+ * stop the analysis worker and free its data
+ * args:
+ *   none
+ *
+ * asserts:
+ *   none
+ *
+ * returns: none
+ */
+void render_analysis_close()
+{
+	if(analysis_running)
+	{
+		__atomic_store_n(&analysis_quit, 1, __ATOMIC_RELEASE);
+		sem_post(&analysis_sem);
+		__THREAD_JOIN(analysis_thread);
+		sem_destroy(&analysis_sem);
+		analysis_running = 0;
+
+		if(verbosity > 0)
+			printf("RENDER: image analysis - %u frames analysed (%" PRIu64 " dropped)\n",
+				analysis_sequence, analysis_dropped);
+	}
+
+	if(grid)
+		free(grid);
+	grid = NULL;
+
+	int i = 0;
+	for(i = 0; i < 2; i++)
+	{
+		if(peak_mask[i])
+			free(peak_mask[i]);
+		peak_mask[i] = NULL;
+	}
+
+	analysis_width = 0;
+	analysis_height = 0;
+	grid_w = 0;
+	grid_h = 0;
+}
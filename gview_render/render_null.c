@@ -0,0 +1,116 @@
+/*******************************************************************************#
+#           guvcview              http://guvcview.sourceforge.net               #
+#                                                                               #
+#           Paulo Assis <pj.assis@gmail.com>                                    #
+#                                                                               #
+# This program is free software; you can redistribute it and/or modify          #
+# it under the terms of the GNU General Public License as published by          #
+# the Free Software Foundation; either version 2 of the License, or             #
+# (at your option) any later version.                                           #
+#                                                                               #
+# This program is distributed in the hope that it will be useful,               #
+# but WITHOUT ANY WARRANTY; without even the implied warranty of                #
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the                 #
+# GNU General Public License for more details.                                  #
+#                                                                               #
+# You should have received a copy of the GNU General Public License             #
+# along with this program; if not, write to the Free Software                   #
+# Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA     #
+#                                                                               #
+********************************************************************************/
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <inttypes.h>
+#include <assert.h>
+
+#include "gview.h"
+#include "gviewrender.h"
+#include "render.h"
+#include "render_null.h"
+#include "../config.h"
+
+extern int verbosity;
+
+static int null_width = 0;
+static int null_height = 0;
+static uint64_t null_frames = 0;
+
+/*
+ * init null render
+ * args:
+ *    width - frame width
+ *    height - frame height
+ *
+ * asserts:
+ *    none
+ *
+ * returns: error code (0 ok)
+ */
+int init_render_null(int width, int height)
+{
+	if(verbosity > 0)
+		printf("RENDER: Initializing null render (%ix%i)\n", width, height);
+
+	null_width = width;
+	null_height = height;
+	null_frames = 0;
+
+	return 0;
+}
+
+/*
+ * render a frame (just count it)
+ * args:
+ *   frame - pointer to frame data (yu12 format)
+ *   width - frame width
+ *   height - frame height
+ *
+ * asserts:
+ *   frame is not null
+ *
+ * returns: error code
+ */
+int render_null_frame(uint8_t *frame, int width, int height)
+{
+	/*asserts*/
+	assert(frame != NULL);
+
+	null_frames++;
+
+	return 0;
+}
+
+/*
+ * clean null render data (prints the render path statistics)
+ * args:
+ *   none
+ *
+ * asserts:
+ *   none
+ *
+ * returns: none
+ */
+void render_null_clean()
+{
+	render_stats_t stats;
+	render_get_stats(&stats);
+
+	printf("RENDER: (null) %ix%i - %" PRIu64 " frames rendered (%" PRIu64 " skipped)\n",
+		null_width, null_height, null_frames, stats.skipped);
+
+	if(stats.frames > 0)
+	{
+		/*fx and osd run for every frame, render only for the displayed ones*/
+		double n = (double) (stats.frames + stats.skipped) * 1000.0; /*ns to us*/
+		printf("RENDER: (null) average per frame: fx %.1f us; osd %.1f us; render %.1f us (max total %.1f us)\n",
+			(double) stats.fx_time / n,
+			(double) stats.osd_time / n,
+			(double) stats.render_time / ((double) stats.frames * 1000.0),
+			(double) stats.max_frame_time / 1000.0);
+	}
+
+	null_width = 0;
+	null_height = 0;
+	null_frames = 0;
+}
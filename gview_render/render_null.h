@@ -0,0 +1,64 @@
+/*******************************************************************************#
+#           guvcview              http://guvcview.sourceforge.net               #
+#                                                                               #
+#           Paulo Assis <pj.assis@gmail.com>                                    #
+#                                                                               #
+# This program is free software; you can redistribute it and/or modify          #
+# it under the terms of the GNU General Public License as published by          #
+# the Free Software Foundation; either version 2 of the License, or             #
+# (at your option) any later version.                                           #
+#                                                                               #
+# This program is distributed in the hope that it will be useful,               #
+# but WITHOUT ANY WARRANTY; without even the implied warranty of                #
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the                 #
+# GNU General Public License for more details.                                  #
+#                                                                               #
+# You should have received a copy of the GNU General Public License             #
+# along with this program; if not, write to the Free Software                   #
+# Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA     #
+#                                                                               #
+********************************************************************************/
+
+#ifndef RENDER_NULL_H
+#define RENDER_NULL_H
+
+/*
+ * init null render
+ * args:
+ *    width - frame width
+ *    height - frame height
+ *
+ * asserts:
+ *    none
+ *
+ * returns: error code (0 ok)
+ */
+int init_render_null(int width, int height);
+
+/*
+ * render a frame (just count it)
+ * args:
+ *   frame - pointer to frame data (yu12 format)
+ *   width - frame width
+ *   height - frame height
+ *
+ * asserts:
+ *   frame is not null
+ *
+ * returns: error code
+ */
+int render_null_frame(uint8_t *frame, int width, int height);
+
+/*
+ * clean null render data (prints the render path statistics)
+ * args:
+ *   none
+ *
+ * asserts:
+ *   none
+ *
+ * returns: none
+ */
+void render_null_clean();
+
+#endif
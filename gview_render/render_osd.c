@@ -0,0 +1,312 @@
+/*******************************************************************************#
+#           guvcview              http://guvcview.sourceforge.net               #
+#                                                                               #
+#           Paulo Assis <pj.assis@gmail.com>                                    #
+#                                                                               #
+# This program is free software; you can redistribute it and/or modify          #
+# it under the terms of the GNU General Public License as published by          #
+# the Free Software Foundation; either version 2 of the License, or             #
+# (at your option) any later version.                                           #
+#                                                                               #
+# This program is distributed in the hope that it will be useful,               #
+# but WITHOUT ANY WARRANTY; without even the implied warranty of                #
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the                 #
+# GNU General Public License for more details.                                  #
+#                                                                               #
+# You should have received a copy of the GNU General Public License             #
+# along with this program; if not, write to the Free Software                   #
+# Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA     #
+#                                                                               #
+********************************************************************************/
+
+/*******************************************************************************#
+#                                                                               #
+#  Render library - OSD sprites                                                 #
+#                                                                               #
+#  OSD elements are drawn once into a cached sprite (yu12 planes + alpha mask)  #
+#  and only redrawn when their state changes, every frame just blends the      #
+#  sprite rectangle into the frame                                              #
+#                                                                               #
+********************************************************************************/
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <inttypes.h>
+#include <string.h>
+#include <errno.h>
+#include <assert.h>
+
+#ifdef __SSE2__
+	#include <emmintrin.h>
+#endif
+
+#include "gview.h"
+#include "gviewrender.h"
+#include "render.h"
+#include "../config.h"
+
+extern int verbosity;
+
+/*
+ * (re)allocate a sprite
+ * args:
+ *   sprite - pointer to sprite
+ *   x - sprite top left x coordinate in the frame
+ *   y - sprite top left y coordinate in the frame
+ *   width - sprite width
+ *   height - sprite height
+ *
+ * asserts:
+ *   sprite is not null
+ *
+ * returns: 1 if the sprite buffers were reallocated (must be redrawn), 0 otherwise
+ */
+int render_osd_sprite_alloc(osd_sprite_t *sprite, int x, int y, int width, int height)
+{
+	/*asserts*/
+	assert(sprite != NULL);
+
+	/*keep chroma aligned*/
+	x &= ~1;
+	y &= ~1;
+	width = (width + 1) & ~1;
+	height = (height + 1) & ~1;
+
+	sprite->x = x;
+	sprite->y = y;
+
+	if(sprite->data != NULL &&
+		sprite->width == width &&
+		sprite->height == height)
+		return 0;
+
+	render_osd_sprite_free(sprite);
+
+	if(width <= 0 || height <= 0)
+		return 0;
+
+	/*y u v planes + y and uv alpha masks*/
+	size_t size = (width * height * 3) / 2 + (width * height * 5) / 4;
+	sprite->data = calloc(size, sizeof(uint8_t));
+	if(sprite->data == NULL)
+	{
+		fprintf(stderr, "RENDER: FATAL memory allocation failure (render_osd_sprite_alloc): %s\n", strerror(errno));
+		exit(-1);
+	}
+
+	sprite->width = width;
+	sprite->height = height;
+	sprite->y_plane = sprite->data;
+	sprite->u_plane = sprite->y_plane + (width * height);
+	sprite->v_plane = sprite->u_plane + (width * height) / 4;
+	sprite->alpha = sprite->v_plane + (width * height) / 4;
+	sprite->alpha_uv = sprite->alpha + (width * height);
+	sprite->key = 0;
+
+	return 1;
+}
+
+/*
+ * clear a sprite (make it fully transparent)
+ * args:
+ *   sprite - pointer to sprite
+ *
+ * asserts:
+ *   sprite is not null
+ *
+ * returns: none
+ */
+void render_osd_sprite_clear(osd_sprite_t *sprite)
+{
+	/*asserts*/
+	assert(sprite != NULL);
+
+	if(sprite->data == NULL)
+		return;
+
+	memset(sprite->alpha, 0, (sprite->width * sprite->height * 5) / 4);
+}
+
+/*
+ * draw an opaque box in a sprite
+ * args:
+ *   sprite - pointer to sprite
+ *   x - box top left x coordinate (in sprite)
+ *   y - box top left y coordinate (in sprite)
+ *   width - box width
+ *   height - box height
+ *   color - box color
+ *
+ * asserts:
+ *   sprite is not null
+ *   color is not null
+ *
+ * returns: none
+ */
+void render_osd_sprite_box(osd_sprite_t *sprite, int x, int y, int width, int height, yuv_color_t *color)
+{
+	/*asserts*/
+	assert(sprite != NULL);
+	assert(color != NULL);
+
+	if(sprite->data == NULL)
+		return;
+
+	/*clip to the sprite*/
+	int x1 = MIN(x + width, sprite->width);
+	int y1 = MIN(y + height, sprite->height);
+	x = MAX(x, 0);
+	y = MAX(y, 0);
+	if(x >= x1 || y >= y1)
+		return;
+
+	int h = 0;
+	for(h = y; h < y1; h++)
+	{
+		memset(sprite->y_plane + (h * sprite->width) + x, color->y, x1 - x);
+		memset(sprite->alpha + (h * sprite->width) + x, 0xFF, x1 - x);
+	}
+
+	/*chroma covers every (even partially) painted 2x2 block*/
+	int cw = sprite->width / 2;
+	int cx0 = x / 2;
+	int cx1 = (x1 + 1) / 2;
+	for(h = y / 2; h < (y1 + 1) / 2; h++)
+	{
+		memset(sprite->u_plane + (h * cw) + cx0, color->u, cx1 - cx0);
+		memset(sprite->v_plane + (h * cw) + cx0, color->v, cx1 - cx0);
+		memset(sprite->alpha_uv + (h * cw) + cx0, 0xFF, cx1 - cx0);
+	}
+}
+
+/*
+ * alpha blend a sprite row into a frame row
+ * args:
+ *   dst - pointer to frame row
+ *   src - pointer to sprite row
+ *   alpha - pointer to sprite alpha row
+ *   width - number of pixels
+ *
+ * asserts:
+ *   none
+ *
+ * returns: none
+ */
+static void blend_row(uint8_t *dst, const uint8_t *src, const uint8_t *alpha, int width)
+{
+	int x = 0;
+#ifdef __SSE2__
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i v256 = _mm_set1_epi16(256);
+	for(; x + 16 <= width; x += 16)
+	{
+		__m128i a = _mm_loadu_si128((const __m128i *) (alpha + x));
+
+		/*fully transparent: nothing to do*/
+		if(_mm_movemask_epi8(_mm_cmpeq_epi8(a, zero)) == 0xFFFF)
+			continue;
+
+		__m128i s = _mm_loadu_si128((const __m128i *) (src + x));
+		__m128i d = _mm_loadu_si128((const __m128i *) (dst + x));
+
+		/*a' = a + (a >> 7) so that 255 maps to 256*/
+		__m128i a_lo = _mm_unpacklo_epi8(a, zero);
+		__m128i a_hi = _mm_unpackhi_epi8(a, zero);
+		a_lo = _mm_add_epi16(a_lo, _mm_srli_epi16(a_lo, 7));
+		a_hi = _mm_add_epi16(a_hi, _mm_srli_epi16(a_hi, 7));
+
+		__m128i r_lo = _mm_srli_epi16(_mm_add_epi16(
+			_mm_mullo_epi16(_mm_unpacklo_epi8(s, zero), a_lo),
+			_mm_mullo_epi16(_mm_unpacklo_epi8(d, zero), _mm_sub_epi16(v256, a_lo))), 8);
+		__m128i r_hi = _mm_srli_epi16(_mm_add_epi16(
+			_mm_mullo_epi16(_mm_unpackhi_epi8(s, zero), a_hi),
+			_mm_mullo_epi16(_mm_unpackhi_epi8(d, zero), _mm_sub_epi16(v256, a_hi))), 8);
+
+		_mm_storeu_si128((__m128i *) (dst + x), _mm_packus_epi16(r_lo, r_hi));
+	}
+#endif
+	for(; x < width; x++)
+	{
+		int a = alpha[x] + (alpha[x] >> 7);
+		if(a)
+			dst[x] = (uint8_t) ((src[x] * a + dst[x] * (256 - a)) >> 8);
+	}
+}
+
+/*
+ * blend a sprite into a yu12 frame (only the sprite rectangle is touched)
+ * args:
+ *   sprite - pointer to sprite
+ *   frame - pointer to yu12 frame data
+ *   width - frame width
+ *   height - frame height
+ *
+ * asserts:
+ *   sprite is not null
+ *   frame is not null
+ *
+ * returns: none
+ */
+void render_osd_sprite_blit(osd_sprite_t *sprite, uint8_t *frame, int width, int height)
+{
+	/*asserts*/
+	assert(sprite != NULL);
+	assert(frame != NULL);
+
+	if(sprite->data == NULL)
+		return;
+
+	/*clip to the frame*/
+	int w = MIN(sprite->width, width - sprite->x);
+	int h = MIN(sprite->height, height - sprite->y);
+	if(w <= 0 || h <= 0 || sprite->x < 0 || sprite->y < 0)
+		return;
+
+	int row = 0;
+	for(row = 0; row < h; row++)
+		blend_row(
+			frame + ((sprite->y + row) * width) + sprite->x,
+			sprite->y_plane + (row * sprite->width),
+			sprite->alpha + (row * sprite->width),
+			w);
+
+	uint8_t *pu = frame + (width * height);
+	uint8_t *pv = pu + ((width * height) / 4);
+	int cw = sprite->width / 2;
+	int fcw = width / 2;
+	for(row = 0; row < h / 2; row++)
+	{
+		int offset = ((sprite->y / 2 + row) * fcw) + sprite->x / 2;
+		blend_row(pu + offset, sprite->u_plane + (row * cw), sprite->alpha_uv + (row * cw), w / 2);
+		blend_row(pv + offset, sprite->v_plane + (row * cw), sprite->alpha_uv + (row * cw), w / 2);
+	}
+}
+
+/*
+ * free sprite buffers
+ * args:
+ *   sprite - pointer to sprite
+ *
+ * asserts:
+ *   sprite is not null
+ *
+ * returns: none
+ */
+void render_osd_sprite_free(osd_sprite_t *sprite)
+{
+	/*asserts*/
+	assert(sprite != NULL);
+
+	if(sprite->data)
+		free(sprite->data);
+
+	sprite->data = NULL;
+	sprite->y_plane = NULL;
+	sprite->u_plane = NULL;
+	sprite->v_plane = NULL;
+	sprite->alpha = NULL;
+	sprite->alpha_uv = NULL;
+	sprite->width = 0;
+	sprite->height = 0;
+	sprite->key = 0;
+}
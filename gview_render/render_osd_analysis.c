@@ -0,0 +1,329 @@
+/*******************************************************************************#
+#           guvcview              http://guvcview.sourceforge.net               #
+#                                                                               #
+#           Paulo Assis <pj.assis@gmail.com>                                    #
+#                                                                               #
+# This program is free software; you can redistribute it and/or modify          #
+# it under the terms of the GNU General Public License as published by          #
+# the Free Software Foundation; either version 2 of the License, or             #
+# (at your option) any later version.                                           #
+#                                                                               #
+# This program is distributed in the hope that it will be useful,               #
+# but WITHOUT ANY WARRANTY; without even the implied warranty of                #
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the                 #
+# GNU General Public License for more details.                                  #
+#                                                                               #
+# You should have received a copy of the GNU General Public License             #
+# along with this program; if not, write to the Free Software                   #
+# Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA     #
+#                                                                               #
+********************************************************************************/
+
+/*******************************************************************************#
+#                                                                               #
+#  Render library - image analysis OSD                                          #
+#                                                                               #
+#  luma histogram (bottom left), waveform (bottom right) and focus peaking     #
+#  overlays, sprites are only redrawn when new analysis results arrive         #
+#                                                                               #
+********************************************************************************/
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <inttypes.h>
+#include <string.h>
+#include <assert.h>
+
+#include "gview.h"
+#include "gviewrender.h"
+#include "render.h"
+
+extern int verbosity;
+
+#define ANALYSIS_OSD_WIDTH  (RENDER_WAVEFORM_COLUMNS)
+#define ANALYSIS_OSD_HEIGHT (RENDER_WAVEFORM_LEVELS)
+#define ANALYSIS_OSD_MARGIN (10)
+
+/*background alpha for the graph sprites*/
+#define ANALYSIS_OSD_ALPHA  (160)
+
+static osd_sprite_t histogram_sprite;
+static osd_sprite_t waveform_sprite;
+
+/*focus peaking color (red)*/
+static yuv_color_t peak_color = {82, 90, 240};
+
+/*
+ * fill a sprite with a translucent dark background
+ * args:
+ *   sprite - pointer to sprite
+ *
+ * asserts:
+ *   none
+ *
+ * returns: none
+ */
+static void graph_sprite_background(osd_sprite_t *sprite)
+{
+	int size = sprite->width * sprite->height;
+
+	memset(sprite->y_plane, 16, size);
+	memset(sprite->u_plane, 128, size / 4);
+	memset(sprite->v_plane, 128, size / 4);
+	memset(sprite->alpha, ANALYSIS_OSD_ALPHA, size);
+	memset(sprite->alpha_uv, ANALYSIS_OSD_ALPHA, size / 4);
+}
+
+/*
+ * set an opaque luma pixel in a graph sprite (chroma stays neutral)
+ * args:
+ *   sprite - pointer to sprite
+ *   x - x coordinate
+ *   y - y coordinate
+ *   luma - luma value
+ *
+ * asserts:
+ *   none
+ *
+ * returns: none
+ */
+static void graph_sprite_pixel(osd_sprite_t *sprite, int x, int y, uint8_t luma)
+{
+	sprite->y_plane[y * sprite->width + x] = luma;
+	sprite->alpha[y * sprite->width + x] = 255;
+}
+
+/*
+ * draw the luma histogram
+ * args:
+ *   res - pointer to analysis results
+ *
+ * asserts:
+ *   none
+ *
+ * returns: none
+ */
+static void histogram_sprite_draw(render_analysis_t *res)
+{
+	graph_sprite_background(&histogram_sprite);
+
+	/*2 histogram bins per column, scaled to the highest column*/
+	uint32_t bins[ANALYSIS_OSD_WIDTH];
+	uint32_t max = 1;
+	int i = 0;
+	int bins_per_col = 256 / ANALYSIS_OSD_WIDTH;
+	for(i = 0; i < ANALYSIS_OSD_WIDTH; i++)
+	{
+		int j = 0;
+		bins[i] = 0;
+		for(j = 0; j < bins_per_col; j++)
+			bins[i] += res->histogram[i * bins_per_col + j];
+		if(bins[i] > max)
+			max = bins[i];
+	}
+
+	int h = histogram_sprite.height;
+	for(i = 0; i < ANALYSIS_OSD_WIDTH; i++)
+	{
+		int bar = (int) (((uint64_t) bins[i] * h) / max);
+		int y = 0;
+		for(y = h - bar; y < h; y++)
+			graph_sprite_pixel(&histogram_sprite, i, y, 200);
+	}
+}
+
+/*
+ * draw the luma waveform
+ * args:
+ *   res - pointer to analysis results
+ *
+ * asserts:
+ *   none
+ *
+ * returns: none
+ */
+static void waveform_sprite_draw(render_analysis_t *res)
+{
+	graph_sprite_background(&waveform_sprite);
+
+	/*
+	 * brightness is proportional to the sample density,
+	 * any non empty cell gets at least a dim trace
+	 */
+	uint32_t scale = res->waveform_scale / 8;
+	if(scale < 1)
+		scale = 1;
+
+	int h = waveform_sprite.height;
+	int x = 0;
+	for(x = 0; x < RENDER_WAVEFORM_COLUMNS; x++)
+	{
+		int level = 0;
+		for(level = 0; level < RENDER_WAVEFORM_LEVELS; level++)
+		{
+			uint32_t count = res->waveform[x][level];
+			if(count == 0)
+				continue;
+
+			uint32_t luma = 64 + (count * 171) / scale;
+			if(luma > 235)
+				luma = 235;
+
+			graph_sprite_pixel(&waveform_sprite, x, h - 1 - level, (uint8_t) luma);
+		}
+	}
+}
+
+/*
+ * paint the focus peaking cells into the frame
+ * args:
+ *   frame - pointer to yu12 frame data
+ *   width - frame width
+ *   height - frame height
+ *   mask - focus peaking mask
+ *   mask_w - mask width
+ *   mask_h - mask height
+ *   step - mask step in frame pixels
+ *
+ * asserts:
+ *   none
+ *
+ * returns: none
+ */
+static void focus_peak_paint(uint8_t *frame, int width, int height,
+	uint8_t *mask, int mask_w, int mask_h, int step)
+{
+	uint8_t *py = frame;
+	uint8_t *pu = frame + (width * height);
+	uint8_t *pv = pu + (width * height) / 4;
+
+	/*a step x step luma block per cell (at most 2x2 to keep it thin)*/
+	int block = step < 2 ? step : 2;
+
+	int gy = 0;
+	for(gy = 0; gy < mask_h; gy++)
+	{
+		uint8_t *m = mask + (gy * mask_w);
+		int y = gy * step;
+
+		int gx = 0;
+		for(gx = 0; gx < mask_w; gx++)
+		{
+			if(!m[gx])
+				continue;
+
+			int x = gx * step;
+
+			int i = 0;
+			for(i = 0; i < block && y + i < height; i++)
+			{
+				py[(y + i) * width + x] = peak_color.y;
+				if(block > 1 && x + 1 < width)
+					py[(y + i) * width + x + 1] = peak_color.y;
+			}
+
+			pu[(y / 2) * (width / 2) + x / 2] = peak_color.u;
+			pv[(y / 2) * (width / 2) + x / 2] = peak_color.v;
+		}
+	}
+}
+
+/*
+ * render the image analysis osd (histogram, waveform and focus peaking)
+ * args:
+ *   frame - pointer to yu12 frame data
+ *   width - frame width
+ *   height - frame height
+ *   mask - osd mask
+ *
+ * asserts:
+ *   none
+ *
+ * returns: none
+ */
+void render_osd_analysis(uint8_t *frame, int width, int height, uint32_t mask)
+{
+	if(!(mask & (REND_OSD_HISTOGRAM | REND_OSD_WAVEFORM | REND_OSD_FOCUS_PEAK)))
+	{
+		/*stop the analysis worker if no longer needed*/
+		render_analysis_close();
+		return;
+	}
+
+	/*submit the current frame while it is still clean (no osd)*/
+	render_analysis_submit(frame, width, height);
+
+	/*
+	 * results are one frame (or more) behind, the worker never
+	 * writes to the published buffer so this is safe after the submit
+	 */
+	uint8_t *peak_mask = NULL;
+	int mask_w = 0;
+	int mask_h = 0;
+	int step = 1;
+	render_analysis_t *res = render_analysis_get_results(&peak_mask, &mask_w, &mask_h, &step);
+
+	if(res == NULL)
+		return;
+
+	if((mask & REND_OSD_FOCUS_PEAK) && mask_w * step <= width && mask_h * step <= height)
+		focus_peak_paint(frame, width, height, peak_mask, mask_w, mask_h, step);
+
+	/*graphs only fit in frames wide enough for both*/
+	int fits = (width >= 2 * (ANALYSIS_OSD_WIDTH + 2 * ANALYSIS_OSD_MARGIN)) &&
+		(height >= ANALYSIS_OSD_HEIGHT + 2 * ANALYSIS_OSD_MARGIN);
+
+	if(!fits)
+		return;
+
+	if(mask & REND_OSD_HISTOGRAM)
+	{
+		int redraw = render_osd_sprite_alloc(&histogram_sprite,
+			ANALYSIS_OSD_MARGIN,
+			height - ANALYSIS_OSD_HEIGHT - ANALYSIS_OSD_MARGIN,
+			ANALYSIS_OSD_WIDTH,
+			ANALYSIS_OSD_HEIGHT);
+
+		if(redraw || histogram_sprite.key != res->sequence)
+		{
+			histogram_sprite_draw(res);
+			histogram_sprite.key = res->sequence;
+		}
+
+		render_osd_sprite_blit(&histogram_sprite, frame, width, height);
+	}
+
+	if(mask & REND_OSD_WAVEFORM)
+	{
+		int redraw = render_osd_sprite_alloc(&waveform_sprite,
+			width - ANALYSIS_OSD_WIDTH - ANALYSIS_OSD_MARGIN,
+			height - ANALYSIS_OSD_HEIGHT - ANALYSIS_OSD_MARGIN,
+			ANALYSIS_OSD_WIDTH,
+			ANALYSIS_OSD_HEIGHT);
+
+		if(redraw || waveform_sprite.key != res->sequence)
+		{
+			waveform_sprite_draw(res);
+			waveform_sprite.key = res->sequence;
+		}
+
+		render_osd_sprite_blit(&waveform_sprite, frame, width, height);
+	}
+}
+
+/*
+ * free the image analysis osd sprites
+ * args:
+ *   none
+ *
+ * asserts:
+ *   none
+ *
+ * returns: none
+ */
+void render_osd_analysis_clean()
+{
+	render_osd_sprite_free(&histogram_sprite);
+	render_osd_sprite_free(&waveform_sprite);
+	render_analysis_close();
+}
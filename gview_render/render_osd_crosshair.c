@@ -29,23 +29,18 @@
 
 #include "gview.h"
 #include "gviewrender.h"
+#include "render.h"
 
 extern int verbosity;
 
-typedef struct _yuv_color_t
-{
-	uint8_t y;
-	uint8_t u;
-	uint8_t v;
-} yuv_color_t;
+#define CROSSHAIR_SIZE (24)
+
+static osd_sprite_t crosshair_sprite;
 
 /*
- * plot a crosshair in a yu12 frame (planar)
+ * draw the crosshair sprite (centered in the sprite)
  * args:
- *   frame - pointer to yu12 frame data
- *   size  - frame line size in pixels (width)
- *   width - width
- *   height - height 
+ *   size  - crosshair size in pixels
  *   color - line color
  *
  * asserts:
@@ -53,78 +48,26 @@ typedef struct _yuv_color_t
  *
  * returns: none
  */
-static void plot_crosshair_yu12(uint8_t *frame, int size, int width, int height, yuv_color_t *color)
+static void crosshair_sprite_draw(int size, yuv_color_t *color)
 {
-	uint8_t *py = frame;
-	uint8_t *pu = frame + (width * height);
-	uint8_t *pv = pu + ((width * height) / 4);
+	render_osd_sprite_clear(&crosshair_sprite);
 
-	/*y - 1st vertical line*/
-	int h = (height-size)/2;
-	for(h = (height-size)/2; h < height/2 - 2; h++)
-	{
-		py = frame + (h * width) + width/2;
-		*py = color->y;
-	}
-	/*y - 1st horizontal line*/
-	int w = (width-size)/2;
-	for(w = (width-size)/2; w < width/2 - 2; w++)
-	{
-		py = frame + ((height/2) * width) + w;
-		*py = color->y;
-	}
-	/*y - 2nd horizontal line*/
-	for(w = width/2 + 2; w < (width+size)/2; w++)
-	{
-		py = frame + ((height/2) * width) + w;
-		*py = color->y;
-	}
-	/*y - 2nd vertical line*/
-	for(h = height/2 + 2; h < (height+size)/2; h++)
-	{
-		py = frame + (h * width) + width/2;
-		*py = color->y;
-	}
+	/*center of the frame in sprite coordinates*/
+	int cx = size / 2;
+	int cy = size / 2;
 
-				
-	/*u v - 1st vertical line*/
-	for(h = (height-size)/4; h < height/4 - 1; h++) /*every two rows*/
-	{
-		pu = frame + (width * height) + (h * width/2) + width/4;
-		*pu = color->u;
-		pv = pu + (width * height)/4;
-		*pv = color->v;
-	}
-	/*u v - 1st horizontal line*/
-	for(w = (width-size)/4; w < width/4 - 1; w++) /*every two rows*/
-	{
-		pu = frame + (width * height) + ((height/4) * width/2) + w;
-		*pu = color->u;
-		pv = pu + (width * height)/4;
-		*pv = color->v;
-	}
-	/*u v - 2nd horizontal line*/
-	for(w = width/4 + 1; w < (width+size)/4; w++) /*every two rows*/
-	{
-		pu = frame + (width * height) + ((height/4) * width/2) + w;
-		*pu = color->u;
-		pv = pu + (width * height)/4;
-		*pv = color->v;
-	}
-	/*u v - 2nd vertical line*/
-	for(h = height/4 + 1; h < (height+size)/4; h++) /*every two rows*/
-	{
-		pu = frame + (width * height) + (h * width/2) + width/4;
-		*pu = color->u;
-		pv = pu + (width * height)/4;
-		*pv = color->v;
-	}
+	/*vertical lines (with a 4 pixel gap in the center)*/
+	render_osd_sprite_box(&crosshair_sprite, cx, 0, 1, size / 2 - 2, color);
+	render_osd_sprite_box(&crosshair_sprite, cx, cy + 2, 1, size / 2 - 2, color);
+	/*horizontal lines*/
+	render_osd_sprite_box(&crosshair_sprite, 0, cy, size / 2 - 2, 1, color);
+	render_osd_sprite_box(&crosshair_sprite, cx + 2, cy, size / 2 - 2, 1, color);
 }
 
 /*
  * render a crosshair
  * args:
- *   frame - pointer to yuyv frame data
+ *   frame - pointer to yu12 frame data
  *   width - frame width
  *   height - frame height
  *
@@ -142,13 +85,44 @@ void render_osd_crosshair(uint8_t *frame, int width, int height)
 
 	uint32_t rgb_color = render_get_crosshair_color();
 
-	uint8_t r = (uint8_t) ((rgb_color & 0x00FF0000) >> 16);
-	uint8_t g = (uint8_t) ((rgb_color & 0x0000FF00) >> 8);
-	uint8_t b = (uint8_t) (rgb_color & 0x000000FF);
+	/*sprite is centered in the frame (width/2 and height/2 are always even)*/
+	int redraw = render_osd_sprite_alloc(&crosshair_sprite,
+		(width - CROSSHAIR_SIZE) / 2,
+		(height - CROSSHAIR_SIZE) / 2,
+		CROSSHAIR_SIZE,
+		CROSSHAIR_SIZE);
+
+	/*only redraw the sprite if the color changed*/
+	uint64_t key = ((uint64_t) rgb_color) | ((uint64_t) 1 << 32);
 
-	color.y = CLIP(0.299*(r-128) + 0.587*(g-128) + 0.114*(b-128) + 128) ;
-	color.u = CLIP(-0.147*(r-128) - 0.289*(g-128) + 0.436*(b-128) + 128);
-	color.v = CLIP(0.615*(r-128) - 0.515*(g-128) - 0.100*(b-128) + 128);
+	if(redraw || key != crosshair_sprite.key)
+	{
+		uint8_t r = (uint8_t) ((rgb_color & 0x00FF0000) >> 16);
+		uint8_t g = (uint8_t) ((rgb_color & 0x0000FF00) >> 8);
+		uint8_t b = (uint8_t) (rgb_color & 0x000000FF);
 
-	plot_crosshair_yu12(frame, 24, width, height, &color);
+		color.y = CLIP(0.299*(r-128) + 0.587*(g-128) + 0.114*(b-128) + 128) ;
+		color.u = CLIP(-0.147*(r-128) - 0.289*(g-128) + 0.436*(b-128) + 128);
+		color.v = CLIP(0.615*(r-128) - 0.515*(g-128) - 0.100*(b-128) + 128);
+
+		crosshair_sprite_draw(CROSSHAIR_SIZE, &color);
+		crosshair_sprite.key = key;
+	}
+
+	render_osd_sprite_blit(&crosshair_sprite, frame, width, height);
+}
+
+/*
+ * free the crosshair osd sprite
+ * args:
+ *   none
+ *
+ * asserts:
+ *   none
+ *
+ * returns: none
+ */
+void render_osd_crosshair_clean()
+{
+	render_osd_sprite_free(&crosshair_sprite);
 }
@@ -28,117 +28,108 @@
 
 #include "gview.h"
 #include "gviewrender.h"
+#include "render.h"
 
 extern int verbosity;
 
-typedef struct _yuv_color_t
-{
-	uint8_t y;
-	uint8_t u;
-	uint8_t v;
-} yuv_color_t;
-
 #define REFERENCE_LEVEL 0.8
 #define VU_BARS         20
+#define VU_NO_PEAK      (VU_BARS + 1)
 
 static float vu_peak[2] = {0.0, 0.0};
 static float vu_peak_freeze[2]= {0.0 ,0.0};
 
+static osd_sprite_t vu_sprite;
+
 /*
- * plot a rectangular box in a yu12 frame (planar)
+ * get the vu bar color
  * args:
- *   frame - pointer to yu12 frame data
- *   lines - number of lines in frame (height)
- *   linesize - frame line size in pixels (width)
- *   x - box top left x coordinate
- *   y - box top left y coordinate
- *   width - box width
- *   height - box height
- *   color - box color
+ *   box - bar index
+ *   color - pointer to color to fill
  *
  * asserts:
  *   none
  *
  * returns: none
  */
-static void plot_box_yu12(uint8_t *frame, int lines, int linesize, int x, int y, int width, int height, yuv_color_t *color)
+static void vu_bar_color(int box, yuv_color_t *color)
 {
-	uint8_t *py = frame;
-	uint8_t *pu = frame + (linesize * lines);
-	uint8_t *pv = pu + ((linesize * lines) / 4);
+	/*
+	 * The dB it takes to light the current box
+	 * step of 2 db between boxes
+	 */
+	float db = 2 * (box - (VU_BARS - 1));
 
-	/*y*/
-	int h = 0;
-	for(h = 0; h < height; ++h)
+	if (db < -10) /*green bar*/
 	{
-		py = frame + x + ((y + h) * linesize);
-		int w = 0;
-		for(w = 0; w < width; ++w)
-		{
-			*py++ = color->y;
-		}
+		color->y = 154;
+		color->u = 72;
+		color->v = 57;
 	}
-
-	/*u v*/
-	for(h = 0; h < height/2; h++) /*every two lines*/
+	else if (db < -2) /*yellow bar*/
 	{
-		pu = frame + (linesize * lines) + (int) floor(x/2) + (( (int) floor(y/2) + h) * (int) floor(linesize/2));
-		pv = pu + (int) floor((linesize * lines) / 4);
-
-		int w = 0;
-		for(w = 0; w < width/2; w++) /*every two rows*/
-		{
-			*pu++ = color->u;
-			*pv++ = color->v;
-		}
+		color->y = 203;
+		color->u = 44;
+		color->v = 142;
+	}
+	else /*red bar*/
+	{
+		color->y = 107;
+		color->u = 100;
+		color->v = 212;
 	}
 }
 
 /*
- * plot a line in a yu12 frame (planar)
+ * draw the vu meter sprite
  * args:
- *   frame - pointer to yu12 frame data
- *   lines - number of lines in frame (height)
- *   linesize - frame line size in pixels (width)
- *   x - box top left x coordinate
- *   y - box top left y coordinate
- *   width - line width
- *   color - line color
+ *   bw - bar width
+ *   bh - bar height
+ *   lit - number of lit bars for each channel (-1 channel not rendered)
+ *   peak - peak bar index for each channel (VU_NO_PEAK if none)
  *
  * asserts:
  *   none
  *
  * returns: none
  */
-static void plot_line_yu12(uint8_t *frame, int lines, int linesize, int x, int y, int width, yuv_color_t *color)
+static void vu_sprite_draw(int bw, int bh, int lit[2], int peak[2])
 {
-	uint8_t *py = frame;
-	uint8_t *pu = frame + (linesize * lines);
-	uint8_t *pv = pu + ((linesize * lines) / 4);
+	render_osd_sprite_clear(&vu_sprite);
 
-	int w = 0;
+	/*sprite origin in the frame*/
+	int ox = vu_sprite.x;
+	int oy = vu_sprite.y;
 
-	/*y*/
-	py = frame + x + (y * linesize);
-	for(w = 0; w < width; ++w)
+	int channel;
+	for (channel = 0; channel < 2; ++channel)
 	{
-		*py++ = color->y;
-	}
+		if(lit[channel] < 0)
+			continue;
 
-	/*u v*/
-	pu = frame + (linesize * lines) + (int) floor(x/2) + ((int) floor(y/2) * (int) floor(linesize/2));
-	pv = pu + (int) floor((linesize * lines) / 4);
-	for(w = 0; w < width/2; w ++) /*every two rows*/
-	{
-		*pu++ = color->u;
-		*pv++ = color->v;
+		int box = 0;
+		for (box = 0; box <= (VU_BARS - 1); ++box)
+		{
+			/* start x coordinate for box */
+			int bx = box * (bw + 4) + (16) - ox;
+			/* Start y coordinate for box (box top)*/
+			int by = channel * (bh + 4) + bh - oy;
+
+			yuv_color_t color;
+			vu_bar_color(box, &color);
+
+			if (box < lit[channel] || box == peak[channel])
+				render_osd_sprite_box(&vu_sprite, bx, by, bw, bh, &color);
+			else if (bw > 0) /*draw single line*/
+				render_osd_sprite_box(&vu_sprite, bx, by + (bh /2), bw, 1, &color);
+		}
 	}
 }
 
 /*
  * render a vu meter
  * args:
- *   frame - pointer to yuyv frame data
+ *   frame - pointer to yu12 frame data
  *   width - frame width
  *   height - frame height
  *   vu_level - vu level values (array with 2 channels)
@@ -153,6 +144,9 @@ void render_osd_vu_meter(uint8_t *frame, int width, int height, float vu_level[2
 	int bw = 2 * (width  / (VU_BARS * 8)); /*make it at least two pixels*/
 	int bh = height / 24;
 
+	int lit[2] = {-1, -1};
+	int peak[2] = {VU_NO_PEAK, VU_NO_PEAK};
+
 	int channel;
 	for (channel = 0; channel < 2; ++channel)
 	{
@@ -172,11 +166,11 @@ void render_osd_vu_meter(uint8_t *frame, int width, int height, float vu_level[2
 		else if (vu_peak_freeze[channel] > 0)
 		{
 			vu_peak_freeze[channel]--;
-  		}
-  		else if (vu_peak[channel] > vu_level[channel])
-  		{
+		}
+		else if (vu_peak[channel] > vu_level[channel])
+		{
 			vu_peak[channel] -= (vu_peak[channel] - vu_level[channel]) / 10;
-  		}
+		}
 
 		/*by default no bar is light */
 		float dBuLevel = - 4 * (VU_BARS - 1);
@@ -188,58 +182,57 @@ void render_osd_vu_meter(uint8_t *frame, int width, int height, float vu_level[2
 		if(vu_peak[channel] > 0)
 			dBuPeak  = 10 * log10(vu_peak[channel]  / REFERENCE_LEVEL);
 
-  		/* draw the bars */
-  		int peaked = 0;
-  		int box = 0;
-  		for (box = 0; box <= (VU_BARS - 1); ++box)
-  		{
-			/*
-			 * The dB it takes to light the current box
-			 * step of 2 db between boxes
-			 */
+		/*
+		 * lit bars are always the first ones (dBuLevel > db)
+		 * and the peak is the first bar with dBuPeak < db + 1
+		 */
+		lit[channel] = 0;
+		int box = 0;
+		for (box = 0; box <= (VU_BARS - 1); ++box)
+		{
 			float db = 2 * (box - (VU_BARS - 1));
 
-			/* start x coordinate for box */
-			int bx = box * (bw + 4) + (16);
-			/* Start y coordinate for box (box top)*/
-			int by = channel * (bh + 4) + bh;
-
-			yuv_color_t color;
-			color.y = 127;
-			color.u = 127;
-			color.v = 127;
-
-			/*green bar*/
-			if (db < -10)
-			{
-					color.y = 154;
-  				color.u = 72;
-  				color.v = 57;
-			}
-			else if (db < -2) /*yellow bar*/
-			{
-					color.y = 203;
-  				color.u = 44;
-  				color.v = 142;
-			}
-			else /*red bar*/
-			{
-				color.y = 107;
-				color.u = 100;
-				color.v = 212;
-			}
-
-			int light = dBuLevel > db;
-			if (dBuPeak < db+1 && !peaked)
-			{
-  				peaked = 1;
-  				light = 1;
-			}
-
-			if (light)
-				plot_box_yu12(frame, height, width, bx, by, bw, bh, &color);
-			else if (bw > 0) /*draw single line*/
-				plot_line_yu12(frame, height, width, bx, by + (bh /2), bw, &color);
+			if (dBuLevel > db)
+				lit[channel] = box + 1;
+			if (dBuPeak < db + 1 && peak[channel] == VU_NO_PEAK)
+				peak[channel] = box;
 		}
-  	}
+	}
+
+	/*sprite covers both channels: from (16, bh) to the end of the last bar*/
+	int redraw = render_osd_sprite_alloc(&vu_sprite,
+		16, bh,
+		VU_BARS * (bw + 4) + 2,
+		2 * (bh + 4) + 2);
+
+	/*only redraw the sprite if the vu state changed*/
+	uint64_t key = ((uint64_t) (lit[0] + 1)) |
+		((uint64_t) (lit[1] + 1) << 8) |
+		((uint64_t) peak[0] << 16) |
+		((uint64_t) peak[1] << 24) |
+		((uint64_t) bw << 32) |
+		((uint64_t) bh << 48);
+
+	if(redraw || key != vu_sprite.key)
+	{
+		vu_sprite_draw(bw, bh, lit, peak);
+		vu_sprite.key = key;
+	}
+
+	render_osd_sprite_blit(&vu_sprite, frame, width, height);
+}
+
+/*
+ * free the vu meter osd sprite
+ * args:
+ *   none
+ *
+ * asserts:
+ *   none
+ *
+ * returns: none
+ */
+void render_osd_vu_meter_clean()
+{
+	render_osd_sprite_free(&vu_sprite);
 }
@@ -0,0 +1,396 @@
+/*******************************************************************************#
+#           guvcview              http://guvcview.sourceforge.net               #
+#                                                                               #
+#           Paulo Assis <pj.assis@gmail.com>                                    #
+#                                                                               #
+# This program is free software; you can redistribute it and/or modify          #
+# it under the terms of the GNU General Public License as published by          #
+# the Free Software Foundation; either version 2 of the License, or             #
+# (at your option) any later version.                                           #
+#                                                                               #
+# This program is distributed in the hope that it will be useful,               #
+# but WITHOUT ANY WARRANTY; without even the implied warranty of                #
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the                 #
+# GNU General Public License for more details.                                  #
+#                                                                               #
+# You should have received a copy of the GNU General Public License             #
+# along with this program; if not, write to the Free Software                   #
+# Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA     #
+#                                                                               #
+********************************************************************************/
+
+/*******************************************************************************#
+#                                                                               #
+#  Render library - preview downscaler                                          #
+#                                                                               #
+#  box filters the yu12 frame by powers of 2 so that the texture uploaded to    #
+#  the render engine is close to the window size, the render engine scales     #
+#  the remaining (fractional) ratio                                             #
+#                                                                               #
+********************************************************************************/
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <inttypes.h>
+#include <string.h>
+#include <errno.h>
+#include <assert.h>
+
+#ifdef __SSE2__
+	#include <emmintrin.h>
+#endif
+
+#include "gview.h"
+#include "gviewrender.h"
+#include "render.h"
+#include "../config.h"
+
+/*max number of halving passes (1/8 of the frame size)*/
+#define SCALE_MAX_SHIFT (3)
+
+extern int verbosity;
+
+static int scale_shift = 0; /*number of halving passes (0 - no scaling)*/
+static int src_width = 0;
+static int src_height = 0;
+
+/*
+ * level[0] is the source frame, level[scale_shift] the scaled frame
+ * and everything in between intermediate (halved) frames
+ */
+static uint8_t *scale_level[SCALE_MAX_SHIFT + 1] = {NULL, NULL, NULL, NULL};
+
+/*worker thread (scales the bottom half of the luma plane)*/
+static __THREAD_TYPE scale_thread;
+static __MUTEX_TYPE scale_mutex;
+static __COND_TYPE scale_cond;
+static int scale_thread_running = 0;
+static int scale_job = 0;  /*jobs requested*/
+static int scale_done = 0; /*jobs finished*/
+static int scale_quit = 0;
+
+/*
+ * get a plane pointer in a yu12 frame
+ * args:
+ *   frame - pointer to yu12 frame
+ *   width - frame width
+ *   height - frame height
+ *   plane - plane index (0 - y; 1 - u; 2 - v)
+ *
+ * asserts:
+ *   none
+ *
+ * returns: pointer to plane data
+ */
+static uint8_t *yu12_plane(uint8_t *frame, int width, int height, int plane)
+{
+	switch(plane)
+	{
+		case 1:
+			return frame + (width * height);
+		case 2:
+			return frame + (width * height) + ((width * height) / 4);
+		default:
+			return frame;
+	}
+}
+
+/*
+ * halve a set of plane rows (2x2 box filter)
+ * args:
+ *   src - pointer to source plane
+ *   src_w - source plane width (line stride)
+ *   dst - pointer to destination plane
+ *   dst_w - destination plane width (line stride)
+ *   row_start - first destination row
+ *   row_end - last destination row (not included)
+ *
+ * asserts:
+ *   none
+ *
+ * returns: none
+ */
+static void halve_rows(const uint8_t *src, int src_w, uint8_t *dst, int dst_w,
+	int row_start, int row_end)
+{
+	int y = 0;
+	for(y = row_start; y < row_end; y++)
+	{
+		const uint8_t *s0 = src + (2 * y * src_w);
+		const uint8_t *s1 = s0 + src_w;
+		uint8_t *d = dst + (y * dst_w);
+
+		int x = 0;
+#ifdef __SSE2__
+		const __m128i mask = _mm_set1_epi16(0x00FF);
+		const __m128i one = _mm_set1_epi16(1);
+		for(; x + 16 <= dst_w; x += 16)
+		{
+			/*vertical average of 32 source pixels*/
+			__m128i a = _mm_avg_epu8(
+				_mm_loadu_si128((const __m128i *) (s0 + 2 * x)),
+				_mm_loadu_si128((const __m128i *) (s1 + 2 * x)));
+			__m128i b = _mm_avg_epu8(
+				_mm_loadu_si128((const __m128i *) (s0 + 2 * x + 16)),
+				_mm_loadu_si128((const __m128i *) (s1 + 2 * x + 16)));
+			/*horizontal average of even and odd pixels*/
+			__m128i ha = _mm_srli_epi16(_mm_add_epi16(_mm_add_epi16(
+				_mm_and_si128(a, mask), _mm_srli_epi16(a, 8)), one), 1);
+			__m128i hb = _mm_srli_epi16(_mm_add_epi16(_mm_add_epi16(
+				_mm_and_si128(b, mask), _mm_srli_epi16(b, 8)), one), 1);
+
+			_mm_storeu_si128((__m128i *) (d + x), _mm_packus_epi16(ha, hb));
+		}
+#endif
+		for(; x < dst_w; x++)
+			d[x] = (uint8_t) ((s0[2*x] + s0[2*x + 1] + s1[2*x] + s1[2*x + 1] + 2) >> 2);
+	}
+}
+
+/*
+ * scale a set of plane rows through all the halving levels
+ * args:
+ *   plane - plane index (0 - y; 1 - u; 2 - v)
+ *   row_start - first source row (multiple of 1 << scale_shift)
+ *   row_end - last source row (not included, multiple of 1 << scale_shift)
+ *
+ * asserts:
+ *   none
+ *
+ * returns: none
+ */
+static void scale_plane_rows(int plane, int row_start, int row_end)
+{
+	int l = 0;
+	for(l = 0; l < scale_shift; l++)
+	{
+		int w = src_width >> l;
+		int h = src_height >> l;
+		int pw = (plane > 0) ? w / 2 : w;
+
+		uint8_t *src = yu12_plane(scale_level[l], w, h, plane);
+		uint8_t *dst = yu12_plane(scale_level[l + 1], w / 2, h / 2, plane);
+
+		halve_rows(src, pw, dst, pw / 2, row_start >> (l + 1), row_end >> (l + 1));
+	}
+}
+
+/*
+ * scaler worker thread loop
+ * args:
+ *   data - pointer to user data (not used)
+ *
+ * asserts:
+ *   none
+ *
+ * returns: pointer to return code
+ */
+static void *scale_thread_loop(void *data)
+{
+	int job = 0;
+
+	__LOCK_MUTEX(&scale_mutex);
+	while(!scale_quit)
+	{
+		if(scale_job == job)
+		{
+			pthread_cond_wait(&scale_cond, &scale_mutex);
+			continue;
+		}
+		job = scale_job;
+		__UNLOCK_MUTEX(&scale_mutex);
+
+		/*bottom half of the luma plane*/
+		int mid = ((src_height / 2) >> scale_shift) << scale_shift;
+		scale_plane_rows(0, mid, src_height);
+
+		__LOCK_MUTEX(&scale_mutex);
+		scale_done = job;
+		__COND_BCAST(&scale_cond);
+	}
+	__UNLOCK_MUTEX(&scale_mutex);
+
+	return ((void *) 0);
+}
+
+/*
+ * init the preview scaler
+ * args:
+ *   width - source frame width
+ *   height - source frame height
+ *   win_w - target (window) width (0 - no scaling)
+ *   win_h - target (window) height (0 - no scaling)
+ *   scaled_w - pointer to store the scaled frame width
+ *   scaled_h - pointer to store the scaled frame height
+ *
+ * asserts:
+ *   scaled_w is not null
+ *   scaled_h is not null
+ *
+ * returns: 1 if scaling is active, 0 otherwise
+ */
+int render_scale_init(int width, int height, int win_w, int win_h, int *scaled_w, int *scaled_h)
+{
+	/*asserts*/
+	assert(scaled_w != NULL);
+	assert(scaled_h != NULL);
+
+	render_scale_close();
+
+	*scaled_w = width;
+	*scaled_h = height;
+
+	if(win_w <= 0 || win_h <= 0)
+		return 0;
+
+	/*
+	 * halve while the result still covers the window
+	 * and the chroma planes keep an integer size
+	 */
+	int shift = 0;
+	while(shift < SCALE_MAX_SHIFT &&
+		(width >> (shift + 1)) >= win_w &&
+		(height >> (shift + 1)) >= win_h &&
+		(width % (1 << (shift + 2))) == 0 &&
+		(height % (1 << (shift + 2))) == 0)
+		shift++;
+
+	if(shift == 0)
+		return 0;
+
+	src_width = width;
+	src_height = height;
+	scale_shift = shift;
+
+	int l = 0;
+	for(l = 1; l <= scale_shift; l++)
+	{
+		int w = width >> l;
+		int h = height >> l;
+		scale_level[l] = calloc((w * h * 3) / 2, sizeof(uint8_t));
+		if(scale_level[l] == NULL)
+		{
+			fprintf(stderr, "RENDER: FATAL memory allocation failure (render_scale_init): %s\n", strerror(errno));
+			exit(-1);
+		}
+		/*black frame*/
+		memset(scale_level[l] + (w * h), 0x80, (w * h) / 2);
+	}
+
+	*scaled_w = width >> scale_shift;
+	*scaled_h = height >> scale_shift;
+
+	scale_job = 0;
+	scale_done = 0;
+	scale_quit = 0;
+	__INIT_MUTEX(&scale_mutex);
+	__INIT_COND(&scale_cond);
+
+	if(__THREAD_CREATE(&scale_thread, scale_thread_loop, NULL))
+		fprintf(stderr, "RENDER: couldn't create the scaler thread (scaling in render thread)\n");
+	else
+		scale_thread_running = 1;
+
+	if(verbosity > 0)
+		printf("RENDER: preview downscale %ix%i -> %ix%i\n",
+			width, height, *scaled_w, *scaled_h);
+
+	return 1;
+}
+
+/*
+ * scale a frame to the preview size
+ * args:
+ *   frame - pointer to source frame (yu12)
+ *
+ * asserts:
+ *   frame is not null
+ *
+ * returns: pointer to the scaled frame (or frame if scaling is not active)
+ */
+uint8_t *render_scale_frame(uint8_t *frame)
+{
+	/*asserts*/
+	assert(frame != NULL);
+
+	if(scale_shift == 0)
+		return frame;
+
+	scale_level[0] = frame;
+
+	int mid = ((src_height / 2) >> scale_shift) << scale_shift;
+
+	int job = 0;
+	if(scale_thread_running)
+	{
+		__LOCK_MUTEX(&scale_mutex);
+		scale_job++;
+		job = scale_job;
+		__COND_BCAST(&scale_cond);
+		__UNLOCK_MUTEX(&scale_mutex);
+	}
+	else
+		scale_plane_rows(0, mid, src_height);
+
+	/*top half of the luma plane and the chroma planes*/
+	scale_plane_rows(0, 0, mid);
+	scale_plane_rows(1, 0, src_height / 2);
+	scale_plane_rows(2, 0, src_height / 2);
+
+	if(scale_thread_running)
+	{
+		__LOCK_MUTEX(&scale_mutex);
+		while(scale_done != job)
+			pthread_cond_wait(&scale_cond, &scale_mutex);
+		__UNLOCK_MUTEX(&scale_mutex);
+	}
+
+	scale_level[0] = NULL;
+
+	return scale_level[scale_shift];
+}
+
+/*
+ * close the preview scaler
+ * args:
+ *   none
+ *
+ * asserts:
+ *   none
+ *
+ * returns: none
+ */
+void render_scale_close()
+{
+	if(scale_thread_running)
+	{
+		__LOCK_MUTEX(&scale_mutex);
+		scale_quit = 1;
+		__COND_BCAST(&scale_cond);
+		__UNLOCK_MUTEX(&scale_mutex);
+
+		__THREAD_JOIN(scale_thread);
+		scale_thread_running = 0;
+
+		__CLOSE_COND(&scale_cond);
+		__CLOSE_MUTEX(&scale_mutex);
+	}
+	else if(scale_shift > 0)
+	{
+		__CLOSE_COND(&scale_cond);
+		__CLOSE_MUTEX(&scale_mutex);
+	}
+
+	int l = 0;
+	for(l = 1; l <= SCALE_MAX_SHIFT; l++)
+	{
+		if(scale_level[l])
+			free(scale_level[l]);
+		scale_level[l] = NULL;
+	}
+
+	scale_level[0] = NULL;
+	scale_shift = 0;
+	src_width = 0;
+	src_height = 0;
+}
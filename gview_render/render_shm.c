@@ -0,0 +1,229 @@
+/*******************************************************************************#
+#           guvcview              http://guvcview.sourceforge.net               #
+#                                                                               #
+#           Paulo Assis <pj.assis@gmail.com>                                    #
+#                                                                               #
+# This program is free software; you can redistribute it and/or modify          #
+# it under the terms of the GNU General Public License as published by          #
+# the Free Software Foundation; either version 2 of the License, or             #
+# (at your option) any later version.                                           #
+#                                                                               #
+# This program is distributed in the hope that it will be useful,               #
+# but WITHOUT ANY WARRANTY; without even the implied warranty of                #
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the                 #
+# GNU General Public License for more details.                                  #
+#                                                                               #
+# You should have received a copy of the GNU General Public License             #
+# along with this program; if not, write to the Free Software                   #
+# Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA     #
+#                                                                               #
+********************************************************************************/
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <inttypes.h>
+#include <string.h>
+#include <limits.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <assert.h>
+
+#include "gview.h"
+#include "gviewrender.h"
+#include "render.h"
+#include "render_shm.h"
+#include "core_time.h"
+#include "../config.h"
+
+/*frame data alignment in the shm segment*/
+#define SHM_ALIGN (4096)
+#define SHM_ALIGN_SIZE(x) (((x) + SHM_ALIGN - 1) & ~((size_t) SHM_ALIGN - 1))
+
+extern int verbosity;
+
+static char shm_name[NAME_MAX] = "";
+static render_shm_header_t *shm_header = NULL;
+static uint8_t *shm_base = NULL;
+static size_t shm_size = 0;
+static uint64_t shm_frame_index = 0;
+
+/*
+ * init shared memory render
+ * args:
+ *    width - frame width
+ *    height - frame height
+ *    name - shm object name
+ *
+ * asserts:
+ *    name is not null
+ *
+ * returns: error code (0 ok)
+ */
+int init_render_shm(int width, int height, const char *name)
+{
+	/*asserts*/
+	assert(name != NULL);
+
+	if(width <= 0 || height <= 0)
+	{
+		fprintf(stderr, "RENDER: (shm) invalid frame size %ix%i\n", width, height);
+		return -1;
+	}
+
+	if(shm_base)
+		render_shm_clean();
+
+	strncpy(shm_name, name, NAME_MAX - 1);
+	shm_name[NAME_MAX - 1] = '\0';
+
+	size_t frame_size = (width * height * 3) / 2; /*yu12*/
+	size_t header_size = SHM_ALIGN_SIZE(sizeof(render_shm_header_t));
+	shm_size = header_size + RENDER_SHM_SLOTS * SHM_ALIGN_SIZE(frame_size);
+
+	if(verbosity > 0)
+		printf("RENDER: Initializing shm render (%s: %ix%i - %zu bytes)\n",
+			shm_name, width, height, shm_size);
+
+	int fd = shm_open(shm_name, O_CREAT | O_RDWR, 0644);
+	if(fd < 0)
+	{
+		fprintf(stderr, "RENDER: (shm) couldn't open %s: %s\n", shm_name, strerror(errno));
+		return -1;
+	}
+
+	if(ftruncate(fd, shm_size) < 0)
+	{
+		fprintf(stderr, "RENDER: (shm) couldn't set %s size: %s\n", shm_name, strerror(errno));
+		close(fd);
+		shm_unlink(shm_name);
+		return -2;
+	}
+
+	shm_base = mmap(NULL, shm_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	/*the mapping keeps the object referenced*/
+	close(fd);
+
+	if(shm_base == MAP_FAILED)
+	{
+		fprintf(stderr, "RENDER: (shm) couldn't map %s: %s\n", shm_name, strerror(errno));
+		shm_base = NULL;
+		shm_unlink(shm_name);
+		return -3;
+	}
+
+	shm_header = (render_shm_header_t *) shm_base;
+	/*make sure readers don't attach to a partial header*/
+	__atomic_store_n(&shm_header->magic, 0, __ATOMIC_RELEASE);
+
+	shm_header->version = RENDER_SHM_VERSION;
+	shm_header->width = width;
+	shm_header->height = height;
+	shm_header->format = RENDER_SHM_FORMAT_YU12;
+	shm_header->frame_size = frame_size;
+	shm_header->num_slots = RENDER_SHM_SLOTS;
+	shm_header->latest = 0;
+
+	int i = 0;
+	for(i = 0; i < RENDER_SHM_SLOTS; i++)
+	{
+		shm_header->slot[i].seq = 0;
+		shm_header->slot[i].frame_index = 0;
+		shm_header->slot[i].timestamp = 0;
+		shm_header->slot[i].offset = header_size + i * SHM_ALIGN_SIZE(frame_size);
+	}
+
+	shm_frame_index = 0;
+
+	__atomic_store_n(&shm_header->magic, RENDER_SHM_MAGIC, __ATOMIC_RELEASE);
+
+	return 0;
+}
+
+/*
+ * publish a frame to the shared memory ring
+ * args:
+ *   frame - pointer to frame data (yu12 format)
+ *   width - frame width
+ *   height - frame height
+ *
+ * asserts:
+ *   frame is not null
+ *
+ * returns: error code
+ */
+int render_shm_frame(uint8_t *frame, int width, int height)
+{
+	/*asserts*/
+	assert(frame != NULL);
+
+	if(!shm_header)
+		return -1;
+
+	if(width != (int) shm_header->width || height != (int) shm_header->height)
+	{
+		fprintf(stderr, "RENDER: (shm) frame size (%ix%i) doesn't match shm segment (%ix%i)\n",
+			width, height, shm_header->width, shm_header->height);
+		return -2;
+	}
+
+	/*
+	 * never write to the slot readers are most likely copying from:
+	 * with 3 slots the one after latest is the oldest frame
+	 */
+	uint32_t index = __atomic_load_n(&shm_header->latest, __ATOMIC_RELAXED);
+	NEXT_IND(index, RENDER_SHM_SLOTS);
+
+	render_shm_slot_t *slot = &shm_header->slot[index];
+
+	/*seqlock write: odd seq while the slot data is being updated*/
+	uint32_t seq = __atomic_load_n(&slot->seq, __ATOMIC_RELAXED);
+	__atomic_store_n(&slot->seq, seq + 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+
+	memcpy(shm_base + slot->offset, frame, shm_header->frame_size);
+
+	shm_frame_index++;
+	slot->frame_index = shm_frame_index;
+	slot->timestamp = ns_time_monotonic();
+
+	__atomic_store_n(&slot->seq, seq + 2, __ATOMIC_RELEASE);
+
+	/*publish the slot*/
+	__atomic_store_n(&shm_header->latest, index, __ATOMIC_RELEASE);
+
+	return 0;
+}
+
+/*
+ * clean shared memory render data
+ * args:
+ *   none
+ *
+ * asserts:
+ *   none
+ *
+ * returns: none
+ */
+void render_shm_clean()
+{
+	if(shm_base)
+	{
+		/*tell attached readers the segment is gone*/
+		__atomic_store_n(&shm_header->magic, 0, __ATOMIC_RELEASE);
+
+		munmap(shm_base, shm_size);
+		shm_unlink(shm_name);
+
+		if(verbosity > 0)
+			printf("RENDER: (shm) %s closed after %" PRIu64 " frames\n",
+				shm_name, shm_frame_index);
+	}
+
+	shm_base = NULL;
+	shm_header = NULL;
+	shm_size = 0;
+	shm_frame_index = 0;
+}
@@ -24,9 +24,16 @@
 #include <stdio.h>
 #include <string.h>
 #include <errno.h>
+#include <unistd.h>
 #include <assert.h>
 
+#ifdef __SSE2__
+	#include <emmintrin.h>
+#endif
+
 #include "gview.h"
+#include "gviewv4l2core.h"
+#include "colorspaces.h"
 #include "../config.h"
 
 extern int verbosity;
@@ -2710,84 +2717,291 @@ void ba24_to_yu12(uint8_t *out, uint8_t *in, int width, int height)
 	}
 }
 
+/*---------------- yu12 to rgb ----------------*/
+
 /*
- * yu12 to rgb24
+ * yu12 to rgb conversion coefficients (Q14)
+ *   r = ygain * (y - yoff) + rv * (v - 128)
+ *   g = ygain * (y - yoff) - gu * (u - 128) - gv * (v - 128)
+ *   b = ygain * (y - yoff) + bu * (u - 128)
+ */
+typedef struct _rgb_matrix_t
+{
+	int yoff;
+	int ygain;
+	int rv;
+	int gu;
+	int gv;
+	int bu;
+} rgb_matrix_t;
+
+static const rgb_matrix_t rgb_matrix[] =
+{
+	/*RGB_MATRIX_BT601_FULL (jpeg)*/
+	{ 0, 16384, 22970,  5638, 11700, 29032},
+	/*RGB_MATRIX_BT601_LIMITED*/
+	{16, 19077, 26149,  6419, 13320, 33050},
+	/*RGB_MATRIX_BT709_FULL*/
+	{ 0, 16384, 25802,  3069,  7670, 30402},
+	/*RGB_MATRIX_BT709_LIMITED*/
+	{16, 19077, 29372,  3494,  8731, 34610},
+};
+
+/*max number of threads for the yu12 to rgb conversion*/
+#define RGB_CONV_MAX_THREADS (8)
+
+typedef struct _rgb_conv_job_t
+{
+	uint8_t *out;
+	uint8_t *in;
+	int width;
+	int height;
+	int row_start; /*first output row (even)*/
+	int row_end;   /*last output row (not included)*/
+	const rgb_matrix_t *m;
+	int flags;
+} rgb_conv_job_t;
+
+/*
+ * convert a single row of yu12 pixels to rgb24 (or bgr24)
+ * args:
+ *    out - pointer to output row
+ *    py - pointer to luma row
+ *    pu - pointer to u chroma row
+ *    pv - pointer to v chroma row
+ *    width - row width (in pixels)
+ *    m - pointer to conversion matrix
+ *    bgr - set to 1 for bgr byte order
+ *
+ * asserts:
+ *    none
+ *
+ * returns: none
+ */
+static void yu12_row_to_rgb24(uint8_t *out, const uint8_t *py,
+	const uint8_t *pu, const uint8_t *pv, int width,
+	const rgb_matrix_t *m, int bgr)
+{
+	int ir = bgr ? 2 : 0;
+	int ib = bgr ? 0 : 2;
+
+	int w = 0;
+#ifdef __SSE2__
+	/*
+	 * 16 bit fixed point (Q5) using mulhi:
+	 *   luma: ((y - yoff) << 7) * (ygain Q14) >> 16
+	 *   chroma: ((c - 128) << 8) * (coef Q13) >> 16
+	 */
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i bias = _mm_set1_epi16((short) 0x8000);
+	const __m128i yoff = _mm_set1_epi16(m->yoff);
+	const __m128i round = _mm_set1_epi16(16);
+	const __m128i kyg = _mm_set1_epi16(m->ygain);
+	const __m128i krv = _mm_set1_epi16(m->rv / 2);
+	const __m128i kgu = _mm_set1_epi16(m->gu / 2);
+	const __m128i kgv = _mm_set1_epi16(m->gv / 2);
+	const __m128i kbu = _mm_set1_epi16(m->bu / 2);
+
+	uint8_t rgb[3][16] __attribute__((aligned(16)));
+
+	for(; w + 16 <= width; w += 16)
+	{
+		__m128i y = _mm_loadu_si128((const __m128i *) (py + w));
+		__m128i u = _mm_loadl_epi64((const __m128i *) (pu + w/2));
+		__m128i v = _mm_loadl_epi64((const __m128i *) (pv + w/2));
+
+		/*(c - 128) << 8*/
+		u = _mm_xor_si128(_mm_unpacklo_epi8(zero, u), bias);
+		v = _mm_xor_si128(_mm_unpacklo_epi8(zero, v), bias);
+
+		__m128i cr = _mm_mulhi_epi16(v, krv);
+		__m128i cg = _mm_add_epi16(_mm_mulhi_epi16(u, kgu), _mm_mulhi_epi16(v, kgv));
+		__m128i cb = _mm_mulhi_epi16(u, kbu);
+
+		__m128i y_lo = _mm_slli_epi16(_mm_sub_epi16(_mm_unpacklo_epi8(y, zero), yoff), 7);
+		__m128i y_hi = _mm_slli_epi16(_mm_sub_epi16(_mm_unpackhi_epi8(y, zero), yoff), 7);
+		y_lo = _mm_add_epi16(_mm_mulhi_epi16(y_lo, kyg), round);
+		y_hi = _mm_add_epi16(_mm_mulhi_epi16(y_hi, kyg), round);
+
+		/*each chroma sample is shared by 2 pixels*/
+		__m128i r = _mm_packus_epi16(
+			_mm_srai_epi16(_mm_adds_epi16(y_lo, _mm_unpacklo_epi16(cr, cr)), 5),
+			_mm_srai_epi16(_mm_adds_epi16(y_hi, _mm_unpackhi_epi16(cr, cr)), 5));
+		__m128i g = _mm_packus_epi16(
+			_mm_srai_epi16(_mm_subs_epi16(y_lo, _mm_unpacklo_epi16(cg, cg)), 5),
+			_mm_srai_epi16(_mm_subs_epi16(y_hi, _mm_unpackhi_epi16(cg, cg)), 5));
+		__m128i b = _mm_packus_epi16(
+			_mm_srai_epi16(_mm_adds_epi16(y_lo, _mm_unpacklo_epi16(cb, cb)), 5),
+			_mm_srai_epi16(_mm_adds_epi16(y_hi, _mm_unpackhi_epi16(cb, cb)), 5));
+
+		_mm_store_si128((__m128i *) rgb[ir], r);
+		_mm_store_si128((__m128i *) rgb[1], g);
+		_mm_store_si128((__m128i *) rgb[ib], b);
+
+		/*interleave*/
+		uint8_t *pout = out + (w * 3);
+		int i = 0;
+		for(i = 0; i < 16; i++)
+		{
+			*pout++ = rgb[0][i];
+			*pout++ = rgb[1][i];
+			*pout++ = rgb[2][i];
+		}
+	}
+#endif
+	/*scalar (Q14)*/
+	uint8_t *pout = out + (w * 3);
+	for(; w < width; w++)
+	{
+		int y = (py[w] - m->yoff) * m->ygain + 8192;
+		int u = pu[w/2] - 128;
+		int v = pv[w/2] - 128;
+
+		int r = (y + m->rv * v) >> 14;
+		int g = (y - m->gu * u - m->gv * v) >> 14;
+		int b = (y + m->bu * u) >> 14;
+
+		pout[ir] = CLIP(r);
+		pout[1] = CLIP(g);
+		pout[ib] = CLIP(b);
+		pout += 3;
+	}
+}
+
+/*
+ * convert a band of yu12 rows to rgb24
+ * args:
+ *    data - pointer to rgb_conv_job_t
+ *
+ * asserts:
+ *    none
+ *
+ * returns: pointer to return code
+ */
+static void *yu12_to_rgb24_rows(void *data)
+{
+	rgb_conv_job_t *job = (rgb_conv_job_t *) data;
+
+	int width = job->width;
+	int height = job->height;
+	uint8_t *pu = job->in + (width * height);
+	uint8_t *pv = pu + ((width * height) / 4);
+
+	int h = 0;
+	for(h = job->row_start; h < job->row_end; h++)
+	{
+		/*dib files store the lines bottom up*/
+		int in_line = (job->flags & RGB_CONV_FLIP) ? (height - 1 - h) : h;
+
+		yu12_row_to_rgb24(
+			job->out + (h * width * 3),
+			job->in + (in_line * width),
+			pu + ((in_line / 2) * (width / 2)),
+			pv + ((in_line / 2) * (width / 2)),
+			width,
+			job->m,
+			(job->flags & RGB_CONV_BGR) ? 1 : 0);
+	}
+
+	return ((void *) 0);
+}
+
+/*
+ * yu12 to rgb24 with selectable matrix
  * args:
  *    out - pointer to output rgb data buffer
  *    in - pointer to input yu12 data buffer
  *    width - buffer width (in pixels)
  *    height - buffer height (in pixels)
+ *    matrix - conversion matrix (RGB_MATRIX_BT601_FULL, ...)
+ *    flags - or'ed conversion flags (RGB_CONV_BGR, RGB_CONV_FLIP)
+ *    threads - number of threads (0 - auto)
  *
  * asserts:
- *    none
+ *    out is not null
+ *    in is not null
  *
  * returns: none
  */
-void yu12_to_rgb24 (uint8_t *out, uint8_t *in, int width, int height)
+void v4l2core_yu12_to_rgb24(uint8_t *out, uint8_t *in, int width, int height,
+	int matrix, int flags, int threads)
 {
 	/*assertions*/
 	assert(out);
 	assert(in);
-	
-	uint8_t *py1 = in; //line 1
-	uint8_t *py2 = py1 + width; //line 2
-	uint8_t *pu = in + (width * height);
-	uint8_t *pv = pu + ((width * height) / 4);
-	
-	uint8_t *pout1 = out; //first line
-	uint8_t *pout2 = out + (width * 3); //second line
-	
-	int h=0, w=0;
-	
-	for(h=0; h < height; h+=2) //every two lines
+
+	if(matrix < 0 || matrix >= (int) ARRAY_LENGTH(rgb_matrix))
+		matrix = RGB_MATRIX_BT601_FULL;
+
+	if(threads <= 0)
 	{
-		py1 = in + (h * width);
-		py2 = py1 + width;
-		
-		pout1 = out + (h * width * 3);
-		pout2 = pout1 + (width * 3);
-		
-		for(w=0; w<width; w+=2) //every 2 pixels
-		{
-			/* standart: r = y0 + 1.402 (v-128) */
-			/* logitech: r = y0 + 1.370705 (v-128) */
-			*pout1++=CLIP(*py1 + 1.402 * (*pv-128));
-			*pout2++=CLIP(*py2 + 1.402 * (*pv-128));	
-			/* standart: g = y0 - 0.34414 (u-128) - 0.71414 (v-128)*/
-			/* logitech: g = y0 - 0.337633 (u-128)- 0.698001 (v-128)*/
-			*pout1++=CLIP(*py1 - 0.34414 * (*pu-128) -0.71414*(*pv-128));
-			*pout2++=CLIP(*py2 - 0.34414 * (*pu-128) -0.71414*(*pv-128));
-			/* standart: b = y0 + 1.772 (u-128) */
-			/* logitech: b = y0 + 1.732446 (u-128) */
-			*pout1++=CLIP(*py1 + 1.772 *( *pu-128));
-			*pout2++=CLIP(*py2 + 1.772 *( *pu-128));
-			
-			py1++;
-			py2++;
-			
-			/* standart: r1 =y1 + 1.402 (v-128) */
-			/* logitech: r1 = y1 + 1.370705 (v-128) */
-			*pout1++=CLIP(*py1 + 1.402 * (*pv-128));
-			*pout2++=CLIP(*py2 + 1.402 * (*pv-128));
-			/* standart: g1 = y1 - 0.34414 (u-128) - 0.71414 (v-128)*/
-			/* logitech: g1 = y1 - 0.337633 (u-128)- 0.698001 (v-128)*/
-			*pout1++=CLIP(*py1 - 0.34414 * (*pu-128) -0.71414 * (*pv-128));
-			*pout2++=CLIP(*py2 - 0.34414 * (*pu-128) -0.71414 * (*pv-128));
-			/* standart: b1 = y1 + 1.772 (u-128) */
-			/* logitech: b1 = y1 + 1.732446 (u-128) */
-			*pout1++=CLIP(*py1 + 1.772 * (*pu-128));
-			*pout2++=CLIP(*py2 + 1.772 * (*pu-128));
-			
-			py1++;
-			py2++;
-			pu++;
-			pv++;
-		}
+		/*not worth it for small frames*/
+		threads = (width * height >= 640 * 480) ? (int) sysconf(_SC_NPROCESSORS_ONLN) : 1;
+	}
+	if(threads > RGB_CONV_MAX_THREADS)
+		threads = RGB_CONV_MAX_THREADS;
+	if(threads > height / 2)
+		threads = height / 2;
+	if(threads < 1)
+		threads = 1;
+
+	rgb_conv_job_t job[RGB_CONV_MAX_THREADS];
+	__THREAD_TYPE thread[RGB_CONV_MAX_THREADS];
+	int thread_ok[RGB_CONV_MAX_THREADS];
+
+	/*bands with an even number of rows*/
+	int band = ((height / threads) + 1) & ~1;
+
+	int i = 0;
+	for(i = 0; i < threads; i++)
+	{
+		job[i].out = out;
+		job[i].in = in;
+		job[i].width = width;
+		job[i].height = height;
+		job[i].row_start = MIN(i * band, height);
+		job[i].row_end = (i == threads - 1) ? height : MIN((i + 1) * band, height);
+		job[i].m = &rgb_matrix[matrix];
+		job[i].flags = flags;
+		thread_ok[i] = 0;
 	}
+
+	/*the calling thread converts the first band*/
+	for(i = 1; i < threads; i++)
+	{
+		if(__THREAD_CREATE(&thread[i], yu12_to_rgb24_rows, &job[i]) == 0)
+			thread_ok[i] = 1;
+		else
+			yu12_to_rgb24_rows(&job[i]);
+	}
+
+	yu12_to_rgb24_rows(&job[0]);
+
+	for(i = 1; i < threads; i++)
+		if(thread_ok[i])
+			__THREAD_JOIN(thread[i]);
 }
 
 /*
- * FIXME:  yu12 to bgr24 with lines upsidedown
+ * yu12 to rgb24
+ * args:
+ *    out - pointer to output rgb data buffer
+ *    in - pointer to input yu12 data buffer
+ *    width - buffer width (in pixels)
+ *    height - buffer height (in pixels)
+ *
+ * asserts:
+ *    none
+ *
+ * returns: none
+ */
+void yu12_to_rgb24 (uint8_t *out, uint8_t *in, int width, int height)
+{
+	v4l2core_yu12_to_rgb24(out, in, width, height, RGB_MATRIX_BT601_FULL, 0, 0);
+}
+
+/*
+ * yu12 to bgr24 with lines upsidedown
  *   used for bitmap files (DIB24)
  * args:
  *    out - pointer to output bgr data buffer
@@ -2802,72 +3016,8 @@ void yu12_to_rgb24 (uint8_t *out, uint8_t *in, int width, int height)
  */
 void yu12_to_dib24 (uint8_t *out, uint8_t *in, int width, int height)
 {
-	/*assertions*/
-	assert(out);
-	assert(in);
-	
-	uint8_t *py1 = in + (height * width) - width; //begin of last line
-	uint8_t *py2 = py1 - width; //last line -1
-	
-	uint8_t *pu = in + ((width * height * 5) / 4) - (width/2); //begin of last line
-	uint8_t *pv = pu + ((width * height) / 4); //begin of last line
-	
-	uint8_t *pout1 = out; //first line
-	uint8_t *pout2 = pout1 + (width * 3); //second line
-	
-	int h=0, w=0;
-	int uvline = height/2;
-	
-	for(h=height; h >0 ; h-=2) //every two lines
-	{
-		uvline--; //begin of uv line
-		
-		py1 = in + ((h-1) * width);
-		py2 = py1 - width;
-		
-		pu = in + (width * height) + ((uvline * width)/2);
-		pv = pu + ((width * height) / 4);
-		
-		pout1 = out + ((height-h) * width * 3);
-		pout2 = pout1 + (width * 3);
-		
-		for(w=0; w<width; w+=2) //every 2 pixels
-		{
-			/* standart: b = y0 + 1.772 (u-128) */
-			/* logitech: b = y0 + 1.732446 (u-128) */
-			*pout1++=CLIP(*py1 + 1.772 *( *pu-128));
-			*pout2++=CLIP(*py2 + 1.772 *( *pu-128));	
-			/* standart: g = y0 - 0.34414 (u-128) - 0.71414 (v-128)*/
-			/* logitech: g = y0 - 0.337633 (u-128)- 0.698001 (v-128)*/
-			*pout1++=CLIP(*py1 - 0.34414 * (*pu-128) -0.71414*(*pv-128));
-			*pout2++=CLIP(*py2 - 0.34414 * (*pu-128) -0.71414*(*pv-128));
-			/* standart: r = y0 + 1.402 (v-128) */
-			/* logitech: r = y0 + 1.370705 (v-128) */
-			*pout1++=CLIP(*py1 + 1.402 * (*pv-128));
-			*pout2++=CLIP(*py2 + 1.402 * (*pv-128));
-			
-			py1++;
-			py2++;
-			
-			/* standart: b = y0 + 1.772 (u-128) */
-			/* logitech: b = y0 + 1.732446 (u-128) */
-			*pout1++=CLIP(*py1 + 1.772 *( *pu-128));
-			*pout2++=CLIP(*py2 + 1.772 *( *pu-128));	
-			/* standart: g = y0 - 0.34414 (u-128) - 0.71414 (v-128)*/
-			/* logitech: g = y0 - 0.337633 (u-128)- 0.698001 (v-128)*/
-			*pout1++=CLIP(*py1 - 0.34414 * (*pu-128) -0.71414*(*pv-128));
-			*pout2++=CLIP(*py2 - 0.34414 * (*pu-128) -0.71414*(*pv-128));
-			/* standart: r = y0 + 1.402 (v-128) */
-			/* logitech: r = y0 + 1.370705 (v-128) */
-			*pout1++=CLIP(*py1 + 1.402 * (*pv-128));
-			*pout2++=CLIP(*py2 + 1.402 * (*pv-128));
-
-			py1++;
-			py2++;
-			pu++;
-			pv++;
-		}
-	}
+	v4l2core_yu12_to_rgb24(out, in, width, height,
+		RGB_MATRIX_BT601_FULL, RGB_CONV_BGR | RGB_CONV_FLIP, 0);
 }
 
 /*
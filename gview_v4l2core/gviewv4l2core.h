@@ -130,6 +130,20 @@ __BEGIN_DECLS
 #define IMG_FMT_PNG     (2)
 #define IMG_FMT_BMP     (3)
 
+/*
+ * yu12 to rgb conversion matrix
+ */
+#define RGB_MATRIX_BT601_FULL    (0) /*jpeg (default)*/
+#define RGB_MATRIX_BT601_LIMITED (1)
+#define RGB_MATRIX_BT709_FULL    (2)
+#define RGB_MATRIX_BT709_LIMITED (3)
+
+/*
+ * yu12 to rgb conversion flags
+ */
+#define RGB_CONV_BGR    (1<<0) /*bgr byte order*/
+#define RGB_CONV_FLIP   (1<<1) /*bottom up lines (dib)*/
+
 
 /*
  * buffer number (for driver mmap ops)
@@ -820,6 +834,21 @@ v4l2_frame_buff_t *v4l2core_get_frame(v4l2_dev_t *vd);
  */
 int v4l2core_release_frame(v4l2_dev_t *vd, v4l2_frame_buff_t *frame);
 
+/*
+ * decodes a frame obtained with v4l2core_get_frame
+ *   (frames that are not needed can be released without decoding)
+ * args:
+ *    vd - pointer to v4l2 device handler
+ *    frame - pointer to frame buffer
+ *
+ * asserts:
+ *   vd is not null
+ *   frame is not null
+ *
+ * returns: error code (E_OK)
+ */
+int v4l2core_decode_frame(v4l2_dev_t *vd, v4l2_frame_buff_t *frame);
+
 /*
  * gets the next video frame and decodes it
  * args:
@@ -1407,6 +1436,26 @@ int v4l2core_save_image(
 	const char *filename,
 	int format);
 
+/*
+ * convert a yu12 frame to rgb24 (fixed point, row split in threads)
+ * args:
+ *    out - pointer to output rgb data buffer (width * height * 3)
+ *    in - pointer to input yu12 data buffer
+ *    width - buffer width (in pixels)
+ *    height - buffer height (in pixels)
+ *    matrix - conversion matrix (RGB_MATRIX_BT601_FULL, ...)
+ *    flags - or'ed conversion flags (RGB_CONV_BGR, RGB_CONV_FLIP)
+ *    threads - number of threads (0 - auto)
+ *
+ * asserts:
+ *    out is not null
+ *    in is not null
+ *
+ * returns: none
+ */
+void v4l2core_yu12_to_rgb24(uint8_t *out, uint8_t *in, int width, int height,
+	int matrix, int flags, int threads);
+
 /*
  * ############### TIME DATA ##############
  */
@@ -1311,6 +1311,32 @@ int v4l2core_release_frame(v4l2_dev_t *vd, v4l2_frame_buff_t *frame)
 	return E_OK;
 }
 
+/*
+ * decodes a frame obtained with v4l2core_get_frame
+ *   (frames that are not needed can be released without decoding)
+ * args:
+ *    vd - pointer to v4l2 device handler
+ *    frame - pointer to frame buffer
+ *
+ * asserts:
+ *   vd is not null
+ *   frame is not null
+ *
+ * returns: error code (E_OK)
+ */
+int v4l2core_decode_frame(v4l2_dev_t *vd, v4l2_frame_buff_t *frame)
+{
+	/*assertions*/
+	assert(vd != NULL);
+	assert(frame != NULL);
+
+	int ret = decode_v4l2_frame(vd, frame);
+	if(ret != E_OK)
+		fprintf(stderr, "V4L2_CORE: Error - Couldn't decode frame\n");
+
+	return ret;
+}
+
 /*
  * gets the next video frame and decodes it
  * args:
@@ -1322,14 +1348,8 @@ v4l2_frame_buff_t *v4l2core_get_decoded_frame(v4l2_dev_t *vd)
 {
 	v4l2_frame_buff_t *frame = v4l2core_get_frame(vd);
 	if(frame != NULL)
-	{
-		/*decode the raw frame*/
-		if(decode_v4l2_frame(vd, frame) != E_OK)
-		{
-			fprintf(stderr, "V4L2_CORE: Error - Couldn't decode frame\n");
-		}
-	}
-	
+		v4l2core_decode_frame(vd, frame); /*decode the raw frame*/
+
 	return frame;
 }
 